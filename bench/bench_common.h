@@ -0,0 +1,32 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <algorithm>
+#include <ctime>
+#include <vector>
+#include <QtGlobal>
+
+/*! Returns the CPU time of the process in ns.
+ */
+static inline qint64 cpuTimeNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return qint64(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+/*! Returns the p-th percentile (0..100) of \p values, the vector is sorted in place.
+ */
+static inline qint64 percentile(std::vector<qint64> &values, double p)
+{
+    if (values.empty())
+    {
+        return 0;
+    }
+
+    std::sort(values.begin(), values.end());
+    size_t i = size_t((values.size() - 1) * p / 100.0 + 0.5);
+    return values[std::min(i, values.size() - 1)];
+}
+
+#endif // BENCH_COMMON_H
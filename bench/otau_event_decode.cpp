@@ -0,0 +1,288 @@
+/*
+ * Decodes an OTAU protocol event dump (ota_events.bin) written by the STD OTAU plugin.
+ *
+ * Usage: otau_event_decode <dump> [--pcapng <out.pcapng>]
+ *
+ * Without options all events are printed as text, one line per event.
+ * With --pcapng received and sent frames are exported as IEEE 802.15.4 frames (without FCS),
+ * the MAC, NWK and APS headers are synthesized around the recorded ZCL payload so that
+ * Wireshark can dissect the OTA cluster commands.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "otau_event_ring.h"
+
+#define LINKTYPE_IEEE802_15_4_NOFCS 230
+#define COORDINATOR_NWK 0x0000
+
+static const char *commandName(const OtauEvent &e)
+{
+    if (e.clusterId != 0x0019)
+    {
+        return "-";
+    }
+
+    switch (e.commandId)
+    {
+    case 0x00: return "ImageNotify";
+    case 0x01: return "QueryNextImageReq";
+    case 0x02: return "QueryNextImageRsp";
+    case 0x03: return "ImageBlockReq";
+    case 0x04: return "ImagePageReq";
+    case 0x05: return "ImageBlockRsp";
+    case 0x06: return "UpgradeEndReq";
+    case 0x07: return "UpgradeEndRsp";
+    case 0x0b: return "DefaultRsp";
+    default:
+        break;
+    }
+
+    return "unknown";
+}
+
+static const char *typeName(uint8_t type)
+{
+    switch (type)
+    {
+    case OtauEventRx: return "RX";
+    case OtauEventTx: return "TX";
+    case OtauEventConfirm: return "CONF";
+    default:
+        break;
+    }
+
+    return "??";
+}
+
+static void printEvent(const OtauEvent &e, int64_t created)
+{
+    const int64_t ms = created + e.timeMs;
+    const time_t sec = static_cast<time_t>(ms / 1000);
+    struct tm tm;
+    char ts[32];
+
+    localtime_r(&sec, &tm);
+    strftime(ts, sizeof(ts), "%H:%M:%S", &tm);
+
+    printf("%s.%03d %-4s %016llx 0x%04x ", ts, static_cast<int>(ms % 1000), typeName(e.type),
+           static_cast<unsigned long long>(e.extAddr), e.nwkAddr);
+
+    if (e.type == OtauEventConfirm)
+    {
+        printf("aps id %u status 0x%02x\n", e.apsId, e.status);
+        return;
+    }
+
+    printf("cl 0x%04x ep %u/%u %s", e.clusterId, e.srcEndpoint, e.dstEndpoint, commandName(e));
+
+    if (e.clusterId == 0x0019)
+    {
+        printf(" seq %u", e.zclSeq);
+
+        if (e.commandId >= 0x03 && e.commandId <= 0x05)
+        {
+            printf(" offset 0x%08x size %u", e.offset, e.size);
+        }
+
+        if (e.commandId == 0x02 || e.commandId == 0x05 || e.commandId == 0x06)
+        {
+            printf(" status 0x%02x", e.status);
+        }
+    }
+
+    if (e.type == OtauEventTx)
+    {
+        printf(" aps id %u", e.apsId);
+    }
+
+    printf("\n");
+}
+
+static void put16(std::vector<uint8_t> &buf, uint16_t v)
+{
+    buf.push_back(v & 0xff);
+    buf.push_back(v >> 8);
+}
+
+static void put32(std::vector<uint8_t> &buf, uint32_t v)
+{
+    put16(buf, v & 0xffff);
+    put16(buf, v >> 16);
+}
+
+/*! Appends a pcapng block, body is padded to 32 bit.
+ */
+static void putBlock(std::vector<uint8_t> &out, uint32_t type, const std::vector<uint8_t> &body)
+{
+    const uint32_t pad = (4 - body.size() % 4) % 4;
+    const uint32_t len = 12 + body.size() + pad;
+
+    put32(out, type);
+    put32(out, len);
+    out.insert(out.end(), body.begin(), body.end());
+    out.insert(out.end(), pad, 0);
+    put32(out, len);
+}
+
+/*! Builds a 802.15.4 data frame with NWK and APS header around the recorded ZCL frame.
+ */
+static std::vector<uint8_t> buildFrame(const OtauEvent &e, uint8_t seq)
+{
+    const uint16_t src = e.type == OtauEventRx ? e.nwkAddr : COORDINATOR_NWK;
+    const uint16_t dst = e.type == OtauEventRx ? COORDINATOR_NWK : e.nwkAddr;
+    std::vector<uint8_t> frame;
+
+    // MAC: data frame, PAN id compression, short addresses, PAN id is not recorded
+    put16(frame, 0x8841);
+    frame.push_back(seq);
+    put16(frame, 0x0000);
+    put16(frame, dst);
+    put16(frame, src);
+
+    // NWK: data frame, protocol version 2
+    put16(frame, 0x0008);
+    put16(frame, dst);
+    put16(frame, src);
+    frame.push_back(30); // radius
+    frame.push_back(seq);
+
+    // APS: unicast data frame
+    frame.push_back(0x00);
+    frame.push_back(e.dstEndpoint);
+    put16(frame, e.clusterId);
+    put16(frame, e.profileId);
+    frame.push_back(e.srcEndpoint);
+    frame.push_back(e.type == OtauEventTx ? e.apsId : seq);
+
+    frame.insert(frame.end(), e.asdu, e.asdu + e.asduLength);
+    return frame;
+}
+
+static bool writePcapng(const char *path, const std::vector<OtauEvent> &events, int64_t created)
+{
+    std::vector<uint8_t> out;
+    std::vector<uint8_t> body;
+
+    // section header block
+    put32(body, 0x1A2B3C4D);
+    put16(body, 1);
+    put16(body, 0);
+    put32(body, 0xFFFFFFFF); // section length unknown
+    put32(body, 0xFFFFFFFF);
+    putBlock(out, 0x0A0D0D0A, body);
+
+    // interface description block
+    body.clear();
+    put16(body, LINKTYPE_IEEE802_15_4_NOFCS);
+    put16(body, 0);
+    put32(body, 0); // no snap length
+    putBlock(out, 0x00000001, body);
+
+    unsigned packets = 0;
+    for (const OtauEvent &e : events)
+    {
+        if (e.type != OtauEventRx && e.type != OtauEventTx)
+        {
+            continue;
+        }
+
+        const std::vector<uint8_t> frame = buildFrame(e, static_cast<uint8_t>(e.seq));
+        const uint64_t us = static_cast<uint64_t>(created + e.timeMs) * 1000;
+
+        // enhanced packet block
+        body.clear();
+        put32(body, 0); // interface id
+        put32(body, us >> 32);
+        put32(body, us & 0xFFFFFFFF);
+        put32(body, frame.size());
+        put32(body, frame.size());
+        body.insert(body.end(), frame.begin(), frame.end());
+        putBlock(out, 0x00000006, body);
+        packets++;
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (!f)
+    {
+        fprintf(stderr, "failed to create %s\n", path);
+        return false;
+    }
+
+    const bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+    fclose(f);
+
+    fprintf(stderr, "%u frames written to %s\n", packets, path);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    const char *input = nullptr;
+    const char *pcapng = nullptr;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--pcapng") == 0 && i + 1 < argc)
+        {
+            pcapng = argv[++i];
+        }
+        else if (argv[i][0] != '-' && !input)
+        {
+            input = argv[i];
+        }
+        else
+        {
+            input = nullptr;
+            break;
+        }
+    }
+
+    if (!input)
+    {
+        fprintf(stderr, "usage: %s <ota_events.bin> [--pcapng <out.pcapng>]\n", argv[0]);
+        return 1;
+    }
+
+    FILE *f = fopen(input, "rb");
+    if (!f)
+    {
+        fprintf(stderr, "failed to open %s\n", input);
+        return 1;
+    }
+
+    OtauEventDumpHeader hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+        memcmp(hdr.magic, OTAU_EVENT_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != OTAU_EVENT_VERSION ||
+        hdr.entrySize != sizeof(OtauEvent))
+    {
+        fprintf(stderr, "%s is not a supported event dump\n", input);
+        fclose(f);
+        return 1;
+    }
+
+    std::vector<OtauEvent> events(hdr.count);
+    const size_t n = hdr.count ? fread(events.data(), sizeof(OtauEvent), hdr.count, f) : 0;
+    fclose(f);
+    events.resize(n);
+
+    if (n != hdr.count)
+    {
+        fprintf(stderr, "dump is truncated, %u of %u events\n", static_cast<unsigned>(n), hdr.count);
+    }
+
+    if (pcapng)
+    {
+        return writePcapng(pcapng, events, hdr.created) ? 0 : 1;
+    }
+
+    for (const OtauEvent &e : events)
+    {
+        printEvent(e, hdr.created);
+    }
+
+    return 0;
+}
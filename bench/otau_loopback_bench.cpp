@@ -0,0 +1,633 @@
+/*
+ * Loopback benchmark for the OTAU server.
+ *
+ * Drives StdOtauPlugin through a simulated APS layer with N OTA clients which
+ * request an image with Image Block or Image Page requests. Transfers run in
+ * virtual time, the plugin timers are fired from the event loop of the bench,
+ * the result only depends on the options and the seed.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <queue>
+#include <random>
+#include <vector>
+#include <QApplication>
+#include <QDataStream>
+#include <QStandardPaths>
+#include <QStringList>
+#include <deconz/aps.h>
+#include <deconz/zcl.h>
+#include "std_otau_plugin.h"
+#include "otau_file.h"
+#include "otau_model.h"
+#include "otau_node.h"
+#include "bench_common.h"
+
+#define BENCH_MANUFACTURER_CODE 0x1234
+#define BENCH_IMAGE_TYPE        0x0101
+#define BENCH_OLD_VERSION       0x01000000
+#define BENCH_NEW_VERSION       0x01000001
+#define BENCH_EXT_ADDRESS_BASE  0x00212EFFFF000000ULL
+#define BENCH_NWK_ADDRESS_BASE  0x1000
+#define PAGE_TICK               10 // ms, same as the plugin image page timer
+#define ACTIVITY_TICK           3000 // ms, same as the plugin activity timer
+
+struct BenchOptions
+{
+    int clients = 1;
+    int imageSize = 200 * 1024;
+    int maxDataSize = 64;
+    double loss = 0; // probability that a frame is lost
+    double noAck = 0; // probability that a server request is confirmed with NO_ACK
+    int confirmLatency = 30; // ms
+    int clientTimeout = 2000; // ms until a client repeats a request
+    int pageSize = 256;
+    int responseSpacing = 20; // ms
+    bool pages = false;
+    bool json = false;
+    unsigned seed = 1;
+    qint64 timeLimit = 24 * 3600 * 1000LL; // ms
+};
+
+struct BenchClient
+{
+    deCONZ::Address addr;
+    uint8_t seq = 0;
+    uint32_t fileVersion = 0;
+    uint32_t fileSize = 0;
+    uint32_t offset = 0;
+    uint32_t pageEnd = 0;
+    unsigned txToken = 0; // invalidates pending timeouts
+    bool transferring = false;
+    bool done = false;
+    unsigned blocks = 0;
+    unsigned requests = 0;
+    unsigned retries = 0;
+    qint64 startTime = -1;
+    qint64 endTime = -1;
+    qint64 cpuNs = 0; // CPU time spent in the plugin for this client
+};
+
+enum BenchEventType
+{
+    EventServerIndication,
+    EventServerConfirm,
+    EventClientFrame,
+    EventClientTimeout,
+    EventPageTick,
+    EventActivityTick
+};
+
+struct BenchEvent
+{
+    qint64 time;
+    quint64 order;
+    BenchEventType type;
+    int client;
+    unsigned token;
+    uint8_t id;
+    uint8_t status;
+    QByteArray asdu;
+
+    bool operator<(const BenchEvent &other) const
+    {
+        if (time != other.time)
+        {
+            return time > other.time; // min heap
+        }
+        return order > other.order;
+    }
+};
+
+/*! Simulated network between the plugin and the OTA clients.
+ */
+class LoopbackNetwork : public OtauTransport
+{
+public:
+    LoopbackNetwork(const BenchOptions &opt, StdOtauPlugin *plugin) :
+        m_opt(opt),
+        m_plugin(plugin),
+        m_rng(opt.seed)
+    {
+        m_baseTime = deCONZ::steadyTimeRef().ref;
+
+        for (int i = 0; i < opt.clients; i++)
+        {
+            BenchClient c;
+            c.addr.setExt(BENCH_EXT_ADDRESS_BASE + i);
+            c.addr.setNwk(BENCH_NWK_ADDRESS_BASE + i);
+            m_clients.push_back(c);
+        }
+    }
+
+    bool isAvailable() override { return true; }
+    bool otauActive() override { return true; }
+    int getNode(int, const deCONZ::Node **node) override { *node = nullptr; return -1; }
+
+    deCONZ::SteadyTimeRef steadyTime() override
+    {
+        deCONZ::SteadyTimeRef t;
+        t.ref = m_baseTime + m_now;
+        return t;
+    }
+
+    int apsdeDataRequest(const deCONZ::ApsDataRequest &req) override
+    {
+        int client = clientIndex(req.dstAddress());
+        if (client < 0)
+        {
+            return deCONZ::ErrorNotConnected;
+        }
+
+        m_serverFrames++;
+        m_serverBytes += req.asdu().size();
+
+        const bool acked = (req.txOptions() & deCONZ::ApsTxAcknowledgedTransmission) ? true : false;
+        bool delivered = !chance(m_opt.loss);
+        uint8_t status = deCONZ::ApsSuccessStatus;
+
+        if (chance(m_opt.noAck) || (acked && !delivered))
+        {
+            status = deCONZ::ApsNoAckStatus;
+            delivered = false;
+        }
+
+        if (delivered)
+        {
+            schedule(m_now + m_opt.confirmLatency / 2, EventClientFrame, client, 0, 0, 0, req.asdu());
+        }
+
+        schedule(m_now + m_opt.confirmLatency, EventServerConfirm, client, 0, req.id(), status);
+        return deCONZ::Success;
+    }
+
+    int run()
+    {
+        for (size_t i = 0; i < m_clients.size(); i++)
+        {
+            sendQueryNextImage(int(i));
+        }
+
+        if (m_opt.pages)
+        {
+            // the image page timer paces the page responses
+            schedule(PAGE_TICK, EventPageTick, -1);
+        }
+        schedule(ACTIVITY_TICK, EventActivityTick, -1);
+
+        const qint64 cpuStart = cpuTimeNs();
+
+        while (m_done < m_clients.size() && m_now < m_opt.timeLimit && !m_events.empty())
+        {
+            BenchEvent ev = m_events.top();
+            m_events.pop();
+            m_now = qMax(m_now, ev.time);
+            dispatch(ev);
+        }
+
+        m_cpuNs = cpuTimeNs() - cpuStart;
+        return m_done == m_clients.size() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    void report() const
+    {
+        qint64 first = -1;
+        qint64 last = 0;
+        quint64 bytes = 0;
+        quint64 blocks = 0;
+        quint64 retries = 0;
+        qint64 cpuNs = 0;
+        qint64 durationSum = 0;
+
+        for (const BenchClient &c : m_clients)
+        {
+            retries += c.retries;
+            cpuNs += c.cpuNs;
+
+            if (!c.done)
+            {
+                continue;
+            }
+
+            if (first < 0 || c.startTime < first)
+            {
+                first = c.startTime;
+            }
+            last = qMax(last, c.endTime);
+            bytes += c.fileSize;
+            blocks += c.blocks;
+            durationSum += c.endTime - c.startTime;
+        }
+
+        const qint64 makespan = first >= 0 ? qMax<qint64>(last - first, 1) : 0;
+        const double seconds = makespan / 1000.0;
+        const double bytesPerSec = makespan ? bytes / seconds : 0;
+        const double blocksPerSec = makespan ? blocks / seconds : 0;
+        const double avgDuration = m_done ? double(durationSum) / m_done : 0;
+        const double cpuPerTransfer = m_done ? double(cpuNs) / m_done / 1000.0 : 0; // us
+        const double totalCpuPerTransfer = m_done ? double(m_cpuNs) / m_done / 1000.0 : 0; // us
+
+        if (m_opt.json)
+        {
+            printf("{\"clients\":%d,\"completed\":%u,\"image_size\":%d,\"mode\":\"%s\",\"time_base\":\"%s\","
+                   "\"loss\":%.4f,\"no_ack\":%.4f,\"confirm_latency_ms\":%d,\"max_data_size\":%d,"
+                   "\"completion_time_ms\":%lld,\"avg_transfer_ms\":%.1f,\"bytes_per_sec\":%.1f,\"blocks_per_sec\":%.2f,"
+                   "\"retries\":%llu,\"server_frames\":%llu,\"server_bytes\":%llu,"
+                   "\"plugin_cpu_us_per_transfer\":%.1f,\"total_cpu_us_per_transfer\":%.1f}\n",
+                   m_opt.clients, m_done, m_opt.imageSize, m_opt.pages ? "page" : "block", "virtual",
+                   m_opt.loss, m_opt.noAck, m_opt.confirmLatency, m_opt.maxDataSize,
+                   (long long)makespan, avgDuration, bytesPerSec, blocksPerSec,
+                   (unsigned long long)retries, (unsigned long long)m_serverFrames, (unsigned long long)m_serverBytes,
+                   cpuPerTransfer, totalCpuPerTransfer);
+            return;
+        }
+
+        printf("mode:                 %s requests (virtual time)\n", m_opt.pages ? "page" : "block");
+        printf("transfers:            %u/%d completed, image size %d bytes\n", m_done, m_opt.clients, m_opt.imageSize);
+        printf("completion time:      %lld ms (avg. per transfer %.1f ms)\n", (long long)makespan, avgDuration);
+        printf("throughput:           %.1f bytes/s, %.2f blocks/s\n", bytesPerSec, blocksPerSec);
+        printf("retries:              %llu\n", (unsigned long long)retries);
+        printf("server frames:        %llu (%llu bytes)\n", (unsigned long long)m_serverFrames, (unsigned long long)m_serverBytes);
+        printf("CPU per transfer:     %.1f us in plugin, %.1f us total\n", cpuPerTransfer, totalCpuPerTransfer);
+    }
+
+private:
+    bool chance(double p)
+    {
+        return p > 0 && std::uniform_real_distribution<double>(0, 1)(m_rng) < p;
+    }
+
+    int clientIndex(const deCONZ::Address &addr) const
+    {
+        if (!addr.hasExt())
+        {
+            return -1;
+        }
+
+        const quint64 i = addr.ext() - BENCH_EXT_ADDRESS_BASE;
+        return i < m_clients.size() ? int(i) : -1;
+    }
+
+    void schedule(qint64 time, BenchEventType type, int client, unsigned token = 0, uint8_t id = 0, uint8_t status = 0, const QByteArray &asdu = QByteArray())
+    {
+        BenchEvent ev;
+        ev.time = time;
+        ev.order = m_order++;
+        ev.type = type;
+        ev.client = client;
+        ev.token = token;
+        ev.id = id;
+        ev.status = status;
+        ev.asdu = asdu;
+        m_events.push(ev);
+    }
+
+    void dispatch(const BenchEvent &ev)
+    {
+        switch (ev.type)
+        {
+        case EventServerIndication:
+        {
+            deCONZ::ApsDataIndication ind;
+            ind.setProfileId(HA_PROFILE_ID);
+            ind.setClusterId(OTAU_CLUSTER_ID);
+            ind.setSrcEndpoint(0x01);
+            ind.setDstEndpoint(0x01);
+            ind.srcAddress() = m_clients[ev.client].addr;
+            ind.setSrcAddressMode(deCONZ::ApsExtAddress);
+            ind.asdu() = ev.asdu;
+
+            const qint64 t0 = cpuTimeNs();
+            m_plugin->apsdeDataIndication(ind);
+            m_clients[ev.client].cpuNs += cpuTimeNs() - t0;
+        }
+            break;
+
+        case EventServerConfirm:
+        {
+            deCONZ::ApsDataConfirm conf;
+            conf.setId(ev.id);
+            conf.dstAddress() = m_clients[ev.client].addr;
+            conf.setDstAddressMode(deCONZ::ApsNwkAddress);
+            conf.setDstEndpoint(0x01);
+            conf.setSrcEndpoint(0x01);
+            conf.setStatus(ev.status);
+
+            const qint64 t0 = cpuTimeNs();
+            m_plugin->apsdeDataConfirm(conf);
+            m_clients[ev.client].cpuNs += cpuTimeNs() - t0;
+        }
+            break;
+
+        case EventClientFrame:
+            clientReceive(ev.client, ev.asdu);
+            break;
+
+        case EventClientTimeout:
+            if (ev.token == m_clients[ev.client].txToken && !m_clients[ev.client].done)
+            {
+                m_clients[ev.client].retries++;
+                clientRequestNext(ev.client);
+            }
+            break;
+
+        case EventPageTick:
+            m_plugin->imagePageTimerFired();
+            schedule(m_now + PAGE_TICK, EventPageTick, -1);
+            break;
+
+        case EventActivityTick:
+            m_plugin->activityTimerFired();
+            schedule(m_now + ACTIVITY_TICK, EventActivityTick, -1);
+            break;
+        }
+    }
+
+    void clientSend(int client, uint8_t commandId, const QByteArray &payload)
+    {
+        BenchClient &c = m_clients[client];
+        deCONZ::ZclFrame zclFrame;
+        zclFrame.setSequenceNumber(++c.seq);
+        zclFrame.setCommandId(commandId);
+        zclFrame.setFrameControl(deCONZ::ZclFCClusterCommand |
+                                 deCONZ::ZclFCDisableDefaultResponse);
+        zclFrame.payload() = payload;
+
+        QByteArray asdu;
+        {
+            QDataStream stream(&asdu, QIODevice::WriteOnly);
+            stream.setByteOrder(QDataStream::LittleEndian);
+            zclFrame.writeToStream(stream);
+        }
+
+        c.requests++;
+        c.txToken++;
+
+        if (!chance(m_opt.loss))
+        {
+            schedule(m_now + m_opt.confirmLatency / 2, EventServerIndication, client, 0, 0, 0, asdu);
+        }
+
+        schedule(m_now + m_opt.clientTimeout, EventClientTimeout, client, c.txToken);
+    }
+
+    void sendQueryNextImage(int client)
+    {
+        QByteArray payload;
+        QDataStream stream(&payload, QIODevice::WriteOnly);
+        stream.setByteOrder(QDataStream::LittleEndian);
+        stream << (uint8_t)0x00; // field control
+        stream << (uint16_t)BENCH_MANUFACTURER_CODE;
+        stream << (uint16_t)BENCH_IMAGE_TYPE;
+        stream << (uint32_t)BENCH_OLD_VERSION;
+
+        if (m_clients[client].startTime < 0)
+        {
+            m_clients[client].startTime = m_now;
+        }
+
+        clientSend(client, OTAU_QUERY_NEXT_IMAGE_REQUEST_CMD_ID, payload);
+    }
+
+    void clientRequestNext(int client)
+    {
+        BenchClient &c = m_clients[client];
+
+        if (!c.transferring)
+        {
+            sendQueryNextImage(client);
+            return;
+        }
+
+        QByteArray payload;
+        QDataStream stream(&payload, QIODevice::WriteOnly);
+        stream.setByteOrder(QDataStream::LittleEndian);
+
+        if (c.offset >= c.fileSize)
+        {
+            stream << (uint8_t)OTAU_SUCCESS;
+            stream << (uint16_t)BENCH_MANUFACTURER_CODE;
+            stream << (uint16_t)BENCH_IMAGE_TYPE;
+            stream << c.fileVersion;
+            clientSend(client, OTAU_UPGRADE_END_REQUEST_CMD_ID, payload);
+            return;
+        }
+
+        stream << (uint8_t)0x00; // field control
+        stream << (uint16_t)BENCH_MANUFACTURER_CODE;
+        stream << (uint16_t)BENCH_IMAGE_TYPE;
+        stream << c.fileVersion;
+        stream << c.offset;
+        stream << (uint8_t)m_opt.maxDataSize;
+
+        if (m_opt.pages)
+        {
+            c.pageEnd = qMin(c.fileSize, c.offset + m_opt.pageSize);
+            stream << (uint16_t)m_opt.pageSize;
+            stream << (uint16_t)m_opt.responseSpacing;
+            clientSend(client, OTAU_IMAGE_PAGE_REQUEST_CMD_ID, payload);
+        }
+        else
+        {
+            clientSend(client, OTAU_IMAGE_BLOCK_REQUEST_CMD_ID, payload);
+        }
+    }
+
+    void clientReceive(int client, const QByteArray &asdu)
+    {
+        BenchClient &c = m_clients[client];
+        deCONZ::ZclFrame zclFrame;
+
+        {
+            QDataStream stream(asdu);
+            stream.setByteOrder(QDataStream::LittleEndian);
+            zclFrame.readFromStream(stream);
+        }
+
+        if (c.done || !zclFrame.isClusterCommand())
+        {
+            return;
+        }
+
+        QDataStream stream(zclFrame.payload());
+        stream.setByteOrder(QDataStream::LittleEndian);
+        uint8_t status = 0xFF;
+        stream >> status;
+
+        if (zclFrame.commandId() == OTAU_QUERY_NEXT_IMAGE_RESPONSE_CMD_ID)
+        {
+            if (status != OTAU_SUCCESS || c.transferring)
+            {
+                return; // busy or no image, the timeout repeats the query
+            }
+
+            uint16_t mfCode;
+            uint16_t imageType;
+            stream >> mfCode >> imageType >> c.fileVersion >> c.fileSize;
+            c.transferring = true;
+            c.offset = 0;
+            clientRequestNext(client);
+        }
+        else if (zclFrame.commandId() == OTAU_IMAGE_BLOCK_RESPONSE_CMD_ID)
+        {
+            if (status != OTAU_SUCCESS)
+            {
+                return;
+            }
+
+            uint16_t mfCode;
+            uint16_t imageType;
+            uint32_t fileVersion;
+            uint32_t offset;
+            uint8_t dataSize;
+            stream >> mfCode >> imageType >> fileVersion >> offset >> dataSize;
+
+            if (offset != c.offset || dataSize == 0)
+            {
+                return; // out of order, a page is repeated from the current offset after the timeout
+            }
+
+            c.offset += dataSize;
+            c.blocks++;
+
+            if (!m_opt.pages || c.offset >= c.pageEnd)
+            {
+                clientRequestNext(client);
+            }
+        }
+        else if (zclFrame.commandId() == OTAU_UPGRADE_END_RESPONSE_CMD_ID)
+        {
+            c.done = true;
+            c.endTime = m_now;
+            c.txToken++;
+            m_done++;
+        }
+    }
+
+    const BenchOptions &m_opt;
+    StdOtauPlugin *m_plugin;
+    std::mt19937 m_rng;
+    std::vector<BenchClient> m_clients;
+    std::priority_queue<BenchEvent> m_events;
+    quint64 m_order = 0;
+    qint64 m_now = 0; // ms since start
+    int64_t m_baseTime = 0;
+    unsigned m_done = 0;
+    quint64 m_serverFrames = 0;
+    quint64 m_serverBytes = 0;
+    qint64 m_cpuNs = 0;
+};
+
+static QByteArray createImage(int size)
+{
+    OtauFile file;
+    file.manufacturerCode = BENCH_MANUFACTURER_CODE;
+    file.imageType = BENCH_IMAGE_TYPE;
+    file.fileVersion = BENCH_NEW_VERSION;
+
+    OtauFile::SubElement sub;
+    sub.tag = TAG_UPGRADE_IMAGE;
+    sub.data.resize(size);
+    for (int i = 0; i < size; i++)
+    {
+        sub.data[i] = char(i * 7 + (i >> 8));
+    }
+    sub.length = uint32_t(size);
+    file.subElements.push_back(sub);
+
+    return file.toArray();
+}
+
+static void usage()
+{
+    printf("usage: otau_loopback_bench [options]\n"
+           "  --clients N            number of OTA clients (1)\n"
+           "  --image-size BYTES     size of the upgrade image (204800)\n"
+           "  --max-data-size N      maxDataSize in block requests (64)\n"
+           "  --loss PERCENT         frame loss in both directions (0)\n"
+           "  --no-ack PERCENT       server requests confirmed with NO_ACK (0)\n"
+           "  --confirm-latency MS   time until a request is confirmed (30)\n"
+           "  --client-timeout MS    time until a client repeats a request (2000)\n"
+           "  --pages                use image page requests\n"
+           "  --page-size N          page size (256)\n"
+           "  --response-spacing MS  requested response spacing (20)\n"
+           "  --seed N               random seed (1)\n"
+           "  --time-limit S         give up after S seconds of simulated time (86400)\n"
+           "  --json                 print results as JSON\n");
+}
+
+int main(int argc, char *argv[])
+{
+    // no display needed, the widget only holds the transfer settings
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+    QStandardPaths::setTestModeEnabled(true); // keep the user's image directories untouched
+
+    BenchOptions opt;
+    const QStringList args = app.arguments();
+
+    for (int i = 1; i < args.size(); i++)
+    {
+        const QString &arg = args.at(i);
+        const bool hasValue = i + 1 < args.size();
+
+        if      (arg == "--clients" && hasValue)          { opt.clients = args.at(++i).toInt(); }
+        else if (arg == "--image-size" && hasValue)       { opt.imageSize = args.at(++i).toInt(); }
+        else if (arg == "--max-data-size" && hasValue)    { opt.maxDataSize = args.at(++i).toInt(); }
+        else if (arg == "--loss" && hasValue)             { opt.loss = args.at(++i).toDouble() / 100; }
+        else if (arg == "--no-ack" && hasValue)           { opt.noAck = args.at(++i).toDouble() / 100; }
+        else if (arg == "--confirm-latency" && hasValue)  { opt.confirmLatency = args.at(++i).toInt(); }
+        else if (arg == "--client-timeout" && hasValue)   { opt.clientTimeout = args.at(++i).toInt(); }
+        else if (arg == "--pages")                        { opt.pages = true; }
+        else if (arg == "--page-size" && hasValue)        { opt.pageSize = args.at(++i).toInt(); }
+        else if (arg == "--response-spacing" && hasValue) { opt.responseSpacing = args.at(++i).toInt(); }
+        else if (arg == "--seed" && hasValue)             { opt.seed = args.at(++i).toUInt(); }
+        else if (arg == "--time-limit" && hasValue)       { opt.timeLimit = args.at(++i).toLongLong() * 1000; }
+        else if (arg == "--json")                         { opt.json = true; }
+        else
+        {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (opt.clients < 1 || opt.imageSize < 1 || opt.maxDataSize < 1 || opt.maxDataSize > 255 ||
+        opt.pageSize < 1 || opt.clientTimeout < 1 || opt.confirmLatency < 0)
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    StdOtauPlugin plugin;
+    plugin.createWidget(); // holds ACK, page request and spacing settings
+
+    LoopbackNetwork net(opt, &plugin);
+    plugin.setTransport(&net);
+
+    // the image is served from memory, no image directory is involved
+    OtauModel *model = plugin.findChild<OtauModel*>();
+    const QByteArray image = createImage(opt.imageSize);
+
+    for (int i = 0; i < opt.clients; i++)
+    {
+        deCONZ::Address addr;
+        addr.setExt(BENCH_EXT_ADDRESS_BASE + i);
+        addr.setNwk(BENCH_NWK_ADDRESS_BASE + i);
+
+        OtauNode *node = model ? model->getNode(addr, true) : nullptr;
+        if (!node || !node->file.fromArray(image))
+        {
+            fprintf(stderr, "failed to prepare client %d\n", i);
+            return EXIT_FAILURE;
+        }
+        node->setRxOnWhenIdle(true); // simulated clients behave like routers
+        node->setHasData(true);
+        node->setPermitUpdate(true);
+    }
+
+    const int ret = net.run();
+    net.report();
+    plugin.setTransport(nullptr);
+    return ret;
+}
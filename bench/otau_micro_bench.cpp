@@ -0,0 +1,409 @@
+/*
+ * Microbenchmarks for the file, index and lookup hot paths of the OTAU server.
+ *
+ * All files are created in a temporary home directory, the results are printed as JSON.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <vector>
+#include <QApplication>
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QTimer>
+#include "std_otau_plugin.h"
+#include "otau_file.h"
+#include "otau_file_loader.h"
+#include "otau_model.h"
+#include "otau_node.h"
+#include "bench_common.h"
+
+#define BENCH_MANUFACTURER_CODE 0x1234
+#define BENCH_EXT_ADDRESS_BASE  0x00212EFFFF000000ULL
+#define BENCH_NWK_ADDRESS_BASE  0x1000
+#define LOCAL_IMAGE_SIZE        2048 // images of the index corpora are small to keep the disk usage low
+
+struct BenchResult
+{
+    QString name;
+    QString params;
+    size_t iterations = 0;
+    qint64 meanNs = 0;
+    qint64 minNs = 0;
+    qint64 p50Ns = 0;
+    qint64 p90Ns = 0;
+};
+
+static std::vector<BenchResult> results;
+static qint64 minDurationNs = 200 * 1000 * 1000LL;
+static QString filter;
+
+static qint64 nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*! Runs \p fn until at least 3 iterations and the min. duration are done.
+ */
+static void measure(const QString &name, const QString &params, const std::function<void()> &fn)
+{
+    if (!filter.isEmpty() && !name.contains(filter))
+    {
+        return;
+    }
+
+    fn(); // warm up
+
+    std::vector<qint64> samples;
+    qint64 total = 0;
+
+    while (samples.size() < 3 || (total < minDurationNs && samples.size() < 1000000))
+    {
+        const qint64 t0 = nowNs();
+        fn();
+        const qint64 dt = nowNs() - t0;
+        samples.push_back(dt);
+        total += dt;
+    }
+
+    BenchResult r;
+    r.name = name;
+    r.params = params;
+    r.iterations = samples.size();
+    r.meanNs = total / qint64(samples.size());
+    r.p50Ns = percentile(samples, 50);
+    r.p90Ns = percentile(samples, 90);
+    r.minNs = samples.front(); // sorted by percentile()
+    results.push_back(r);
+
+    fprintf(stderr, "%-40s %-28s %12lld ns/op\n", qPrintable(name), qPrintable(params), (long long)r.p50Ns);
+}
+
+static QByteArray createImage(uint16_t imageType, uint32_t fileVersion, int size)
+{
+    OtauFile file;
+    file.manufacturerCode = BENCH_MANUFACTURER_CODE;
+    file.imageType = imageType;
+    file.fileVersion = fileVersion;
+
+    OtauFile::SubElement sub;
+    sub.tag = TAG_UPGRADE_IMAGE;
+    sub.data.resize(size);
+    for (int i = 0; i < size; i++)
+    {
+        sub.data[i] = char(i * 7 + imageType);
+    }
+    sub.length = uint32_t(size);
+    file.subElements.push_back(sub);
+
+    return file.toArray();
+}
+
+static QString imageFileName(uint16_t imageType, uint32_t fileVersion)
+{
+    return QString("%1_%2_%3.zigbee").arg(BENCH_MANUFACTURER_CODE, 4, 16, QChar('0'))
+                                     .arg(imageType, 4, 16, QChar('0'))
+                                     .arg(fileVersion, 8, 16, QChar('0')).toUpper();
+}
+
+static deCONZ::Address nodeAddress(int i)
+{
+    deCONZ::Address addr;
+    addr.setExt(BENCH_EXT_ADDRESS_BASE + i);
+    addr.setNwk(uint16_t(BENCH_NWK_ADDRESS_BASE + i));
+    return addr;
+}
+
+/*! Lets the plugin look up images without a controller.
+ */
+class BenchTransport : public OtauTransport
+{
+public:
+    bool isAvailable() override { return true; }
+    bool otauActive() override { return true; }
+};
+
+/*! Access to the download state machine of the plugin.
+ */
+class OtauMicroBench
+{
+public:
+    /*! Replaces the image store by an empty one, the next index build has to read and hash all files.
+     */
+    static void clearImageStore(StdOtauPlugin *plugin)
+    {
+        const QString storePath = plugin->m_imageStore.storePath();
+        plugin->m_imageStore = OtauImageStore();
+        plugin->m_imageStore.setStorePath(storePath);
+    }
+
+    /*! Runs the index processing step of downloadTimerFired() on the given remote index.
+     */
+    static void processRemoteIndex(StdOtauPlugin *plugin, const QString &indexPath)
+    {
+        plugin->m_downloads.clear();
+        plugin->m_prefetchRunning = false;
+        plugin->m_downloadIndexPath = indexPath;
+        plugin->m_downloadState = StdOtauPlugin::DownloadStateProcessIndex;
+        plugin->downloadTimerFired();
+        plugin->m_downloadTimer->stop(); // nothing is downloaded
+        plugin->m_downloadState = StdOtauPlugin::DownloadStateInitial;
+    }
+};
+
+static void benchFile()
+{
+    for (int size : {64 * 1024, 256 * 1024, 1024 * 1024})
+    {
+        const QString params = QString("size=%1").arg(size);
+        const QByteArray arr = createImage(1, 1, size);
+        OtauFile file;
+
+        measure("OtauFile::fromArray", params, [&]() { file.fromArray(arr); });
+        measure("OtauFile::toArray", params, [&]() { file.toArray(); });
+
+        const QString path = QDir::homePath() + "/" + imageFileName(1, uint32_t(size));
+        QFile f(path);
+        if (f.open(QFile::WriteOnly))
+        {
+            f.write(arr);
+            f.close();
+        }
+
+        OtauFileLoader ld;
+        measure("OtauFileLoader::readFile", params, [&]() { ld.readFile(path, file); });
+        QFile::remove(path);
+    }
+}
+
+/*! Remote index with \p entries images, the first half matches the local images (already downloaded).
+ */
+static QString createRemoteIndex(int entries)
+{
+    std::mt19937 rng(entries);
+    QByteArray data = "[";
+
+    for (int i = 0; i < entries; i++)
+    {
+        QByteArray sha512;
+        for (int k = 0; k < 128; k++)
+        {
+            sha512.append("0123456789abcdef"[rng() & 0xF]);
+        }
+
+        if (i)
+        {
+            data += ",";
+        }
+
+        const QByteArray fileName = imageFileName(uint16_t(i), 2).toLatin1();
+        data += "\n  {\n    \"fileName\": \"" + fileName + "\",\n";
+        data += "    \"fileVersion\": 2,\n";
+        data += "    \"fileSize\": " + QByteArray::number(LOCAL_IMAGE_SIZE) + ",\n";
+        data += "    \"url\": \"https://example.com/images/" + fileName + "\",\n";
+        data += "    \"imageType\": " + QByteArray::number(i) + ",\n";
+        data += "    \"manufacturerCode\": " + QByteArray::number(BENCH_MANUFACTURER_CODE) + ",\n";
+        data += "    \"sha512\": \"" + sha512 + "\"\n  }";
+    }
+
+    data += "\n]\n";
+
+    const QString path = QDir::homePath() + QString("/remote_index_%1.json").arg(entries);
+    QFile f(path);
+    if (f.open(QFile::WriteOnly))
+    {
+        f.write(data);
+    }
+    return path;
+}
+
+static void benchIndex(const std::vector<int> &imageCounts, const std::vector<int> &nodeCounts)
+{
+    const QString imgPath = QDir::homePath() + "/otau";
+    QDir().mkpath(imgPath);
+    int created = 0;
+
+    for (int images : imageCounts)
+    {
+        for (; created < images; created++)
+        {
+            QFile f(imgPath + "/" + imageFileName(uint16_t(created), 1));
+            if (f.open(QFile::WriteOnly))
+            {
+                f.write(createImage(uint16_t(created), 1, LOCAL_IMAGE_SIZE));
+            }
+        }
+
+        const QString params = QString("images=%1").arg(images);
+
+        StdOtauPlugin plugin;
+        BenchTransport transport;
+        plugin.setTransport(&transport);
+        OtauModel *model = plugin.findChild<OtauModel*>();
+        if (!model)
+        {
+            return;
+        }
+
+        // includes releasing the cached file states, which is small compared to hashing
+        measure("createLocalFileIndex (cold)", params, [&]() {
+            OtauMicroBench::clearImageStore(&plugin);
+            plugin.createLocalFileIndex();
+        });
+
+        measure("createLocalFileIndex", params, [&]() { plugin.createLocalFileIndex(); });
+
+        OtauNode *node = model->getNode(nodeAddress(0), true);
+        node->manufacturerId = BENCH_MANUFACTURER_CODE;
+        node->setSoftwareVersion(0);
+
+        std::mt19937 rng(images);
+        measure("checkForUpdateImageImage (hit)", params, [&]() {
+            node->setImageType(uint16_t(rng() % images));
+            node->setHasData(false);
+            plugin.checkForUpdateImageImage(node);
+        });
+
+        measure("checkForUpdateImageImage (miss)", params, [&]() {
+            node->setImageType(0xFFFF);
+            node->setHasData(false);
+            plugin.checkForUpdateImageImage(node);
+        });
+        node->setHasData(false);
+
+        // remote index as large as the local corpus, known models from the nodes
+        const QString remoteIndex = createRemoteIndex(images);
+
+        for (int nodes : nodeCounts)
+        {
+            for (int i = int(model->nodes().size()); i < nodes; i++)
+            {
+                OtauNode *n = model->getNode(nodeAddress(i), true);
+                n->manufacturerId = BENCH_MANUFACTURER_CODE;
+                n->setImageType(uint16_t(i % (images * 2))); // half of the models are not in the index
+                n->setSoftwareVersion(1);
+            }
+
+            measure("downloadTimerFired (process index)", QString("images=%1 nodes=%2").arg(images).arg(nodes), [&]() {
+                OtauMicroBench::processRemoteIndex(&plugin, remoteIndex);
+            });
+        }
+
+        plugin.setTransport(nullptr);
+    }
+}
+
+static void benchNodes(const std::vector<int> &nodeCounts)
+{
+    OtauModel model;
+    std::mt19937 rng(1);
+    int created = 0;
+
+    for (int nodes : nodeCounts)
+    {
+        for (; created < nodes; created++)
+        {
+            model.getNode(nodeAddress(created), true);
+        }
+
+        const QString params = QString("nodes=%1").arg(nodes);
+
+        measure("OtauModel::getNode (hit)", params, [&]() { model.getNode(nodeAddress(int(rng() % nodes))); });
+        measure("OtauModel::getNode (miss)", params, [&]() { model.getNode(nodeAddress(nodes + 1)); });
+    }
+}
+
+static void printJson(FILE *out)
+{
+    fprintf(out, "{\"benchmarks\":[\n");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult &r = results[i];
+        fprintf(out, "  {\"name\":\"%s\",\"params\":\"%s\",\"iterations\":%zu,\"mean_ns\":%lld,\"min_ns\":%lld,\"p50_ns\":%lld,\"p90_ns\":%lld}%s\n",
+                qPrintable(r.name), qPrintable(r.params), r.iterations,
+                (long long)r.meanNs, (long long)r.minNs, (long long)r.p50Ns, (long long)r.p90Ns,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "]}\n");
+}
+
+static void usage()
+{
+    printf("usage: otau_micro_bench [options]\n"
+           "  --quick          small corpora and short runs\n"
+           "  --filter TEXT    only run benchmarks whose name contains TEXT\n"
+           "  --min-time MS    min. run time per benchmark (200)\n"
+           "  --out FILE       write JSON to FILE instead of stdout\n");
+}
+
+int main(int argc, char *argv[])
+{
+    // everything the plugin writes goes to a temporary home directory
+    QTemporaryDir home;
+    if (!home.isValid())
+    {
+        fprintf(stderr, "failed to create temporary directory\n");
+        return EXIT_FAILURE;
+    }
+
+    qputenv("HOME", home.path().toLocal8Bit());
+    qputenv("XDG_DATA_HOME", (home.path() + "/.local/share").toLocal8Bit());
+    qputenv("XDG_CONFIG_HOME", (home.path() + "/.config").toLocal8Bit());
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+
+    std::vector<int> imageCounts = {10, 100, 1000, 5000};
+    std::vector<int> nodeCounts = {10, 100, 1000, 10000};
+    QString outPath;
+    const QStringList args = app.arguments();
+
+    for (int i = 1; i < args.size(); i++)
+    {
+        const QString &arg = args.at(i);
+        const bool hasValue = i + 1 < args.size();
+
+        if (arg == "--quick")
+        {
+            imageCounts = {10, 100};
+            nodeCounts = {10, 100};
+            minDurationNs = 20 * 1000 * 1000LL;
+        }
+        else if (arg == "--filter" && hasValue)   { filter = args.at(++i); }
+        else if (arg == "--min-time" && hasValue) { minDurationNs = args.at(++i).toLongLong() * 1000 * 1000; }
+        else if (arg == "--out" && hasValue)      { outPath = args.at(++i); }
+        else
+        {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    benchFile();
+    benchIndex(imageCounts, nodeCounts);
+    benchNodes(nodeCounts);
+
+    FILE *out = stdout;
+    if (!outPath.isEmpty())
+    {
+        out = fopen(qPrintable(outPath), "w");
+        if (!out)
+        {
+            fprintf(stderr, "failed to open %s\n", qPrintable(outPath));
+            return EXIT_FAILURE;
+        }
+    }
+
+    printJson(out);
+
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,455 @@
+/*
+ * Download source failover harness.
+ *
+ * Starts local HTTP stand-ins with different delays and failure modes and lets the download
+ * state machine of the plugin fetch an OTA file from them, through a transport which uses
+ * QNetworkAccessManager instead of the deCONZ downloader. The url from the index and the
+ * mirrors are raced and failed over by StdOtauPlugin::downloadStartAttempt() and
+ * downloadAttemptDone(), mirror content is verified against the sha512 from the index and
+ * a request ends after DOWNLOAD_TIMEOUT. Each scenario checks which source delivered, how
+ * long it took and that no attempt is left running, the exit code is the number of failed checks.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <vector>
+#include <QApplication>
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QNetworkAccessManager>
+#include <QNetworkProxy>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <QUrl>
+#include "std_otau_plugin.h"
+#include "otau_source_list.h"
+#include "otau_transport.h"
+
+#define BENCH_BODY_SIZE      (32 * 1024) // the plugin drops files up to 512 bytes
+#define BENCH_FAST_DELAY     20 // ms
+#define BENCH_SLOW_DELAY     10000 // ms, longer than the hedge delay of an unknown source
+#define BENCH_REQUEST_TIMEOUT 20000 // ms, DOWNLOAD_TIMEOUT of the plugin
+#define BENCH_WAIT_LIMIT     (3 * BENCH_REQUEST_TIMEOUT) // ms until a scenario is given up
+
+enum StandInMode
+{
+    ModeOk, //!< 200 with the expected body after the delay
+    ModeError, //!< 500 after the delay
+    ModeReset, //!< connection is reset before any response
+    ModeHang, //!< connection stays open without response
+    ModeCorrupt //!< 200 with a wrong body after the delay
+};
+
+/*! Minimal HTTP server which answers every request according to its mode.
+ */
+class HttpStandIn
+{
+public:
+    HttpStandIn(StandInMode mode, int delayMs, const QByteArray &body) :
+        m_mode(mode), m_delay(delayMs), m_body(body)
+    {
+        m_server.listen(QHostAddress::LocalHost);
+        QObject::connect(&m_server, &QTcpServer::newConnection, [this]() { accept(); });
+    }
+
+    /*! Url of the file as given in the index.
+     */
+    QString url() const
+    {
+        return baseUrl() + "images/bench/image.ota";
+    }
+
+    /*! Base url as configured in otau/mirror-urls.
+     */
+    QString baseUrl() const
+    {
+        return QString("http://127.0.0.1:%1/").arg(m_server.serverPort());
+    }
+
+    int requests() const { return m_requests; }
+
+private:
+    void accept()
+    {
+        while (QTcpSocket *sock = m_server.nextPendingConnection())
+        {
+            QObject::connect(sock, &QTcpSocket::disconnected, sock, &QObject::deleteLater);
+
+            if (m_mode == ModeReset)
+            {
+                m_requests++;
+                sock->abort();
+                continue;
+            }
+
+            auto request = std::make_shared<QByteArray>();
+            QObject::connect(sock, &QTcpSocket::readyRead, sock, [this, sock, request]()
+            {
+                request->append(sock->readAll());
+                if (!request->contains("\r\n\r\n"))
+                {
+                    return;
+                }
+
+                m_requests++;
+                request->clear();
+
+                if (m_mode != ModeHang)
+                {
+                    QTimer::singleShot(m_delay, sock, [this, sock]() { respond(sock); });
+                }
+            });
+        }
+    }
+
+    void respond(QTcpSocket *sock)
+    {
+        QByteArray body = m_body;
+        QByteArray status = "200 OK";
+
+        if (m_mode == ModeError)
+        {
+            status = "500 Internal Server Error";
+            body = "error";
+        }
+        else if (m_mode == ModeCorrupt)
+        {
+            body[0] = char(body[0] ^ 0xff);
+        }
+
+        sock->write("HTTP/1.1 " + status + "\r\nContent-Length: " + QByteArray::number(body.size()) +
+                    "\r\nConnection: close\r\n\r\n" + body);
+        sock->disconnectFromHost();
+    }
+
+    QTcpServer m_server;
+    StandInMode m_mode;
+    int m_delay;
+    QByteArray m_body;
+    int m_requests = 0;
+};
+
+/*! Downloads with QNetworkAccessManager in place of the deCONZ downloader.
+ */
+class BenchDownloadTransport : public OtauTransport
+{
+public:
+    BenchDownloadTransport()
+    {
+        m_nam.setProxy(QNetworkProxy::NoProxy);
+    }
+
+    int download(const char *url, unsigned maxSize, void (*callback)(N_DownloadData*), void *user) override
+    {
+        const int handle = ++m_lastHandle;
+        QNetworkReply *reply = m_nam.get(QNetworkRequest(QUrl(QString::fromUtf8(url))));
+        m_replies[handle] = reply;
+        m_started++;
+
+        QObject::connect(reply, &QNetworkReply::finished, reply, [this, handle, reply, maxSize, callback, user]()
+        {
+            m_replies.erase(handle);
+            reply->deleteLater();
+
+            const QByteArray body = reply->readAll();
+            N_DownloadData dd = {};
+            dd.user = user;
+
+            if (reply->error() == QNetworkReply::NoError && unsigned(body.size()) <= maxSize)
+            {
+                dd.status = N_DownloadDone;
+                dd.data = reinterpret_cast<decltype(dd.data)>(const_cast<char*>(body.constData()));
+                dd.data_size = unsigned(body.size());
+            }
+            else
+            {
+                dd.status = decltype(dd.status)(N_DownloadDone + 1); // any other status is an error
+            }
+
+            callback(&dd);
+        });
+
+        return handle;
+    }
+
+    void cancelDownload(int handle) override
+    {
+        auto i = m_replies.find(handle);
+        if (i == m_replies.end())
+        {
+            return;
+        }
+
+        QNetworkReply *reply = i->second;
+        m_replies.erase(i);
+        m_cancelled++;
+        reply->disconnect();
+        reply->abort();
+        reply->deleteLater();
+    }
+
+    int started() const { return m_started; }
+    int cancelled() const { return m_cancelled; }
+    int running() const { return static_cast<int>(m_replies.size()); }
+
+private:
+    QNetworkAccessManager m_nam;
+    std::map<int, QNetworkReply*> m_replies;
+    int m_lastHandle = 0;
+    int m_started = 0;
+    int m_cancelled = 0;
+};
+
+struct RequestResult
+{
+    int winner = -1; //!< source which delivered, -1 if the download failed
+    int attempts = 0; //!< downloads started, including retries of the plugin
+    int cancelled = 0; //!< downloads cancelled by the plugin
+    bool stored = false; //!< the image file has the expected content
+    bool idle = false; //!< no attempt slot and no download left running
+    qint64 ms = 0;
+};
+
+/*! Access to the download state machine of the plugin.
+ */
+class OtauSourceBench
+{
+public:
+    /*! Sets the file sources like otau/mirror-urls, index 0 is the url from the index.
+     */
+    static void setMirrors(StdOtauPlugin *plugin, const QStringList &mirrors)
+    {
+        QStringList urls;
+        urls.append(QLatin1String("origin"));
+        urls.append(mirrors);
+        plugin->m_fileSources.setUrls(urls);
+    }
+
+    static const OtauSourceList &sources(const StdOtauPlugin *plugin)
+    {
+        return plugin->m_fileSources;
+    }
+
+    /*! Queues one file like the index processing does and runs the download state machine
+        until the file is stored or dropped after the retries.
+     */
+    static RequestResult downloadFile(StdOtauPlugin *plugin, BenchDownloadTransport &transport, const QString &url, const QByteArray &body)
+    {
+        static int fileCount = 0;
+        const QString fileName = QString("bench_%1.ota").arg(++fileCount);
+
+        StdOtauPlugin::DownloadOtaFile dl;
+        dl.manufacturerCode = 0x1135;
+        dl.imageType = 0x0001;
+        dl.fileVersion = uint32_t(fileCount);
+        dl.fileSize = uint32_t(body.size());
+        dl.fileName = fileName.toStdString();
+        dl.sha512 = QCryptographicHash::hash(body, QCryptographicHash::Sha512).toHex().toStdString();
+        dl.url = url.toStdString();
+
+        const OtauSourceList &src = plugin->m_fileSources;
+        std::vector<unsigned> successes;
+        for (int i = 0; i < src.size(); i++)
+        {
+            successes.push_back(src.at(i).successCount);
+        }
+
+        const int started = transport.started();
+        const int cancelled = transport.cancelled();
+
+        plugin->m_downloads.clear();
+        plugin->m_downloads.push_back(dl);
+        plugin->m_downloadState = StdOtauPlugin::DownloadStateRequestOtaFile;
+
+        QElapsedTimer total;
+        total.start();
+        plugin->downloadTimerFired();
+
+        QEventLoop loop;
+        QTimer poll;
+        QObject::connect(&poll, &QTimer::timeout, &loop, [&]()
+        {
+            if (plugin->m_downloads.empty() || total.elapsed() > BENCH_WAIT_LIMIT)
+            {
+                loop.quit();
+            }
+        });
+        poll.start(10);
+        loop.exec();
+
+        RequestResult r;
+        r.ms = total.elapsed();
+        r.attempts = transport.started() - started;
+        r.cancelled = transport.cancelled() - cancelled;
+
+        for (int i = 0; i < src.size(); i++)
+        {
+            if (src.at(i).successCount > successes[size_t(i)])
+            {
+                r.winner = i;
+            }
+        }
+
+        QFile f(plugin->m_imgPath + "/" + fileName);
+        r.stored = f.open(QFile::ReadOnly) && f.readAll() == body;
+
+        r.idle = transport.running() == 0 &&
+                 std::none_of(plugin->m_downloadAttempts.begin(), plugin->m_downloadAttempts.end(),
+                              [](const OtauDownloadAttempt &a) { return a.active; });
+
+        return r;
+    }
+};
+
+static int failedChecks = 0;
+
+static void check(const char *scenario, bool ok, const char *what)
+{
+    if (!ok)
+    {
+        failedChecks++;
+    }
+    printf("%-24s %-6s %s\n", scenario, ok ? "ok" : "FAILED", what);
+}
+
+static void report(const char *scenario, const RequestResult &r)
+{
+    printf("%-24s winner %d, %d attempts, %d cancelled, %lld ms\n", scenario, r.winner, r.attempts, r.cancelled, (long long)r.ms);
+}
+
+int main(int argc, char **argv)
+{
+    // everything the plugin writes goes to a temporary home directory
+    QTemporaryDir home;
+    if (!home.isValid())
+    {
+        fprintf(stderr, "failed to create temporary directory\n");
+        return EXIT_FAILURE;
+    }
+
+    qputenv("HOME", home.path().toLocal8Bit());
+    qputenv("XDG_DATA_HOME", (home.path() + "/.local/share").toLocal8Bit());
+    qputenv("XDG_CONFIG_HOME", (home.path() + "/.config").toLocal8Bit());
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+
+    QByteArray body(BENCH_BODY_SIZE, 0);
+    for (int i = 0; i < body.size(); i++)
+    {
+        body[i] = char(i * 13);
+    }
+
+    { // a failing source falls over to the next one without waiting for the hedge delay
+        HttpStandIn reset(ModeReset, 0, body);
+        HttpStandIn error(ModeError, BENCH_FAST_DELAY, body);
+        HttpStandIn ok(ModeOk, BENCH_FAST_DELAY, body);
+        StdOtauPlugin plugin;
+        BenchDownloadTransport transport;
+        plugin.setTransport(&transport);
+        OtauSourceBench::setMirrors(&plugin, {error.baseUrl(), ok.baseUrl()});
+        const OtauSourceList &sources = OtauSourceBench::sources(&plugin);
+        const qint64 hedgeDelay = sources.hedgeDelay(0);
+
+        RequestResult r = OtauSourceBench::downloadFile(&plugin, transport, reset.url(), body);
+        report("failover", r);
+        check("failover", r.winner == 2 && r.stored, "third source delivers");
+        check("failover", r.ms < hedgeDelay, "no hedge delay spent");
+        check("failover", sources.at(0).failures == 1 && sources.at(1).failures == 1, "failures recorded");
+        check("failover", r.idle, "no attempt left");
+
+        r = OtauSourceBench::downloadFile(&plugin, transport, reset.url(), body);
+        report("failover (backed off)", r);
+        check("failover (backed off)", r.winner == 2 && r.attempts == 1, "healthy source is tried first");
+        check("failover (backed off)", reset.requests() == 1 && error.requests() == 1, "backed off sources are skipped");
+    }
+
+    { // a slow source is raced by the next one after the hedge delay, the loser is cancelled
+        HttpStandIn slow(ModeOk, BENCH_SLOW_DELAY, body);
+        HttpStandIn fast(ModeOk, BENCH_FAST_DELAY, body);
+        StdOtauPlugin plugin;
+        BenchDownloadTransport transport;
+        plugin.setTransport(&transport);
+        OtauSourceBench::setMirrors(&plugin, {fast.baseUrl()});
+        const qint64 hedgeDelay = OtauSourceBench::sources(&plugin).hedgeDelay(0);
+
+        RequestResult r = OtauSourceBench::downloadFile(&plugin, transport, slow.url(), body);
+        report("hedging", r);
+        check("hedging", r.winner == 1 && r.attempts == 2 && r.stored, "second source wins the race");
+        check("hedging", r.ms >= hedgeDelay && r.ms < BENCH_SLOW_DELAY, "raced after the hedge delay");
+        check("hedging", r.cancelled == 1 && r.idle, "slow download is cancelled");
+
+        r = OtauSourceBench::downloadFile(&plugin, transport, slow.url(), body);
+        report("hedging (ranked)", r);
+        check("hedging (ranked)", r.winner == 1 && r.attempts == 1, "measured faster source is tried first");
+        check("hedging (ranked)", r.ms < hedgeDelay, "no hedge delay spent");
+    }
+
+    { // a mirror with wrong content fails the sha512 check of the plugin
+        HttpStandIn corrupt(ModeCorrupt, BENCH_FAST_DELAY, body);
+        HttpStandIn ok(ModeOk, BENCH_FAST_DELAY, body);
+        StdOtauPlugin plugin;
+        BenchDownloadTransport transport;
+        plugin.setTransport(&transport);
+        OtauSourceBench::setMirrors(&plugin, {corrupt.baseUrl()});
+        const OtauSourceList &sources = OtauSourceBench::sources(&plugin);
+
+        RequestResult r = OtauSourceBench::downloadFile(&plugin, transport, ok.url(), body);
+        report("corrupt (origin)", r);
+        check("corrupt (origin)", r.winner == 0 && r.stored, "origin delivers");
+
+        OtauSourceBench::setMirrors(&plugin, {corrupt.baseUrl(), ok.baseUrl()});
+        r = OtauSourceBench::downloadFile(&plugin, transport, corrupt.url(), body);
+        report("corrupt", r);
+        check("corrupt", r.winner == 2 && r.stored, "wrong content falls over");
+        check("corrupt", sources.at(0).failures == 1 && sources.at(1).failures == 1, "wrong content counts as failure");
+    }
+
+    { // sources which never answer end in the request timeout and give their slots back
+        HttpStandIn hang1(ModeHang, 0, body);
+        HttpStandIn hang2(ModeHang, 0, body);
+        StdOtauPlugin plugin;
+        BenchDownloadTransport transport;
+        plugin.setTransport(&transport);
+        OtauSourceBench::setMirrors(&plugin, {hang2.baseUrl()});
+        const OtauSourceList &sources = OtauSourceBench::sources(&plugin);
+
+        RequestResult r = OtauSourceBench::downloadFile(&plugin, transport, hang1.url(), body);
+        report("timeout", r);
+        check("timeout", r.winner == -1 && !r.stored, "download fails");
+        check("timeout", r.ms >= BENCH_REQUEST_TIMEOUT && r.ms < BENCH_WAIT_LIMIT, "ends after the request timeout");
+        check("timeout", r.cancelled == r.attempts && r.idle, "hanging downloads are cancelled");
+        check("timeout", sources.at(0).failures >= 1 && sources.at(1).failures >= 1, "timed out sources are backed off");
+
+        HttpStandIn ok(ModeOk, BENCH_FAST_DELAY, body);
+        OtauSourceBench::setMirrors(&plugin, {ok.baseUrl()});
+        r = OtauSourceBench::downloadFile(&plugin, transport, hang1.url(), body);
+        report("timeout (next request)", r);
+        check("timeout (next request)", r.winner == 1 && r.stored, "attempt slots are available again");
+    }
+
+    { // consecutive failures back off the source, the plugin retries the file once
+        HttpStandIn error(ModeError, BENCH_FAST_DELAY, body);
+        StdOtauPlugin plugin;
+        BenchDownloadTransport transport;
+        plugin.setTransport(&transport);
+        OtauSourceBench::setMirrors(&plugin, {});
+        const OtauSourceList &sources = OtauSourceBench::sources(&plugin);
+
+        RequestResult r = OtauSourceBench::downloadFile(&plugin, transport, error.url(), body);
+        report("backoff", r);
+        check("backoff", r.winner == -1 && !r.stored && r.idle, "download fails");
+        check("backoff", error.requests() == 2 && sources.at(0).failures == 2, "only backed off source is still tried");
+    }
+
+    printf("%d failed checks\n", failedChecks);
+    return failedChecks;
+}
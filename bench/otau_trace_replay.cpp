@@ -0,0 +1,417 @@
+/*
+ * Replays a trace recorded with --otau-trace into the OTAU server.
+ *
+ * Indications and confirms are fed into StdOtauPlugin at their recorded times in virtual time,
+ * the requests sent by the plugin are compared with the recorded ones. Confirms are matched to
+ * the replayed requests by their position in the per node request sequence.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
+#include <QApplication>
+#include <QDataStream>
+#include <QFile>
+#include <QStandardPaths>
+#include <QStringList>
+#include <deconz/aps.h>
+#include <deconz/zcl.h>
+#include "std_otau_plugin.h"
+#include "otau_file.h"
+#include "otau_model.h"
+#include "otau_node.h"
+#include "otau_trace.h"
+#include "bench_common.h"
+
+#define PAGE_TICK      10 // ms, same as the plugin image page timer
+#define ACTIVITY_TICK  3000 // ms, same as the plugin activity timer
+#define MAX_IDLE_TICKS (60 * 1000) // ms, ticks aren't needed when nothing happens for a longer time
+
+struct ReplayRequest
+{
+    uint8_t id;
+    uint32_t time;
+    QByteArray asdu;
+};
+
+struct ReplayNode
+{
+    std::vector<ReplayRequest> recorded;
+    std::vector<ReplayRequest> replayed;
+    size_t confirmCursor = 0; // position in recorded requests of the last matched confirm
+};
+
+/*! Returns the data size of a successful image block response, 0 for other frames.
+ */
+static unsigned blockDataSize(const QByteArray &asdu)
+{
+    const int zclHeader = 3;
+    const int blockHeader = 1 + 2 + 2 + 4 + 4; // status .. offset
+
+    if (asdu.size() > zclHeader + blockHeader &&
+        uint8_t(asdu[2]) == OTAU_IMAGE_BLOCK_RESPONSE_CMD_ID &&
+        uint8_t(asdu[zclHeader]) == OTAU_SUCCESS)
+    {
+        return uint8_t(asdu[zclHeader + blockHeader]);
+    }
+
+    return 0;
+}
+
+class ReplayTransport : public OtauTransport
+{
+public:
+    explicit ReplayTransport(StdOtauPlugin *plugin) :
+        m_plugin(plugin)
+    {
+        m_baseTime = deCONZ::steadyTimeRef().ref;
+    }
+
+    bool isAvailable() override { return true; }
+    bool otauActive() override { return true; }
+    int getNode(int, const deCONZ::Node **node) override { *node = nullptr; return -1; }
+
+    deCONZ::SteadyTimeRef steadyTime() override
+    {
+        deCONZ::SteadyTimeRef t;
+        t.ref = m_baseTime + m_now;
+        return t;
+    }
+
+    int apsdeDataRequest(const deCONZ::ApsDataRequest &req) override
+    {
+        const quint64 ext = req.dstAddress().hasExt() ? req.dstAddress().ext() : 0;
+        m_nodes[ext].replayed.push_back({req.id(), uint32_t(m_now), req.asdu()});
+        m_blockBytes += blockDataSize(req.asdu());
+        return deCONZ::Success;
+    }
+
+    void load(const std::vector<OtauTraceRecord> &records)
+    {
+        for (const OtauTraceRecord &rec : records)
+        {
+            if (rec.type == OtauTraceRecord::Request)
+            {
+                m_nodes[rec.extAddr].recorded.push_back({rec.id, rec.time, rec.asdu});
+                m_recordedBlockBytes += blockDataSize(rec.asdu);
+            }
+        }
+    }
+
+    void replay(const std::vector<OtauTraceRecord> &records)
+    {
+        const qint64 cpuStart = cpuTimeNs();
+
+        for (const OtauTraceRecord &rec : records)
+        {
+            if (rec.type == OtauTraceRecord::Request)
+            {
+                continue; // produced by the plugin
+            }
+
+            advanceTo(rec.time);
+
+            const qint64 t0 = cpuTimeNs();
+
+            if (rec.type == OtauTraceRecord::Indication)
+            {
+                deCONZ::ApsDataIndication ind;
+                ind.setProfileId(rec.profileId);
+                ind.setClusterId(rec.clusterId);
+                ind.setSrcEndpoint(rec.srcEndpoint);
+                ind.setDstEndpoint(rec.dstEndpoint);
+                ind.srcAddress().setExt(rec.extAddr);
+                ind.srcAddress().setNwk(rec.nwkAddr);
+                ind.setSrcAddressMode(deCONZ::ApsExtAddress);
+                ind.asdu() = rec.asdu;
+
+                m_plugin->apsdeDataIndication(ind);
+                m_indications++;
+                m_indicationCpu.push_back(cpuTimeNs() - t0);
+            }
+            else if (rec.type == OtauTraceRecord::Confirm)
+            {
+                int id = replayedRequestId(rec);
+                if (id < 0)
+                {
+                    m_unmatchedConfirms++;
+                    continue;
+                }
+
+                deCONZ::ApsDataConfirm conf;
+                conf.setId(uint8_t(id));
+                conf.dstAddress().setExt(rec.extAddr);
+                conf.dstAddress().setNwk(rec.nwkAddr);
+                conf.setDstAddressMode(deCONZ::ApsNwkAddress);
+                conf.setDstEndpoint(rec.dstEndpoint);
+                conf.setSrcEndpoint(rec.srcEndpoint);
+                conf.setStatus(rec.status);
+
+                m_plugin->apsdeDataConfirm(conf);
+                m_confirms++;
+                m_confirmCpu.push_back(cpuTimeNs() - t0);
+            }
+        }
+
+        advanceTo(m_now + MAX_IDLE_TICKS); // let paced page responses finish
+        m_cpuNs = cpuTimeNs() - cpuStart;
+    }
+
+    void report(bool json)
+    {
+        quint64 recorded = 0;
+        quint64 replayed = 0;
+        quint64 equal = 0;
+        quint64 diverged = 0;
+        quint64 firstDivergenceExt = 0;
+        int firstDivergenceTime = -1;
+
+        for (const auto &i : m_nodes)
+        {
+            const ReplayNode &n = i.second;
+            recorded += n.recorded.size();
+            replayed += n.replayed.size();
+
+            const size_t count = std::min(n.recorded.size(), n.replayed.size());
+            for (size_t k = 0; k < count; k++)
+            {
+                if (n.recorded[k].asdu == n.replayed[k].asdu)
+                {
+                    equal++;
+                    continue;
+                }
+
+                diverged++;
+                if (firstDivergenceTime < 0 || int(n.recorded[k].time) < firstDivergenceTime)
+                {
+                    firstDivergenceTime = int(n.recorded[k].time);
+                    firstDivergenceExt = i.first;
+                }
+            }
+        }
+
+        const double seconds = qMax<qint64>(m_now, 1) / 1000.0;
+        const qint64 indP50 = percentile(m_indicationCpu, 50);
+        const qint64 indP99 = percentile(m_indicationCpu, 99);
+        const qint64 confP50 = percentile(m_confirmCpu, 50);
+        const qint64 confP99 = percentile(m_confirmCpu, 99);
+
+        if (json)
+        {
+            printf("{\"duration_ms\":%lld,\"indications\":%llu,\"confirms\":%llu,\"unmatched_confirms\":%llu,"
+                   "\"recorded_requests\":%llu,\"replayed_requests\":%llu,\"equal_requests\":%llu,\"diverged_requests\":%llu,"
+                   "\"first_divergence_ms\":%d,\"recorded_block_bytes\":%llu,\"replayed_block_bytes\":%llu,"
+                   "\"recorded_bytes_per_sec\":%.1f,\"replayed_bytes_per_sec\":%.1f,"
+                   "\"indication_cpu_ns_p50\":%lld,\"indication_cpu_ns_p99\":%lld,"
+                   "\"confirm_cpu_ns_p50\":%lld,\"confirm_cpu_ns_p99\":%lld,\"cpu_ms\":%.3f}\n",
+                   (long long)m_now, (unsigned long long)m_indications, (unsigned long long)m_confirms, (unsigned long long)m_unmatchedConfirms,
+                   (unsigned long long)recorded, (unsigned long long)replayed, (unsigned long long)equal, (unsigned long long)diverged,
+                   firstDivergenceTime, (unsigned long long)m_recordedBlockBytes, (unsigned long long)m_blockBytes,
+                   m_recordedBlockBytes / seconds, m_blockBytes / seconds,
+                   (long long)indP50, (long long)indP99, (long long)confP50, (long long)confP99, m_cpuNs / 1e6);
+            return;
+        }
+
+        printf("trace duration:       %lld ms\n", (long long)m_now);
+        printf("replayed:             %llu indications, %llu confirms (%llu without matching request)\n",
+               (unsigned long long)m_indications, (unsigned long long)m_confirms, (unsigned long long)m_unmatchedConfirms);
+        printf("requests:             %llu recorded, %llu replayed, %llu equal, %llu diverged\n",
+               (unsigned long long)recorded, (unsigned long long)replayed, (unsigned long long)equal, (unsigned long long)diverged);
+        if (firstDivergenceTime >= 0)
+        {
+            printf("first divergence:     %d ms, node 0x%016llX\n", firstDivergenceTime, (unsigned long long)firstDivergenceExt);
+        }
+        printf("image block bytes:    %llu recorded (%.1f bytes/s), %llu replayed (%.1f bytes/s)\n",
+               (unsigned long long)m_recordedBlockBytes, m_recordedBlockBytes / seconds, (unsigned long long)m_blockBytes, m_blockBytes / seconds);
+        printf("indication CPU:       p50 %lld ns, p99 %lld ns\n", (long long)indP50, (long long)indP99);
+        printf("confirm CPU:          p50 %lld ns, p99 %lld ns\n", (long long)confP50, (long long)confP99);
+        printf("total CPU:            %.3f ms\n", m_cpuNs / 1e6);
+    }
+
+private:
+    /*! Drives the plugin timers in virtual time up to \p time.
+     */
+    void advanceTo(qint64 time)
+    {
+        if (time - m_now > MAX_IDLE_TICKS)
+        {
+            m_now = time - MAX_IDLE_TICKS;
+        }
+
+        while (m_now + PAGE_TICK <= time)
+        {
+            m_now += PAGE_TICK;
+            m_plugin->imagePageTimerFired();
+
+            if (m_now % ACTIVITY_TICK < PAGE_TICK)
+            {
+                m_plugin->activityTimerFired();
+            }
+        }
+
+        m_now = qMax(m_now, time);
+    }
+
+    /*! Maps the request id of a recorded confirm to the id of the replayed request at the same position.
+        \return the replayed request id, or -1 if there is no such request
+     */
+    int replayedRequestId(const OtauTraceRecord &conf)
+    {
+        ReplayNode &n = m_nodes[conf.extAddr];
+
+        // request ids wrap around, search forward from the last match
+        for (size_t k = n.confirmCursor; k < n.recorded.size(); k++)
+        {
+            if (n.recorded[k].id == conf.id && n.recorded[k].time <= conf.time)
+            {
+                n.confirmCursor = k;
+                return k < n.replayed.size() ? n.replayed[k].id : -1;
+            }
+        }
+
+        return -1;
+    }
+
+    StdOtauPlugin *m_plugin;
+    std::map<quint64, ReplayNode> m_nodes;
+    qint64 m_now = 0;
+    int64_t m_baseTime = 0;
+    quint64 m_indications = 0;
+    quint64 m_confirms = 0;
+    quint64 m_unmatchedConfirms = 0;
+    quint64 m_blockBytes = 0;
+    quint64 m_recordedBlockBytes = 0;
+    qint64 m_cpuNs = 0;
+    std::vector<qint64> m_indicationCpu;
+    std::vector<qint64> m_confirmCpu;
+};
+
+/*! Preloads the images for all nodes which query an image with matching manufacturer code and image type.
+ */
+static void preloadImages(OtauModel *model, const std::vector<OtauTraceRecord> &records, const std::vector<QByteArray> &images)
+{
+    for (const OtauTraceRecord &rec : records)
+    {
+        // ZCL header (3) + field control, manufacturer code, image type
+        if (rec.type != OtauTraceRecord::Indication || rec.clusterId != OTAU_CLUSTER_ID || rec.asdu.size() < 8 ||
+            uint8_t(rec.asdu[2]) != OTAU_QUERY_NEXT_IMAGE_REQUEST_CMD_ID)
+        {
+            continue;
+        }
+
+        const uint16_t mfCode = uint8_t(rec.asdu[4]) | uint8_t(rec.asdu[5]) << 8;
+        const uint16_t imageType = uint8_t(rec.asdu[6]) | uint8_t(rec.asdu[7]) << 8;
+
+        deCONZ::Address addr;
+        addr.setExt(rec.extAddr);
+        addr.setNwk(rec.nwkAddr);
+
+        OtauNode *node = model->getNode(addr, true);
+        if (!node || node->hasData())
+        {
+            continue;
+        }
+
+        for (const QByteArray &image : images)
+        {
+            OtauFile file;
+            if (file.fromArray(image) && file.manufacturerCode == mfCode && file.imageType == imageType)
+            {
+                node->file = file;
+                node->setHasData(true);
+                node->setPermitUpdate(true);
+                break;
+            }
+        }
+    }
+}
+
+static void usage()
+{
+    printf("usage: otau_trace_replay TRACE [options]\n"
+           "  --image FILE   OTA file served to matching nodes, can be repeated\n"
+           "  --json         print results as JSON\n");
+}
+
+int main(int argc, char *argv[])
+{
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+    QStandardPaths::setTestModeEnabled(true); // keep the user's image directories untouched
+
+    QString tracePath;
+    std::vector<QByteArray> images;
+    bool json = false;
+    const QStringList args = app.arguments();
+
+    for (int i = 1; i < args.size(); i++)
+    {
+        const QString &arg = args.at(i);
+
+        if (arg == "--image" && i + 1 < args.size())
+        {
+            QFile f(args.at(++i));
+            if (!f.open(QFile::ReadOnly))
+            {
+                fprintf(stderr, "failed to read %s\n", qPrintable(f.fileName()));
+                return EXIT_FAILURE;
+            }
+            images.push_back(f.readAll());
+        }
+        else if (arg == "--json")
+        {
+            json = true;
+        }
+        else if (tracePath.isEmpty() && !arg.startsWith("--"))
+        {
+            tracePath = arg;
+        }
+        else
+        {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (tracePath.isEmpty())
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    std::vector<OtauTraceRecord> records;
+    {
+        OtauTraceReader reader;
+        if (!reader.open(tracePath))
+        {
+            fprintf(stderr, "%s is not a supported trace\n", qPrintable(tracePath));
+            return EXIT_FAILURE;
+        }
+
+        OtauTraceRecord rec;
+        while (reader.next(&rec))
+        {
+            records.push_back(rec);
+        }
+    }
+
+    StdOtauPlugin plugin;
+    plugin.createWidget(); // holds ACK, page request and spacing settings
+
+    ReplayTransport transport(&plugin);
+    plugin.setTransport(&transport);
+
+    OtauModel *model = plugin.findChild<OtauModel*>();
+    if (model)
+    {
+        preloadImages(model, records, images);
+    }
+
+    transport.load(records);
+    transport.replay(records);
+    transport.report(json);
+
+    plugin.setTransport(nullptr);
+    return EXIT_SUCCESS;
+}
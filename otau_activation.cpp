@@ -0,0 +1,55 @@
+#include <algorithm>
+#include "otau_activation.h"
+
+/*! Assigns the activation time of a node.
+    A node which repeats its upgrade end request keeps its time.
+    \param extAddr - the node
+    \param router - true if the node routes, only routers are limited
+    \param delay - requested seconds until the restart
+    \param nowMs - steady time
+    \return seconds until the restart for the upgrade end response
+ */
+uint32_t OtauActivationScheduler::schedule(uint64_t extAddr, bool router, uint32_t delay, int64_t nowMs)
+{
+    m_activations.erase(std::remove_if(m_activations.begin(), m_activations.end(), [this, nowMs](const Activation &a)
+    {
+        return a.timeMs + m_slotMs < nowMs;
+    }), m_activations.end());
+
+    int64_t timeMs = nowMs + int64_t(delay) * 1000;
+
+    auto i = std::find_if(m_activations.begin(), m_activations.end(), [extAddr](const Activation &a) { return a.extAddr == extAddr; });
+    if (i != m_activations.end())
+    {
+        timeMs = std::max(i->timeMs, nowMs);
+        return static_cast<uint32_t>((timeMs - nowMs + 999) / 1000);
+    }
+
+    if (router && m_maxParallel > 0 && m_slotMs > 0)
+    {
+        while (routersNear(timeMs) >= unsigned(m_maxParallel))
+        {
+            timeMs += m_slotMs;
+        }
+    }
+
+    m_activations.push_back({extAddr, timeMs, router});
+    return static_cast<uint32_t>((timeMs - nowMs + 999) / 1000);
+}
+
+/*! Returns the number of routers which restart less than one slot before or after \p timeMs.
+ */
+unsigned OtauActivationScheduler::routersNear(int64_t timeMs) const
+{
+    return static_cast<unsigned>(std::count_if(m_activations.begin(), m_activations.end(), [this, timeMs](const Activation &a)
+    {
+        return a.router && a.timeMs > timeMs - m_slotMs && a.timeMs < timeMs + m_slotMs;
+    }));
+}
+
+/*! Returns the number of nodes which haven't restarted yet.
+ */
+unsigned OtauActivationScheduler::pending(int64_t nowMs) const
+{
+    return static_cast<unsigned>(std::count_if(m_activations.begin(), m_activations.end(), [nowMs](const Activation &a) { return a.timeMs > nowMs; }));
+}
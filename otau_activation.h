@@ -0,0 +1,38 @@
+#ifndef OTAU_ACTIVATION_H
+#define OTAU_ACTIVATION_H
+
+#include <stdint.h>
+#include <vector>
+
+/*! \class OtauActivationScheduler
+
+    Spreads the switch to the new image of nodes which finished their upgrade.
+
+    Each node gets an activation time for the upgrade end response. Routers are limited to
+    a maximum number of restarts within one restart slot, so that not all routes of a mesh
+    break at once after a campaign wave. End devices don't route and switch at the requested time.
+ */
+class OtauActivationScheduler
+{
+public:
+    void setMaxParallel(int count) { m_maxParallel = count; }
+    void setSlotSeconds(int seconds) { m_slotMs = int64_t(seconds) * 1000; }
+    uint32_t schedule(uint64_t extAddr, bool router, uint32_t delay, int64_t nowMs);
+    unsigned pending(int64_t nowMs) const;
+
+private:
+    struct Activation
+    {
+        uint64_t extAddr;
+        int64_t timeMs; //!< steady time of the restart
+        bool router;
+    };
+
+    unsigned routersNear(int64_t timeMs) const;
+
+    std::vector<Activation> m_activations;
+    int m_maxParallel = 0; //!< routers restarting within one slot, 0 for unlimited
+    int64_t m_slotMs = 30 * 1000; //!< time a router needs to restart and rejoin
+};
+
+#endif // OTAU_ACTIVATION_H
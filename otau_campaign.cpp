@@ -0,0 +1,330 @@
+#include <algorithm>
+#include <deconz/dbg_trace.h>
+#include "otau_campaign.h"
+#include "otau_node.h"
+
+#define NOTIFY_RETRIES        3
+
+bool OtauCampaignConfig::operator==(const OtauCampaignConfig &o) const
+{
+    return enabled == o.enabled &&
+           manufacturerCode == o.manufacturerCode &&
+           imageType == o.imageType &&
+           minVersion == o.minVersion &&
+           maxVersion == o.maxVersion &&
+           waveSize == o.waveSize &&
+           concurrency == o.concurrency &&
+           notifySpacingMs == o.notifySpacingMs &&
+           windowStart == o.windowStart &&
+           windowEnd == o.windowEnd &&
+           haltFailures == o.haltFailures;
+}
+
+/*! Starts a campaign for all nodes which match the target.
+    \param config - the campaign definition
+    \param nodes - candidate nodes, the caller filters nodes for which no newer image exists
+    \param nowMs - steady time
+ */
+void OtauCampaign::start(const OtauCampaignConfig &config, const std::vector<OtauNode*> &nodes, int64_t nowMs)
+{
+    m_config = config;
+    m_members.clear();
+    m_wave = 0;
+    m_lastNotify = 0;
+
+    for (OtauNode *node : nodes)
+    {
+        if (node->manufacturerId != config.manufacturerCode ||
+            node->imageType() != config.imageType ||
+            node->softwareVersion() < config.minVersion ||
+            node->softwareVersion() > config.maxVersion)
+        {
+            continue;
+        }
+
+        Member m;
+        m.extAddr = node->address().ext();
+        m.startVersion = node->softwareVersion();
+        m.stateTime = nowMs;
+        m_members.push_back(m);
+    }
+
+    // deterministic order, so that a restarted campaign has the same waves
+    std::sort(m_members.begin(), m_members.end(), [](const Member &a, const Member &b) { return a.extAddr < b.extAddr; });
+
+    m_state = m_members.empty() ? StateDone : StateRunning;
+
+    DBG_Printf(DBG_OTA, "OTAU: campaign mfcode: 0x%04X, img type: 0x%04X, versions 0x%08X-0x%08X, %u nodes in %d waves\n",
+               config.manufacturerCode, config.imageType, config.minVersion, config.maxVersion, size(), waveCount());
+}
+
+void OtauCampaign::stop()
+{
+    m_state = StateIdle;
+    m_members.clear();
+    m_wave = 0;
+}
+
+/*! Updates the member states and returns the next node to notify.
+    \param nodes - all OTAU nodes
+    \param nowMs - steady time
+    \param hour - local hour 0..23 for the maintenance window
+    \return the node which should get an image notify now, or nullptr
+ */
+OtauNode *OtauCampaign::tick(const std::vector<OtauNode*> &nodes, int64_t nowMs, int hour)
+{
+    if (m_state == StateIdle || m_state == StateDone)
+    {
+        return nullptr;
+    }
+
+    for (Member &m : m_members)
+    {
+        auto i = std::find_if(nodes.begin(), nodes.end(), [&m](OtauNode *n) { return n->address().hasExt() && n->address().ext() == m.extAddr; });
+        if (i != nodes.end())
+        {
+            updateMember(m, *i, nowMs);
+        }
+    }
+
+    const size_t waveSize = static_cast<size_t>(std::max(1, m_config.waveSize));
+    const size_t waveBegin = static_cast<size_t>(m_wave) * waveSize;
+    const size_t waveEnd = std::min(waveBegin + waveSize, m_members.size());
+
+    int active = 0;
+    int finished = 0;
+    int failed = 0;
+    Member *next = nullptr;
+    Member *nextPermit = nullptr;
+
+    for (size_t i = waveBegin; i < waveEnd; i++)
+    {
+        Member &m = m_members[i];
+        switch (m.state)
+        {
+        case MemberNotified:
+        case MemberTransferring:
+            active++;
+            break;
+
+        case MemberDone:
+            finished++;
+            break;
+
+        case MemberFailed:
+            finished++;
+            failed++;
+            break;
+
+        case MemberPending:
+            if (m.notify && !next)
+            {
+                next = &m;
+            }
+            else if (!m.notify && !m.permitted && !nextPermit)
+            {
+                nextPermit = &m;
+            }
+            break;
+        }
+    }
+
+    if (m_config.haltFailures > 0 && failed >= m_config.haltFailures)
+    {
+        if (m_state != StateHalted)
+        {
+            DBG_Printf(DBG_OTA, "OTAU: campaign halted, %d failed nodes in wave %d\n", failed, m_wave + 1);
+            m_state = StateHalted;
+        }
+        return nullptr;
+    }
+
+    if (finished == int(waveEnd - waveBegin))
+    {
+        if (waveEnd >= m_members.size())
+        {
+            DBG_Printf(DBG_OTA, "OTAU: campaign done, %u updated, %u failed\n", count(MemberDone), count(MemberFailed));
+            m_state = StateDone;
+            return nullptr;
+        }
+
+        m_wave++;
+        DBG_Printf(DBG_OTA, "OTAU: campaign start wave %d of %d\n", m_wave + 1, waveCount());
+        return nullptr; // admit the new wave with the next tick
+    }
+
+    if (!inWindow(hour))
+    {
+        m_state = StateWaitWindow;
+        return nullptr;
+    }
+
+    m_state = StateRunning;
+
+    if (nextPermit)
+    {
+        auto i = std::find_if(nodes.begin(), nodes.end(), [nextPermit](OtauNode *n) { return n->address().hasExt() && n->address().ext() == nextPermit->extAddr; });
+        if (i != nodes.end())
+        {
+            DBG_Printf(DBG_OTA, "OTAU: campaign permits " FMT_MAC ", waiting for its query\n", FMT_MAC_CAST(nextPermit->extAddr));
+            nextPermit->permitted = true;
+            return *i;
+        }
+    }
+
+    if (!next || active >= std::max(1, m_config.concurrency))
+    {
+        return nullptr;
+    }
+
+    if (m_lastNotify != 0 && nowMs - m_lastNotify < m_config.notifySpacingMs)
+    {
+        return nullptr;
+    }
+
+    auto i = std::find_if(nodes.begin(), nodes.end(), [next](OtauNode *n) { return n->address().hasExt() && n->address().ext() == next->extAddr; });
+    if (i == nodes.end())
+    {
+        setMemberState(*next, MemberFailed, nowMs); // node is gone
+        return nullptr;
+    }
+
+    next->attempts++;
+    setMemberState(*next, MemberNotified, nowMs);
+    m_lastNotify = nowMs;
+    return *i;
+}
+
+/*! Derives the member state from the node.
+ */
+void OtauCampaign::updateMember(Member &m, OtauNode *node, int64_t nowMs)
+{
+    if (m.state == MemberDone || m.state == MemberFailed)
+    {
+        return;
+    }
+
+    // the outcome of a transfer is recorded by transferEnd(), the node fields may be left from an earlier transfer
+    if (node->softwareVersion() > m.startVersion)
+    {
+        setMemberState(m, MemberDone, nowMs);
+        return;
+    }
+
+    m.notify = node->transferProfile().unicastNotify; // the device class may be learned during the campaign
+
+    if (m.state == MemberPending)
+    {
+        if (m.permitted && node->status() == OtauNode::StatusUploading)
+        {
+            m.attempts++; // stalled transfers count like unanswered notifies
+            setMemberState(m, MemberTransferring, nowMs); // queried on its own
+        }
+    }
+    else if (m.state == MemberNotified)
+    {
+        if (node->status() == OtauNode::StatusUploading)
+        {
+            setMemberState(m, MemberTransferring, nowMs);
+        }
+        else if (nowMs - m.stateTime > node->transferProfile().startTimeoutMs)
+        {
+            setMemberState(m, m.attempts >= NOTIFY_RETRIES ? MemberFailed : MemberPending, nowMs);
+        }
+    }
+    else if (m.state == MemberTransferring)
+    {
+        const bool stalled = !isValid(node->lastActivity) || nowMs - node->lastActivity.ref > node->transferProfile().stallTimeoutMs;
+
+        if (node->state() == OtauNode::NodeAbort || stalled)
+        {
+            m.permitted = false;
+            setMemberState(m, m.attempts >= NOTIFY_RETRIES ? MemberFailed : MemberPending, nowMs);
+        }
+    }
+}
+
+/*! Records the end of a transfer of a member which was notified or is transferring.
+    \param extAddr - the node
+    \param success - true if the node reported a successful upgrade end
+    \param nowMs - steady time
+ */
+void OtauCampaign::transferEnd(uint64_t extAddr, bool success, int64_t nowMs)
+{
+    for (Member &m : m_members)
+    {
+        if (m.extAddr == extAddr && (m.state == MemberNotified || m.state == MemberTransferring))
+        {
+            setMemberState(m, success ? MemberDone : MemberFailed, nowMs);
+        }
+    }
+}
+
+void OtauCampaign::setMemberState(Member &m, MemberState state, int64_t nowMs)
+{
+    if (m.state != state)
+    {
+        DBG_Printf(DBG_OTA, "OTAU: campaign node " FMT_MAC " state %d -> %d\n", FMT_MAC_CAST(m.extAddr), m.state, state);
+        m.state = state;
+    }
+    m.stateTime = nowMs;
+}
+
+/*! Returns true if new transfers may be started at \p hour.
+ */
+bool OtauCampaign::inWindow(int hour) const
+{
+    if (m_config.windowStart == m_config.windowEnd)
+    {
+        return true;
+    }
+
+    if (m_config.windowStart < m_config.windowEnd)
+    {
+        return hour >= m_config.windowStart && hour < m_config.windowEnd;
+    }
+
+    return hour >= m_config.windowStart || hour < m_config.windowEnd; // wraps midnight
+}
+
+bool OtauCampaign::isMember(uint64_t extAddr) const
+{
+    return std::any_of(m_members.begin(), m_members.end(), [extAddr](const Member &m) { return m.extAddr == extAddr; });
+}
+
+/*! Returns true if the node is a member which isn't done or failed yet.
+ */
+bool OtauCampaign::isUnfinished(uint64_t extAddr) const
+{
+    return std::any_of(m_members.begin(), m_members.end(), [extAddr](const Member &m)
+    {
+        return m.extAddr == extAddr && m.state != MemberDone && m.state != MemberFailed;
+    });
+}
+
+int OtauCampaign::waveCount() const
+{
+    const size_t waveSize = static_cast<size_t>(std::max(1, m_config.waveSize));
+    return static_cast<int>((m_members.size() + waveSize - 1) / waveSize);
+}
+
+unsigned OtauCampaign::count(MemberState state) const
+{
+    return static_cast<unsigned>(std::count_if(m_members.begin(), m_members.end(), [state](const Member &m) { return m.state == state; }));
+}
+
+const char *OtauCampaign::stateName(State state)
+{
+    switch (state)
+    {
+    case StateIdle: return "idle";
+    case StateRunning: return "running";
+    case StateWaitWindow: return "wait_window";
+    case StateHalted: return "halted";
+    case StateDone: return "done";
+    default:
+        break;
+    }
+
+    return "unknown";
+}
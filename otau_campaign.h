@@ -0,0 +1,100 @@
+#ifndef OTAU_CAMPAIGN_H
+#define OTAU_CAMPAIGN_H
+
+#include <stdint.h>
+#include <vector>
+
+struct OtauNode;
+
+/*! Definition of a rollout campaign, read from the otau/campaign-* settings.
+ */
+struct OtauCampaignConfig
+{
+    bool enabled = false;
+    uint16_t manufacturerCode = 0;
+    uint16_t imageType = 0;
+    uint32_t minVersion = 0; //!< nodes running a version in [minVersion, maxVersion] are updated
+    uint32_t maxVersion = 0xFFFFFFFF;
+    int waveSize = 10; //!< nodes per wave, the next wave starts when all transfers of a wave finished
+    int concurrency = 4; //!< max. notified or transferring nodes
+    int notifySpacingMs = 2000; //!< min. time between two unicast image notifies
+    int windowStart = 0; //!< hour 0..23 from which new transfers are started
+    int windowEnd = 0; //!< hour 0..23, equal to windowStart for no restriction
+    int haltFailures = 0; //!< failed nodes in a wave which halt the campaign, 0 to never halt
+
+    bool operator==(const OtauCampaignConfig &o) const;
+    bool operator!=(const OtauCampaignConfig &o) const { return !(*this == o); }
+};
+
+/*! \class OtauCampaign
+
+    Rolls out an image to a set of nodes in waves.
+
+    The nodes of a wave are notified one after another by unicast image notify, paced by the
+    notify spacing and limited by the concurrency. A node which doesn't start its transfer is
+    notified again, after NOTIFY_RETRIES attempts it counts as failed. Running transfers continue
+    outside the maintenance window, only new ones aren't started.
+
+    Sleepy end devices would miss the notify, they are only permitted to update and stay pending
+    without taking a slot until they query on their own schedule.
+ */
+class OtauCampaign
+{
+public:
+    enum State
+    {
+        StateIdle,
+        StateRunning,
+        StateWaitWindow, //!< outside the maintenance window
+        StateHalted, //!< too many failures in a wave
+        StateDone
+    };
+
+    enum MemberState
+    {
+        MemberPending,
+        MemberNotified,
+        MemberTransferring,
+        MemberDone,
+        MemberFailed
+    };
+
+    struct Member
+    {
+        uint64_t extAddr = 0;
+        uint32_t startVersion = 0; //!< version when the campaign started
+        MemberState state = MemberPending;
+        int attempts = 0; //!< image notifies sent, or transfers started by nodes without notify
+        int64_t stateTime = 0; //!< steady time of the last state change or notify
+        bool notify = true; //!< false for nodes which don't get unicast image notifies
+        bool permitted = false; //!< update permitted without notify, waiting for the node to query
+    };
+
+    void start(const OtauCampaignConfig &config, const std::vector<OtauNode*> &nodes, int64_t nowMs);
+    void stop();
+    OtauNode *tick(const std::vector<OtauNode*> &nodes, int64_t nowMs, int hour);
+    void transferEnd(uint64_t extAddr, bool success, int64_t nowMs);
+
+    State state() const { return m_state; }
+    static const char *stateName(State state);
+    const OtauCampaignConfig &config() const { return m_config; }
+    bool isMember(uint64_t extAddr) const;
+    bool isUnfinished(uint64_t extAddr) const;
+    int wave() const { return m_wave; }
+    int waveCount() const;
+    unsigned count(MemberState state) const;
+    unsigned size() const { return static_cast<unsigned>(m_members.size()); }
+
+private:
+    bool inWindow(int hour) const;
+    void updateMember(Member &m, OtauNode *node, int64_t nowMs);
+    void setMemberState(Member &m, MemberState state, int64_t nowMs);
+
+    State m_state = StateIdle;
+    OtauCampaignConfig m_config;
+    std::vector<Member> m_members;
+    int m_wave = 0;
+    int64_t m_lastNotify = 0;
+};
+
+#endif // OTAU_CAMPAIGN_H
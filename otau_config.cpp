@@ -0,0 +1,109 @@
+#include <QDateTime>
+#include <QFileInfo>
+#include <QSettings>
+#include <deconz/dbg_trace.h>
+#include "otau_config.h"
+
+#define FAST_PAGE_SPACEING 25
+#define MIN_PAGE_SPACEING 20
+#define MAX_PAGE_SPACEING 3000
+#define DEFAULT_RESTART_TIME 5
+#define DEFAULT_MAX_PARALLEL_RESTARTS 2
+#define DEFAULT_RESTART_SLOT 30 // seconds
+#define DEFAULT_MAX_PER_PARENT 1
+#define DEFAULT_MAX_PER_BRANCH 2
+
+static uint32_t toNumber(const QSettings &config, const char *key, uint32_t defaultValue)
+{
+    bool ok = false;
+    // base 0 accepts hex values like 0x115F
+    const uint32_t val = config.value(key).toString().toUInt(&ok, 0);
+    return ok ? val : defaultValue;
+}
+
+/*! Reads the settings and remembers the file for reloading.
+    Missing keys are written with their default values, so that they can be edited.
+    \param path - the deCONZ configuration file
+ */
+void OtauConfig::load(const QString &path)
+{
+    QSettings config(path, QSettings::IniFormat);
+    bool ok = false;
+
+    m_path = path;
+
+    m_packetSpacingMs = FAST_PAGE_SPACEING;
+    if (config.contains("otau/fast-page-spacing"))
+    {
+        int sp = config.value("otau/fast-page-spacing", FAST_PAGE_SPACEING).toInt(&ok);
+        if (ok && sp >= MIN_PAGE_SPACEING && sp < MAX_PAGE_SPACEING)
+        {
+            m_packetSpacingMs = sp;
+        }
+    }
+
+    if (!ok)
+    {
+        config.setValue("otau/fast-page-spacing", m_packetSpacingMs);
+    }
+
+    m_acksEnabled = config.value("otau/acks-enabled", false).toBool();
+    m_pageRequestEnabled = config.value("otau/page-request-enabled", true).toBool();
+
+    // negative for no automatic restart
+    const int restart = config.value("otau/restart-time", DEFAULT_RESTART_TIME).toInt(&ok);
+    m_restartTime = !ok ? DEFAULT_RESTART_TIME : restart < 0 ? OTAU_UNLIMITED_RESTART_TIME : uint32_t(restart);
+
+    m_maxParallelRestarts = int(toNumber(config, "otau/max-parallel-restarts", DEFAULT_MAX_PARALLEL_RESTARTS));
+    m_restartSlotSeconds = int(toNumber(config, "otau/restart-slot", DEFAULT_RESTART_SLOT));
+    m_maxTransfersPerParent = int(toNumber(config, "otau/max-per-parent", DEFAULT_MAX_PER_PARENT));
+    m_maxTransfersPerBranch = int(toNumber(config, "otau/max-per-branch", DEFAULT_MAX_PER_BRANCH));
+
+    loadCampaign(config);
+
+    config.sync();
+    m_mtime = QFileInfo(path).lastModified().toMSecsSinceEpoch();
+}
+
+/*! Reloads the settings if the configuration file was modified since the last load.
+    \return true if the settings were reloaded
+ */
+bool OtauConfig::reloadIfChanged()
+{
+    if (m_path.isEmpty())
+    {
+        return false;
+    }
+
+    const qint64 mtime = QFileInfo(m_path).lastModified().toMSecsSinceEpoch();
+    if (mtime == m_mtime)
+    {
+        return false;
+    }
+
+    load(m_path);
+    DBG_Printf(DBG_OTA, "OTAU: reloaded settings, acks: %d, page requests: %d, spacing: %d ms, restart time: %u\n",
+               m_acksEnabled, m_pageRequestEnabled, m_packetSpacingMs, m_restartTime);
+    return true;
+}
+
+/*! Reads the rollout campaign, the campaign is disabled unless otau/campaign-enabled is set.
+ */
+void OtauConfig::loadCampaign(QSettings &config)
+{
+    OtauCampaignConfig c;
+
+    c.enabled = config.value("otau/campaign-enabled", false).toBool();
+    c.manufacturerCode = uint16_t(toNumber(config, "otau/campaign-manufacturer", 0));
+    c.imageType = uint16_t(toNumber(config, "otau/campaign-image-type", 0));
+    c.minVersion = toNumber(config, "otau/campaign-min-version", c.minVersion);
+    c.maxVersion = toNumber(config, "otau/campaign-max-version", c.maxVersion);
+    c.waveSize = int(toNumber(config, "otau/campaign-wave-size", uint32_t(c.waveSize)));
+    c.concurrency = int(toNumber(config, "otau/campaign-concurrency", uint32_t(c.concurrency)));
+    c.notifySpacingMs = int(toNumber(config, "otau/campaign-notify-spacing", uint32_t(c.notifySpacingMs)));
+    c.windowStart = int(toNumber(config, "otau/campaign-window-start", 0) % 24);
+    c.windowEnd = int(toNumber(config, "otau/campaign-window-end", 0) % 24);
+    c.haltFailures = int(toNumber(config, "otau/campaign-halt-failures", 0));
+
+    m_campaign = c;
+}
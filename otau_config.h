@@ -0,0 +1,55 @@
+#ifndef OTAU_CONFIG_H
+#define OTAU_CONFIG_H
+
+#include <stdint.h>
+#include <QString>
+#include "otau_campaign.h"
+
+class QSettings;
+
+#define OTAU_UNLIMITED_RESTART_TIME 0xFFFFFFFFUL // node waits for an explicit upgrade command
+
+/*! \class OtauConfig
+
+    Transfer settings of the OTAU server, stored under otau/ in the deCONZ configuration.
+
+    The settings are reloaded when the configuration file changes. The widget is only a view
+    which changes the values at runtime, the server doesn't depend on it.
+ */
+class OtauConfig
+{
+public:
+    void load(const QString &path);
+    bool reloadIfChanged();
+
+    bool acksEnabled() const { return m_acksEnabled; }
+    void setAcksEnabled(bool enabled) { m_acksEnabled = enabled; }
+    bool pageRequestEnabled() const { return m_pageRequestEnabled; }
+    void setPageRequestEnabled(bool enabled) { m_pageRequestEnabled = enabled; }
+    int packetSpacingMs() const { return m_packetSpacingMs; }
+    void setPacketSpacingMs(int spacing) { m_packetSpacingMs = spacing; }
+    uint32_t restartTime() const { return m_restartTime; }
+    void setRestartTime(uint32_t seconds) { m_restartTime = seconds; }
+    int maxParallelRestarts() const { return m_maxParallelRestarts; }
+    int restartSlotSeconds() const { return m_restartSlotSeconds; }
+    int maxTransfersPerParent() const { return m_maxTransfersPerParent; }
+    int maxTransfersPerBranch() const { return m_maxTransfersPerBranch; }
+    const OtauCampaignConfig &campaign() const { return m_campaign; }
+
+private:
+    void loadCampaign(QSettings &config);
+
+    QString m_path;
+    qint64 m_mtime = 0;
+    bool m_acksEnabled = false; //!< APS ACKs for image page responses
+    bool m_pageRequestEnabled = true;
+    int m_packetSpacingMs = 0; //!< min. spacing of image page responses
+    uint32_t m_restartTime = 5; //!< seconds after upgrade end until the node switches to the new image
+    int m_maxParallelRestarts = 2; //!< routers switching to the new image within one restart slot, 0 for unlimited
+    int m_restartSlotSeconds = 30;
+    int m_maxTransfersPerParent = 1; //!< end devices served through the same parent, 0 for unlimited
+    int m_maxTransfersPerBranch = 2; //!< transfers routed through the same router next to the coordinator, 0 for unlimited
+    OtauCampaignConfig m_campaign;
+};
+
+#endif // OTAU_CONFIG_H
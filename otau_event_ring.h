@@ -0,0 +1,194 @@
+#ifndef OTAU_EVENT_RING_H
+#define OTAU_EVENT_RING_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define OTAU_EVENT_RING_SIZE 2048 // entries, must be a power of two
+#define OTAU_EVENT_MAX_ASDU  82 // longer frames are truncated
+#define OTAU_EVENT_MAGIC     "OTAUEVT"
+#define OTAU_EVENT_VERSION   1
+
+enum OtauEventType
+{
+    OtauEventRx = 1, //!< indication received from a node
+    OtauEventTx = 2, //!< request sent to a node
+    OtauEventConfirm = 3 //!< confirm of a request, status is the APS status
+};
+
+/*! One OTA protocol event, fixed size so that dumps can be decoded offline.
+    Command, sequence number, offset and size are derived from the ZCL frame when recorded.
+ */
+struct OtauEvent
+{
+    uint32_t seq; //!< ring position + 1, 0 for an empty entry
+    uint32_t timeMs; //!< ms since the ring was created
+    uint64_t extAddr;
+    uint32_t offset; //!< image offset of block and page requests and block responses
+    uint16_t nwkAddr;
+    uint16_t profileId;
+    uint16_t clusterId;
+    uint8_t type; //!< OtauEventType
+    uint8_t commandId; //!< ZCL command id
+    uint8_t status; //!< ZCL status of responses, APS status of confirms
+    uint8_t zclSeq;
+    uint8_t size; //!< data size of block responses, max. data size of requests
+    uint8_t apsId; //!< APS request id of requests and confirms
+    uint8_t srcEndpoint;
+    uint8_t dstEndpoint;
+    uint8_t asduLength;
+    uint8_t reserved;
+    uint8_t asdu[OTAU_EVENT_MAX_ASDU];
+};
+
+/*! Header of an event ring dump, followed by count entries, oldest first.
+    All values are little endian.
+ */
+struct OtauEventDumpHeader
+{
+    char magic[7];
+    uint8_t version;
+    uint32_t entrySize;
+    uint32_t count;
+    int64_t created; //!< ms since epoch
+};
+
+/*! \class OtauEventRing
+
+    Fixed size ring buffer of OTA protocol events.
+
+    Recording is a copy into the next slot, there is no formatting and no allocation.
+    There is a single writer, the plugin in the main thread. A snapshot can be taken without
+    locking, entries which are overwritten while copying are detected by their sequence number.
+ */
+class OtauEventRing
+{
+public:
+    OtauEventRing()
+    {
+        memset(m_events, 0, sizeof(m_events));
+    }
+
+    /*! Records an event.
+        \param ev - filled address, endpoint, type, status and time fields
+        \param asdu - the ZCL frame, can be nullptr
+        \param len - length of asdu
+     */
+    void record(const OtauEvent &ev, const uint8_t *asdu, unsigned len)
+    {
+        const uint32_t n = m_head.load(std::memory_order_relaxed);
+        OtauEvent &e = m_events[n & (OTAU_EVENT_RING_SIZE - 1)];
+
+        e.seq = 0; // invalid while being written
+        std::atomic_thread_fence(std::memory_order_release);
+
+        memcpy(&e, &ev, offsetof(OtauEvent, asdu));
+        e.seq = 0;
+        e.asduLength = static_cast<uint8_t>(len < OTAU_EVENT_MAX_ASDU ? len : OTAU_EVENT_MAX_ASDU);
+        if (asdu && e.asduLength)
+        {
+            memcpy(e.asdu, asdu, e.asduLength);
+            if (e.clusterId == 0x0019) // OTAU cluster
+            {
+                decodeZcl(e);
+            }
+        }
+
+        std::atomic_thread_fence(std::memory_order_release);
+        e.seq = n + 1;
+        m_head.store(n + 1, std::memory_order_release);
+    }
+
+    /*! Copies the recorded events, oldest first.
+        \param out - destination with space for OTAU_EVENT_RING_SIZE entries
+        \return the number of copied events
+     */
+    unsigned snapshot(OtauEvent *out) const
+    {
+        const uint32_t head = m_head.load(std::memory_order_acquire);
+        const uint32_t first = head > OTAU_EVENT_RING_SIZE ? head - OTAU_EVENT_RING_SIZE : 0;
+        unsigned count = 0;
+
+        for (uint32_t n = first; n < head; n++)
+        {
+            const OtauEvent &e = m_events[n & (OTAU_EVENT_RING_SIZE - 1)];
+            out[count] = e;
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (out[count].seq == n + 1 && e.seq == n + 1)
+            {
+                count++;
+            }
+        }
+
+        return count;
+    }
+
+    uint32_t recorded() const { return m_head.load(std::memory_order_relaxed); }
+
+private:
+    /*! Fills command, sequence number, status, offset and size from the ZCL frame.
+     */
+    static void decodeZcl(OtauEvent &e)
+    {
+        const uint8_t *zcl = e.asdu;
+        const unsigned hdr = (zcl[0] & 0x04) ? 5 : 3; // manufacturer specific frames have a 2 byte code
+        if (e.asduLength < hdr)
+        {
+            return;
+        }
+
+        e.zclSeq = zcl[hdr - 2];
+        e.commandId = zcl[hdr - 1];
+
+        const uint8_t *pl = zcl + hdr;
+        const unsigned plen = e.asduLength - hdr;
+
+        if ((zcl[0] & 0x03) != 0x01) // not a cluster command
+        {
+            return;
+        }
+
+        switch (e.commandId)
+        {
+        case 0x03: // image block request
+        case 0x04: // image page request
+            if (plen >= 14)
+            {
+                e.offset = pl[9] | pl[10] << 8 | pl[11] << 16 | uint32_t(pl[12]) << 24;
+                e.size = pl[13];
+            }
+            break;
+
+        case 0x05: // image block response
+            if (plen >= 1 && e.type == OtauEventTx)
+            {
+                e.status = pl[0];
+                if (pl[0] == 0x00 && plen >= 14)
+                {
+                    e.offset = pl[9] | pl[10] << 8 | pl[11] << 16 | uint32_t(pl[12]) << 24;
+                    e.size = pl[13];
+                }
+            }
+            break;
+
+        case 0x02: // query next image response
+        case 0x06: // upgrade end request
+            if (plen >= 1)
+            {
+                e.status = pl[0];
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    std::atomic<uint32_t> m_head{0};
+    OtauEvent m_events[OTAU_EVENT_RING_SIZE];
+};
+
+#endif // OTAU_EVENT_RING_H
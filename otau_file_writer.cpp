@@ -0,0 +1,166 @@
+#include <cstring>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <deconz/dbg_trace.h>
+#include "otau_file_writer.h"
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*! Returns true if the file at \p path has exactly the content \p data.
+ */
+static bool fileContentEquals(const QString &path, const QByteArray &data)
+{
+    QFile f(path);
+
+    if (f.size() != data.size() || !f.open(QFile::ReadOnly))
+    {
+        return false;
+    }
+
+    const int chunkSize = 64 * 1024;
+    qint64 pos = 0;
+
+    while (pos < data.size())
+    {
+        const QByteArray chunk = f.read(chunkSize);
+        if (chunk.isEmpty() || memcmp(chunk.constData(), data.constData() + pos, chunk.size()) != 0)
+        {
+            return false;
+        }
+        pos += chunk.size();
+    }
+
+    return f.atEnd();
+}
+
+/*! Writes a file if its content differs from \p data.
+    The file is replaced atomically, a crash leaves either the old or the new content.
+    \param path - the file path
+    \param data - the new content
+    \param cause - reason of the write for the byte counters
+    \return true if the file has the new content afterwards, also if the write was skipped
+ */
+bool OtauFileWriter::writeFile(const QString &path, const QByteArray &data, OtauWriteCause cause)
+{
+    Counters &cnt = m_counters[cause];
+
+    if (fileContentEquals(path, data))
+    {
+        cnt.skipped++;
+        cnt.bytesSkipped += data.size();
+        return true;
+    }
+
+    QSaveFile f(path);
+    if (!f.open(QFile::WriteOnly))
+    {
+        DBG_Printf(DBG_OTA, "OTAU: failed to open %s: %s\n", qPrintable(path), qPrintable(f.errorString()));
+        return false;
+    }
+
+    if (f.write(data) != data.size() || !f.flush())
+    {
+        f.cancelWriting();
+        f.commit();
+        return false;
+    }
+
+#ifdef Q_OS_UNIX
+    // not deferred in a batch, the renamed file must be visible right away (e.g. to the index scan)
+    ::fsync(f.handle()); // data must be durable before the rename
+#endif
+
+    if (!f.commit())
+    {
+        DBG_Printf(DBG_OTA, "OTAU: failed to write %s: %s\n", qPrintable(path), qPrintable(f.errorString()));
+        return false;
+    }
+
+    cnt.writes++;
+    cnt.bytesWritten += data.size();
+
+    DBG_Printf(DBG_OTA, "OTAU: wrote %s (%d bytes), %s total: %llu bytes written, %llu bytes skipped\n",
+               qPrintable(path), data.size(), causeName(cause), cnt.bytesWritten, cnt.bytesSkipped);
+
+    const QString dir = QFileInfo(path).absolutePath();
+
+    if (m_batchLevel > 0)
+    {
+        if (!m_pendingDirs.contains(dir))
+        {
+            m_pendingDirs.append(dir);
+        }
+    }
+    else
+    {
+        syncDirectory(dir);
+    }
+
+    return true;
+}
+
+/*! Starts a batch, directory syncs are deferred until endBatch().
+    Batches can be nested.
+ */
+void OtauFileWriter::beginBatch()
+{
+    m_batchLevel++;
+}
+
+/*! Ends a batch and syncs all directories which were written to.
+ */
+void OtauFileWriter::endBatch()
+{
+    if (m_batchLevel > 0)
+    {
+        m_batchLevel--;
+    }
+
+    if (m_batchLevel == 0)
+    {
+        for (const QString &dir : m_pendingDirs)
+        {
+            syncDirectory(dir);
+        }
+        m_pendingDirs.clear();
+    }
+}
+
+/*! Returns a short name of the write cause.
+ */
+const char *OtauFileWriter::causeName(OtauWriteCause cause)
+{
+    switch (cause)
+    {
+    case OtauWriteLocalIndex: return "local_index";
+    case OtauWriteRemoteIndex: return "remote_index";
+    case OtauWriteImage: return "image";
+    case OtauWriteJournal: return "journal";
+    case OtauWriteEvents: return "events";
+    case OtauWriteInventory: return "inventory";
+    default:
+        break;
+    }
+
+    return "unknown";
+}
+
+/*! Makes renames in a directory durable.
+ */
+void OtauFileWriter::syncDirectory(const QString &dir)
+{
+#ifdef Q_OS_UNIX
+    int fd = ::open(QFile::encodeName(dir).constData(), O_RDONLY);
+    if (fd >= 0)
+    {
+        ::fsync(fd);
+        ::close(fd);
+    }
+#else
+    Q_UNUSED(dir);
+#endif
+}
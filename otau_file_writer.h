@@ -0,0 +1,55 @@
+#ifndef OTAU_FILE_WRITER_H
+#define OTAU_FILE_WRITER_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+
+/*! Reason for a file write, used to account written bytes.
+ */
+enum OtauWriteCause
+{
+    OtauWriteLocalIndex,
+    OtauWriteRemoteIndex,
+    OtauWriteImage,
+    OtauWriteJournal,
+    OtauWriteEvents,
+    OtauWriteInventory,
+
+    OtauWriteCauseCount
+};
+
+/*! \class OtauFileWriter
+
+    Writes files with minimal flash wear.
+
+    A file is only written if its content changed. Updates are atomic by writing a temporary
+    file which is renamed over the old one. The directory sync which makes the rename durable
+    is deferred to the end of a batch, so that multiple writes share one sync.
+ */
+class OtauFileWriter
+{
+public:
+    struct Counters
+    {
+        quint64 bytesWritten = 0;
+        quint64 bytesSkipped = 0; //!< bytes not written since the content was unchanged
+        unsigned writes = 0;
+        unsigned skipped = 0;
+    };
+
+    bool writeFile(const QString &path, const QByteArray &data, OtauWriteCause cause);
+    void beginBatch();
+    void endBatch();
+    const Counters &counters(OtauWriteCause cause) const { return m_counters[cause]; }
+    static const char *causeName(OtauWriteCause cause);
+
+private:
+    void syncDirectory(const QString &dir);
+
+    int m_batchLevel = 0;
+    QStringList m_pendingDirs; //!< directories to sync at the end of the batch
+    Counters m_counters[OtauWriteCauseCount];
+};
+
+#endif // OTAU_FILE_WRITER_H
@@ -0,0 +1,136 @@
+#include "otau_health.h"
+
+#define MIN_CONFIRMS           20 // below this the failure rate isn't meaningful
+#define THROTTLE_FAILURE_PCT   15
+#define PAUSE_FAILURE_PCT      30
+#define THROTTLE_LATENCY_MS    400
+#define PAUSE_LATENCY_MS       1500
+#define PAUSE_QUEUE_FULL       3
+#define RECOVER_HOLD_MS        (10 * 1000) // the network must be better this long before OTA speeds up again
+
+/*! Returns the bucket of the current second, old buckets are reset on reuse.
+ */
+OtauConfirmHealth::Bucket &OtauConfirmHealth::bucket(int64_t nowMs)
+{
+    const int64_t second = nowMs / 1000;
+    Bucket &b = m_buckets[static_cast<size_t>(second % OTAU_HEALTH_BUCKETS)];
+
+    if (b.second != second)
+    {
+        b = Bucket();
+        b.second = second;
+    }
+
+    return b;
+}
+
+/*! Counts a confirm of any APS request.
+ */
+void OtauConfirmHealth::addConfirm(int64_t nowMs, bool success)
+{
+    Bucket &b = bucket(nowMs);
+    b.confirms++;
+    if (!success)
+    {
+        b.failures++;
+    }
+}
+
+/*! Counts the request to confirm latency of an OTA request.
+ */
+void OtauConfirmHealth::addLatency(int64_t nowMs, int64_t us)
+{
+    Bucket &b = bucket(nowMs);
+    b.latencyCount++;
+    b.latencySumUs += us;
+}
+
+/*! Counts a request which was rejected by the APS layer.
+ */
+void OtauConfirmHealth::addQueueFull(int64_t nowMs)
+{
+    bucket(nowMs).queueFull++;
+}
+
+/*! Returns the level the current window asks for.
+ */
+OtauConfirmHealth::Level OtauConfirmHealth::measure(int64_t nowMs)
+{
+    const int64_t second = nowMs / 1000;
+    uint32_t confirms = 0;
+    uint32_t failures = 0;
+    uint32_t queueFull = 0;
+    uint32_t latencyCount = 0;
+    int64_t latencySumUs = 0;
+
+    for (const Bucket &b : m_buckets)
+    {
+        if (b.second < 0 || second - b.second >= OTAU_HEALTH_BUCKETS)
+        {
+            continue;
+        }
+
+        confirms += b.confirms;
+        failures += b.failures;
+        queueFull += b.queueFull;
+        latencyCount += b.latencyCount;
+        latencySumUs += b.latencySumUs;
+    }
+
+    m_failurePercent = confirms >= MIN_CONFIRMS ? failures * 100 / confirms : 0;
+    m_latencyMs = latencyCount > 0 ? static_cast<unsigned>(latencySumUs / latencyCount / 1000) : 0;
+    m_queueFull = queueFull;
+
+    if (m_failurePercent >= PAUSE_FAILURE_PCT || m_latencyMs >= PAUSE_LATENCY_MS || m_queueFull >= PAUSE_QUEUE_FULL)
+    {
+        return LevelPause;
+    }
+
+    if (m_failurePercent >= THROTTLE_FAILURE_PCT || m_latencyMs >= THROTTLE_LATENCY_MS || m_queueFull > 0)
+    {
+        return LevelThrottle;
+    }
+
+    return LevelOk;
+}
+
+/*! Returns the name of a level for the VFS.
+ */
+const char *OtauConfirmHealth::levelName(Level level)
+{
+    switch (level)
+    {
+    case LevelOk: return "ok";
+    case LevelThrottle: return "throttle";
+    case LevelPause: return "pause";
+    default:
+        break;
+    }
+
+    return "unknown";
+}
+
+/*! Evaluates the window, a worse level applies at once, a better one after RECOVER_HOLD_MS.
+    \return the level to apply
+ */
+OtauConfirmHealth::Level OtauConfirmHealth::update(int64_t nowMs)
+{
+    const Level measured = measure(nowMs);
+
+    if (measured >= m_level)
+    {
+        m_level = measured;
+        m_betterSince = 0;
+    }
+    else if (m_betterSince == 0)
+    {
+        m_betterSince = nowMs;
+    }
+    else if (nowMs - m_betterSince >= RECOVER_HOLD_MS)
+    {
+        m_level = measured;
+        m_betterSince = 0;
+    }
+
+    return m_level;
+}
@@ -0,0 +1,60 @@
+#ifndef OTAU_HEALTH_H
+#define OTAU_HEALTH_H
+
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+
+#define OTAU_HEALTH_BUCKETS 30 // one second each
+
+/*! \class OtauConfirmHealth
+
+    Rolling window of the APS confirms of all traffic, not only OTA.
+
+    Failed confirms of any traffic, the confirm latency of OTA requests and rejected requests
+    (full APS queue) are counted per second. When the network degrades OTA first slows down
+    and then pauses, it resumes after the window was healthy for a while.
+ */
+class OtauConfirmHealth
+{
+public:
+    enum Level
+    {
+        LevelOk,
+        LevelThrottle, //!< OTA pacing is stretched
+        LevelPause //!< no OTA data is sent
+    };
+
+    void addConfirm(int64_t nowMs, bool success);
+    void addLatency(int64_t nowMs, int64_t us);
+    void addQueueFull(int64_t nowMs);
+    Level update(int64_t nowMs);
+    static const char *levelName(Level level);
+    Level level() const { return m_level; }
+    unsigned failurePercent() const { return m_failurePercent; }
+    unsigned latencyMs() const { return m_latencyMs; }
+    unsigned queueFull() const { return m_queueFull; }
+
+private:
+    struct Bucket
+    {
+        int64_t second = -1;
+        uint32_t confirms = 0;
+        uint32_t failures = 0;
+        uint32_t queueFull = 0;
+        uint32_t latencyCount = 0;
+        int64_t latencySumUs = 0;
+    };
+
+    Bucket &bucket(int64_t nowMs);
+    Level measure(int64_t nowMs);
+
+    std::array<Bucket, OTAU_HEALTH_BUCKETS> m_buckets{};
+    Level m_level = LevelOk;
+    int64_t m_betterSince = 0; //!< steady time since the measured level is below the current one
+    unsigned m_failurePercent = 0;
+    unsigned m_latencyMs = 0;
+    unsigned m_queueFull = 0;
+};
+
+#endif // OTAU_HEALTH_H
@@ -0,0 +1,573 @@
+#include <algorithm>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <deconz/dbg_trace.h>
+#include <deconz/u_sha512.h>
+#include "otau_file.h"
+#include "otau_image_store.h"
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#endif
+
+// files written by the downloader: mfcode-imagetype-version-sha512prefix.zigbee
+#define DOWNLOAD_FILE_PATTERN "^[0-9A-Fa-f]{4}-[0-9A-Fa-f]{4}-[0-9A-Fa-f]{8}-[0-9A-Fa-f]{6}\\.zigbee$"
+
+/*! Creates a hard link \p dst to \p src.
+    \return true on success, false if not supported or failed (e.g. different file systems)
+ */
+static bool linkFile(const QString &src, const QString &dst)
+{
+#ifdef Q_OS_UNIX
+    return ::link(QFile::encodeName(src).constData(), QFile::encodeName(dst).constData()) == 0;
+#else
+    Q_UNUSED(src);
+    Q_UNUSED(dst);
+    return false;
+#endif
+}
+
+/*! Returns the number of hard links of a file, 1 if not supported by the platform.
+ */
+static quint64 linkCount(const QString &path)
+{
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (::stat(QFile::encodeName(path).constData(), &st) == 0)
+    {
+        return st.st_nlink;
+    }
+#else
+    Q_UNUSED(path);
+#endif
+    return 1;
+}
+
+/*! Sets the directory of the store, it is created if it doesn't exist.
+    \param path - the store directory, empty to disable the store
+ */
+void OtauImageStore::setStorePath(const QString &path)
+{
+    m_storePath = path.isEmpty() ? QString() : QDir::cleanPath(QDir(path).absolutePath());
+
+    if (!m_storePath.isEmpty())
+    {
+        QDir dir(m_storePath);
+        if (!dir.exists() && !dir.mkpath(m_storePath))
+        {
+            DBG_Printf(DBG_OTA, "OTAU: failed to create image store %s\n", qPrintable(m_storePath));
+            m_storePath.clear();
+        }
+    }
+}
+
+/*! Scans the store and the image directories and rebuilds the list of images.
+    Duplicates in the image directories are replaced by hard links to the store object,
+    store objects without any link left are removed.
+    \param dirs - the image directories
+ */
+void OtauImageStore::scan(const QStringList &dirs)
+{
+    std::vector<FileState> files;
+    QStringList allDirs;
+    QElapsedTimer timer;
+
+    timer.start();
+    m_entries.clear();
+    m_stats = {};
+
+    if (!m_storePath.isEmpty())
+    {
+        allDirs.append(m_storePath); // first, so that store objects are known when processing the links
+    }
+
+    allDirs += dirs;
+
+    for (const QString &dir : allDirs)
+    {
+        const bool isStore = !m_storePath.isEmpty() && dir == m_storePath;
+        const QFileInfoList ls = QDir(dir).entryInfoList(QDir::Files, QDir::Name);
+
+        for (const QFileInfo &fi : ls)
+        {
+            FileState fs;
+
+            if (!statFile(fi.absoluteFilePath(), &fs))
+            {
+                continue;
+            }
+
+            if (!lookupCached(files, &fs) && !lookupCached(m_files, &fs) && !readFile(&fs))
+            {
+                continue;
+            }
+
+            if (addFile(&fs, isStore))
+            {
+                files.push_back(fs);
+                m_stats.files++;
+            }
+        }
+    }
+
+    m_files = files;
+    removeOrphans();
+
+    for (OtauImageEntry &e : m_entries)
+    {
+        e.path = e.aliases.isEmpty() ? e.storePath : e.aliases.first();
+    }
+
+    m_stats.enumerateNs = timer.nsecsElapsed() - m_stats.readNs - m_stats.parseNs - m_stats.hashNs;
+
+    DBG_Printf(DBG_OTA, "OTAU: image store: %d images in %d files, %d hashed, %d linked (%d kB saved)\n",
+               int(m_entries.size()), m_stats.files, m_stats.hashed, m_stats.linked, int(m_stats.savedBytes / 1024));
+}
+
+/*! Returns the image with the given SHA-512 hash or nullptr if not known.
+ */
+const OtauImageEntry *OtauImageStore::findBySha512(const QByteArray &sha512) const
+{
+    for (const OtauImageEntry &e : m_entries)
+    {
+        if (e.sha512 == sha512)
+        {
+            return &e;
+        }
+    }
+
+    return nullptr;
+}
+
+/*! Returns the size in bytes of all distinct images, as counted against the disk budget.
+    Aliases and the store object of an image share their data and count once.
+ */
+qint64 OtauImageStore::totalSize() const
+{
+    qint64 total = 0;
+
+    for (const OtauImageEntry &e : m_entries)
+    {
+        total += e.fileSize;
+    }
+
+    return total;
+}
+
+/*! Queries file system meta data of a regular file.
+    \return false if the file doesn't exist or isn't a regular file
+ */
+bool OtauImageStore::statFile(const QString &path, FileState *fs) const
+{
+    fs->path = path;
+
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (::stat(QFile::encodeName(path).constData(), &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        return false;
+    }
+
+    fs->size = st.st_size;
+    fs->mtime = st.st_mtime;
+    fs->device = st.st_dev;
+    fs->inode = st.st_ino;
+#else
+    QFileInfo fi(path);
+    if (!fi.isFile())
+    {
+        return false;
+    }
+
+    fs->size = fi.size();
+    fs->mtime = fi.lastModified().toMSecsSinceEpoch();
+    fs->device = 0;
+    fs->inode = 0;
+#endif
+
+    return true;
+}
+
+/*! Reads, parses and hashes an image file.
+    \return false if the file isn't a valid OTA file
+ */
+bool OtauImageStore::readFile(FileState *fs)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QFile file(fs->path);
+    if (!file.open(QFile::ReadOnly))
+    {
+        return false;
+    }
+
+    const QByteArray arr = file.readAll();
+    m_stats.readNs += timer.nsecsElapsed();
+    if (arr.isEmpty())
+    {
+        return false;
+    }
+
+    timer.restart();
+    OtauFile of;
+    of.path = QFileInfo(fs->path).fileName();
+    const bool ok = of.fromArray(arr);
+    m_stats.parseNs += timer.nsecsElapsed();
+    if (!ok)
+    {
+        return false;
+    }
+
+    fs->image.manufacturerCode = of.manufacturerCode;
+    fs->image.imageType = of.imageType;
+    fs->image.fileVersion = of.fileVersion;
+    fs->image.fileSize = static_cast<uint32_t>(arr.size());
+    timer.restart();
+    fs->image.sha512.resize(U_SHA512_HASH_SIZE);
+    U_Sha512(arr.constData(), arr.size(), reinterpret_cast<uint8_t*>(fs->image.sha512.data()));
+    m_stats.hashNs += timer.nsecsElapsed();
+    m_stats.hashed++;
+
+    return true;
+}
+
+/*! Looks up the image data of a file which was already hashed.
+    A file is known if it is the same inode with unchanged size and modification time,
+    on platforms without inodes the path is compared instead.
+    \return true if found, the image data is copied into \p fs
+ */
+bool OtauImageStore::lookupCached(const std::vector<FileState> &files, FileState *fs) const
+{
+    for (const FileState &f : files)
+    {
+        if (f.size != fs->size || f.mtime != fs->mtime)
+        {
+            continue;
+        }
+
+        if (fs->inode != 0 ? (f.inode == fs->inode && f.device == fs->device) : f.path == fs->path)
+        {
+            fs->image = f.image;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*! Adds a scanned file to the image list and links it to the store.
+    \param fs - the file, path and inode are updated if the file was moved or replaced by a link
+    \param isStore - true if the file is a store object
+    \return false if the file was dropped
+ */
+bool OtauImageStore::addFile(FileState *fs, bool isStore)
+{
+    const QString objPath = storeObjectPath(fs->image.sha512);
+
+    if (isStore && fs->path != objPath)
+    {
+        // content doesn't match the name, e.g. modified in place through one of its links
+        if (QFile::exists(objPath) || !QFile::rename(fs->path, objPath))
+        {
+            QFile::remove(fs->path); // other links keep the data
+            return false;
+        }
+
+        fs->path = objPath;
+    }
+
+    OtauImageEntry *e = entry(fs->image.sha512);
+
+    if (!e)
+    {
+        m_entries.push_back(fs->image);
+        e = &m_entries.back();
+        e->path.clear();
+        e->storePath.clear();
+        e->aliases.clear();
+    }
+
+    if (isStore)
+    {
+        e->storePath = fs->path;
+        return true;
+    }
+
+    if (!m_storePath.isEmpty())
+    {
+        if (e->storePath.isEmpty())
+        {
+            if (!QFile::exists(objPath) && linkFile(fs->path, objPath))
+            {
+                e->storePath = objPath;
+            }
+        }
+        else
+        {
+            FileState obj;
+            if (statFile(e->storePath, &obj) && (obj.inode != fs->inode || obj.device != fs->device))
+            {
+                replaceWithLink(e->storePath, fs);
+            }
+        }
+    }
+
+    e->aliases.append(fs->path);
+    return true;
+}
+
+/*! Atomically replaces a duplicate file by a hard link to \p target.
+    \return true on success
+ */
+bool OtauImageStore::replaceWithLink(const QString &target, FileState *fs)
+{
+#ifdef Q_OS_UNIX
+    const QString tmp = fs->path + QLatin1String(".tmp");
+    QFile::remove(tmp);
+
+    if (!linkFile(target, tmp))
+    {
+        return false;
+    }
+
+    if (::rename(QFile::encodeName(tmp).constData(), QFile::encodeName(fs->path).constData()) != 0)
+    {
+        QFile::remove(tmp);
+        return false;
+    }
+
+    m_stats.linked++;
+    m_stats.savedBytes += fs->size;
+    DBG_Printf(DBG_OTA, "OTAU: replaced duplicate %s by link to %s\n", qPrintable(fs->path), qPrintable(target));
+
+    FileState st;
+    if (statFile(fs->path, &st))
+    {
+        fs->size = st.size;
+        fs->mtime = st.mtime;
+        fs->device = st.device;
+        fs->inode = st.inode;
+    }
+
+    return true;
+#else
+    Q_UNUSED(target);
+    Q_UNUSED(fs);
+    return false;
+#endif
+}
+
+/*! Removes store objects which have no link in any directory anymore.
+ */
+void OtauImageStore::removeOrphans()
+{
+    for (auto i = m_entries.begin(); i != m_entries.end(); )
+    {
+        if (i->aliases.isEmpty() && !i->storePath.isEmpty() && linkCount(i->storePath) <= 1)
+        {
+            DBG_Printf(DBG_OTA, "OTAU: remove unreferenced image %s\n", qPrintable(i->storePath));
+            QFile::remove(i->storePath);
+
+            const QString path = i->storePath;
+            m_files.erase(std::remove_if(m_files.begin(), m_files.end(), [&path](const FileState &f) { return f.path == path; }), m_files.end());
+            i = m_entries.erase(i);
+        }
+        else
+        {
+            ++i;
+        }
+    }
+}
+
+/*! Removes superseded images according to the retention policy.
+    Per manufacturer code and image type the newest versions are kept, older ones are removed
+    until the disk budget is met. Pinned images, the newest version of each image type and
+    images which weren't written by the downloader are never removed.
+    \param policy - the retention rules
+    \return the number of images which still should be removed in a later run
+ */
+int OtauImageStore::collectGarbage(const OtauRetentionPolicy &policy)
+{
+    struct Candidate
+    {
+        QByteArray sha512;
+        qint64 size;
+        int rank; //!< 0 = newest version of its image type
+        uint32_t fileVersion;
+    };
+
+    std::vector<Candidate> candidates;
+    qint64 total = totalSize();
+
+    for (const OtauImageEntry &e : m_entries)
+    {
+        int rank = 0;
+        for (const OtauImageEntry &o : m_entries)
+        {
+            if (o.manufacturerCode == e.manufacturerCode && o.imageType == e.imageType && o.fileVersion > e.fileVersion)
+            {
+                rank++;
+            }
+        }
+
+        if (rank == 0 || isPinned(e, policy) || !isRemovable(e))
+        {
+            continue;
+        }
+
+        candidates.push_back({e.sha512, e.fileSize, rank, e.fileVersion});
+    }
+
+    // oldest versions first
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b)
+    {
+        return a.rank != b.rank ? a.rank > b.rank : a.fileVersion < b.fileVersion;
+    });
+
+    std::vector<QByteArray> victims;
+
+    for (const Candidate &c : candidates)
+    {
+        if (c.rank >= policy.keepVersions || (policy.diskBudget > 0 && total > policy.diskBudget))
+        {
+            victims.push_back(c.sha512);
+            total -= c.size;
+        }
+    }
+
+    int removed = 0;
+    for (const QByteArray &sha512 : victims)
+    {
+        if (removed >= policy.maxRemovePerRun)
+        {
+            break;
+        }
+
+        removeImage(sha512);
+        removed++;
+    }
+
+    if (policy.diskBudget > 0 && total > policy.diskBudget)
+    {
+        DBG_Printf(DBG_OTA, "OTAU: images exceed disk budget by %d kB\n", int((total - policy.diskBudget) / 1024));
+    }
+
+    return static_cast<int>(victims.size()) - removed;
+}
+
+/*! Returns the "MMMM-IIII-VVVVVVVV" key of an image as used for pinning.
+ */
+QString OtauImageStore::imageKey(uint16_t manufacturerCode, uint16_t imageType, uint32_t fileVersion)
+{
+    return QString("%1-%2-%3").arg(manufacturerCode, 4, 16, QLatin1Char('0'))
+                              .arg(imageType, 4, 16, QLatin1Char('0'))
+                              .arg(fileVersion, 8, 16, QLatin1Char('0')).toUpper();
+}
+
+/*! Returns true if the image is pinned by key or SHA-512 prefix.
+ */
+bool OtauImageStore::isPinned(const OtauImageEntry &e, const OtauRetentionPolicy &policy) const
+{
+    if (policy.pinned.isEmpty())
+    {
+        return false;
+    }
+
+    const QString key = imageKey(e.manufacturerCode, e.imageType, e.fileVersion);
+    const QString sha = QString::fromLatin1(e.sha512.toHex());
+
+    for (const QString &pin : policy.pinned)
+    {
+        if (pin.compare(key, Qt::CaseInsensitive) == 0)
+        {
+            return true;
+        }
+
+        if (pin.size() >= 8 && sha.startsWith(pin, Qt::CaseInsensitive))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*! Returns true if all files of the image were written by the downloader.
+    Files provided by the user are never removed.
+ */
+bool OtauImageStore::isRemovable(const OtauImageEntry &e) const
+{
+    static const QRegularExpression re(QLatin1String(DOWNLOAD_FILE_PATTERN));
+
+    for (const QString &alias : e.aliases)
+    {
+        if (!re.match(QFileInfo(alias).fileName()).hasMatch())
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*! Removes an image with all its links and the store object.
+ */
+void OtauImageStore::removeImage(const QByteArray &sha512)
+{
+    auto i = std::find_if(m_entries.begin(), m_entries.end(), [&sha512](const OtauImageEntry &e) { return e.sha512 == sha512; });
+
+    if (i == m_entries.end())
+    {
+        return;
+    }
+
+    DBG_Printf(DBG_OTA, "OTAU: remove superseded image %s\n", qPrintable(imageKey(i->manufacturerCode, i->imageType, i->fileVersion)));
+
+    QStringList files = i->aliases;
+    if (!i->storePath.isEmpty())
+    {
+        files.append(i->storePath);
+    }
+
+    for (const QString &path : files)
+    {
+        QFile::remove(path);
+        m_files.erase(std::remove_if(m_files.begin(), m_files.end(), [&path](const FileState &f) { return f.path == path; }), m_files.end());
+    }
+
+    m_entries.erase(i);
+}
+
+/*! Returns the path of the store object for a given hash.
+ */
+QString OtauImageStore::storeObjectPath(const QByteArray &sha512) const
+{
+    if (m_storePath.isEmpty())
+    {
+        return QString();
+    }
+
+    return m_storePath + '/' + QString::fromLatin1(sha512.toHex()) + QLatin1String(".zigbee");
+}
+
+/*! Returns the image with the given hash or nullptr if not known.
+ */
+OtauImageEntry *OtauImageStore::entry(const QByteArray &sha512)
+{
+    for (OtauImageEntry &e : m_entries)
+    {
+        if (e.sha512 == sha512)
+        {
+            return &e;
+        }
+    }
+
+    return nullptr;
+}
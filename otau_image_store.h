@@ -0,0 +1,96 @@
+#ifndef OTAU_IMAGE_STORE_H
+#define OTAU_IMAGE_STORE_H
+
+#include <stdint.h>
+#include <vector>
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+
+/*! An OTA image known to the store, identified by the SHA-512 of its content.
+ */
+struct OtauImageEntry
+{
+    QString path; //!< store object or first file if the store isn't available
+    QString storePath; //!< store object, empty if not stored
+    QStringList aliases; //!< files in the image directories with this content
+    QByteArray sha512; //!< 64 byte hash
+    uint16_t manufacturerCode = 0;
+    uint16_t imageType = 0;
+    uint32_t fileVersion = 0;
+    uint32_t fileSize = 0;
+};
+
+/*! Rules which images are kept when collecting garbage.
+ */
+struct OtauRetentionPolicy
+{
+    int keepVersions = 3; //!< newest versions kept per manufacturer code and image type
+    qint64 diskBudget = 0; //!< max. bytes of all images, 0 for no limit
+    int maxRemovePerRun = 4; //!< limits the work done per index update
+    QStringList pinned; //!< never removed, "MMMM-IIII-VVVVVVVV" or a SHA-512 hex prefix
+};
+
+/*! \class OtauImageStore
+
+    Content addressed on-disk store of OTA images.
+
+    Each distinct image is kept once as <store>/<sha512>.zigbee, files with the same content
+    in the image directories are hard links to the store object. Files are only read and hashed
+    if they weren't seen before, either in a previous scan or as another link to the same inode.
+ */
+class OtauImageStore
+{
+public:
+    struct Stats
+    {
+        int files = 0; //!< scanned image files
+        int hashed = 0; //!< files which had to be read and hashed
+        int linked = 0; //!< duplicates replaced by a link to the store object
+        qint64 savedBytes = 0; //!< disk space freed by deduplication
+        qint64 enumerateNs = 0; //!< directory listing, stat and link handling
+        qint64 readNs = 0; //!< reading files which had to be hashed
+        qint64 parseNs = 0; //!< OTA header parsing
+        qint64 hashNs = 0; //!< SHA-512 hashing
+    };
+
+    void setStorePath(const QString &path);
+    const QString &storePath() const { return m_storePath; }
+    void scan(const QStringList &dirs);
+    const std::vector<OtauImageEntry> &entries() const { return m_entries; }
+    const OtauImageEntry *findBySha512(const QByteArray &sha512) const;
+    qint64 totalSize() const;
+    const Stats &stats() const { return m_stats; }
+    int collectGarbage(const OtauRetentionPolicy &policy);
+    static QString imageKey(uint16_t manufacturerCode, uint16_t imageType, uint32_t fileVersion);
+
+private:
+    struct FileState
+    {
+        QString path;
+        qint64 size = 0;
+        qint64 mtime = 0;
+        quint64 device = 0;
+        quint64 inode = 0; //!< 0 if not supported by the platform
+        OtauImageEntry image; //!< header data and hash of the content
+    };
+
+    bool statFile(const QString &path, FileState *fs) const;
+    bool readFile(FileState *fs);
+    bool lookupCached(const std::vector<FileState> &files, FileState *fs) const;
+    bool addFile(FileState *fs, bool isStore);
+    bool replaceWithLink(const QString &target, FileState *fs);
+    void removeOrphans();
+    void removeImage(const QByteArray &sha512);
+    bool isPinned(const OtauImageEntry &e, const OtauRetentionPolicy &policy) const;
+    bool isRemovable(const OtauImageEntry &e) const;
+    QString storeObjectPath(const QByteArray &sha512) const;
+    OtauImageEntry *entry(const QByteArray &sha512);
+
+    QString m_storePath;
+    std::vector<OtauImageEntry> m_entries;
+    std::vector<FileState> m_files; //!< result of the last scan, used as cache
+    Stats m_stats;
+};
+
+#endif // OTAU_IMAGE_STORE_H
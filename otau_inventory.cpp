@@ -0,0 +1,97 @@
+#include "otau_inventory.h"
+#include "otau_node.h"
+
+#define INVENTORY_HEADER    "# otau inventory 2"
+#define INVENTORY_HEADER_V1 "# otau inventory 1" // receiver on when idle instead of the device class
+
+/*! Serializes the entries.
+    Lines have the format: ext nwk mfcode imagetype swversion hwversion endpoint profile deviceclass lastseen
+    (hex except deviceclass and lastseen, deviceclass is 'u' for unknown, 'r' for router and 'e' for end device).
+ */
+QByteArray OtauInventory::serialize(const std::vector<OtauInventoryEntry> &entries)
+{
+    QByteArray data(INVENTORY_HEADER "\n");
+
+    for (const OtauInventoryEntry &e : entries)
+    {
+        data += QByteArray::number(qulonglong(e.extAddr), 16).rightJustified(16, '0');
+        data += ' ';
+        data += QByteArray::number(e.nwkAddr, 16).rightJustified(4, '0');
+        data += ' ';
+        data += QByteArray::number(e.manufacturerCode, 16).rightJustified(4, '0');
+        data += ' ';
+        data += QByteArray::number(e.imageType, 16).rightJustified(4, '0');
+        data += ' ';
+        data += QByteArray::number(e.swVersion, 16).rightJustified(8, '0');
+        data += ' ';
+        data += QByteArray::number(e.hwVersion, 16).rightJustified(4, '0');
+        data += ' ';
+        data += QByteArray::number(e.endpoint, 16).rightJustified(2, '0');
+        data += ' ';
+        data += QByteArray::number(e.profileId, 16).rightJustified(4, '0');
+        data += ' ';
+        data += e.deviceClass == OtauNode::DeviceRouter ? 'r' : e.deviceClass == OtauNode::DeviceEndDevice ? 'e' : 'u';
+        data += ' ';
+        data += QByteArray::number(qlonglong(e.lastSeen));
+        data += '\n';
+    }
+
+    return data;
+}
+
+/*! Parses an inventory, malformed lines are skipped.
+    Version 1 stored the receiver on when idle flag, which was also set for nodes without
+    node descriptor, so only sleepy nodes keep their device class.
+    \return false if the data isn't an inventory
+ */
+bool OtauInventory::parse(const QByteArray &data, std::vector<OtauInventoryEntry> *entries)
+{
+    const QList<QByteArray> lines = data.split('\n');
+
+    if (lines.isEmpty())
+    {
+        return false;
+    }
+
+    const bool v1 = lines.first().trimmed() == INVENTORY_HEADER_V1;
+    if (!v1 && lines.first().trimmed() != INVENTORY_HEADER)
+    {
+        return false;
+    }
+
+    for (int i = 1; i < lines.size(); i++)
+    {
+        const QList<QByteArray> f = lines.at(i).trimmed().split(' ');
+        if (f.size() != 10)
+        {
+            continue;
+        }
+
+        bool ok[9];
+        OtauInventoryEntry e;
+        e.extAddr = f.at(0).toULongLong(&ok[0], 16);
+        e.nwkAddr = f.at(1).toUShort(&ok[1], 16);
+        e.manufacturerCode = f.at(2).toUShort(&ok[2], 16);
+        e.imageType = f.at(3).toUShort(&ok[3], 16);
+        e.swVersion = f.at(4).toUInt(&ok[4], 16);
+        e.hwVersion = f.at(5).toUShort(&ok[5], 16);
+        e.endpoint = static_cast<uint8_t>(f.at(6).toUShort(&ok[6], 16));
+        e.profileId = f.at(7).toUShort(&ok[7], 16);
+        if (v1)
+        {
+            e.deviceClass = f.at(8) == "0" ? OtauNode::DeviceEndDevice : OtauNode::DeviceUnknown;
+        }
+        else
+        {
+            e.deviceClass = f.at(8) == "r" ? OtauNode::DeviceRouter : f.at(8) == "e" ? OtauNode::DeviceEndDevice : OtauNode::DeviceUnknown;
+        }
+        e.lastSeen = f.at(9).toLongLong(&ok[8]);
+
+        if (ok[0] && ok[1] && ok[2] && ok[3] && ok[4] && ok[5] && ok[6] && ok[7] && ok[8] && e.extAddr != 0)
+        {
+            entries->push_back(e);
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,38 @@
+#ifndef OTAU_INVENTORY_H
+#define OTAU_INVENTORY_H
+
+#include <stdint.h>
+#include <vector>
+#include <QByteArray>
+
+/*! OTA relevant description of a node as last seen.
+ */
+struct OtauInventoryEntry
+{
+    uint64_t extAddr = 0;
+    uint16_t nwkAddr = 0;
+    uint16_t manufacturerCode = 0;
+    uint16_t imageType = 0;
+    uint32_t swVersion = 0;
+    uint16_t hwVersion = 0xFFFF;
+    uint8_t endpoint = 0xFF;
+    uint16_t profileId = 0;
+    int deviceClass = 0; //!< OtauNode::DeviceClass, 0 if unknown
+    int64_t lastSeen = 0; //!< seconds since epoch, rounded to OTAU_INVENTORY_SEEN_GRANULARITY
+};
+
+#define OTAU_INVENTORY_SEEN_GRANULARITY 3600 // seconds, coarse so that frequent queries don't rewrite the file
+
+/*! \class OtauInventory
+
+    Text serialization of all known OTAU nodes, one line per node, used to populate
+    the model at startup before the nodes query again.
+ */
+class OtauInventory
+{
+public:
+    static QByteArray serialize(const std::vector<OtauInventoryEntry> &entries);
+    static bool parse(const QByteArray &data, std::vector<OtauInventoryEntry> *entries);
+};
+
+#endif // OTAU_INVENTORY_H
@@ -0,0 +1,73 @@
+#include "otau_journal.h"
+
+#define JOURNAL_HEADER "# otau journal 1"
+
+/*! Serializes the entries.
+    Lines have the format: ext mfcode imagetype fileversion swversion offset permit sha512 (hex except offset and permit).
+ */
+QByteArray OtauJournal::serialize(const std::vector<OtauJournalEntry> &entries)
+{
+    QByteArray data(JOURNAL_HEADER "\n");
+
+    for (const OtauJournalEntry &e : entries)
+    {
+        data += QByteArray::number(qulonglong(e.extAddr), 16).rightJustified(16, '0');
+        data += ' ';
+        data += QByteArray::number(e.manufacturerCode, 16).rightJustified(4, '0');
+        data += ' ';
+        data += QByteArray::number(e.imageType, 16).rightJustified(4, '0');
+        data += ' ';
+        data += QByteArray::number(e.fileVersion, 16).rightJustified(8, '0');
+        data += ' ';
+        data += QByteArray::number(e.swVersion, 16).rightJustified(8, '0');
+        data += ' ';
+        data += QByteArray::number(e.offset);
+        data += ' ';
+        data += e.permitUpdate ? '1' : '0';
+        data += ' ';
+        data += e.sha512.toHex();
+        data += '\n';
+    }
+
+    return data;
+}
+
+/*! Parses a journal, malformed lines are skipped.
+    \return false if the data isn't a journal
+ */
+bool OtauJournal::parse(const QByteArray &data, std::vector<OtauJournalEntry> *entries)
+{
+    const QList<QByteArray> lines = data.split('\n');
+
+    if (lines.isEmpty() || lines.first().trimmed() != JOURNAL_HEADER)
+    {
+        return false;
+    }
+
+    for (int i = 1; i < lines.size(); i++)
+    {
+        const QList<QByteArray> f = lines.at(i).trimmed().split(' ');
+        if (f.size() != 8 || f.at(7).size() != 128)
+        {
+            continue;
+        }
+
+        bool ok[6];
+        OtauJournalEntry e;
+        e.extAddr = f.at(0).toULongLong(&ok[0], 16);
+        e.manufacturerCode = f.at(1).toUShort(&ok[1], 16);
+        e.imageType = f.at(2).toUShort(&ok[2], 16);
+        e.fileVersion = f.at(3).toUInt(&ok[3], 16);
+        e.swVersion = f.at(4).toUInt(&ok[4], 16);
+        e.offset = f.at(5).toUInt(&ok[5]);
+        e.permitUpdate = f.at(6) == "1";
+        e.sha512 = QByteArray::fromHex(f.at(7));
+
+        if (ok[0] && ok[1] && ok[2] && ok[3] && ok[4] && ok[5] && e.extAddr != 0)
+        {
+            entries->push_back(e);
+        }
+    }
+
+    return true;
+}
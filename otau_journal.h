@@ -0,0 +1,34 @@
+#ifndef OTAU_JOURNAL_H
+#define OTAU_JOURNAL_H
+
+#include <stdint.h>
+#include <vector>
+#include <QByteArray>
+
+/*! Transfer state of one node, enough to continue serving it after a restart.
+ */
+struct OtauJournalEntry
+{
+    uint64_t extAddr = 0;
+    uint16_t manufacturerCode = 0;
+    uint16_t imageType = 0;
+    uint32_t fileVersion = 0; //!< version of the image being transferred
+    uint32_t swVersion = 0; //!< version running on the node
+    uint32_t offset = 0; //!< last requested offset
+    bool permitUpdate = false;
+    QByteArray sha512; //!< 64 byte digest of the image file
+};
+
+/*! \class OtauJournal
+
+    Text serialization of the active and permitted transfers, one line per node.
+    The image is referenced by its digest, so that a renamed or moved file is still found.
+ */
+class OtauJournal
+{
+public:
+    static QByteArray serialize(const std::vector<OtauJournalEntry> &entries);
+    static bool parse(const QByteArray &data, std::vector<OtauJournalEntry> *entries);
+};
+
+#endif // OTAU_JOURNAL_H
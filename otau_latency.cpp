@@ -0,0 +1,114 @@
+#include "otau_latency.h"
+
+#define SUB_COUNT (1 << OTAU_LATENCY_SUB_BITS)
+
+/*! Returns the most significant bit of \p v, v must be non zero.
+ */
+static unsigned msb(uint32_t v)
+{
+    unsigned n = 0;
+    while (v >>= 1)
+    {
+        n++;
+    }
+    return n;
+}
+
+/*! Returns the bucket index of a value, values below SUB_COUNT have their own bucket.
+ */
+static unsigned bucketIndex(uint32_t v)
+{
+    if (v < SUB_COUNT)
+    {
+        return v;
+    }
+
+    const unsigned k = msb(v);
+    const unsigned shift = k - OTAU_LATENCY_SUB_BITS;
+    return ((k - OTAU_LATENCY_SUB_BITS + 1) << OTAU_LATENCY_SUB_BITS) + (v >> shift) - SUB_COUNT;
+}
+
+/*! Returns the highest value which falls into bucket \p i.
+ */
+static uint32_t bucketMax(unsigned i)
+{
+    if (i < SUB_COUNT)
+    {
+        return i;
+    }
+
+    const unsigned shift = (i >> OTAU_LATENCY_SUB_BITS) - 1;
+    const uint32_t m = (i & (SUB_COUNT - 1)) + SUB_COUNT;
+    return ((m + 1) << shift) - 1;
+}
+
+/*! Adds a sample.
+    \param us - latency in microseconds, negative values count as 0
+ */
+void OtauLatencyHistogram::record(int64_t us)
+{
+    uint32_t v = 0;
+    if (us > OTAU_LATENCY_MAX_US)
+    {
+        v = OTAU_LATENCY_MAX_US;
+    }
+    else if (us > 0)
+    {
+        v = static_cast<uint32_t>(us);
+    }
+
+    m_buckets[bucketIndex(v)]++;
+    m_count++;
+
+    if (v > m_max)
+    {
+        m_max = v;
+    }
+}
+
+void OtauLatencyHistogram::reset()
+{
+    m_buckets.fill(0);
+    m_count = 0;
+    m_max = 0;
+}
+
+/*! Returns the latency in microseconds below which \p p percent of the samples are.
+    The value is the upper bound of the bucket, but never above the maximum.
+ */
+uint32_t OtauLatencyHistogram::percentile(unsigned p) const
+{
+    if (m_count == 0)
+    {
+        return 0;
+    }
+
+    const uint64_t rank = (static_cast<uint64_t>(m_count) * p + 99) / 100; // 1 based
+    uint64_t n = 0;
+
+    for (unsigned i = 0; i < m_buckets.size(); i++)
+    {
+        n += m_buckets[i];
+        if (n >= rank && n > 0)
+        {
+            const uint32_t v = bucketMax(i);
+            return v < m_max ? v : m_max;
+        }
+    }
+
+    return m_max;
+}
+
+const char *OtauLatencyHistogram::pathName(OtauLatencyPath path)
+{
+    switch (path)
+    {
+    case OtauLatencyQueryNextImage: return "query_next_image";
+    case OtauLatencyBlockResponse: return "block_response";
+    case OtauLatencyConfirm: return "confirm";
+    default:
+        break;
+    }
+
+    return "unknown";
+}
@@ -0,0 +1,44 @@
+#ifndef OTAU_LATENCY_H
+#define OTAU_LATENCY_H
+
+#include <array>
+#include <stdint.h>
+
+#define OTAU_LATENCY_SUB_BITS 3 // 8 sub buckets per power of two, max. 12.5% error
+#define OTAU_LATENCY_MAX_US   ((1 << 27) - 1) // larger values are clamped (~134 s)
+#define OTAU_LATENCY_BUCKETS  ((27 - OTAU_LATENCY_SUB_BITS + 1) << OTAU_LATENCY_SUB_BITS)
+
+/*! Measured hot paths.
+ */
+enum OtauLatencyPath
+{
+    OtauLatencyQueryNextImage, //!< handling of a query next image request, including disk access
+    OtauLatencyBlockResponse, //!< image block request indication to APSDE-DATA.request of the response
+    OtauLatencyConfirm, //!< APSDE-DATA.request to APSDE-DATA.confirm
+
+    OtauLatencyPathCount
+};
+
+/*! \class OtauLatencyHistogram
+
+    Log-linear histogram of latencies in microseconds, like a HDR histogram with
+    fixed precision. Recording is a few integer operations, no allocation.
+ */
+class OtauLatencyHistogram
+{
+public:
+    void record(int64_t us);
+    void reset();
+    uint32_t count() const { return m_count; }
+    uint32_t max() const { return m_max; }
+    uint32_t percentile(unsigned p) const;
+
+    static const char *pathName(OtauLatencyPath path);
+
+private:
+    std::array<uint32_t, OTAU_LATENCY_BUCKETS> m_buckets{};
+    uint32_t m_count = 0;
+    uint32_t m_max = 0;
+};
+
+#endif // OTAU_LATENCY_H
@@ -0,0 +1,106 @@
+#include <algorithm>
+#include <unordered_set>
+#include "otau_file.h"
+#include "otau_memory.h"
+#include "otau_node.h"
+
+/*! Returns the allocated data size of a byte array, 0 for the shared empty array.
+ */
+quint64 OtauMemoryMeter::bufferBytes(const QByteArray &arr)
+{
+    if (arr.isEmpty() && arr.capacity() == 0)
+    {
+        return 0;
+    }
+
+    return static_cast<quint64>(arr.capacity());
+}
+
+/*! Returns the bytes of image data a node references, including data shared with other nodes.
+ */
+quint64 OtauMemoryMeter::nodeImageBytes(OtauNode *node)
+{
+    quint64 bytes = bufferBytes(node->file.raw);
+
+    if (node->rawFile.constData() != node->file.raw.constData())
+    {
+        bytes += bufferBytes(node->rawFile);
+    }
+
+    for (const OtauFile::SubElement &sub : node->file.subElements)
+    {
+        bytes += bufferBytes(sub.data);
+    }
+
+    return bytes;
+}
+
+/*! Measures the current memory usage and updates the high-water marks.
+    \param nodes - all OTAU nodes
+    \param cacheBytes - memory of caches which are accounted by the caller
+    \param images - if not nullptr receives the image data per image file
+    \return the current usage
+ */
+const OtauMemoryUsage &OtauMemoryMeter::measure(const std::vector<OtauNode*> &nodes, quint64 cacheBytes, std::vector<OtauImageMemory> *images)
+{
+    std::unordered_set<const char*> seen;
+    OtauMemoryUsage usage;
+
+    for (OtauNode *node : nodes)
+    {
+        usage.nodes += sizeof(OtauNode);
+
+        quint64 bytes = 0;
+        bool hasImage = false;
+
+        auto add = [&](const QByteArray &arr)
+        {
+            const quint64 n = bufferBytes(arr);
+            if (n == 0)
+            {
+                return;
+            }
+
+            hasImage = true;
+            if (seen.insert(arr.constData()).second)
+            {
+                bytes += n;
+            }
+        };
+
+        add(node->file.raw);
+        add(node->rawFile);
+        for (const OtauFile::SubElement &sub : node->file.subElements)
+        {
+            add(sub.data);
+        }
+
+        usage.images += bytes;
+
+        if (images && hasImage)
+        {
+            auto i = std::find_if(images->begin(), images->end(), [node](const OtauImageMemory &m) { return m.path == node->file.path; });
+            if (i == images->end())
+            {
+                images->push_back({node->file.path, 0, 0});
+                i = images->end() - 1;
+            }
+            i->bytes += bytes;
+            i->nodes++;
+        }
+    }
+
+    usage.caches = cacheBytes;
+    m_current = usage;
+
+    m_highWater.images = std::max(m_highWater.images, usage.images);
+    m_highWater.nodes = std::max(m_highWater.nodes, usage.nodes);
+    m_highWater.caches = std::max(m_highWater.caches, usage.caches);
+    // the total high-water mark is the highest sum, not the sum of the per owner marks
+    if (usage.total() > m_highWaterTotal)
+    {
+        m_highWaterTotal = usage.total();
+    }
+
+    return m_current;
+}
@@ -0,0 +1,58 @@
+#ifndef OTAU_MEMORY_H
+#define OTAU_MEMORY_H
+
+#include <vector>
+#include <QByteArray>
+#include <QString>
+
+struct OtauNode;
+
+/*! Heap memory held by the plugin in bytes, by owner.
+ */
+struct OtauMemoryUsage
+{
+    quint64 images = 0; //!< image data of nodes, buffers shared by several nodes are counted once
+    quint64 nodes = 0; //!< node objects
+    quint64 caches = 0; //!< event ring, image index and download queue
+
+    quint64 total() const { return images + nodes + caches; }
+};
+
+/*! Image data held for one image file.
+ */
+struct OtauImageMemory
+{
+    QString path;
+    quint64 bytes = 0;
+    unsigned nodes = 0; //!< nodes which reference the data
+};
+
+/*! \class OtauMemoryMeter
+
+    Accounts the memory held for images, nodes and caches and tracks the high-water marks.
+
+    Image data is counted by the allocated size of the QByteArray buffers. Implicitly shared
+    buffers are detected by their data pointer, so that they are counted once.
+ */
+class OtauMemoryMeter
+{
+public:
+    void setBudget(quint64 bytes) { m_budget = bytes; }
+    quint64 budget() const { return m_budget; }
+    const OtauMemoryUsage &measure(const std::vector<OtauNode*> &nodes, quint64 cacheBytes, std::vector<OtauImageMemory> *images = nullptr);
+    const OtauMemoryUsage &current() const { return m_current; }
+    const OtauMemoryUsage &highWater() const { return m_highWater; }
+    quint64 highWaterTotal() const { return m_highWaterTotal; }
+    bool overBudget() const { return m_budget > 0 && m_current.images > m_budget; }
+
+    static quint64 bufferBytes(const QByteArray &arr);
+    static quint64 nodeImageBytes(OtauNode *node);
+
+private:
+    quint64 m_budget = 0; //!< max. bytes of image data, 0 for no limit
+    OtauMemoryUsage m_current;
+    OtauMemoryUsage m_highWater;
+    quint64 m_highWaterTotal = 0;
+};
+
+#endif // OTAU_MEMORY_H
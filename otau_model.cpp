@@ -1,14 +1,18 @@
 #include <QFont>
 #include "deconz.h"
+#include "otau_campaign.h"
 #include "otau_file.h"
 #include "otau_node.h"
 #include "otau_model.h"
+#include "otau_transport.h"
 #include "std_otau_plugin.h"
 
 /*! The constructor.
+    \param transport - provides the time base, must outlive the model
  */
-OtauModel::OtauModel(QObject *parent) :
-    QAbstractTableModel(parent)
+OtauModel::OtauModel(OtauTransport *transport, QObject *parent) :
+    QAbstractTableModel(parent),
+    m_transport(transport)
 {
 }
 
@@ -69,6 +73,12 @@ QVariant OtauModel::headerData(int section, Qt::Orientation orientation, int rol
         case SectionDuration:
             return tr("Time");
 
+        case SectionRate:
+            return tr("Rate");
+
+        case SectionEta:
+            return tr("ETA");
+
 //        case SectionStatus:
 //            return tr("Status");
 
@@ -184,6 +194,25 @@ QVariant OtauModel::data(const QModelIndex &index, int role) const
         }
             break;
 
+        case SectionRate:
+            if (node->status() == OtauNode::StatusUploading)
+            {
+                const uint32_t bps = node->rate.bytesPerSecond(m_transport->steadyTime().ref);
+                str = bps > 0 ? QString("%1 B/s").arg(bps) : tr("Stalled");
+            }
+            break;
+
+        case SectionEta:
+            if (node->status() == OtauNode::StatusUploading)
+            {
+                const uint32_t eta = node->eta(m_transport->steadyTime().ref);
+                if (eta > 0)
+                {
+                    str = QString("%1:%2").arg(eta / 60).arg(eta % 60, 2, 10, QLatin1Char('0'));
+                }
+            }
+            break;
+
         default:
             break;
         }
@@ -316,9 +345,68 @@ void OtauModel::nodeDataUpdate(OtauNode *node)
     }
 }
 
+/*! Sets the time base of the rate and ETA columns, e.g. the virtual time of a benchmark transport.
+ */
+void OtauModel::setTransport(OtauTransport *transport)
+{
+    m_transport = transport;
+}
+
 /*! Returns the internal vector of nodes.
  */
 std::vector<OtauNode *> &OtauModel::nodes()
 {
     return m_nodes;
 }
+
+/*! Returns the sum of the current transfer rates of all nodes in bytes per second.
+ */
+uint32_t OtauModel::totalRate(int64_t nowMs) const
+{
+    uint32_t total = 0;
+
+    for (OtauNode *node : m_nodes)
+    {
+        if (node->status() == OtauNode::StatusUploading)
+        {
+            total += node->rate.bytesPerSecond(nowMs);
+        }
+    }
+
+    return total;
+}
+
+/*! Returns the estimated time in seconds until all running and queued transfers are done, 0 if unknown.
+    Queued nodes are assumed to be served with the bandwidth of the running transfers once they finish.
+    \param nowMs - steady time
+    \param campaign - running campaign, its unfinished members count as queued, may be nullptr
+    \param campaignImageSize - size of the image the campaign rolls out
+ */
+uint32_t OtauModel::campaignEta(int64_t nowMs, const OtauCampaign *campaign, uint32_t campaignImageSize) const
+{
+    const uint32_t rate = totalRate(nowMs);
+    uint64_t remaining = 0;
+
+    if (rate == 0)
+    {
+        return 0;
+    }
+
+    for (OtauNode *node : m_nodes)
+    {
+        if (node->status() == OtauNode::StatusUploading)
+        {
+            remaining += node->remainingBytes();
+        }
+        else if (node->hasData() && node->permitUpdate())
+        {
+            remaining += node->file.totalImageSize;
+        }
+        else if (campaign && campaign->isUnfinished(node->address().ext()))
+        {
+            remaining += campaignImageSize; // not notified yet or data not loaded
+        }
+    }
+
+    return static_cast<uint32_t>((remaining + rate - 1) / rate);
+}
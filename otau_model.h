@@ -1,12 +1,15 @@
 #ifndef OTAU_MODEL_H
 #define OTAU_MODEL_H
 
+#include <stdint.h>
 #include <vector>
 #include <QAbstractTableModel>
 #include "deconz/types.h"
 #include "deconz/aps.h"
 
 struct OtauNode;
+class OtauTransport;
+class OtauCampaign;
 
 /*! \class OtauModel
 
@@ -24,12 +27,14 @@ public:
         SectionSoftwareVersion,
         SectionProgress,
         SectionDuration,
+        SectionRate,
+        SectionEta,
 //        SectionStatus,
 
         SectionCount
     };
 
-    explicit OtauModel(QObject *parent = nullptr);
+    explicit OtauModel(OtauTransport *transport, QObject *parent = nullptr);
     ~OtauModel();
     int rowCount(const QModelIndex &parent) const;
     int columnCount(const QModelIndex &parent) const;
@@ -40,11 +45,15 @@ public:
     OtauNode *getNodeAtRow(uint row);
     void nodeDataUpdate(OtauNode *node);
     std::vector<OtauNode *> &nodes();
+    uint32_t totalRate(int64_t nowMs) const;
+    uint32_t campaignEta(int64_t nowMs, const OtauCampaign *campaign = nullptr, uint32_t campaignImageSize = 0) const;
+    void setTransport(OtauTransport *transport);
 signals:
 
 public slots:
 private:
     std::vector<OtauNode*> m_nodes;
+    OtauTransport *m_transport; //!< time base of the rate and ETA columns
 };
 
 #endif // OTAU_MODEL_H
@@ -5,6 +5,19 @@
 #include "otau_model.h"
 
 #define OTAU_QUERY_NEXT_IMAGE_REQUEST_CMD_ID   0x01
+#define RATE_ALPHA 0.3 // weight of the newest sample
+#define END_DEVICE_POLL_INTERVAL 7500 // ms, common long poll interval of sleepy devices
+#define END_DEVICE_BLOCK_SIZE    40 // fits one frame in the indirect buffer of the parent, even source routed
+
+// also used for nodes without node descriptor, so that otau/acks-enabled applies to them
+static const OtauTransferProfile profileRouter = {
+    0, true, false, true, 60000, NODE_TIMEOUT, 60 * 1000, 5 * 60 * 1000
+};
+
+// one block per poll, no page bursts which overflow the parent and no notifies the device sleeps through
+static const OtauTransferProfile profileEndDevice = {
+    END_DEVICE_BLOCK_SIZE, false, true, false, 8 * END_DEVICE_POLL_INTERVAL, 4 * END_DEVICE_POLL_INTERVAL, 10 * 60 * 1000, 15 * 60 * 1000
+};
 
 /*! The constructor.
  */
@@ -124,11 +137,20 @@ uint8_t OtauNode::lastZclCmd() const
     return m_lastZclCmd;
 }
 
-/*! Refreshs/resets the otau process timeout.
+/*! Sets the receiver on when idle flag of the node descriptor, which selects the transfer profile.
+    \param rxOn - false for sleepy end devices
+ */
+void OtauNode::setRxOnWhenIdle(bool rxOn)
+{
+    rxOnWhenIdle = rxOn;
+    deviceClass = rxOn ? DeviceRouter : DeviceEndDevice;
+}
+
+/*! Returns the transfer parameters for the device class of the node, unknown nodes are served like routers.
  */
-void OtauNode::refreshTimeout()
+const OtauTransferProfile &OtauNode::transferProfile() const
 {
-    timeout = NODE_TIMEOUT;
+    return deviceClass == DeviceEndDevice ? profileEndDevice : profileRouter;
 }
 
 /*! Restarts the timer to measure the elapsed process time.
@@ -136,6 +158,7 @@ void OtauNode::refreshTimeout()
 void OtauNode::restartElapsedTimer()
 {
     m_elapsedTime = 0;
+    rate.reset();
     m_time.restart();
     model->nodeDataUpdate(this);
 }
@@ -175,3 +198,75 @@ QString OtauNode::statusString() const
 
     return "Unknown";
 }
+
+/*! Returns the number of bytes which are not yet transferred.
+ */
+uint32_t OtauNode::remainingBytes()
+{
+    if (file.totalImageSize > m_offset)
+    {
+        return file.totalImageSize - m_offset;
+    }
+
+    return 0;
+}
+
+/*! Returns the estimated remaining transfer time in seconds, or 0 if unknown.
+    \param nowMs - current steady time
+ */
+uint32_t OtauNode::eta(int64_t nowMs)
+{
+    const uint32_t bps = rate.bytesPerSecond(nowMs);
+
+    if (bps == 0)
+    {
+        return 0;
+    }
+
+    return (remainingBytes() + bps - 1) / bps;
+}
+
+void OtauRateEstimator::reset()
+{
+    m_rate = 0;
+    m_windowStart = 0;
+    m_lastData = 0;
+    m_windowBytes = 0;
+}
+
+/*! Adds confirmed bytes.
+    \param bytes - number of delivered image bytes
+    \param nowMs - steady time of the confirm
+ */
+void OtauRateEstimator::addBytes(unsigned bytes, int64_t nowMs)
+{
+    if (m_windowStart == 0 || nowMs - m_lastData > RATE_STALL_MS)
+    {
+        m_windowStart = nowMs; // first data or after a stall, the pause isn't part of the rate
+        m_windowBytes = 0;
+    }
+
+    m_windowBytes += bytes;
+    m_lastData = nowMs;
+
+    const int64_t dt = nowMs - m_windowStart;
+    if (dt >= RATE_WINDOW_MS)
+    {
+        const double sample = m_windowBytes * 1000.0 / dt;
+        m_rate = m_rate > 0 ? RATE_ALPHA * sample + (1 - RATE_ALPHA) * m_rate : sample;
+        m_windowStart = nowMs;
+        m_windowBytes = 0;
+    }
+}
+
+/*! Returns the current rate in bytes per second, 0 if unknown or stalled.
+ */
+uint32_t OtauRateEstimator::bytesPerSecond(int64_t nowMs) const
+{
+    if (m_lastData == 0 || nowMs - m_lastData > RATE_STALL_MS)
+    {
+        return 0;
+    }
+
+    return static_cast<uint32_t>(m_rate + 0.5);
+}
@@ -7,20 +7,37 @@
 #include "deconz/types.h"
 #include "deconz/aps.h"
 #include "deconz/timeref.h"
+#include "otau_latency.h"
 
 #define NODE_TIMEOUT        10000
+#define RATE_WINDOW_MS      1000 // min. time per throughput sample
+#define RATE_STALL_MS       10000 // no confirmed data for this long counts as stalled
 #define MAX_ACTIVE_BLOCK_REQUESTS 9
 
 struct OtauFile;
 class OtauModel;
 
+#define IMAGE_NOTIFY_JITTER           0x00
+#define IMAGE_NOTIFY_MFCODE           0x01
+#define IMAGE_NOTIFY_MFCODE_TYPE      0x02
+#define IMAGE_NOTIFY_MFCODE_TYPE_VER  0x03
+
 struct ImageNotifyReq
 {
+    ImageNotifyReq() :
+        payloadType(IMAGE_NOTIFY_JITTER), queryJitter(100), manufacturerCode(0), imageType(0), fileVersion(0)
+    {}
     // adressing
     deCONZ::ApsAddressMode addrMode;
     deCONZ::Address addr;
     uint8_t dstEndpoint;
     uint8_t radius;
+    // payload, the fields after query jitter are sent depending on the payload type
+    uint8_t payloadType;
+    uint8_t queryJitter; //!< 1..100 probability in percent that a matching client queries
+    uint16_t manufacturerCode;
+    uint16_t imageType;
+    uint32_t fileVersion;
 };
 
 struct ImageBlockReq
@@ -55,6 +72,39 @@ struct UpgradeEndReq
     uint32_t fileVersion;
 };
 
+/*! Transfer parameters of a device class, see OtauNode::transferProfile().
+ */
+struct OtauTransferProfile
+{
+    uint8_t maxDataSize; //!< max. image block payload, 0 for no limit beyond the ASDU size
+    bool pageRequests; //!< image page requests are served, otherwise the node falls back to block requests
+    bool apsAcks; //!< all image block responses are sent with APS ACK
+    bool unicastNotify; //!< the node can receive an unsolicited image notify
+    int waitNextRequestMs; //!< time after a page until the node is notified again
+    int activityTimeoutMs; //!< time without request until the transfer counts as inactive
+    int startTimeoutMs; //!< time after a notify until the node has to start the transfer
+    int stallTimeoutMs; //!< time without progress until the transfer counts as stalled
+};
+
+/*! \class OtauRateEstimator
+
+    Exponentially weighted moving average of confirmed bytes per second.
+    Confirmed bytes are summed over windows of at least RATE_WINDOW_MS, each window adds one sample.
+ */
+class OtauRateEstimator
+{
+public:
+    void reset();
+    void addBytes(unsigned bytes, int64_t nowMs);
+    uint32_t bytesPerSecond(int64_t nowMs) const;
+
+private:
+    double m_rate = 0; // bytes per second, 0 before the first sample
+    int64_t m_windowStart = 0;
+    int64_t m_lastData = 0;
+    unsigned m_windowBytes = 0;
+};
+
 /*! \class OtauNode
 
     Represents a otau node and its state/data.
@@ -91,6 +141,13 @@ public:
         StatusImageRequest       = 0x0D
     };
 
+    enum DeviceClass
+    {
+        DeviceUnknown, //!< no node descriptor seen yet
+        DeviceRouter, //!< receiver is on when idle
+        DeviceEndDevice //!< sleepy, frames are buffered by the parent until the next poll
+    };
+
     OtauNode(const deCONZ::Address &addr);
 
     NodeState state() { return m_state; }
@@ -105,7 +162,6 @@ public:
     void setOffset(uint32_t offset);
     uint16_t imageType() { return m_imageType; }
     void setImageType(uint16_t type);
-    void refreshTimeout();
     bool permitUpdate() { return m_permitUpdate; }
     void setPermitUpdate(bool permit) { m_permitUpdate = permit; }
     bool hasData() { return m_hasData; }
@@ -116,14 +172,19 @@ public:
     Status status() const { return m_status; }
     void setStatus(Status status) { m_status = status; }
     QString statusString() const;
+    uint32_t remainingBytes();
+    uint32_t eta(int64_t nowMs);
     void setLastZclCommand(uint8_t commandId);
     uint8_t lastZclCmd() const;
     const QTime &lastQueryTime() const { return m_lastQueryTime; }
+    void setRxOnWhenIdle(bool rxOn);
+    const OtauTransferProfile &transferProfile() const;
 
     // service for model
     uint row;
     OtauModel *model;
     bool rxOnWhenIdle;
+    DeviceClass deviceClass = DeviceUnknown;
 
     // TODO: getter and setter
     uint16_t apsRequestId;
@@ -135,9 +196,8 @@ public:
     uint16_t manufacturerId;
     uint32_t imageSize;
     uint8_t *imageData;
-    uint32_t timeout; // seconds
-    QElapsedTimer lastResponseTime;
-    QElapsedTimer lastActivity;
+    deCONZ::SteadyTimeRef lastResponseTime;
+    deCONZ::SteadyTimeRef lastActivity;
 
     OtauFile file;
     QByteArray rawFile;
@@ -148,6 +208,17 @@ public:
     int imgBlockResponseRetry;
 
     std::array<ImageBlockReqTrack, MAX_ACTIVE_BLOCK_REQUESTS> imgBlockTrack{};
+    std::array<OtauLatencyHistogram, OtauLatencyPathCount> latency;
+    OtauRateEstimator rate;
+    bool imageEvicted = false; //!< image data released to stay within the memory budget, reloaded on demand
+    int64_t lastSeen = 0; //!< seconds since epoch of the last query next image request
+    uint32_t updateVersion = 0; //!< newest image version in the index if newer than the node's, otherwise 0
+    bool availableNotified = false; //!< an availability notify was published
+    uint32_t notifiedSwVersion = 0; //!< values of the last availability notify
+    uint32_t notifiedFileVersion = 0;
+    bool notifiedPermitUpdate = false;
+    bool paused = false; //!< block requests are answered with WAIT_FOR_DATA
+    int64_t progressNotifyTime = 0; //!< steady time of the last progress notify
 
 private:
     deCONZ::Address m_addr;
@@ -0,0 +1,158 @@
+#include <deconz/dbg_trace.h>
+#include "otau_source_list.h"
+
+#define UNKNOWN_LATENCY      2000 // ms, assumed for not yet measured sources
+#define SOURCE_BACKOFF_MIN   (60 * 1000)
+#define SOURCE_BACKOFF_MAX   (60 * 60 * 1000)
+#define HEDGE_MIN_DELAY      1500 // ms before racing the next source
+#define HEDGE_MAX_DELAY      8000
+
+/*! The constructor.
+ */
+OtauSourceList::OtauSourceList()
+{
+    m_clock.start();
+}
+
+/*! Sets the ordered list of source URLs, health data of known URLs is preserved.
+    \param urls - the source URLs, the first has the highest priority
+ */
+void OtauSourceList::setUrls(const QStringList &urls)
+{
+    std::vector<Source> sources;
+
+    for (const QString &url : urls)
+    {
+        if (sources.size() >= OTAU_MAX_SOURCES)
+        {
+            break;
+        }
+
+        Source src;
+        src.url = url;
+
+        for (const Source &s : m_sources)
+        {
+            if (s.url == url)
+            {
+                src = s;
+                break;
+            }
+        }
+
+        sources.push_back(src);
+    }
+
+    m_sources = sources;
+}
+
+/*! Returns the expected latency of a source in milliseconds.
+ */
+qint64 OtauSourceList::expectedLatency(int i) const
+{
+    if (i < 0 || i >= size() || m_sources[i].latency < 0)
+    {
+        return UNKNOWN_LATENCY;
+    }
+
+    return m_sources[i].latency;
+}
+
+/*! Returns the time in milliseconds after which the next source is raced against a running download.
+    \param i - index of the source of the running download
+ */
+qint64 OtauSourceList::hedgeDelay(int i) const
+{
+    return qBound<qint64>(HEDGE_MIN_DELAY, 2 * expectedLatency(i), HEDGE_MAX_DELAY);
+}
+
+/*! Selects the source with the lowest expected latency.
+    Healthy sources are preferred, backed off sources are only used if no healthy one is left.
+    On equal latency the order of the list decides.
+    \param excludeMask - bit mask of sources which shall not be selected (already tried)
+    \return index of the source or -1 if none is left
+ */
+int OtauSourceList::selectBest(uint32_t excludeMask) const
+{
+    const qint64 now = m_clock.elapsed();
+    int best = -1;
+    bool bestHealthy = false;
+
+    for (int i = 0; i < size(); i++)
+    {
+        if (excludeMask & (1U << i))
+        {
+            continue;
+        }
+
+        const bool healthy = m_sources[i].blockedUntil <= now;
+
+        if (best < 0 || (healthy && !bestHealthy))
+        {
+            best = i;
+            bestHealthy = healthy;
+        }
+        else if (healthy == bestHealthy)
+        {
+            if (healthy && expectedLatency(i) < expectedLatency(best))
+            {
+                best = i;
+            }
+            else if (!healthy && m_sources[i].blockedUntil < m_sources[best].blockedUntil)
+            {
+                best = i;
+            }
+        }
+    }
+
+    return best;
+}
+
+/*! Records a successful download.
+    \param i - index of the source
+    \param duration - time in milliseconds until the download completed
+ */
+void OtauSourceList::reportSuccess(int i, qint64 duration)
+{
+    if (i < 0 || i >= size())
+    {
+        return;
+    }
+
+    Source &src = m_sources[i];
+
+    if (src.latency < 0)
+    {
+        src.latency = duration;
+    }
+    else
+    {
+        src.latency = (src.latency * 3 + duration) / 4;
+    }
+
+    src.failures = 0;
+    src.blockedUntil = 0;
+    src.successCount++;
+}
+
+/*! Records a failed download, the source is backed off exponentially.
+    \param i - index of the source
+ */
+void OtauSourceList::reportFailure(int i)
+{
+    if (i < 0 || i >= size())
+    {
+        return;
+    }
+
+    Source &src = m_sources[i];
+
+    src.failures++;
+    src.failureCount++;
+
+    const unsigned shift = src.failures < 7 ? src.failures - 1 : 6;
+    const qint64 backoff = qMin<qint64>(qint64(SOURCE_BACKOFF_MIN) << shift, SOURCE_BACKOFF_MAX);
+    src.blockedUntil = m_clock.elapsed() + backoff;
+
+    DBG_Printf(DBG_OTA, "OTAU: source %s failed (%u), back off %d s\n", qPrintable(src.url), src.failures, int(backoff / 1000));
+}
@@ -0,0 +1,45 @@
+#ifndef OTAU_SOURCE_LIST_H
+#define OTAU_SOURCE_LIST_H
+
+#include <stdint.h>
+#include <vector>
+#include <QElapsedTimer>
+#include <QString>
+#include <QStringList>
+
+#define OTAU_MAX_SOURCES 32 // tried sources are tracked in a 32-bit mask
+
+/*! \class OtauSourceList
+
+    Ordered list of download sources (index URLs or mirror base URLs) with health tracking.
+    Sources are ranked by their measured latency, failing sources are backed off for a while.
+ */
+class OtauSourceList
+{
+public:
+    struct Source
+    {
+        QString url;
+        qint64 latency = -1; //!< EWMA of successful download durations in ms, -1 if unknown
+        qint64 blockedUntil = 0; //!< backoff end time, relative to m_clock
+        unsigned failures = 0; //!< consecutive failures
+        unsigned successCount = 0;
+        unsigned failureCount = 0;
+    };
+
+    OtauSourceList();
+    void setUrls(const QStringList &urls);
+    int size() const { return static_cast<int>(m_sources.size()); }
+    const Source &at(int i) const { return m_sources[i]; }
+    int selectBest(uint32_t excludeMask) const;
+    qint64 expectedLatency(int i) const;
+    qint64 hedgeDelay(int i) const;
+    void reportSuccess(int i, qint64 duration);
+    void reportFailure(int i);
+
+private:
+    std::vector<Source> m_sources;
+    QElapsedTimer m_clock;
+};
+
+#endif // OTAU_SOURCE_LIST_H
@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <unordered_set>
+#include "otau_topology.h"
+
+/*! Forgets all nodes and links before the neighbour tables are read again.
+ */
+void OtauTopology::clear()
+{
+    m_coordinator = 0;
+    m_endDevices.clear();
+    m_links.clear();
+    m_parent.clear();
+    m_branch.clear();
+}
+
+/*! Adds a node of the network.
+    \param extAddr - IEEE address
+    \param endDevice - true if the node doesn't route
+ */
+void OtauTopology::addNode(uint64_t extAddr, bool endDevice)
+{
+    if (endDevice)
+    {
+        m_endDevices.push_back(extAddr);
+    }
+}
+
+/*! Adds an entry of the neighbour table of a node.
+    \param extAddr - the node which reported the neighbour
+    \param neighbor - IEEE address of the neighbour
+    \param relationship - relationship of the neighbour to the node (Mgmt_Lqi)
+    \param lqi - link quality
+ */
+void OtauTopology::addNeighbor(uint64_t extAddr, uint64_t neighbor, uint8_t relationship, uint8_t lqi)
+{
+    if (extAddr == 0 || neighbor == 0 || extAddr == neighbor)
+    {
+        return;
+    }
+
+    if (relationship == RelationChild)
+    {
+        m_parent[neighbor] = extAddr;
+    }
+    else if (relationship == RelationParent)
+    {
+        m_parent[extAddr] = neighbor;
+    }
+
+    m_links.push_back({extAddr, neighbor, lqi});
+}
+
+/*! Assigns the branches, breadth first from the coordinator along the best links.
+ */
+void OtauTopology::build()
+{
+    m_branch.clear();
+
+    if (m_coordinator == 0)
+    {
+        return;
+    }
+
+    std::vector<uint64_t> layer{m_coordinator};
+    std::unordered_set<uint64_t> reached{m_coordinator};
+
+    while (!layer.empty())
+    {
+        std::vector<uint64_t> next;
+        std::unordered_map<uint64_t, uint8_t> candidates;
+
+        for (const Link &link : m_links)
+        {
+            uint64_t from = 0;
+            uint64_t to = 0;
+
+            if (std::find(layer.begin(), layer.end(), link.a) != layer.end())
+            {
+                from = link.a;
+                to = link.b;
+            }
+            else if (std::find(layer.begin(), layer.end(), link.b) != layer.end())
+            {
+                from = link.b;
+                to = link.a;
+            }
+            else
+            {
+                continue;
+            }
+
+            if (reached.count(to) != 0 || std::find(m_endDevices.begin(), m_endDevices.end(), to) != m_endDevices.end())
+            {
+                continue; // end devices don't route, they are mapped through their parent below
+            }
+
+            auto c = candidates.find(to);
+            if (c == candidates.end())
+            {
+                candidates[to] = link.lqi;
+                next.push_back(to);
+                m_branch[to] = from == m_coordinator ? to : m_branch[from];
+            }
+            else if (link.lqi > c->second)
+            {
+                c->second = link.lqi;
+                m_branch[to] = from == m_coordinator ? to : m_branch[from];
+            }
+        }
+
+        reached.insert(next.begin(), next.end());
+
+        layer.swap(next);
+    }
+
+    for (uint64_t ed : m_endDevices)
+    {
+        const auto p = m_parent.find(ed);
+        if (p == m_parent.end())
+        {
+            continue;
+        }
+
+        if (p->second == m_coordinator)
+        {
+            m_branch[ed] = ed;
+        }
+        else
+        {
+            const auto b = m_branch.find(p->second);
+            if (b != m_branch.end())
+            {
+                m_branch[ed] = b->second;
+            }
+        }
+    }
+}
+
+/*! Returns the parent of an end device.
+    \return IEEE address of the parent, 0 if unknown or the node isn't an end device
+ */
+uint64_t OtauTopology::parent(uint64_t extAddr) const
+{
+    if (std::find(m_endDevices.begin(), m_endDevices.end(), extAddr) == m_endDevices.end())
+    {
+        return 0;
+    }
+
+    const auto i = m_parent.find(extAddr);
+    return i != m_parent.end() ? i->second : 0;
+}
+
+/*! Returns the branch of a node.
+    \return IEEE address of the router next to the coordinator, 0 if unknown
+ */
+uint64_t OtauTopology::branch(uint64_t extAddr) const
+{
+    const auto i = m_branch.find(extAddr);
+    return i != m_branch.end() ? i->second : 0;
+}
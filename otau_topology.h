@@ -0,0 +1,49 @@
+#ifndef OTAU_TOPOLOGY_H
+#define OTAU_TOPOLOGY_H
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+/*! \class OtauTopology
+
+    Which router carries the OTA traffic of a node, derived from the neighbour tables (Mgmt_Lqi).
+
+    End devices are served from the indirect buffer of their parent. All other nodes are mapped
+    to a branch, the router one hop from the coordinator through which the node is most likely
+    routed. Transfers on the same parent or branch share the buffers of that router.
+ */
+class OtauTopology
+{
+public:
+    enum Relationship
+    {
+        RelationParent = 0x00,
+        RelationChild = 0x01,
+        RelationSibling = 0x02
+    };
+
+    void clear();
+    void setCoordinator(uint64_t extAddr) { m_coordinator = extAddr; }
+    void addNode(uint64_t extAddr, bool endDevice);
+    void addNeighbor(uint64_t extAddr, uint64_t neighbor, uint8_t relationship, uint8_t lqi);
+    void build();
+    uint64_t parent(uint64_t extAddr) const;
+    uint64_t branch(uint64_t extAddr) const;
+
+private:
+    struct Link
+    {
+        uint64_t a;
+        uint64_t b;
+        uint8_t lqi;
+    };
+
+    uint64_t m_coordinator = 0;
+    std::vector<uint64_t> m_endDevices;
+    std::vector<Link> m_links;
+    std::unordered_map<uint64_t, uint64_t> m_parent;
+    std::unordered_map<uint64_t, uint64_t> m_branch;
+};
+
+#endif // OTAU_TOPOLOGY_H
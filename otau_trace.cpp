@@ -0,0 +1,183 @@
+#include <cstring>
+#include <QDateTime>
+#include <deconz/aps.h>
+#include <deconz/dbg_trace.h>
+#include "otau_trace.h"
+
+#define TRACE_FLUSH_INTERVAL 2000 // ms
+#define TRACE_MAX_FILE_SIZE  (64 * 1024 * 1024)
+
+OtauTraceWriter::~OtauTraceWriter()
+{
+    close();
+}
+
+/*! Creates a new trace file.
+    \param path - the trace file, an existing file is overwritten
+    \param now - current time in ms, the reference for record timestamps
+    \return true if the file was created
+ */
+bool OtauTraceWriter::open(const QString &path, int64_t now)
+{
+    close();
+
+    m_file.setFileName(path);
+    if (!m_file.open(QFile::WriteOnly | QFile::Truncate))
+    {
+        DBG_Printf(DBG_OTA, "OTAU: failed to create trace %s\n", qPrintable(path));
+        return false;
+    }
+
+    m_stream.setDevice(&m_file);
+    m_stream.setByteOrder(QDataStream::LittleEndian);
+    m_stream.writeRawData(OTAU_TRACE_MAGIC, 7);
+    m_stream << (quint8)OTAU_TRACE_VERSION;
+    m_stream << (qint64)QDateTime::currentMSecsSinceEpoch();
+
+    m_start = now;
+    m_lastFlush = now;
+
+    DBG_Printf(DBG_OTA, "OTAU: recording trace to %s\n", qPrintable(path));
+    return true;
+}
+
+void OtauTraceWriter::close()
+{
+    if (m_file.isOpen())
+    {
+        m_stream.setDevice(nullptr);
+        m_file.close();
+    }
+}
+
+void OtauTraceWriter::writeIndication(const deCONZ::ApsDataIndication &ind, int64_t now)
+{
+    OtauTraceRecord rec;
+    rec.type = OtauTraceRecord::Indication;
+    rec.extAddr = ind.srcAddress().hasExt() ? ind.srcAddress().ext() : 0;
+    rec.nwkAddr = ind.srcAddress().hasNwk() ? ind.srcAddress().nwk() : 0;
+    rec.srcEndpoint = ind.srcEndpoint();
+    rec.dstEndpoint = ind.dstEndpoint();
+    rec.profileId = ind.profileId();
+    rec.clusterId = ind.clusterId();
+    rec.asdu = ind.asdu();
+    write(rec, now);
+}
+
+void OtauTraceWriter::writeConfirm(const deCONZ::ApsDataConfirm &conf, int64_t now)
+{
+    OtauTraceRecord rec;
+    rec.type = OtauTraceRecord::Confirm;
+    rec.extAddr = conf.dstAddress().hasExt() ? conf.dstAddress().ext() : 0;
+    rec.nwkAddr = conf.dstAddress().hasNwk() ? conf.dstAddress().nwk() : 0;
+    rec.srcEndpoint = conf.srcEndpoint();
+    rec.dstEndpoint = conf.dstEndpoint();
+    rec.id = conf.id();
+    rec.status = conf.status();
+    write(rec, now);
+}
+
+void OtauTraceWriter::writeRequest(const deCONZ::ApsDataRequest &req, int64_t now)
+{
+    OtauTraceRecord rec;
+    rec.type = OtauTraceRecord::Request;
+    rec.extAddr = req.dstAddress().hasExt() ? req.dstAddress().ext() : 0;
+    rec.nwkAddr = req.dstAddress().hasNwk() ? req.dstAddress().nwk() : 0;
+    rec.srcEndpoint = req.srcEndpoint();
+    rec.dstEndpoint = req.dstEndpoint();
+    rec.profileId = req.profileId();
+    rec.clusterId = req.clusterId();
+    rec.id = req.id();
+    rec.status = (req.txOptions() & deCONZ::ApsTxAcknowledgedTransmission) ? 1 : 0;
+    rec.asdu = req.asdu();
+    write(rec, now);
+}
+
+void OtauTraceWriter::write(const OtauTraceRecord &rec, int64_t now)
+{
+    if (!m_file.isOpen())
+    {
+        return;
+    }
+
+    if (m_file.size() > TRACE_MAX_FILE_SIZE)
+    {
+        DBG_Printf(DBG_OTA, "OTAU: trace %s reached max. size, stop recording\n", qPrintable(m_file.fileName()));
+        close();
+        return;
+    }
+
+    m_stream << rec.type;
+    m_stream << (quint32)(now - m_start);
+    m_stream << (quint64)rec.extAddr;
+    m_stream << rec.nwkAddr;
+    m_stream << rec.srcEndpoint;
+    m_stream << rec.dstEndpoint;
+    m_stream << rec.profileId;
+    m_stream << rec.clusterId;
+    m_stream << rec.id;
+    m_stream << rec.status;
+    m_stream << (quint16)rec.asdu.size();
+    m_stream.writeRawData(rec.asdu.constData(), rec.asdu.size());
+
+    if (now - m_lastFlush > TRACE_FLUSH_INTERVAL)
+    {
+        m_file.flush();
+        m_lastFlush = now;
+    }
+}
+
+/*! Opens a trace file for reading.
+    \return true if the file is a trace of a supported version
+ */
+bool OtauTraceReader::open(const QString &path)
+{
+    m_file.setFileName(path);
+    if (!m_file.open(QFile::ReadOnly))
+    {
+        return false;
+    }
+
+    m_stream.setDevice(&m_file);
+    m_stream.setByteOrder(QDataStream::LittleEndian);
+
+    char magic[7];
+    quint8 version = 0;
+    if (m_stream.readRawData(magic, sizeof(magic)) != sizeof(magic) || memcmp(magic, OTAU_TRACE_MAGIC, sizeof(magic)) != 0)
+    {
+        return false;
+    }
+
+    m_stream >> version;
+    m_stream >> m_created;
+
+    return version == OTAU_TRACE_VERSION && m_stream.status() == QDataStream::Ok;
+}
+
+/*! Reads the next record.
+    \return false at the end of the trace or if the record is truncated
+ */
+bool OtauTraceReader::next(OtauTraceRecord *rec)
+{
+    quint16 asduLength = 0;
+
+    m_stream >> rec->type;
+    m_stream >> rec->time;
+    m_stream >> rec->extAddr;
+    m_stream >> rec->nwkAddr;
+    m_stream >> rec->srcEndpoint;
+    m_stream >> rec->dstEndpoint;
+    m_stream >> rec->profileId;
+    m_stream >> rec->clusterId;
+    m_stream >> rec->id;
+    m_stream >> rec->status;
+    m_stream >> asduLength;
+
+    if (m_stream.status() != QDataStream::Ok)
+    {
+        return false;
+    }
+
+    rec->asdu.resize(asduLength);
+    return m_stream.readRawData(rec->asdu.data(), asduLength) == asduLength;
+}
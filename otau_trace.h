@@ -0,0 +1,87 @@
+#ifndef OTAU_TRACE_H
+#define OTAU_TRACE_H
+
+#include <stdint.h>
+#include <QByteArray>
+#include <QDataStream>
+#include <QFile>
+#include <QString>
+
+#define OTAU_TRACE_MAGIC   "OTAUTRC"
+#define OTAU_TRACE_VERSION 1
+
+namespace deCONZ {
+    class ApsDataIndication;
+    class ApsDataConfirm;
+    class ApsDataRequest;
+}
+
+/*! One APS primitive of a trace.
+ */
+struct OtauTraceRecord
+{
+    enum Type
+    {
+        Indication = 1,
+        Confirm = 2,
+        Request = 3
+    };
+
+    uint8_t type = 0;
+    uint32_t time = 0; //!< ms since start of the trace
+    quint64 extAddr = 0; //!< source of an indication, destination of a request or confirm
+    uint16_t nwkAddr = 0;
+    uint8_t srcEndpoint = 0;
+    uint8_t dstEndpoint = 0;
+    uint16_t profileId = 0;
+    uint16_t clusterId = 0;
+    uint8_t id = 0; //!< APS request id of requests and confirms
+    uint8_t status = 0; //!< confirm status, for requests 1 if APS acknowledged
+    QByteArray asdu;
+};
+
+/*! \class OtauTraceWriter
+
+    Records APS indications, confirms and requests into a compact binary trace.
+
+    The file starts with the 7 byte magic and a version byte, followed by the creation time
+    in ms since epoch. Each record is stored little endian with a fixed 25 byte header and the ASDU.
+ */
+class OtauTraceWriter
+{
+public:
+    ~OtauTraceWriter();
+    bool open(const QString &path, int64_t now);
+    bool isOpen() const { return m_file.isOpen(); }
+    void close();
+    void writeIndication(const deCONZ::ApsDataIndication &ind, int64_t now);
+    void writeConfirm(const deCONZ::ApsDataConfirm &conf, int64_t now);
+    void writeRequest(const deCONZ::ApsDataRequest &req, int64_t now);
+
+private:
+    void write(const OtauTraceRecord &rec, int64_t now);
+
+    QFile m_file;
+    QDataStream m_stream;
+    int64_t m_start = 0;
+    int64_t m_lastFlush = 0;
+};
+
+/*! \class OtauTraceReader
+
+    Reads a trace written by OtauTraceWriter.
+ */
+class OtauTraceReader
+{
+public:
+    bool open(const QString &path);
+    bool next(OtauTraceRecord *rec);
+    qint64 created() const { return m_created; }
+
+private:
+    QFile m_file;
+    QDataStream m_stream;
+    qint64 m_created = 0;
+};
+
+#endif // OTAU_TRACE_H
@@ -0,0 +1,76 @@
+#include <deconz/aps_controller.h>
+#include "otau_transport.h"
+
+/*! Returns true if the APS layer can be used.
+ */
+bool OtauTransport::isAvailable()
+{
+    return deCONZ::ApsController::instance() != nullptr;
+}
+
+/*! Returns true if OTAU is enabled in the controller.
+ */
+bool OtauTransport::otauActive()
+{
+    deCONZ::ApsController *apsCtrl = deCONZ::ApsController::instance();
+    return apsCtrl && apsCtrl->getParameter(deCONZ::ParamOtauActive) != 0;
+}
+
+/*! Enables or disables OTAU in the controller.
+    \return true on success
+ */
+bool OtauTransport::setOtauActive(bool active)
+{
+    deCONZ::ApsController *apsCtrl = deCONZ::ApsController::instance();
+    return apsCtrl && apsCtrl->setParameter(deCONZ::ParamOtauActive, active ? 1 : 0);
+}
+
+/*! Queues an APSDE-DATA.request.
+    \param req - the request
+    \return deCONZ::Success if the request was queued
+ */
+int OtauTransport::apsdeDataRequest(const deCONZ::ApsDataRequest &req)
+{
+    deCONZ::ApsController *apsCtrl = deCONZ::ApsController::instance();
+    if (!apsCtrl)
+    {
+        return deCONZ::ErrorNotConnected;
+    }
+
+    return apsCtrl->apsdeDataRequest(req);
+}
+
+/*! Returns a node of the controller, index 0 is the coordinator.
+ */
+int OtauTransport::getNode(int index, const deCONZ::Node **node)
+{
+    deCONZ::ApsController *apsCtrl = deCONZ::ApsController::instance();
+    if (!apsCtrl)
+    {
+        return -1;
+    }
+
+    return apsCtrl->getNode(index, node);
+}
+
+/*! Returns the current time used for transfer bookkeeping.
+ */
+deCONZ::SteadyTimeRef OtauTransport::steadyTime()
+{
+    return deCONZ::steadyTimeRef();
+}
+
+/*! Starts a download, \p callback is called with \p user as user data when it finished.
+    \return handle for cancelDownload()
+ */
+int OtauTransport::download(const char *url, unsigned maxSize, void (*callback)(N_DownloadData*), void *user)
+{
+    return N_Download(url, maxSize, callback, user);
+}
+
+/*! Cancels a running download.
+ */
+void OtauTransport::cancelDownload(int handle)
+{
+    N_CancelDownload(handle);
+}
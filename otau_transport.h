@@ -0,0 +1,35 @@
+#ifndef OTAU_TRANSPORT_H
+#define OTAU_TRANSPORT_H
+
+#include <deconz/aps.h>
+#include <deconz/n_downloader.h>
+#include <deconz/timeref.h>
+
+namespace deCONZ {
+    class Node;
+}
+
+/*! \class OtauTransport
+
+    Access to the APS layer, the downloader and the time base used for transfers.
+
+    The default implementation forwards to deCONZ::ApsController and the deCONZ downloader.
+    Another transport can be set to run the plugin without a network, e.g. the loopback
+    benchmark which simulates OTA clients in virtual time, or the source benchmark which
+    downloads from local HTTP stand-ins.
+ */
+class OtauTransport
+{
+public:
+    virtual ~OtauTransport() = default;
+    virtual bool isAvailable();
+    virtual bool otauActive();
+    virtual bool setOtauActive(bool active);
+    virtual int apsdeDataRequest(const deCONZ::ApsDataRequest &req);
+    virtual int getNode(int index, const deCONZ::Node **node);
+    virtual deCONZ::SteadyTimeRef steadyTime();
+    virtual int download(const char *url, unsigned maxSize, void (*callback)(N_DownloadData*), void *user);
+    virtual void cancelDownload(int handle);
+};
+
+#endif // OTAU_TRANSPORT_H
@@ -42,14 +42,43 @@ HEADERS  = std_otau_plugin.h \
            otau_file.h \
            otau_file_loader.h \
            otau_model.h \
-           otau_node.h
+           otau_node.h \
+           otau_activation.h \
+           otau_campaign.h \
+           otau_config.h \
+           otau_event_ring.h \
+           otau_file_writer.h \
+           otau_health.h \
+           otau_image_store.h \
+           otau_inventory.h \
+           otau_journal.h \
+           otau_latency.h \
+           otau_memory.h \
+           otau_source_list.h \
+           otau_topology.h \
+           otau_trace.h \
+           otau_transport.h
 
 SOURCES  = std_otau_plugin.cpp \
            std_otau_widget.cpp \
            otau_file.cpp \
            otau_file_loader.cpp \
            otau_model.cpp \
-           otau_node.cpp
+           otau_node.cpp \
+           otau_activation.cpp \
+           otau_campaign.cpp \
+           otau_config.cpp \
+           otau_file_writer.cpp \
+           otau_health.cpp \
+           otau_image_store.cpp \
+           otau_inventory.cpp \
+           otau_journal.cpp \
+           otau_latency.cpp \
+           otau_memory.cpp \
+           otau_source_list.cpp \
+           otau_topology.cpp \
+           otau_trace.cpp \
+           otau_transport.cpp
 
 win32:DESTDIR  = ../../debug/plugins # TODO adjust
 unix:DESTDIR  = ..
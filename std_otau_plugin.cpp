@@ -1,9 +1,15 @@
+#include <QDateTime>
 #include <QDebug>
 #include <QDir>
+#include <QHash>
 #include <QSettings>
 #include <QtPlugin>
+#include <QTime>
 #include <QTimer>
+#include <algorithm>
+#include <limits>
 #include <stdint.h>
+#include <vector>
 #include "std_otau_plugin.h"
 #include "std_otau_widget.h"
 #include "otau_file.h"
@@ -79,12 +85,35 @@
 #define MAX_ACTIVITY   120 // hits 0 after 5 seconds
 #define MAX_IMG_PAGE_REQ_RETRY   5
 #define MAX_IMG_BLOCK_RSP_RETRY   10
-#define WAIT_NEXT_REQUEST_TIMEOUT 60000
 #define INVALID_APS_REQ_ID (0xff + 1) // request ids are 8-bit
 
-#define FAST_PAGE_SPACEING 25
-#define MIN_PAGE_SPACEING 20
-#define MAX_PAGE_SPACEING 3000
+#define PREFETCH_TIMER_DELAY      (10 * 60 * 1000) // check every 10 minutes if a prefetch is due
+#define PREFETCH_DOWNLOAD_SPACING 5000 // ms between two prefetched files, keeps bandwidth low
+#define DEFAULT_PREFETCH_INTERVAL (12 * 60) // minutes
+#define DEFAULT_PREFETCH_QUIET_START 2 // hour
+#define DEFAULT_PREFETCH_QUIET_END   5 // hour
+#define DEFAULT_PREFETCH_MAX_KB      (8 * 1024)
+#define GC_RETRY_DELAY               (60 * 1000) // continue garbage collection of superseded images
+#define DEFAULT_KEEP_VERSIONS        3
+#define MAX_DOWNLOAD_FILE_SIZE       (1 << 21) // 2 MB, should be plenty enough
+#define DOWNLOAD_TIMEOUT             20000
+#define DEFAULT_MEMORY_BUDGET_MB     32 // image data held in RAM
+#define MEMORY_IDLE_TIMEOUT          (60 * 1000) // ms without activity before image data of a node can be evicted
+#define CONFIG_RELOAD_INTERVAL       5000 // ms between checks if the settings file changed
+#define EVENT_DUMP_MIN_INTERVAL      (10 * 60) // seconds between two automatic protocol event dumps
+#define MAX_IMAGE_NOTIFY_BROADCASTS  3 // targeted image notify broadcasts per request
+#define JOURNAL_SAVE_INTERVAL        (30 * 1000) // ms between transfer journal updates
+#define JOURNAL_RESTORE_TIMEOUT      (60 * 60 * 1000) // ms after startup until unclaimed journal entries are dropped
+#define INVENTORY_MAX_AGE            (90 * 24 * 3600) // seconds since a node was last seen until it's dropped from the inventory
+#define PROGRESS_NOTIFY_INTERVAL     (10 * 1000) // ms between two progress notifies of a node
+#define PAUSE_REQUEST_DELAY          60 // seconds a paused node waits before it asks again
+#define BUSY_REQUEST_DELAY           30 // seconds a node waits before it asks again while the network is busy
+#define BUSY_SPACING_FACTOR          4 // page response spacing multiplier while the network is degraded
+#define TOPOLOGY_REFRESH_INTERVAL    (60 * 1000) // ms between two scans of the neighbour tables
+#define AVAILABLE_NOTIFY_DELAY       500 // ms to coalesce availability changes into one notify per node
+#define CAMPAIGN_TIMER_INTERVAL      1000 // ms between campaign steps
+#define CAMPAIGN_START_DELAY         (5 * 60 * 1000) // ms after startup to learn the nodes before a campaign starts
+
 
 #define OTA_TIME_INFINITE                      0xFFFFFFFFUL
 #define DONT_CARE_FILE_VERSION                 0xFFFFFFFFUL
@@ -136,9 +165,21 @@ const deCONZ::SimpleDescriptor *getSimpleDescriptor(const deCONZ::Node *node, qu
 #define AM_ACTOR_ID_CORE_APS    2005
 
 #define OTA_M_ID_OTA_AVAILABLE_NOTIFY AM_MESSAGE_ID_SPECIFIC_NOTIFY(0x0001)
+#define OTA_M_ID_AVAILABILITY_REQ     AM_MESSAGE_ID_SPECIFIC_REQUEST(0x0002)
+#define OTA_M_ID_AVAILABILITY_RSP     AM_MESSAGE_ID_SPECIFIC_RESPONSE(0x0002)
+
+#define OTA_M_ID_CONTROL_REQ          AM_MESSAGE_ID_SPECIFIC_REQUEST(0x0003)
+#define OTA_M_ID_CONTROL_RSP          AM_MESSAGE_ID_SPECIFIC_RESPONSE(0x0003)
+#define OTA_M_ID_PROGRESS_NOTIFY      AM_MESSAGE_ID_SPECIFIC_NOTIFY(0x0004)
+#define OTA_M_ID_COMPLETE_NOTIFY      AM_MESSAGE_ID_SPECIFIC_NOTIFY(0x0005)
+
+#define OTA_AVAILABILITY_MAX_ENTRIES  32 // per response message, larger networks are read in pages
+#define OTA_VFS_NODES_PAGE_SIZE       64 // addresses per read of the nodes entry
 
 static struct am_actor am_actor_ota0;
 struct am_api_functions *am = nullptr;
+static StdOtauPlugin *otauPlugin = nullptr; // for VFS requests
+static StdOtauPlugin *downloadPlugin = nullptr; // receives the downloader callbacks
 
 static int OTA_ReadEntryRequest(struct am_message *msg)
 {
@@ -149,6 +190,7 @@ static int OTA_ReadEntryRequest(struct am_message *msg)
 
     uint32_t mode = 0;
     uint64_t mtime = 0;
+    OtauVfsValue val;
 
     tag = am->msg_get_u16(msg);
     url = am->msg_get_string(msg);
@@ -170,6 +212,30 @@ static int OTA_ReadEntryRequest(struct am_message *msg)
         am->msg_put_u64(m, mtime);
         am->msg_put_cstring(m, "ota");
     }
+    else if (otauPlugin && otauPlugin->vfsRead(QByteArray::fromRawData(reinterpret_cast<const char*>(url.data), static_cast<int>(url.size)), &val))
+    {
+        if (val.type == OtauVfsValue::TypeString)
+        {
+            am->msg_put_cstring(m, "str");
+            am->msg_put_u32(m, mode);
+            am->msg_put_u64(m, mtime);
+            am->msg_put_cstring(m, val.str.constData());
+        }
+        else if (val.type == OtauVfsValue::TypeU64)
+        {
+            am->msg_put_cstring(m, "u64");
+            am->msg_put_u32(m, mode);
+            am->msg_put_u64(m, mtime);
+            am->msg_put_u64(m, val.num);
+        }
+        else
+        {
+            am->msg_put_cstring(m, "u32");
+            am->msg_put_u32(m, mode);
+            am->msg_put_u64(m, mtime);
+            am->msg_put_u32(m, static_cast<uint32_t>(val.num));
+        }
+    }
     else
     {
         m->pos = 0;
@@ -189,11 +255,129 @@ static int OTA_ReadEntryRequest(struct am_message *msg)
     return AM_CB_STATUS_OK;
 }
 
+/*! Reports the update availability of all nodes in one response.
+
+    Request: u16 tag, u16 start index
+    Response: u16 tag, u8 status, u16 total nodes, u16 count, then count times
+              u64 ext, u16 mfcode, u16 image type, u32 sw version, u16 hw version, u8 permit, u32 newest file version (0 if none)
+
+    Subscribers read further pages while start + count < total.
+ */
+static int OTA_AvailabilityRequest(struct am_message *msg)
+{
+    struct am_message *m;
+
+    const uint16_t tag = am->msg_get_u16(msg);
+    const uint16_t start = am->msg_get_u16(msg);
+
+    if (msg->status != AM_MSG_STATUS_OK)
+        return AM_CB_STATUS_INVALID;
+
+    m = am->msg_alloc();
+    if (!m)
+        return AM_CB_STATUS_MESSAGE_ALLOC_FAILED;
+
+    std::vector<OtauAvailability> nodes;
+    if (otauPlugin)
+    {
+        otauPlugin->availability(&nodes);
+    }
+
+    const size_t begin = std::min(size_t(start), nodes.size());
+    const size_t end = std::min(begin + OTA_AVAILABILITY_MAX_ENTRIES, nodes.size());
+
+    am->msg_put_u16(m, tag);
+    am->msg_put_u8(m, AM_RESPONSE_STATUS_OK);
+    am->msg_put_u16(m, static_cast<unsigned short>(nodes.size()));
+    am->msg_put_u16(m, static_cast<unsigned short>(end - begin));
+
+    for (size_t i = begin; i < end; i++)
+    {
+        const OtauAvailability &a = nodes[i];
+        am->msg_put_u64(m, (am_u64)a.extAddr);
+        am->msg_put_u16(m, a.manufacturerCode);
+        am->msg_put_u16(m, a.imageType);
+        am->msg_put_u32(m, a.swVersion);
+        am->msg_put_u16(m, a.hwVersion);
+        am->msg_put_u8(m, a.permitUpdate);
+        am->msg_put_u32(m, a.fileVersion);
+    }
+
+    m->src = msg->dst;
+    m->dst = msg->src;
+    m->id = OTA_M_ID_AVAILABILITY_RSP;
+    am->send_message(m);
+
+    return AM_CB_STATUS_OK;
+}
+
+/*! Controls transfers without the widget.
+
+    Request: u16 tag, u8 command, u8 target, then depending on the target
+             u64 ext (node) or u16 mfcode, u16 image type (model) or nothing (all),
+             the select image command appends the SHA-512 of the image as hex string
+    Response: u16 tag, u8 status, u16 affected nodes
+
+    See OtauControl for the command and target values. Progress of the transfers is published
+    with OTA_M_ID_PROGRESS_NOTIFY, the result with OTA_M_ID_COMPLETE_NOTIFY.
+ */
+static int OTA_ControlRequest(struct am_message *msg)
+{
+    struct am_message *m;
+    OtauControl ctl;
+
+    const uint16_t tag = am->msg_get_u16(msg);
+    ctl.command = am->msg_get_u8(msg);
+    ctl.target = am->msg_get_u8(msg);
+
+    if (ctl.target == OtauControl::TargetNode)
+    {
+        ctl.extAddr = am->msg_get_u64(msg);
+    }
+    else if (ctl.target == OtauControl::TargetModel)
+    {
+        ctl.manufacturerCode = am->msg_get_u16(msg);
+        ctl.imageType = am->msg_get_u16(msg);
+    }
+
+    if (ctl.command == OtauControl::CommandSelectImage)
+    {
+        const am_string digest = am->msg_get_string(msg);
+        ctl.sha512 = QByteArray::fromHex(QByteArray(reinterpret_cast<const char*>(digest.data), static_cast<int>(digest.size)));
+    }
+
+    if (msg->status != AM_MSG_STATUS_OK)
+        return AM_CB_STATUS_INVALID;
+
+    m = am->msg_alloc();
+    if (!m)
+        return AM_CB_STATUS_MESSAGE_ALLOC_FAILED;
+
+    const int count = otauPlugin ? otauPlugin->control(ctl) : -1;
+
+    am->msg_put_u16(m, tag);
+    am->msg_put_u8(m, count > 0 ? AM_RESPONSE_STATUS_OK : AM_RESPONSE_STATUS_NOT_FOUND);
+    am->msg_put_u16(m, static_cast<unsigned short>(std::max(count, 0)));
+
+    m->src = msg->dst;
+    m->dst = msg->src;
+    m->id = OTA_M_ID_CONTROL_RSP;
+    am->send_message(m);
+
+    return AM_CB_STATUS_OK;
+}
+
 static int OTA0_MessageCallback(struct am_message *msg)
 {
     if (msg->id == VFS_M_ID_READ_ENTRY_REQ)
         return OTA_ReadEntryRequest(msg);
 
+    if (msg->id == OTA_M_ID_AVAILABILITY_REQ)
+        return OTA_AvailabilityRequest(msg);
+
+    if (msg->id == OTA_M_ID_CONTROL_REQ)
+        return OTA_ControlRequest(msg);
+
     return AM_CB_STATUS_UNSUPPORTED;
 }
 
@@ -279,6 +463,49 @@ static void U_sstream_put_hex_u16(U_SStream *ss, uint16_t value)
     U_sstream_put_hex(ss, &b, 2);
 }
 
+/*! Writes the lower case hex string of a SHA-512 hash into \p str (at least 129 bytes).
+ */
+static void sha512ToHex(const uint8_t *sha512, char *str, unsigned maxlen)
+{
+    U_SStream ssha;
+    U_sstream_init(&ssha, str, maxlen);
+    U_sstream_put_hex(&ssha, sha512, U_SHA512_HASH_SIZE);
+    for (unsigned i = 0; i < ssha.pos; i++) // to lower
+    {
+        char ch = ssha.str[i];
+        if (ch >= 'A' && ch <= 'Z')
+            ch += (char)('a' - 'A');
+        ssha.str[i] = ch;
+    }
+}
+
+/*! Returns the url of a file on a mirror.
+    The path below the "images/" directory of the original url is appended to the mirror base url,
+    if there is no such directory only the file name is used.
+ */
+static QString mirrorFileUrl(const QString &base, const std::string &url)
+{
+    const QString orig = QString::fromStdString(url);
+    QString rel;
+
+    int pos = orig.indexOf(QLatin1String("/images/"));
+    if (pos >= 0)
+    {
+        rel = orig.mid(pos + 8); // strlen("/images/")
+    }
+    else
+    {
+        rel = orig.mid(orig.lastIndexOf('/') + 1);
+    }
+
+    if (base.endsWith('/'))
+    {
+        return base + rel;
+    }
+
+    return base + '/' + rel;
+}
+
 static void U_sstream_put_hex_u32(U_SStream *ss, uint32_t value)
 {
     const uint8_t b[4] = {
@@ -291,15 +518,34 @@ static void U_sstream_put_hex_u32(U_SStream *ss, uint32_t value)
     U_sstream_put_hex(ss, &b, 4);
 }
 
+static OtauTransport defaultTransport;
+
 /*! The constructor.
  */
 StdOtauPlugin::StdOtauPlugin(QObject *parent) :
     QObject(parent)
 {
+    m_startupClock.start();
+    qint64 phaseStart = 0;
+    auto endPhase = [this, &phaseStart](qint64 *us)
+    {
+        const qint64 now = m_startupClock.nsecsElapsed() / 1000;
+        *us = now - phaseStart;
+        phaseStart = now;
+    };
+
     m_state = StateEnabled;
     m_w = nullptr;
+    m_transport = &defaultTransport;
+    m_eventRing.reset(new OtauEventRing);
+    m_eventRingStart = m_transport->steadyTime().ref;
+    m_latencyClock.start();
+#ifdef USE_ACTOR_MODEL
+    otauPlugin = this;
+#endif
+    downloadPlugin = this;
     m_srcEndpoint = 0x01; // TODO: ask from controller
-    m_model = new OtauModel(this);
+    m_model = new OtauModel(m_transport, this);
     m_imagePageTimer = new QTimer(this);
     m_maxAsduDataSize = MAX_ASDU_SIZE;
     m_nNoAckErrors = 0;
@@ -323,11 +569,23 @@ StdOtauPlugin::StdOtauPlugin(QObject *parent) :
     connect(m_activityTimer, SIGNAL(timeout()),
             this, SLOT(activityTimerFired()));
 
+    m_availableNotifyTimer = new QTimer(this);
+    m_availableNotifyTimer->setSingleShot(true);
+    connect(m_availableNotifyTimer, SIGNAL(timeout()),
+            this, SLOT(availableNotifyTimerFired()));
+
     m_downloadTimer = new QTimer(this);
     m_downloadTimer->setSingleShot(true);
     connect(m_downloadTimer, SIGNAL(timeout()),
             this, SLOT(downloadTimerFired()));
 
+    m_prefetchTimer = new QTimer(this);
+    m_prefetchTimer->setSingleShot(true);
+    connect(m_prefetchTimer, SIGNAL(timeout()),
+            this, SLOT(prefetchTimerFired()));
+
+    endPhase(&m_startup.setupUs);
+
     QString defaultImgPath = deCONZ::getStorageLocation(deCONZ::HomeLocation) + "/otau";
     m_imgPath = deCONZ::appArgumentString("--otau-img-path", defaultImgPath);
 
@@ -350,35 +608,51 @@ StdOtauPlugin::StdOtauPlugin(QObject *parent) :
         DBG_Printf(DBG_OTA, "OTAU: image path: %s\n", qPrintable(m_imgPath));
     }
 
+    // each distinct image is stored once, files in the image directories are hard links
+    m_imageStore.setStorePath(deCONZ::getStorageLocation(deCONZ::ApplicationsDataLocation) + "/ota_store");
+    endPhase(&m_startup.pathsUs);
+
+    m_gcTimer = new QTimer(this);
+    m_gcTimer->setSingleShot(true);
+    m_gcTimer->setInterval(GC_RETRY_DELAY);
+    connect(m_gcTimer, SIGNAL(timeout()),
+            this, SLOT(createLocalFileIndex()));
+
     deCONZ::ApsController *apsCtrl = deCONZ::ApsController::instance();
 
-    connect(apsCtrl, SIGNAL(apsdeDataConfirm(deCONZ::ApsDataConfirm)),
-            this, SLOT(apsdeDataConfirm(deCONZ::ApsDataConfirm)));
+    if (apsCtrl) // not present when driven by the loopback benchmark
+    {
+        connect(apsCtrl, SIGNAL(apsdeDataConfirm(deCONZ::ApsDataConfirm)),
+                this, SLOT(apsdeDataConfirm(deCONZ::ApsDataConfirm)));
 
-    connect(apsCtrl, SIGNAL(apsdeDataIndication(deCONZ::ApsDataIndication)),
-            this, SLOT(apsdeDataIndication(deCONZ::ApsDataIndication)));
+        connect(apsCtrl, SIGNAL(apsdeDataIndication(deCONZ::ApsDataIndication)),
+                this, SLOT(apsdeDataIndication(deCONZ::ApsDataIndication)));
 
-    connect(apsCtrl, SIGNAL(nodeEvent(deCONZ::NodeEvent)),
-            this, SLOT(nodeEvent(deCONZ::NodeEvent)));
+        connect(apsCtrl, SIGNAL(nodeEvent(deCONZ::NodeEvent)),
+                this, SLOT(nodeEvent(deCONZ::NodeEvent)));
+    }
+    endPhase(&m_startup.connectUs);
 
 
     QSettings config(deCONZ::getStorageLocation(deCONZ::ConfigLocation), QSettings::IniFormat);
 
-    // fast page spacing
-    bool ok = false;
-    m_fastPageSpaceing = FAST_PAGE_SPACEING;
-    if (config.contains("otau/fast-page-spacing"))
-    {
-        int sp = config.value("otau/fast-page-spacing", FAST_PAGE_SPACEING).toInt(&ok);
-        if (ok && sp >= MIN_PAGE_SPACEING && sp < MAX_PAGE_SPACEING)
-        {
-            m_fastPageSpaceing = sp;
-        }
-    }
+    // transfer settings, the widget is an optional view of them
+    m_config.load(config.fileName());
+    m_configTimer = new QTimer(this);
+    m_configTimer->setSingleShot(false);
+    connect(m_configTimer, SIGNAL(timeout()),
+            this, SLOT(configTimerFired()));
+    m_configTimer->start(CONFIG_RELOAD_INTERVAL);
 
-    if (!ok)
+    m_campaignTimer = new QTimer(this);
+    m_campaignTimer->setSingleShot(false);
+    connect(m_campaignTimer, SIGNAL(timeout()),
+            this, SLOT(campaignTimerFired()));
+    connect(this, SIGNAL(configChanged()),
+            this, SLOT(restartCampaign()));
+    if (m_config.campaign().enabled)
     {
-        config.setValue("otau/fast-page-spacing", m_fastPageSpaceing);
+        m_campaignTimer->start(CAMPAIGN_TIMER_INTERVAL);
     }
 
     if (config.contains("otau/online-enabled"))
@@ -394,1430 +668,3175 @@ StdOtauPlugin::StdOtauPlugin(QObject *parent) :
         m_downloadIndexUrl = config.value("otau/online-url", m_downloadIndexUrl).toString();
     }
 
-    createLocalFileIndex();
-}
-
-/*! APSDE-DATA.indication callback.
-    \param ind - the indication primitive
-    \note Will be called from the main application for each incoming indication.
-    Any filtering for nodes, profiles, clusters must be handled by this plugin.
- */
-void StdOtauPlugin::apsdeDataIndication(const deCONZ::ApsDataIndication &ind)
-{
-    deCONZ::ApsController *apsCtrl = deCONZ::ApsController::instance();
-    if (!apsCtrl)
+    // optional fallback index sources and mirror base urls for the image files
     {
-        return;
-    }
+        QStringList indexUrls;
+        if (!m_downloadIndexUrl.isEmpty())
+        {
+            indexUrls.append(m_downloadIndexUrl);
+        }
 
-    if (apsCtrl->getParameter(deCONZ::ParamOtauActive) == 0)
-    {
-        setState(StateDisabled);
+        for (const QString &url : config.value("otau/online-urls").toStringList())
+        {
+            if (!url.isEmpty() && !indexUrls.contains(url))
+            {
+                indexUrls.append(url);
+            }
+        }
+
+        QStringList fileUrls;
+        fileUrls.append(QLatin1String("origin")); // placeholder for the url given in the index
+
+        for (const QString &url : config.value("otau/mirror-urls").toStringList())
+        {
+            if (!url.isEmpty() && !fileUrls.contains(url))
+            {
+                fileUrls.append(url);
+            }
+        }
 
+        m_indexSources.setUrls(indexUrls);
+        m_fileSources.setUrls(fileUrls);
     }
-    else if (state() == StateDisabled)
+
+    // background prefetch, only active when online downloads are enabled
+    m_prefetchInterval = config.value("otau/prefetch-interval", DEFAULT_PREFETCH_INTERVAL).toInt();
+    m_prefetchQuietStart = config.value("otau/prefetch-quiet-start", DEFAULT_PREFETCH_QUIET_START).toInt();
+    m_prefetchQuietEnd = config.value("otau/prefetch-quiet-end", DEFAULT_PREFETCH_QUIET_END).toInt();
+    m_prefetchMaxBytes = config.value("otau/prefetch-max-kb", DEFAULT_PREFETCH_MAX_KB).toLongLong() * 1024;
+
+    if (m_prefetchQuietStart < 0 || m_prefetchQuietStart > 23)
     {
-        setState(StateEnabled);
+        m_prefetchQuietStart = DEFAULT_PREFETCH_QUIET_START;
     }
 
-    if (ind.profileId() == ZDP_PROFILE_ID && ind.clusterId() == ZDP_MATCH_DESCRIPTOR_CLID)
+    if (m_prefetchQuietEnd < 0 || m_prefetchQuietEnd > 23)
     {
-        matchDescriptorRequest(ind);
+        m_prefetchQuietEnd = DEFAULT_PREFETCH_QUIET_END;
     }
 
-    if (ind.clusterId() != OTAU_CLUSTER_ID)
+    if (m_prefetchInterval > 0)
     {
-        return;
+        m_prefetchTimer->start(PREFETCH_TIMER_DELAY);
     }
 
-    deCONZ::ZclFrame zclFrame;
-
-    QDataStream stream(ind.asdu());
-    stream.setByteOrder(QDataStream::LittleEndian);
-    zclFrame.readFromStream(stream);
-
-    // filter
-    if (zclFrame.isClusterCommand())
-    {
-        switch (zclFrame.commandId())
-        {
-        case OTAU_QUERY_NEXT_IMAGE_REQUEST_CMD_ID:
-        case OTAU_IMAGE_BLOCK_REQUEST_CMD_ID:
-        case OTAU_IMAGE_PAGE_REQUEST_CMD_ID:
-        case OTAU_UPGRADE_END_REQUEST_CMD_ID:
-            m_cleanupTimer->stop();
-            m_cleanupTimer->start();
-            break;
+    // retention of downloaded images, superseded versions are removed
+    m_retention.keepVersions = config.value("otau/keep-versions", DEFAULT_KEEP_VERSIONS).toInt();
+    m_retention.diskBudget = config.value("otau/disk-budget-mb", 0).toLongLong() * 1024 * 1024;
+    m_retention.pinned = config.value("otau/pinned").toStringList();
 
-        default:
-            return;
-        }
-    }
-    else
+    if (m_retention.keepVersions < 1)
     {
-        if (zclFrame.commandId() == deCONZ::ZclDefaultResponseId)
-        {
-            switch (zclFrame.defaultResponseCommandId())
-            {
-            case OTAU_QUERY_NEXT_IMAGE_REQUEST_CMD_ID:
-            case OTAU_QUERY_NEXT_IMAGE_RESPONSE_CMD_ID:
-            case OTAU_IMAGE_BLOCK_REQUEST_CMD_ID:
-            case OTAU_IMAGE_BLOCK_RESPONSE_CMD_ID:
-            case OTAU_IMAGE_PAGE_REQUEST_CMD_ID:
-            case OTAU_UPGRADE_END_REQUEST_CMD_ID:
-            case OTAU_UPGRADE_END_RESPONSE_CMD_ID:
-                DBG_Printf(DBG_OTA, "OTAU: " FMT_MAC " default rsp cmd: 0x%02X, status 0x%02X, seq: %u\n", FMT_MAC_CAST(ind.srcAddress().ext()), zclFrame.defaultResponseCommandId(), (uint8_t)zclFrame.defaultResponseStatus(), zclFrame.sequenceNumber());
-                break;
-
-            default:
-                break;
-            }
-            return;
-        }
+        m_retention.keepVersions = 1;
     }
 
-    bool create = true;
-    OtauNode *node = m_model->getNode(ind.srcAddress(), create);
+    // image data held in RAM, idle nodes release theirs when exceeded
+    m_memory.setBudget(config.value("otau/memory-budget-mb", DEFAULT_MEMORY_BUDGET_MB).toLongLong() * 1024 * 1024);
 
-    if (!node)
+    // binary capture of all OTA related APS traffic for offline replay
+    const QString tracePath = deCONZ::appArgumentString("--otau-trace", QString());
+    if (!tracePath.isEmpty())
     {
-        return;
+        m_trace.open(tracePath, m_transport->steadyTime().ref);
     }
+    endPhase(&m_startup.settingsUs);
 
-    node->lastActivity.invalidate();
-    node->lastActivity.start();
-    if (!zclFrame.isDefaultResponse())
-    {
-        node->setLastZclCommand(zclFrame.commandId());
-    }
+    createLocalFileIndex();
 
-    // filter
-    if (zclFrame.isClusterCommand())
-    {
-        switch (zclFrame.commandId())
-        {
-        case OTAU_QUERY_NEXT_IMAGE_REQUEST_CMD_ID:
-            queryNextImageRequest(ind, zclFrame);
-            break;
+    // transfers which were running before the last shutdown
+    m_journalPath = deCONZ::getStorageLocation(deCONZ::ApplicationsDataLocation) + "/ota_journal.txt";
+    loadJournal();
 
-        case OTAU_IMAGE_BLOCK_REQUEST_CMD_ID:
-            imageBlockRequest(ind, zclFrame);
-            break;
+    // known nodes of the last run, so that pending updates are known before the nodes query again
+    m_inventoryPath = deCONZ::getStorageLocation(deCONZ::ApplicationsDataLocation) + "/ota_inventory.txt";
+    loadInventory();
 
-        case OTAU_IMAGE_PAGE_REQUEST_CMD_ID:
-            imagePageRequest(ind, zclFrame);
-            break;
+    m_journalTimer = new QTimer(this);
+    m_journalTimer->setSingleShot(false);
+    connect(m_journalTimer, SIGNAL(timeout()),
+            this, SLOT(journalTimerFired()));
+    m_journalTimer->start(JOURNAL_SAVE_INTERVAL);
 
-        case OTAU_UPGRADE_END_REQUEST_CMD_ID:
-            upgradeEndRequest(ind, zclFrame);
-            break;
+    m_startup.totalUs = m_startupClock.nsecsElapsed() / 1000;
+    printStartupTiming();
+}
 
-        default:
-            break;
-        }
+StdOtauPlugin::~StdOtauPlugin()
+{
+    saveJournal();
+    saveInventory();
+    downloadCancelAttempts();
+
+    if (downloadPlugin == this)
+    {
+        downloadPlugin = nullptr;
     }
 
-    m_model->nodeDataUpdate(node);
+#ifdef USE_ACTOR_MODEL
+    if (otauPlugin == this)
+    {
+        otauPlugin = nullptr;
+    }
+#endif
 }
 
-/*! APSDE-DATA.confirm callback.
-    \param conf - the confirm primitive
-    \note Will be called from the main application for each incoming confirmation,
-    even if the APSDE-DATA.request was not issued by this plugin.
+/*! Reads an entry of the read-only OTA actor VFS.
+
+    Global counters are under stats/, per node values under nodes/<mac>/ where mac is
+    the 16 digit hex address as listed in the nodes entry. The nodes entry holds up to
+    OTA_VFS_NODES_PAGE_SIZE addresses, further pages are read as "nodes?start=<index>".
+
+    \param path - the entry path, e.g. "nodes/00212effff001234/offset"
+    \param value - receives the value
+    \return true if the entry exists
  */
-void StdOtauPlugin::apsdeDataConfirm(const deCONZ::ApsDataConfirm &conf)
+bool StdOtauPlugin::vfsRead(const QByteArray &path, OtauVfsValue *value)
 {
-    if (!conf.dstAddress().isNwkUnicast())
-        return;
+    std::vector<OtauNode*> &nodes = m_model->nodes();
 
-    OtauNode *node = m_model->getNode(conf.dstAddress());
-
-    if (node)
+    if (path.startsWith("stats/"))
     {
-        if (node->state() == OtauNode::NodeAbort)
-        {
-            return;
-        }
+        const QByteArray key = path.mid(6);
+        value->type = OtauVfsValue::TypeU32;
 
-        if (node->apsRequestId == INVALID_APS_REQ_ID)
-        { }
-        else if (node->apsRequestId == conf.id())
+        if (key == "active_transfers" || key == "queue_length")
         {
-            node->apsRequestId = INVALID_APS_REQ_ID;
-
-            if (conf.status() != deCONZ::ApsSuccessStatus)
+            unsigned active = 0;
+            unsigned queued = 0;
+            const auto now = m_transport->steadyTime();
+            for (OtauNode *node : nodes)
             {
-                DBG_Printf(DBG_OTA, "OTAU: aps conf failed status 0x%02X\n", conf.status());
-                // FIXME hack to detect source routing
-                // note that no ack doesn't always refer to source routing but this provides a safe fallback
-                if (conf.status() == deCONZ::ApsNoAckStatus  || conf.status() == 0xE5 /* ??? */)
+                if (node->status() == OtauNode::StatusUploading && isValid(node->lastActivity) && now.ref - node->lastActivity.ref < node->transferProfile().activityTimeoutMs)
                 {
-                    if (++m_nNoAckErrors > NO_ACK_THRESHOLD ||
-                        (node->zclCommandId == OTAU_IMAGE_BLOCK_RESPONSE_CMD_ID &&
-                         node->imgBlockReq.offset == 0)
-                       )
-                    {
-                        if (m_maxAsduDataSize > MAX_SAFE_ASDU_SIZE)
-                        {
-                            m_maxAsduDataSize = MAX_SAFE_ASDU_SIZE;
-                            DBG_Printf(DBG_OTA, "OTAU: reducing max data size to %d\n", MAX_DATA_SIZE);
-                        }
-                    }
+                    active++;
                 }
-                else
+                else if (node->permitUpdate() && node->hasData())
                 {
-                    m_nNoAckErrors = 0;
+                    queued++;
                 }
-                // End FIXME
+            }
+            value->num = key == "active_transfers" ? active : queued;
+        }
+        else if (key == "bytes_served")
+        {
+            value->type = OtauVfsValue::TypeU64;
+            value->num = m_bytesServed;
+        }
+        else if (key == "no_acks")
+        {
+            value->num = m_noAckCount;
+        }
+        else if (key == "index_size")
+        {
+            value->num = m_imageStore.entries().size();
+        }
+        else if (key == "pending_updates")
+        {
+            value->num = std::count_if(nodes.begin(), nodes.end(), [](OtauNode *n) { return n->updateVersion != 0; });
+        }
+        else if (key == "nodes")
+        {
+            value->num = nodes.size();
+        }
+        else if (key == "throughput")
+        {
+            value->num = m_model->totalRate(m_transport->steadyTime().ref);
+        }
+        else if (key == "pending_restarts")
+        {
+            value->num = m_activation.pending(m_transport->steadyTime().ref);
+        }
+        else if (key == "campaign_eta")
+        {
+            const OtauCampaignConfig &campaign = m_campaign.config();
+            const OtauImageEntry *image = m_campaign.state() == OtauCampaign::StateIdle ? nullptr : newestImage(campaign.manufacturerCode, campaign.imageType);
+            value->num = m_model->campaignEta(m_transport->steadyTime().ref, image ? &m_campaign : nullptr, image ? image->fileSize : 0);
+        }
+        else if (key == "confirm_failure_rate")
+        {
+            value->num = m_health.failurePercent();
+        }
+        else if (key == "confirm_latency")
+        {
+            value->num = m_health.latencyMs();
+        }
+        else if (key == "queue_full")
+        {
+            value->num = m_health.queueFull();
+        }
+        else if (key == "network_health")
+        {
+            value->type = OtauVfsValue::TypeString;
+            value->str = OtauConfirmHealth::levelName(m_health.level());
+        }
+        else if (key.startsWith("memory_"))
+        {
+            const OtauMemoryUsage &mem = updateMemoryUsage();
+            value->type = OtauVfsValue::TypeU64;
+
+            if (key == "memory_images")
+            {
+                value->num = mem.images;
+            }
+            else if (key == "memory_nodes")
+            {
+                value->num = mem.nodes;
+            }
+            else if (key == "memory_caches")
+            {
+                value->num = mem.caches;
+            }
+            else if (key == "memory_total")
+            {
+                value->num = mem.total();
+            }
+            else if (key == "memory_images_high_water")
+            {
+                value->num = m_memory.highWater().images;
+            }
+            else if (key == "memory_high_water")
+            {
+                value->num = m_memory.highWaterTotal();
+            }
+            else if (key == "memory_budget")
+            {
+                value->num = m_memory.budget();
             }
             else
             {
-                node->refreshTimeout();
+                return false;
+            }
+        }
+        else if (key.startsWith("bytes_written_") || key.startsWith("bytes_skipped_"))
+        {
+            const QByteArray cause = key.mid(14);
+            int i = 0;
 
-                if (node->zclCommandId == OTAU_IMAGE_BLOCK_RESPONSE_CMD_ID)
+            for (; i < OtauWriteCauseCount; i++)
+            {
+                if (cause == OtauFileWriter::causeName(OtauWriteCause(i)))
                 {
-                    node->imgBlockReq.pageBytesDone += node->imgBlockReq.maxDataSize;
-                    node->imgBlockReq.offset += node->imgBlockReq.maxDataSize;
-                    node->reqSequenceNumber++;
-
-                    if (node->state() == OtauNode::NodeWaitPageSpacing)
-                    {
-                        imagePageResponse(node);
-                    }
+                    break;
                 }
             }
 
-            if (node->zclCommandId == OTAU_UPGRADE_END_RESPONSE_CMD_ID)
+            if (i == OtauWriteCauseCount)
             {
-                if (conf.status() == deCONZ::ApsSuccessStatus)
-                {
-                    node->setHasData(false);
-                }
+                return false;
             }
+
+            const OtauFileWriter::Counters &cnt = m_fileWriter.counters(OtauWriteCause(i));
+            value->type = OtauVfsValue::TypeU64;
+            value->num = key.startsWith("bytes_written_") ? cnt.bytesWritten : cnt.bytesSkipped;
+        }
+        else
+        {
+            return false;
         }
+
+        return true;
     }
-}
 
-/*! Handler for node events.
-    \param event - the event which occured
- */
-void StdOtauPlugin::nodeEvent(const deCONZ::NodeEvent &event)
-{
-    if (event.event() != deCONZ::NodeEvent::NodeDeselected && !event.node())
-    {
-        return;
+    if (path.startsWith("startup/"))
+    {
+        const QByteArray key = path.mid(8);
+        const struct { const char *name; qint64 us; } phases[] = {
+            { "total_us", m_startup.totalUs },
+            { "setup_us", m_startup.setupUs },
+            { "paths_us", m_startup.pathsUs },
+            { "connect_us", m_startup.connectUs },
+            { "settings_us", m_startup.settingsUs },
+            { "enumerate_us", m_startup.enumerateUs },
+            { "read_us", m_startup.readUs },
+            { "parse_us", m_startup.parseUs },
+            { "hash_us", m_startup.hashUs },
+            { "gc_us", m_startup.gcUs },
+            { "index_build_us", m_startup.indexBuildUs },
+            { "index_write_us", m_startup.indexWriteUs },
+            { "first_query_us", m_startup.firstQueryUs }
+        };
+
+        for (const auto &phase : phases)
+        {
+            if (key == phase.name && phase.us >= 0)
+            {
+                value->type = OtauVfsValue::TypeU64;
+                value->num = static_cast<uint64_t>(phase.us);
+                return true;
+            }
+        }
+
+        return false;
     }
 
-    if (event.event() == deCONZ::NodeEvent::UpdatedSimpleDescriptor)
+    if (path.startsWith("campaign/"))
     {
-        checkIfNewOtauNode(event.node(), event.endpoint());
+        const QByteArray key = path.mid(9);
+
+        if (key == "state")
+        {
+            value->type = OtauVfsValue::TypeString;
+            value->str = OtauCampaign::stateName(m_campaign.state());
+            return true;
+        }
+
+        value->type = OtauVfsValue::TypeU32;
+
+        if (key == "wave")
+        {
+            value->num = m_campaign.state() == OtauCampaign::StateIdle ? 0 : m_campaign.wave() + 1;
+        }
+        else if (key == "waves")
+        {
+            value->num = m_campaign.waveCount();
+        }
+        else if (key == "nodes")
+        {
+            value->num = m_campaign.size();
+        }
+        else if (key == "pending")
+        {
+            value->num = m_campaign.count(OtauCampaign::MemberPending);
+        }
+        else if (key == "active")
+        {
+            value->num = m_campaign.count(OtauCampaign::MemberNotified) + m_campaign.count(OtauCampaign::MemberTransferring);
+        }
+        else if (key == "done")
+        {
+            value->num = m_campaign.count(OtauCampaign::MemberDone);
+        }
+        else if (key == "failed")
+        {
+            value->num = m_campaign.count(OtauCampaign::MemberFailed);
+        }
+        else
+        {
+            return false;
+        }
+
+        return true;
     }
-    else if (event.event() == deCONZ::NodeEvent::NodeSelected)
+
+    if (path == "nodes" || path.startsWith("nodes?start="))
     {
-        nodeSelected(event.node());
+        size_t begin = 0;
+        if (path.size() > 5)
+        {
+            bool ok = false;
+            begin = path.mid(12).toUInt(&ok);
+            if (!ok)
+            {
+                return false;
+            }
+        }
+
+        value->type = OtauVfsValue::TypeString;
+        value->str.clear();
+        const size_t end = std::min(begin + OTA_VFS_NODES_PAGE_SIZE, nodes.size());
+        for (size_t i = begin; i < end; i++)
+        {
+            if (!value->str.isEmpty())
+            {
+                value->str += ' ';
+            }
+            value->str += QByteArray::number(qulonglong(nodes[i]->address().ext()), 16).rightJustified(16, '0');
+        }
+        return true;
     }
-    else if (event.event() == deCONZ::NodeEvent::NodeDeselected)
+
+    if (!path.startsWith("nodes/") || path.size() < 24 || path.at(22) != '/')
     {
-        m_w->clearNode();
+        return false;
     }
-    else if (event.event() == deCONZ::NodeEvent::NodeRemoved)
+
+    bool ok = false;
+    deCONZ::Address addr;
+    addr.setExt(path.mid(6, 16).toULongLong(&ok, 16));
+    OtauNode *node = ok ? m_model->getNode(addr) : nullptr;
+
+    if (!node)
     {
-        // TODO: Remove node from model and tableview
+        return false;
     }
-}
 
-void StdOtauPlugin::nodeSelected(const deCONZ::Node *node)
-{
-    if (!m_model || m_model->nodes().empty())
+    const QByteArray key = path.mid(23);
+    const int64_t now = m_transport->steadyTime().ref;
+
+    value->type = OtauVfsValue::TypeU32;
+
+    if (key == "status")
     {
-        return;
+        value->type = OtauVfsValue::TypeString;
+        value->str = node->statusString().toUtf8();
     }
-    OtauNode *otauNode = m_model->getNode(node->address());
-    if (otauNode != nullptr)
+    else if (key == "state")
     {
-        m_selectedNodeAddress = node->address();
-        m_w->displayNode(otauNode, m_model->index(otauNode->row, 0));
+        value->num = node->state();
+    }
+    else if (key == "offset")
+    {
+        value->num = node->offset();
+    }
+    else if (key == "image_size")
+    {
+        value->num = node->file.totalImageSize;
+    }
+    else if (key == "block_size")
+    {
+        value->num = node->imgBlockReq.maxDataSize;
+    }
+    else if (key == "spacing")
+    {
+        value->num = node->imgBlockReq.responseSpacing;
+    }
+    else if (key == "retries")
+    {
+        value->num = node->imgBlockResponseRetry + node->imgPageRequestRetry;
+    }
+    else if (key == "throughput")
+    {
+        value->num = node->rate.bytesPerSecond(now); // bytes per second
+    }
+    else if (key == "eta")
+    {
+        value->num = node->eta(now); // seconds
+    }
+    else if (key == "sw_version")
+    {
+        value->num = node->softwareVersion();
+    }
+    else if (key == "update_version")
+    {
+        value->num = node->updateVersion;
+    }
+    else if (key == "last_seen")
+    {
+        value->type = OtauVfsValue::TypeU64;
+        value->num = static_cast<uint64_t>(node->lastSeen);
+    }
+    else if (key == "memory")
+    {
+        value->type = OtauVfsValue::TypeU64;
+        value->num = OtauMemoryMeter::nodeImageBytes(node);
+    }
+    else if (key == "parent" || key == "branch")
+    {
+        refreshTopology();
+        value->type = OtauVfsValue::TypeU64;
+        value->num = key == "parent" ? m_topology.parent(node->address().ext()) : m_topology.branch(node->address().ext());
     }
     else
     {
-        m_w->clearNode();
+        return false;
     }
-}
 
-/*! Checks if a new otau image for the node is available in the otau folder.
-    Otau images must be in the <otau> directory.
+    return true;
+}
 
-    \param node - the node for which the check will be done
+/*! APSDE-DATA.indication callback.
+    \param ind - the indication primitive
+    \note Will be called from the main application for each incoming indication.
+    Any filtering for nodes, profiles, clusters must be handled by this plugin.
  */
-bool StdOtauPlugin::checkForUpdateImageImage(OtauNode *node)
+void StdOtauPlugin::apsdeDataIndication(const deCONZ::ApsDataIndication &ind)
 {
-    deCONZ::ApsController *apsCtrl = deCONZ::ApsController::instance();
-    if (!apsCtrl)
+    if (!m_transport->isAvailable())
     {
-        return false;
+        return;
     }
 
-    // if (apsCtrl->getParameter(deCONZ::ParamOtauActive) == 0)
-    // {
-    //     return false;
-    // }
-
-    QString updateFile;
-    uint32_t cmpFileVersion = node->softwareVersion();
+    if (!m_transport->otauActive())
+    {
+        setState(StateDisabled);
 
-    if (!QFile::exists(m_localIndexPath))
-        return false;
+    }
+    else if (state() == StateDisabled)
+    {
+        setState(StateEnabled);
+    }
 
+    if (m_trace.isOpen() &&
+        (ind.clusterId() == OTAU_CLUSTER_ID || (ind.profileId() == ZDP_PROFILE_ID && ind.clusterId() == ZDP_MATCH_DESCRIPTOR_CLID)))
     {
-        QFile f(m_localIndexPath);
-        if (!f.open(QFile::ReadOnly))
-            return false;
+        m_trace.writeIndication(ind, m_transport->steadyTime().ref);
+    }
 
-        for (;;)
-        {
-            QByteArray line = f.readLine().trimmed(); // one json object per line
-            if (line.size() <= 0)
-                break;
+    if (ind.profileId() == ZDP_PROFILE_ID && ind.clusterId() == ZDP_MATCH_DESCRIPTOR_CLID)
+    {
+        matchDescriptorRequest(ind);
+    }
 
-            U_SStream ss;
-            U_sstream_init(&ss, line.data(), line.size());
+    if (ind.clusterId() != OTAU_CLUSTER_ID)
+    {
+        return;
+    }
 
-            if (U_sstream_peek_char(&ss) != '{')
-                continue;
+    m_indicationTimeUs = latencyClockUs();
 
-            uint32_t mfcode;
-            if (!jsonGetU32(ss, "manufacturerCode", &mfcode))
-                continue;
+    {
+        OtauEvent ev = {};
+        ev.type = OtauEventRx;
+        ev.extAddr = ind.srcAddress().hasExt() ? ind.srcAddress().ext() : 0;
+        ev.nwkAddr = ind.srcAddress().hasNwk() ? ind.srcAddress().nwk() : 0;
+        ev.profileId = ind.profileId();
+        ev.clusterId = ind.clusterId();
+        ev.srcEndpoint = ind.srcEndpoint();
+        ev.dstEndpoint = ind.dstEndpoint();
+        recordEvent(ev, ind.asdu());
+    }
 
-            if (mfcode != node->manufacturerId)
-                continue;
+    deCONZ::ZclFrame zclFrame;
 
-            uint32_t imageType;
-            if (!jsonGetU32(ss, "imageType", &imageType))
-                continue;
+    QDataStream stream(ind.asdu());
+    stream.setByteOrder(QDataStream::LittleEndian);
+    zclFrame.readFromStream(stream);
 
-            if (imageType != node->imageType())
-                continue;
-
-            uint32_t fileVersion;
-            if (!jsonGetU32(ss, "fileVersion", &fileVersion))
-                continue;
-
-            if (fileVersion <= cmpFileVersion)
-                continue;
+    // filter
+    if (zclFrame.isClusterCommand())
+    {
+        switch (zclFrame.commandId())
+        {
+        case OTAU_QUERY_NEXT_IMAGE_REQUEST_CMD_ID:
+        case OTAU_IMAGE_BLOCK_REQUEST_CMD_ID:
+        case OTAU_IMAGE_PAGE_REQUEST_CMD_ID:
+        case OTAU_UPGRADE_END_REQUEST_CMD_ID:
+            m_cleanupTimer->stop();
+            m_cleanupTimer->start();
+            break;
 
+        default:
+            return;
+        }
+    }
+    else
+    {
+        if (zclFrame.commandId() == deCONZ::ZclDefaultResponseId)
+        {
+            switch (zclFrame.defaultResponseCommandId())
             {
-                char path[2048];
-                if (!jsonGetString(ss, "path", path, sizeof(path)))
-                    continue;
-
-                updateFile = path;
-                if (QFile::exists(updateFile))
-                    break;
+            case OTAU_QUERY_NEXT_IMAGE_REQUEST_CMD_ID:
+            case OTAU_QUERY_NEXT_IMAGE_RESPONSE_CMD_ID:
+            case OTAU_IMAGE_BLOCK_REQUEST_CMD_ID:
+            case OTAU_IMAGE_BLOCK_RESPONSE_CMD_ID:
+            case OTAU_IMAGE_PAGE_REQUEST_CMD_ID:
+            case OTAU_UPGRADE_END_REQUEST_CMD_ID:
+            case OTAU_UPGRADE_END_RESPONSE_CMD_ID:
+                DBG_Printf(DBG_OTA, "OTAU: " FMT_MAC " default rsp cmd: 0x%02X, status 0x%02X, seq: %u\n", FMT_MAC_CAST(ind.srcAddress().ext()), zclFrame.defaultResponseCommandId(), (uint8_t)zclFrame.defaultResponseStatus(), zclFrame.sequenceNumber());
+                break;
 
-                updateFile = QString();
+            default:
+                break;
             }
-
-            if (ss.status != U_SSTREAM_OK)
-                continue;
+            return;
         }
     }
 
-    if (!updateFile.isEmpty())
-    {
-        OtauFileLoader ld;
+    bool create = true;
+    OtauNode *node = m_model->getNode(ind.srcAddress(), create);
 
-        if (ld.readFile(updateFile, node->file))
-        {
-            node->setHasData(true);
-            DBG_Printf(DBG_OTA, "OTAU: found update file %s\n", qPrintable(updateFile));
-        }
-        else
-        {
-            node->setHasData(false);
-            DBG_Printf(DBG_OTA, "OTAU: found invalid update file %s\n", qPrintable(updateFile));
-        }
+    if (!node)
+    {
+        return;
     }
 
-#ifdef USE_ACTOR_MODEL
-    if (am)
+    node->lastActivity = m_transport->steadyTime();
+    if (!zclFrame.isDefaultResponse())
     {
-        // broadcast OTA0 OTA_M_ID_OTA_AVAILABLE_NOTIFY message
-        struct am_message *m;
+        node->setLastZclCommand(zclFrame.commandId());
+    }
 
-        m = am->msg_alloc();
-        if (m)
+    // filter
+    if (zclFrame.isClusterCommand())
+    {
+        switch (zclFrame.commandId())
         {
-            m->src = AM_ACTOR_ID_OTA;
-            m->dst = AM_ACTOR_ID_SUBSCRIBERS;
-            m->id = OTA_M_ID_OTA_AVAILABLE_NOTIFY;
-
-            am->msg_put_u64(m, (am_u64)(node->address().ext()));
-            am->msg_put_u16(m, node->manufacturerId);
-            am->msg_put_u16(m, node->imageType());
-            am->msg_put_u32(m, node->softwareVersion());
-            am->msg_put_u16(m, (unsigned short)node->hardwareVersion());
-            am->msg_put_u8(m, node->permitUpdate());
+        case OTAU_QUERY_NEXT_IMAGE_REQUEST_CMD_ID:
+            queryNextImageRequest(ind, zclFrame);
+            recordLatency(node, OtauLatencyQueryNextImage, latencyClockUs() - m_indicationTimeUs);
+            break;
 
-            if (node->hasData())
-            {
-                am->msg_put_u16(m, 1); // count
-                am->msg_put_u32(m, node->file.fileVersion);
-            }
-            else
-            {
-                am->msg_put_u16(m, 0); // count
-            }
+        case OTAU_IMAGE_BLOCK_REQUEST_CMD_ID:
+            imageBlockRequest(ind, zclFrame);
+            break;
 
-            am->send_message(m);
-        }
-    }
-#endif // USE_ACTOR_MODEL
+        case OTAU_IMAGE_PAGE_REQUEST_CMD_ID:
+            imagePageRequest(ind, zclFrame);
+            break;
 
-    return node->hasData();
-}
+        case OTAU_UPGRADE_END_REQUEST_CMD_ID:
+            upgradeEndRequest(ind, zclFrame);
+            break;
 
-/*! Invalidates the upgrade end request.
- */
-void StdOtauPlugin::invalidateUpdateEndRequest(OtauNode *node)
-{
-    if (node)
-    {
-        if ((node->upgradeEndReq.fileVersion != 0) || (node->upgradeEndReq.manufacturerCode != 0))
-        {
-            DBG_Printf(DBG_OTA, "OTAU: invalid update end request for node " FMT_MAC "\n", FMT_MAC_CAST(node->address().ext()));
+        default:
+            break;
         }
-
-        node->upgradeEndReq.status = 0;
-        node->upgradeEndReq.manufacturerCode = 0;
-        node->upgradeEndReq.fileVersion = 0;
-        node->upgradeEndReq.imageType = 0;
     }
+
+    m_model->nodeDataUpdate(node);
 }
 
-/*! Handler to automatically send image page responses.
+/*! APSDE-DATA.confirm callback.
+    \param conf - the confirm primitive
+    \note Will be called from the main application for each incoming confirmation,
+    even if the APSDE-DATA.request was not issued by this plugin.
  */
-void StdOtauPlugin::imagePageTimerFired()
+void StdOtauPlugin::apsdeDataConfirm(const deCONZ::ApsDataConfirm &conf)
 {
-    if (!m_model || m_model->nodes().empty())
-    {
-        return;
-    }
-
-    deCONZ::ApsController *apsCtrl = deCONZ::ApsController::instance();
-    if (!apsCtrl)
-    {
+    if (!conf.dstAddress().isNwkUnicast())
         return;
-    }
 
-    if (apsCtrl->getParameter(deCONZ::ParamOtauActive) == 0)
-    {
-        return;
-    }
+    m_health.addConfirm(m_transport->steadyTime().ref, conf.status() == deCONZ::ApsSuccessStatus);
+    updateHealthState();
 
-    bool refire = false;
+    OtauNode *node = m_model->getNode(conf.dstAddress());
 
-    for (OtauNode *node : m_model->nodes())
+    if (node)
     {
-        if (!node)
-            continue;
+        if (m_trace.isOpen())
+        {
+            m_trace.writeConfirm(conf, m_transport->steadyTime().ref);
+        }
 
-        if (node->state() == OtauNode::NodeWaitPageSpacing)
         {
-            refire = true;
-            if (!imagePageResponse(node))
+            OtauEvent ev = {};
+            ev.type = OtauEventConfirm;
+            ev.extAddr = node->address().ext();
+            ev.nwkAddr = conf.dstAddress().nwk();
+            ev.srcEndpoint = conf.srcEndpoint();
+            ev.dstEndpoint = conf.dstEndpoint();
+            ev.apsId = conf.id();
+            ev.status = conf.status();
+            recordEvent(ev, QByteArray());
+        }
+
+        if (m_apsBlockSize[conf.id()] != 0)
+        {
+            if (conf.status() == deCONZ::ApsSuccessStatus)
             {
-                if (node->imgBlockResponseRetry >= MAX_IMG_BLOCK_RSP_RETRY)
-                {
-                    // giveup
-                    node->setState(OtauNode::NodeIdle);
-                }
+                node->rate.addBytes(m_apsBlockSize[conf.id()], m_transport->steadyTime().ref);
             }
+            m_apsBlockSize[conf.id()] = 0;
         }
-        else if (node->state() == OtauNode::NodeWaitNextRequest)
+
+        if (m_apsRequestTimeUs[conf.id()] != 0)
         {
-            refire = true;
+            const int64_t us = latencyClockUs() - m_apsRequestTimeUs[conf.id()];
+            recordLatency(node, OtauLatencyConfirm, us);
+            m_health.addLatency(m_transport->steadyTime().ref, us);
+            m_apsRequestTimeUs[conf.id()] = 0;
+        }
 
-            if (node->lastActivity.hasExpired(WAIT_NEXT_REQUEST_TIMEOUT))
+        if (node->state() == OtauNode::NodeAbort)
+        {
+            return;
+        }
+
+        if (node->apsRequestId == INVALID_APS_REQ_ID)
+        { }
+        else if (node->apsRequestId == conf.id())
+        {
+            node->apsRequestId = INVALID_APS_REQ_ID;
+
+            if (conf.status() != deCONZ::ApsSuccessStatus)
             {
-                node->imgPageRequestRetry++;
-                if (node->imgPageRequestRetry >= MAX_IMG_PAGE_REQ_RETRY)
+                if (DBG_IsEnabled(DBG_OTA))
                 {
-                    // giveup
-                    node->setState(OtauNode::NodeIdle);
+                    DBG_Printf(DBG_OTA, "OTAU: aps conf failed status 0x%02X\n", conf.status());
+                }
+                // FIXME hack to detect source routing
+                // note that no ack doesn't always refer to source routing but this provides a safe fallback
+                if (conf.status() == deCONZ::ApsNoAckStatus  || conf.status() == 0xE5 /* ??? */)
+                {
+                    m_noAckCount++;
+                    if (++m_nNoAckErrors > NO_ACK_THRESHOLD ||
+                        (node->zclCommandId == OTAU_IMAGE_BLOCK_RESPONSE_CMD_ID &&
+                         node->imgBlockReq.offset == 0)
+                       )
+                    {
+                        if (m_maxAsduDataSize > MAX_SAFE_ASDU_SIZE)
+                        {
+                            m_maxAsduDataSize = MAX_SAFE_ASDU_SIZE;
+                            DBG_Printf(DBG_OTA, "OTAU: reducing max data size to %d\n", MAX_DATA_SIZE);
+                        }
+                    }
                 }
                 else
                 {
-                    DBG_Printf(DBG_OTA, "OTAU: wait request timeout (retry %d)\n", node->imgPageRequestRetry);
-                    node->apsRequestId = INVALID_APS_REQ_ID; // don't wait for prior requests
+                    m_nNoAckErrors = 0;
+                }
+                // End FIXME
+            }
+            else
+            {
+                if (node->zclCommandId == OTAU_IMAGE_BLOCK_RESPONSE_CMD_ID)
+                {
+                    node->imgBlockReq.pageBytesDone += node->imgBlockReq.maxDataSize;
+                    node->imgBlockReq.offset += node->imgBlockReq.maxDataSize;
+                    node->reqSequenceNumber++;
 
-                    if (node->imgPageRequestRetry < 3)
+                    if (node->state() == OtauNode::NodeWaitPageSpacing)
                     {
-                        unicastImageNotify(node->address());
+                        imagePageResponse(node);
                     }
                 }
             }
-        }
-    }
 
-    if (refire && !m_imagePageTimer->isActive())
-    {
-        m_imagePageTimer->start(IMAGE_PAGE_TIMER_DELAY);
+            if (node->zclCommandId == OTAU_UPGRADE_END_RESPONSE_CMD_ID)
+            {
+                if (conf.status() == deCONZ::ApsSuccessStatus)
+                {
+                    node->setHasData(false);
+                }
+            }
+        }
     }
 }
 
-/*! Handler to cleanup timed out nodes.
+/*! Handler for node events.
+    \param event - the event which occured
  */
-void StdOtauPlugin::cleanupTimerFired()
+void StdOtauPlugin::nodeEvent(const deCONZ::NodeEvent &event)
 {
-    if (!m_model)
+    if (event.event() != deCONZ::NodeEvent::NodeDeselected && !event.node())
     {
         return;
     }
 
-    int activeNodes = 0;
-
-    std::vector<OtauNode*>::iterator i = m_model->nodes().begin();
-    std::vector<OtauNode*>::iterator end = m_model->nodes().end();
-
-    for (; i != end; ++i)
+    if (event.event() == deCONZ::NodeEvent::UpdatedSimpleDescriptor)
     {
-        OtauNode *node = *i;
-        if (node->hasData())
+        checkIfNewOtauNode(event.node(), event.endpoint());
+    }
+    else if (event.event() == deCONZ::NodeEvent::NodeSelected)
+    {
+        nodeSelected(event.node());
+    }
+    else if (event.event() == deCONZ::NodeEvent::NodeDeselected)
+    {
+        if (m_w)
         {
-            if (node->lastActivity.hasExpired(CLEANUP_DELAY))
-            {
-                node->file.subElements.clear();
-                node->setHasData(false);
-                DBG_Printf(DBG_OTA, "OTAU: cleanup node\n");
-            }
-            else
-            {
-                activeNodes++;
-            }
+            m_w->clearNode();
         }
     }
-
-    if (activeNodes)
+    else if (event.event() == deCONZ::NodeEvent::NodeRemoved)
     {
-        m_cleanupTimer->start();
+        // TODO: Remove node from model and tableview
     }
 }
 
-void StdOtauPlugin::activityTimerFired()
+void StdOtauPlugin::nodeSelected(const deCONZ::Node *node)
 {
-    const auto now = deCONZ::steadyTimeRef();
-
-    auto i = std::find_if(m_otauTracker.begin(), m_otauTracker.end(), [&](const OtauTracker &t)
+    if (!m_model || m_model->nodes().empty())
     {
-        return deCONZ::TimeSeconds{10} < (now - t.lastActivity);
-    });
-
-    if (i != m_otauTracker.end())
+        return;
+    }
+    OtauNode *otauNode = m_model->getNode(node->address());
+    if (otauNode != nullptr)
     {
-        m_otauTracker.erase(i);
+        m_selectedNodeAddress = node->address();
+        if (m_w)
+        {
+            m_w->displayNode(otauNode, m_model->index(otauNode->row, 0));
+        }
     }
-
-    if (m_otauTracker.empty())
+    else if (m_w)
     {
-        m_activityTimer->stop();
+        m_w->clearNode();
     }
 }
 
-void StdOtauPlugin::downloadCancelOrError()
-{
-    m_downloadState = DownloadStateInitial;
-}
+/*! Checks if a new otau image for the node is available in the otau folder.
+    Otau images must be in the <otau> directory.
 
-static void downloadIndexCallback(N_DownloadData *dd)
+    \param node - the node for which the check will be done
+ */
+bool StdOtauPlugin::checkForUpdateImageImage(OtauNode *node)
 {
-    StdOtauPlugin *q = static_cast<StdOtauPlugin*>(dd->user);
-    if (dd->status == N_DownloadDone)
-    {
-        q->downloadedStoreIndex(dd->data, dd->data_size);
-    }
-    else
+    if (!m_transport->isAvailable())
     {
-        DBG_Printf(DBG_ERROR, "OTAU: error downloading index file. status: %d\n", (int)dd->status);
-        q->downloadCancelOrError();
+        return false;
     }
-}
 
-static void downloadOtaFileCallback(N_DownloadData *dd)
-{
-    StdOtauPlugin *q = static_cast<StdOtauPlugin*>(dd->user);
-    if (dd->status == N_DownloadDone)
-    {
-        q->downloadedStoreOtaFile(dd->data, dd->data_size);
-    }
-    else
-    {
-        DBG_Printf(DBG_ERROR, "OTAU: error downloading index file. status: %d\n", (int)dd->status);
-        // let run into timeout and proceed
-    }
-}
+    // if (!m_transport->otauActive())
+    // {
+    //     return false;
+    // }
+
+    QString updateFile;
+    uint32_t updateFileVersion = 0;
+    uint32_t cmpFileVersion = node->softwareVersion();
+
+    if (!QFile::exists(m_localIndexPath))
+        return false;
 
-void StdOtauPlugin::downloadTimerFired()
-{
-    if (m_downloadState == DownloadStateRequestIndex)
     {
-        if (!m_downloadsEnabled)
-        {
-            downloadCancelOrError();
-            return;
-        }
+        QFile f(m_localIndexPath);
+        if (!f.open(QFile::ReadOnly))
+            return false;
 
-        if (m_downloadIndexUrl.size() == 0)
+        for (;;)
         {
-            downloadCancelOrError();
-            return;
-        }
+            QByteArray line = f.readLine().trimmed(); // one json object per line
+            if (line.size() <= 0)
+                break;
 
-        m_downloadIndexPath = deCONZ::getStorageLocation(deCONZ::ApplicationsDataLocation) + "/ota_remote_index.json";
+            U_SStream ss;
+            U_sstream_init(&ss, line.data(), line.size());
 
-        auto now = deCONZ::steadyTimeRef();
-        bool indexExists = QFile::exists(m_downloadIndexPath);
-        bool needRefresh = (!indexExists || !isValid(m_downloadIndexAge) || deCONZ::TimeSeconds{30 * 60} < (now - m_downloadIndexAge));
+            if (U_sstream_peek_char(&ss) != '{')
+                continue;
 
-        if (needRefresh)
-        {
-            unsigned maxFileSize = 1 << 21; // 2 MB, should be plenty enough
-            m_downloadHandle = N_Download(qPrintable(m_downloadIndexUrl), maxFileSize, downloadIndexCallback, this);
-            m_downloadState = DownloadStateWaitIndexResponse;
-            m_downloadTimer->start(20000);
-        }
-        else
-        {
-            m_downloadState = DownloadStateProcessIndex;
-            m_downloadTimer->start(50);
-        }
-    }
-    else if (m_downloadState == DownloadStateWaitIndexResponse)
-    {
-        DBG_Printf(DBG_ERROR, "OTAU: failed to download OTA index\n");
-        downloadCancelOrError();
-    }
-    else if (m_downloadState == DownloadStateProcessIndex)
-    {
-        struct KOP
-        {
-            uint16_t manufacturerCode;
-            uint16_t imageType;
-            uint32_t fileVersion;
-        };
+            uint32_t mfcode;
+            if (!jsonGetU32(ss, "manufacturerCode", &mfcode))
+                continue;
 
-        std::vector<KOP> known;
+            if (mfcode != node->manufacturerId)
+                continue;
 
-        m_downloadState = DownloadStateInitial;
+            uint32_t imageType;
+            if (!jsonGetU32(ss, "imageType", &imageType))
+                continue;
 
-        {
-            auto i = m_model->nodes().cbegin();
-            const auto iend = m_model->nodes().cend();
+            if (imageType != node->imageType())
+                continue;
+
+            uint32_t fileVersion;
+            if (!jsonGetU32(ss, "fileVersion", &fileVersion))
+                continue;
+
+            if (fileVersion <= cmpFileVersion)
+                continue;
+
+            if (!updateFile.isEmpty() && fileVersion <= updateFileVersion)
+                continue; // prefer the newest version
 
-            for (; i != iend; ++i)
             {
-                if ((*i)->manufacturerId == 0)
+                char path[2048];
+                if (!jsonGetString(ss, "path", path, sizeof(path)))
                     continue;
 
-                auto j = known.cbegin();
-                const auto jend = known.cend();
+                QString file = path;
 
-                for (; j != jend; ++j)
+                // the file might be gone but the store object still exists
+                if (!QFile::exists(file) && jsonGetString(ss, "store", path, sizeof(path)) && path[0] != '\0')
                 {
-                    if (j->manufacturerCode != (*i)->manufacturerId)
-                        continue;
-                    if (j->imageType != (*i)->imageType())
-                        continue;
-                    break;
+                    file = path;
                 }
 
-                if (j == jend)
+                if (QFile::exists(file))
                 {
-                    KOP entry;
-                    entry.fileVersion = (*i)->file.fileVersion; // needed?
-                    entry.manufacturerCode = (*i)->manufacturerId;
-                    entry.imageType = (*i)->imageType();
-                    known.push_back(entry);
+                    updateFile = file;
+                    updateFileVersion = fileVersion;
                 }
             }
+
+            if (ss.status != U_SSTREAM_OK)
+                continue;
         }
+    }
 
-        if (known.empty())
+    if (!updateFile.isEmpty())
+    {
+        if (loadImageFile(node, updateFile, updateFileVersion))
         {
-            downloadCancelOrError();
-            return;
+            node->setHasData(true);
+            DBG_Printf(DBG_OTA, "OTAU: found update file %s\n", qPrintable(updateFile));
+            enforceMemoryBudget();
         }
-
-        QByteArray data;
+        else
         {
-            QFile f(m_downloadIndexPath);
-            if (f.open(QFile::ReadOnly))
-            {
-                data = f.readAll();
-                if (data.size() == 0 || data.at(0) != '[')
-                    data = {};
-            }
+            node->setHasData(false);
+            DBG_Printf(DBG_OTA, "OTAU: found invalid update file %s\n", qPrintable(updateFile));
         }
+    }
 
-        // following is a very crude way to parse each JSON object in the large array
-        // it's messy and verbose but also pretty fast
-        U_SStream ss;
-        U_sstream_init(&ss, data.data(), data.size());
+    queueAvailableNotify(node);
 
-        /*
-      [{
-        "fileName": "1135-0100-1000002A-Kobold.zigbee",
-        "fileVersion": 268435498,
-        "fileSize": 244094,
-        "url": "https://raw.githubusercontent.com/Koenkk/zigbee-OTA/master/images/DresdenElektronik/1135-0100-1000002A-Kobold.zigbee",
-        "imageType": 256,
-        "manufacturerCode": 4405,
-        "sha512": "0905f0e6a469be3893f2c665156f18077258e24439e283c9f4b121553a94e8eb142e6250e721585ddd9aceef75da3c10a03defaee89885d7cb8f08449a20912d",
-        "otaHeaderString": "",
-        "originalUrl": "https://deconz.dresden-elektronik.de/otau/1135-0100-1000002A-Kobold.zigbee"
-      }, {...}]
-        */
+    return node->hasData();
+}
 
-        for (;U_sstream_find(&ss, "{");)
+/*! Invalidates the upgrade end request.
+ */
+void StdOtauPlugin::invalidateUpdateEndRequest(OtauNode *node)
+{
+    if (node)
+    {
+        if ((node->upgradeEndReq.fileVersion != 0) || (node->upgradeEndReq.manufacturerCode != 0))
         {
-            uint32_t manufacturerCode;
-            uint32_t imageType;
-            uint32_t fileVersion;
+            DBG_Printf(DBG_OTA, "OTAU: invalid update end request for node " FMT_MAC "\n", FMT_MAC_CAST(node->address().ext()));
+        }
 
-            U_SStream so = ss; // stream limited to one object
-            if (U_sstream_find(&so, "}"))
-            {
-                so.len = so.pos + 1;
-                so.pos = ss.pos;
-                ss.pos = so.len; // advance stream to the next object
-                // 'so' is a string view to the current OTA entry (object)
-            }
-            else
-            {
-                break; // invalid json
-            }
+        node->upgradeEndReq.status = 0;
+        node->upgradeEndReq.manufacturerCode = 0;
+        node->upgradeEndReq.fileVersion = 0;
+        node->upgradeEndReq.imageType = 0;
+    }
+}
 
-            if (!jsonGetU32(so, "manufacturerCode", &manufacturerCode))
-                continue;
+/*! Handler to automatically send image page responses.
+ */
+void StdOtauPlugin::imagePageTimerFired()
+{
+    if (!m_model || m_model->nodes().empty())
+    {
+        return;
+    }
 
-            if (!jsonGetU32(so, "imageType", &imageType))
-                continue;
+    if (!m_transport->isAvailable() || !m_transport->otauActive())
+    {
+        return;
+    }
 
-            if (!jsonGetU32(so, "fileVersion", &fileVersion))
-                continue;
+    bool refire = false;
+    const auto now = m_transport->steadyTime();
 
-            auto j = known.cbegin();
-            const auto jend = known.cend();
+    for (OtauNode *node : m_model->nodes())
+    {
+        if (!node)
+            continue;
 
-            for (; j != jend; ++j)
+        if (node->state() == OtauNode::NodeWaitPageSpacing)
+        {
+            refire = true;
+            if (!imagePageResponse(node))
             {
-                if (j->manufacturerCode == manufacturerCode && j->imageType == imageType)
+                if (node->imgBlockResponseRetry >= MAX_IMG_BLOCK_RSP_RETRY)
                 {
-                    DownloadOtaFile dlota;
-                    char valbuf[1280];
+                    // giveup
+                    node->setState(OtauNode::NodeIdle);
+                    dumpEventRingOnError();
+                }
+            }
+        }
+        else if (node->state() == OtauNode::NodeWaitNextRequest)
+        {
+            refire = true;
 
-                    dlota.manufacturerCode = manufacturerCode;
+            if (now.ref - node->lastActivity.ref > node->transferProfile().waitNextRequestMs)
+            {
+                node->imgPageRequestRetry++;
+                if (node->imgPageRequestRetry >= MAX_IMG_PAGE_REQ_RETRY)
+                {
+                    // giveup
+                    node->setState(OtauNode::NodeIdle);
+                    dumpEventRingOnError();
+                }
+                else
+                {
+                    DBG_Printf(DBG_OTA, "OTAU: wait request timeout (retry %d)\n", node->imgPageRequestRetry);
+                    node->apsRequestId = INVALID_APS_REQ_ID; // don't wait for prior requests
+
+                    if (node->imgPageRequestRetry < 3 && node->transferProfile().unicastNotify)
+                    {
+                        unicastImageNotify(node->address());
+                    }
+                }
+            }
+        }
+    }
+
+    if (refire && !m_imagePageTimer->isActive())
+    {
+        m_imagePageTimer->start(IMAGE_PAGE_TIMER_DELAY);
+    }
+}
+
+/*! Handler to cleanup timed out nodes.
+ */
+void StdOtauPlugin::cleanupTimerFired()
+{
+    if (!m_model)
+    {
+        return;
+    }
+
+    int activeNodes = 0;
+    const auto now = m_transport->steadyTime();
+
+    std::vector<OtauNode*>::iterator i = m_model->nodes().begin();
+    std::vector<OtauNode*>::iterator end = m_model->nodes().end();
+
+    for (; i != end; ++i)
+    {
+        OtauNode *node = *i;
+        if (node->hasData())
+        {
+            if (now.ref - node->lastActivity.ref > CLEANUP_DELAY)
+            {
+                releaseImageData(node);
+                node->imageEvicted = false;
+                node->setHasData(false);
+                DBG_Printf(DBG_OTA, "OTAU: cleanup node\n");
+            }
+            else
+            {
+                activeNodes++;
+            }
+        }
+    }
+
+    if (activeNodes)
+    {
+        m_cleanupTimer->start();
+    }
+}
+
+void StdOtauPlugin::activityTimerFired()
+{
+    const auto now = m_transport->steadyTime();
+
+    auto i = std::find_if(m_otauTracker.begin(), m_otauTracker.end(), [&](const OtauTracker &t)
+    {
+        return now.ref - t.lastActivity.ref > t.activityTimeoutMs;
+    });
+
+    if (i != m_otauTracker.end())
+    {
+        m_otauTracker.erase(i);
+    }
+
+    if (m_otauTracker.empty())
+    {
+        m_activityTimer->stop();
+    }
+}
+
+void StdOtauPlugin::downloadCancelOrError()
+{
+    m_downloadState = DownloadStateInitial;
+
+    if (m_prefetchRunning)
+    {
+        m_prefetchRunning = false;
+        DBG_Printf(DBG_OTA, "OTAU: background prefetch finished\n");
+    }
+}
+
+static void downloadCallback(N_DownloadData *dd)
+{
+    const unsigned id = static_cast<unsigned>(reinterpret_cast<uintptr_t>(dd->user));
+
+    if (!downloadPlugin)
+    {
+        return;
+    }
+
+    if (dd->status == N_DownloadDone)
+    {
+        downloadPlugin->downloadAttemptDone(id, true, dd->data, dd->data_size);
+    }
+    else
+    {
+        DBG_Printf(DBG_ERROR, "OTAU: error in download %u, status: %d\n", id, (int)dd->status);
+        downloadPlugin->downloadAttemptDone(id, false, nullptr, 0);
+    }
+}
+
+/*! Starts a download from the best source which wasn't tried yet for the current request.
+    While waiting, the download timer is armed to race the next source if the first one is slow.
+    \return true if a download was started
+ */
+bool StdOtauPlugin::downloadStartAttempt()
+{
+    const bool isIndex = m_downloadState == DownloadStateWaitIndexResponse;
+    OtauSourceList &sources = isIndex ? m_indexSources : m_fileSources;
+
+    if (!isIndex && m_downloads.empty())
+    {
+        return false;
+    }
+
+    const int src = sources.selectBest(m_downloadTried);
+    if (src < 0)
+    {
+        return false;
+    }
+
+    OtauDownloadAttempt *attempt = nullptr;
+    for (OtauDownloadAttempt &a : m_downloadAttempts)
+    {
+        if (!a.active)
+        {
+            attempt = &a;
+            break;
+        }
+    }
+
+    if (!attempt)
+    {
+        return false;
+    }
+
+    QString url;
+    if (isIndex)
+    {
+        url = sources.at(src).url;
+    }
+    else if (src == 0)
+    {
+        url = QString::fromStdString(m_downloads.front().url);
+    }
+    else
+    {
+        url = mirrorFileUrl(sources.at(src).url, m_downloads.front().url);
+    }
+
+    m_downloadTried |= (1U << src);
+    m_downloadAttemptId = m_downloadAttemptId == std::numeric_limits<unsigned>::max() ? 1 : m_downloadAttemptId + 1;
+    attempt->id = m_downloadAttemptId;
+    attempt->generation = m_downloadGeneration;
+    attempt->source = src;
+    attempt->index = isIndex;
+    attempt->active = true;
+    attempt->time.start();
+
+    DBG_Printf(DBG_OTA, "OTAU: download %u %s\n", attempt->id, qPrintable(url));
+    attempt->handle = m_transport->download(qPrintable(url), MAX_DOWNLOAD_FILE_SIZE, downloadCallback, reinterpret_cast<void*>(uintptr_t(attempt->id)));
+
+    qint64 delay = sources.hedgeDelay(src);
+    delay = qMin<qint64>(delay, qMax<qint64>(DOWNLOAD_TIMEOUT - m_downloadTime.elapsed(), 10));
+    m_downloadTimer->start(static_cast<int>(delay));
+
+    return true;
+}
+
+/*! Called when all sources failed for the current download request.
+ */
+void StdOtauPlugin::downloadRequestFailed()
+{
+    m_downloadGeneration++; // late results are ignored
+    downloadCancelAttempts();
+
+    if (m_downloadState == DownloadStateWaitIndexResponse)
+    {
+        DBG_Printf(DBG_ERROR, "OTAU: failed to download OTA index\n");
+        downloadCancelOrError();
+    }
+    else if (m_downloadState == DownloadStateWaitOtaFileResponse)
+    {
+        m_downloadState = DownloadStateRequestOtaFile;
+        m_downloadTimer->start(100);
+    }
+}
+
+/*! Cancels all running download attempts and frees their slots.
+    The sources of timed out attempts must be reported as failed before.
+ */
+void StdOtauPlugin::downloadCancelAttempts()
+{
+    for (OtauDownloadAttempt &a : m_downloadAttempts)
+    {
+        if (a.active)
+        {
+            DBG_Printf(DBG_OTA, "OTAU: cancel download %u\n", a.id);
+            a.active = false;
+            m_transport->cancelDownload(a.handle);
+        }
+    }
+}
+
+/*! Handles the result of a download attempt.
+    The first valid result wins and cancels the others, a failed source falls over to the next one immediately.
+    \param id - the attempt, results of cancelled attempts are ignored
+    \param success - true if the downloader finished without error
+    \param data - the downloaded data, only valid during this call
+    \param size - size of data
+ */
+void StdOtauPlugin::downloadAttemptDone(unsigned id, bool success, const uint8_t *data, unsigned size)
+{
+    auto a = std::find_if(m_downloadAttempts.begin(), m_downloadAttempts.end(), [id](const OtauDownloadAttempt &x)
+    {
+        return x.active && x.id == id;
+    });
+
+    if (a == m_downloadAttempts.end())
+    {
+        return; // cancelled or timed out, the slot may be in use by another attempt
+    }
+
+    OtauDownloadAttempt *attempt = &*a;
+    attempt->active = false;
+
+    if (success && attempt->index)
+    {
+        success = data && 512 < size && data[0] == '[';
+    }
+    else if (success && data && attempt->generation == m_downloadGeneration && !m_downloads.empty())
+    {
+        // mirrors are not trusted, verify the content against the index
+        uint8_t sha512[U_SHA512_HASH_SIZE];
+        char sha512Ascii[128 + 8];
+
+        U_Sha512((const char*)data, size, &sha512[0]);
+        sha512ToHex(sha512, sha512Ascii, sizeof(sha512Ascii));
+        success = m_downloads.front().sha512 == sha512Ascii;
+
+        if (!success)
+        {
+            DBG_Printf(DBG_OTA, "OTAU: downloaded file %s has wrong sha512\n", m_downloads.front().fileName.c_str());
+        }
+    }
+
+    OtauSourceList &sources = attempt->index ? m_indexSources : m_fileSources;
+
+    if (success)
+    {
+        sources.reportSuccess(attempt->source, attempt->time.elapsed());
+    }
+    else
+    {
+        sources.reportFailure(attempt->source);
+    }
+
+    if (attempt->generation != m_downloadGeneration)
+    {
+        return; // lost the race or timed out
+    }
+
+    const DownloadState waitState = attempt->index ? DownloadStateWaitIndexResponse : DownloadStateWaitOtaFileResponse;
+    if (m_downloadState != waitState)
+    {
+        return; // should not happen
+    }
+
+    if (success)
+    {
+        m_downloadGeneration++; // other racing attempts are obsolete now
+        downloadCancelAttempts();
+
+        if (attempt->index)
+        {
+            downloadedStoreIndex(data, size);
+        }
+        else
+        {
+            downloadedStoreOtaFile(data, size);
+        }
+        return;
+    }
+
+    for (const OtauDownloadAttempt &a : m_downloadAttempts)
+    {
+        if (a.active && a.generation == m_downloadGeneration)
+        {
+            return; // wait for the other racing attempt
+        }
+    }
+
+    if (!downloadStartAttempt())
+    {
+        downloadRequestFailed();
+    }
+}
+
+void StdOtauPlugin::downloadTimerFired()
+{
+    if (m_downloadState == DownloadStateRequestIndex)
+    {
+        if (!m_downloadsEnabled)
+        {
+            downloadCancelOrError();
+            return;
+        }
+
+        if (m_indexSources.size() == 0)
+        {
+            downloadCancelOrError();
+            return;
+        }
+
+        m_downloadIndexPath = deCONZ::getStorageLocation(deCONZ::ApplicationsDataLocation) + "/ota_remote_index.json";
+
+        auto now = deCONZ::steadyTimeRef();
+        bool indexExists = QFile::exists(m_downloadIndexPath);
+        bool needRefresh = (!indexExists || !isValid(m_downloadIndexAge) || deCONZ::TimeSeconds{30 * 60} < (now - m_downloadIndexAge));
+
+        if (needRefresh)
+        {
+            m_downloadState = DownloadStateWaitIndexResponse;
+            m_downloadGeneration++;
+            m_downloadTried = 0;
+            m_downloadTime.start();
+
+            if (!downloadStartAttempt())
+            {
+                downloadRequestFailed();
+            }
+        }
+        else
+        {
+            m_downloadState = DownloadStateProcessIndex;
+            m_downloadTimer->start(50);
+        }
+    }
+    else if (m_downloadState == DownloadStateWaitIndexResponse || m_downloadState == DownloadStateWaitOtaFileResponse)
+    {
+        if (m_downloadTime.hasExpired(DOWNLOAD_TIMEOUT))
+        {
+            const bool isIndex = m_downloadState == DownloadStateWaitIndexResponse;
+            OtauSourceList &sources = isIndex ? m_indexSources : m_fileSources;
+
+            for (const OtauDownloadAttempt &a : m_downloadAttempts)
+            {
+                if (a.active && a.generation == m_downloadGeneration)
+                {
+                    sources.reportFailure(a.source);
+                }
+            }
+
+            downloadRequestFailed(); // frees the slots
+        }
+        else if (!downloadStartAttempt()) // race the next source
+        {
+            m_downloadTimer->start(static_cast<int>(qMax<qint64>(DOWNLOAD_TIMEOUT - m_downloadTime.elapsed(), 10)));
+        }
+    }
+    else if (m_downloadState == DownloadStateProcessIndex)
+    {
+        struct KOP
+        {
+            uint16_t manufacturerCode;
+            uint16_t imageType;
+            uint32_t fileVersion;
+            uint32_t minSwVersion; // lowest version running on the nodes
+            uint32_t indexVersion; // newest version in the remote index
+        };
+
+        std::vector<KOP> known;
+
+        m_downloadState = DownloadStateInitial;
+
+        {
+            auto i = m_model->nodes().cbegin();
+            const auto iend = m_model->nodes().cend();
+
+            for (; i != iend; ++i)
+            {
+                if ((*i)->manufacturerId == 0)
+                    continue;
+
+                auto j = known.begin();
+                const auto jend = known.end();
+
+                for (; j != jend; ++j)
+                {
+                    if (j->manufacturerCode != (*i)->manufacturerId)
+                        continue;
+                    if (j->imageType != (*i)->imageType())
+                        continue;
+                    break;
+                }
+
+                if (j == jend)
+                {
+                    KOP entry;
+                    entry.fileVersion = (*i)->file.fileVersion; // needed?
+                    entry.manufacturerCode = (*i)->manufacturerId;
+                    entry.imageType = (*i)->imageType();
+                    entry.minSwVersion = (*i)->softwareVersion();
+                    entry.indexVersion = 0;
+                    known.push_back(entry);
+                }
+                else if ((*i)->softwareVersion() < j->minSwVersion)
+                {
+                    j->minSwVersion = (*i)->softwareVersion();
+                }
+            }
+        }
+
+        if (known.empty())
+        {
+            downloadCancelOrError();
+            return;
+        }
+
+        QByteArray data;
+        {
+            QFile f(m_downloadIndexPath);
+            if (f.open(QFile::ReadOnly))
+            {
+                data = f.readAll();
+                if (data.size() == 0 || data.at(0) != '[')
+                    data = {};
+            }
+        }
+
+        // following is a very crude way to parse each JSON object in the large array
+        // it's messy and verbose but also pretty fast
+        U_SStream ss;
+        U_sstream_init(&ss, data.data(), data.size());
+
+        /*
+      [{
+        "fileName": "1135-0100-1000002A-Kobold.zigbee",
+        "fileVersion": 268435498,
+        "fileSize": 244094,
+        "url": "https://raw.githubusercontent.com/Koenkk/zigbee-OTA/master/images/DresdenElektronik/1135-0100-1000002A-Kobold.zigbee",
+        "imageType": 256,
+        "manufacturerCode": 4405,
+        "sha512": "0905f0e6a469be3893f2c665156f18077258e24439e283c9f4b121553a94e8eb142e6250e721585ddd9aceef75da3c10a03defaee89885d7cb8f08449a20912d",
+        "otaHeaderString": "",
+        "originalUrl": "https://deconz.dresden-elektronik.de/otau/1135-0100-1000002A-Kobold.zigbee"
+      }, {...}]
+        */
+
+        for (;U_sstream_find(&ss, "{");)
+        {
+            uint32_t manufacturerCode;
+            uint32_t imageType;
+            uint32_t fileVersion;
+
+            U_SStream so = ss; // stream limited to one object
+            if (U_sstream_find(&so, "}"))
+            {
+                so.len = so.pos + 1;
+                so.pos = ss.pos;
+                ss.pos = so.len; // advance stream to the next object
+                // 'so' is a string view to the current OTA entry (object)
+            }
+            else
+            {
+                break; // invalid json
+            }
+
+            if (!jsonGetU32(so, "manufacturerCode", &manufacturerCode))
+                continue;
+
+            if (!jsonGetU32(so, "imageType", &imageType))
+                continue;
+
+            if (!jsonGetU32(so, "fileVersion", &fileVersion))
+                continue;
+
+            auto j = known.begin();
+            const auto jend = known.end();
+
+            for (; j != jend; ++j)
+            {
+                if (j->manufacturerCode == manufacturerCode && j->imageType == imageType)
+                {
+                    DownloadOtaFile dlota;
+                    char valbuf[1280];
+
+                    if (fileVersion > j->indexVersion)
+                    {
+                        j->indexVersion = fileVersion;
+                    }
+
+                    dlota.manufacturerCode = manufacturerCode;
                     dlota.imageType = imageType;
+                    dlota.fileVersion = fileVersion;
+                    jsonGetU32(so, "fileSize", &dlota.fileSize);
+
+                    if (!jsonGetString(so, "url", valbuf, sizeof(valbuf)))
+                        continue;
+
+                    dlota.url = valbuf;
+
+                    if (!jsonGetString(so, "sha512", valbuf, sizeof(valbuf)))
+                        continue;
+
+                    if (U_strlen(valbuf) != 128)
+                        continue;
+
+                    dlota.sha512 = valbuf;
+
+                    { // check if we already have this file
+                        bool found = false;
+                        QFile f(m_localIndexPath);
+                        auto needle = QByteArray::fromRawData(valbuf, 128); // sha512
+
+                        if (f.open(QFile::ReadOnly))
+                        {
+                            for (;;)
+                            {
+                                QByteArray line = f.readLine().trimmed(); // one json object per line
+                                if (line.size() <= 0)
+                                    break;
+
+                                if (line.contains(needle))
+                                {
+                                    found = true;
+                                    break;
+                                }
+                            }
+                        }
+
+                        if (found) // don't need to download twice
+                            break;
+                    }
+
+                    U_SStream fname;
+                    U_sstream_init(&fname, valbuf, sizeof(valbuf));
+
+                    U_sstream_put_hex_u16(&fname, manufacturerCode);
+                    U_sstream_put_str(&fname, "-");
+                    U_sstream_put_hex_u16(&fname, imageType);
+                    U_sstream_put_str(&fname, "-");
+                    U_sstream_put_hex_u32(&fname, fileVersion);
+                    U_sstream_put_str(&fname, "-");
+                    for (int v = 0; v < 6; v++)
+                        fname.str[fname.pos++] = dlota.sha512.c_str()[v];
+
+                    fname.str[fname.pos] = '\0';
+                    U_sstream_put_str(&fname, ".zigbee");
+                    dlota.fileName = fname.str;
+
+                    bool found = false;
+                    for (const auto &dl : m_downloads)
+                    {
+                        if (dl.sha512 == dlota.sha512)
+                        {
+                            found = true;
+                            break;
+                        }
+                    }
+
+                    if (!found)
+                    {
+                        m_downloads.push_back(dlota);
+                        DBG_Printf(DBG_OTA, "OTAU: download %s from %s\n", dlota.fileName.c_str(), dlota.url.c_str());
+                    }
+                    break;
+                }
+            }
+        }
+
+        if (m_prefetchRunning)
+        {
+            // only fetch the newest image per model which is newer than what the nodes run,
+            // and only as long as it fits the per run and disk budget
+            qint64 budget = m_prefetchMaxBytes;
+            qint64 diskAvail = m_retention.diskBudget > 0 ? m_retention.diskBudget - m_imageStore.totalSize()
+                                                          : std::numeric_limits<qint64>::max();
+
+            for (auto i = m_downloads.begin(); i != m_downloads.end(); )
+            {
+                bool keep = false;
+                const qint64 size = i->fileSize != 0 ? i->fileSize : MAX_DOWNLOAD_FILE_SIZE;
+
+                for (const KOP &k : known)
+                {
+                    if (k.manufacturerCode == i->manufacturerCode && k.imageType == i->imageType)
+                    {
+                        keep = i->fileVersion == k.indexVersion && i->fileVersion > k.minSwVersion;
+                        break;
+                    }
+                }
+
+                if (keep && (size > budget || size > diskAvail))
+                {
+                    DBG_Printf(DBG_OTA, "OTAU: prefetch skip %s, exceeds budget\n", i->fileName.c_str());
+                    keep = false;
+                }
+
+                if (keep)
+                {
+                    budget -= size;
+                    diskAvail -= size;
+                    ++i;
+                }
+                else
+                {
+                    i = m_downloads.erase(i);
+                }
+            }
+        }
+
+        if (!m_downloads.empty())
+        {
+            m_downloadState = DownloadStateRequestOtaFile;
+            m_downloadTimer->start(50);
+        }
+        else
+        {
+            downloadCancelOrError();
+        }
+    }
+    else if (m_downloadState == DownloadStateRequestOtaFile)
+    {
+        if (m_downloads.empty())
+        {
+            downloadCancelOrError();
+            return;
+        }
+        DownloadOtaFile &dl = m_downloads.front();
+        if (dl.retry < 2)
+        {
+            dl.retry++;
+            m_downloadState = DownloadStateWaitOtaFileResponse;
+            m_downloadGeneration++;
+            m_downloadTried = 0;
+            m_downloadTime.start();
+
+            if (!downloadStartAttempt())
+            {
+                downloadRequestFailed();
+            }
+        }
+        else
+        {
+            m_downloads.front() = m_downloads.back();
+            m_downloads.pop_back();
+            m_downloadTimer->start(100);
+        }
+    }
+}
+
+void StdOtauPlugin::downloadedStoreIndex(const uint8_t *data, unsigned int size)
+{
+    bool ok = false;
+
+    if (m_downloadState != DownloadStateWaitIndexResponse)
+        return; // should not happen
+
+    if (data && 512 < size)
+    {
+        DBG_Printf(DBG_OTA, "OTAU: downloaded index file: %u kB\n", size / 1000);
+        // mostly the index didn't change since the last download, skip rewriting it
+        if (m_fileWriter.writeFile(m_downloadIndexPath, QByteArray::fromRawData((const char*)data, size), OtauWriteRemoteIndex))
+        {
+            ok = true;
+            m_downloadIndexAge = deCONZ::steadyTimeRef();
+            m_downloadState = DownloadStateProcessIndex;
+            m_downloadTimer->start(50);
+        }
+    }
+
+    if (!ok)
+    {
+        downloadCancelOrError();
+    }
+}
+
+void StdOtauPlugin::downloadedStoreOtaFile(const uint8_t *data, unsigned int size)
+{
+    if (m_downloadState != DownloadStateWaitOtaFileResponse)
+        return; // should not happen
+
+    if (m_downloads.empty())
+        return; // should not happen
+
+    DownloadOtaFile dl = m_downloads.front();
+    m_downloads.front() = m_downloads.back();
+    m_downloads.pop_back();
+
+    QString filePath = m_imgPath + "/" + dl.fileName.c_str();
+
+    // image and index are synced together
+    m_fileWriter.beginBatch();
+
+    if (data && 512 < size)
+    {
+        DBG_Printf(DBG_OTA, "OTAU: downloaded %s: %u kB\n", dl.fileName.c_str(), size / 1000);
+        m_fileWriter.writeFile(filePath, QByteArray::fromRawData((const char*)data, size), OtauWriteImage);
+    }
+
+    createLocalFileIndex();
+    m_fileWriter.endBatch();
+
+    // proceed with next (or finish)
+    m_downloadState = DownloadStateRequestOtaFile;
+    m_downloadTimer->start(m_prefetchRunning ? PREFETCH_DOWNLOAD_SPACING : 50);
+}
+
+void StdOtauPlugin::markOtauActivity(const deCONZ::Address &address)
+{
+    if (!address.hasExt())
+    {
+        return;
+    }
+
+    auto i = std::find_if(m_otauTracker.begin(), m_otauTracker.end(), [&](const OtauTracker &t)
+    {
+        return t.extAddr == address.ext();
+    });
+
+    const OtauNode *node = m_model->getNode(address);
+    const int activityTimeout = node ? node->transferProfile().activityTimeoutMs : NODE_TIMEOUT;
+
+    if (i != m_otauTracker.end())
+    {
+        i->lastActivity = m_transport->steadyTime();
+        i->activityTimeoutMs = activityTimeout; // node descriptor may have arrived meanwhile
+    }
+    else if (m_otauTracker.size() < OTAU_MAX_ACTIVE)
+    {
+        refreshTopology();
+
+        OtauTracker t;
+        t.extAddr = address.ext();
+        t.lastActivity = m_transport->steadyTime();
+        t.activityTimeoutMs = activityTimeout;
+        t.parentAddr = m_topology.parent(t.extAddr);
+        t.branchAddr = m_topology.branch(t.extAddr);
+        m_otauTracker.push_back(t);
+    }
+
+    if (!m_activityTimer->isActive())
+    {
+        m_activityTimer->start(ACTIVITY_TIMER_DELAY);
+    }
+}
+
+/*! Reads the neighbour tables of all nodes, at most every TOPOLOGY_REFRESH_INTERVAL.
+ */
+void StdOtauPlugin::refreshTopology()
+{
+    const int64_t now = m_transport->steadyTime().ref;
+
+    if (m_topologyTime != 0 && now - m_topologyTime < TOPOLOGY_REFRESH_INTERVAL)
+    {
+        return;
+    }
+
+    m_topologyTime = now;
+    m_topology.clear();
+
+    const deCONZ::Node *node = nullptr;
+
+    for (int i = 0; m_transport->getNode(i, &node) == 0; i++)
+    {
+        if (!node || !node->address().hasExt())
+        {
+            continue;
+        }
+
+        if (node->isCoordinator())
+        {
+            m_topology.setCoordinator(node->address().ext());
+        }
+
+        m_topology.addNode(node->address().ext(), node->isEndDevice());
+
+        for (const deCONZ::NodeNeighbor &nb : node->neighbors())
+        {
+            if (nb.address().hasExt())
+            {
+                m_topology.addNeighbor(node->address().ext(), nb.address().ext(), nb.relationship(), nb.lqi());
+            }
+        }
+    }
+
+    m_topology.build();
+}
+
+/*! Checks if a transfer may start without overloading the parent or branch it shares with running transfers.
+    \param node - the node which asks for an image
+    \return true if the transfer can start
+ */
+bool StdOtauPlugin::admitTransfer(const OtauNode *node)
+{
+    const uint64_t extAddr = node->address().ext();
+
+    for (const OtauTracker &t : m_otauTracker)
+    {
+        if (t.extAddr == extAddr)
+        {
+            return true; // already running
+        }
+    }
+
+    refreshTopology();
+
+    const uint64_t parent = m_topology.parent(extAddr);
+    const uint64_t branch = m_topology.branch(extAddr);
+    const int maxParent = m_config.maxTransfersPerParent();
+    const int maxBranch = m_config.maxTransfersPerBranch();
+
+    const int sameParent = parent == 0 ? 0 : int(std::count_if(m_otauTracker.begin(), m_otauTracker.end(), [parent](const OtauTracker &t) { return t.parentAddr == parent; }));
+    const int sameBranch = branch == 0 ? 0 : int(std::count_if(m_otauTracker.begin(), m_otauTracker.end(), [branch](const OtauTracker &t) { return t.branchAddr == branch; }));
+
+    if (maxParent > 0 && sameParent >= maxParent)
+    {
+        DBG_Printf(DBG_OTA, "OTAU: " FMT_MAC " parent " FMT_MAC " busy with %d transfers\n", FMT_MAC_CAST(extAddr), FMT_MAC_CAST(parent), sameParent);
+        return false;
+    }
+
+    if (maxBranch > 0 && sameBranch >= maxBranch)
+    {
+        DBG_Printf(DBG_OTA, "OTAU: " FMT_MAC " branch " FMT_MAC " busy with %d transfers\n", FMT_MAC_CAST(extAddr), FMT_MAC_CAST(branch), sameBranch);
+        return false;
+    }
+
+    return true;
+}
+
+/*! Returns the number of running transfers on the branch of a node, at least 1.
+ */
+unsigned StdOtauPlugin::branchLoad(uint64_t extAddr) const
+{
+    const auto i = std::find_if(m_otauTracker.begin(), m_otauTracker.end(), [extAddr](const OtauTracker &t) { return t.extAddr == extAddr; });
+
+    if (i == m_otauTracker.end() || i->branchAddr == 0)
+    {
+        return 1;
+    }
+
+    const uint64_t branch = i->branchAddr;
+    return std::max(1, int(std::count_if(m_otauTracker.begin(), m_otauTracker.end(), [branch](const OtauTracker &t) { return t.branchAddr == branch; })));
+}
+
+/*! Rebuilds the local index of OTA images.
+    The image directories are scanned through the content addressed image store,
+    each distinct image is listed once together with all file names which link to it.
+ */
+void StdOtauPlugin::createLocalFileIndex()
+{
+    QStringList paths;
+
+    {
+        QString defaultImgPath = deCONZ::getStorageLocation(deCONZ::HomeLocation) + "/otau";
+        defaultImgPath = deCONZ::appArgumentString("--otau-img-path", defaultImgPath);
+
+        QDir otauDir(defaultImgPath);
+
+        if (otauDir.exists())
+            paths.append(defaultImgPath);
+
+        QString secondaryPath = deCONZ::getStorageLocation(deCONZ::ApplicationsDataLocation) + "/otau";
+        otauDir = secondaryPath;
+        if (otauDir.exists() && !paths.contains(secondaryPath))
+            paths.append(secondaryPath);
+    }
+
+    m_localIndexPath = deCONZ::getStorageLocation(deCONZ::ApplicationsDataLocation) + "/ota_index.json";
+
+    const bool startup = m_startup.totalUs == 0;
+    QElapsedTimer timer;
+    timer.start();
+
+    m_imageStore.scan(paths);
+
+    if (startup)
+    {
+        const OtauImageStore::Stats &st = m_imageStore.stats();
+        m_startup.enumerateUs = st.enumerateNs / 1000;
+        m_startup.readUs = st.readNs / 1000;
+        m_startup.parseUs = st.parseNs / 1000;
+        m_startup.hashUs = st.hashNs / 1000;
+        timer.restart();
+    }
+
+    {
+        // images which are currently served must not be removed
+        OtauRetentionPolicy policy = m_retention;
+
+        for (OtauNode *node : m_model->nodes())
+        {
+            if (node->hasData())
+            {
+                policy.pinned.append(OtauImageStore::imageKey(node->file.manufacturerCode, node->file.imageType, node->file.fileVersion));
+            }
+        }
+
+        if (m_imageStore.collectGarbage(policy) > 0)
+        {
+            m_gcTimer->start(); // continue later, keeps the work per update small
+        }
+    }
+
+    if (startup)
+    {
+        m_startup.gcUs = timer.nsecsElapsed() / 1000;
+        timer.restart();
+    }
+
+    {
+        // built in memory and only written when changed, the index is rebuilt far more often than it changes
+        QByteArray indexData;
+        {
+            int count = 0;
+            QTextStream stream(&indexData, QIODevice::WriteOnly);
+            stream << "[\n";
+            for (const OtauImageEntry &e : m_imageStore.entries())
+            {
+                char sha512Ascii[128 + 8];
+                sha512ToHex(reinterpret_cast<const uint8_t*>(e.sha512.constData()), sha512Ascii, sizeof(sha512Ascii));
+
+                if (count)
+                    stream << ",\n";
+
+                // Important: one minified object per line (the parser expects exactly this)
+                // paths must come last, the parser searches for the first occurrence of a key
+                stream << "{";
+                stream << "\"fileVersion\":" << e.fileVersion << ",";
+                stream << "\"fileSize\":" << e.fileSize << ",";
+                stream << "\"manufacturerCode\":" << e.manufacturerCode << ",";
+                stream << "\"imageType\":" << e.imageType << ",";
+                stream << "\"sha512\":\"" << sha512Ascii << "\",";
+                stream << "\"path\":\"" << e.path << "\",";
+                stream << "\"store\":\"" << e.storePath << "\",";
+                stream << "\"aliases\":[";
+                for (int i = 0; i < e.aliases.size(); i++)
+                {
+                    stream << (i ? ",\"" : "\"") << e.aliases.at(i) << "\"";
+                }
+                stream << "]";
+                stream << "}";
+                count++;
+            }
+
+            stream << "\n]\n";
+        }
+
+        if (startup)
+        {
+            m_startup.indexBuildUs = timer.nsecsElapsed() / 1000;
+            timer.restart();
+        }
+
+        m_fileWriter.writeFile(m_localIndexPath, indexData, OtauWriteLocalIndex);
+
+        if (startup)
+        {
+            m_startup.indexWriteUs = timer.nsecsElapsed() / 1000;
+        }
+    }
+
+    if (m_model)
+    {
+        for (OtauNode *node : m_model->nodes())
+        {
+            resolveUpdate(node);
+            if (node->availableNotified || node->updateVersion != 0)
+            {
+                queueAvailableNotify(node); // new or removed images
+            }
+        }
+    }
+}
+
+/*! Executed when check online button is clicked */
+void StdOtauPlugin::downloadRequestIndex()
+{
+    if (m_downloadState == DownloadStateInitial)
+    {
+        m_prefetchRunning = false;
+        m_downloadState = DownloadStateRequestIndex;
+        m_downloadsEnabled = true;
+        m_downloadTimer->start(10);
+
+        if (m_selectedNodeAddress.hasExt())
+        {
+            unicastImageNotify(m_selectedNodeAddress);
+        }
+        else
+        {
+            broadcastImageNotify();
+        }
+    }
+}
+
+/*! Periodically refreshes the remote index and prefetches firmware for all known device models.
+    Runs only during the configured quiet hours and when online downloads are enabled,
+    so that images are already on disk when devices query next time.
+ */
+void StdOtauPlugin::prefetchTimerFired()
+{
+    m_prefetchTimer->start(PREFETCH_TIMER_DELAY);
+
+    if (!m_downloadsEnabled || m_prefetchInterval <= 0)
+    {
+        return;
+    }
+
+    if (m_downloadState != DownloadStateInitial)
+    {
+        return; // manual check in progress
+    }
+
+    if (!isPrefetchQuietTime())
+    {
+        return;
+    }
+
+    const auto now = deCONZ::steadyTimeRef();
+
+    if (isValid(m_prefetchLastRun) && !(deCONZ::TimeSeconds{m_prefetchInterval * 60} < (now - m_prefetchLastRun)))
+    {
+        return;
+    }
+
+    DBG_Printf(DBG_OTA, "OTAU: start background prefetch\n");
+    m_prefetchLastRun = now;
+    m_prefetchRunning = true;
+    m_downloadState = DownloadStateRequestIndex;
+    m_downloadTimer->start(10);
+}
+
+/*! Returns true if the current local time is within the prefetch quiet hours.
+    Equal start and end hour means no restriction.
+ */
+bool StdOtauPlugin::isPrefetchQuietTime() const
+{
+    if (m_prefetchQuietStart == m_prefetchQuietEnd)
+    {
+        return true;
+    }
+
+    const int hour = QTime::currentTime().hour();
+
+    if (m_prefetchQuietStart < m_prefetchQuietEnd)
+    {
+        return hour >= m_prefetchQuietStart && hour < m_prefetchQuietEnd;
+    }
+
+    return hour >= m_prefetchQuietStart || hour < m_prefetchQuietEnd; // wraps midnight
+}
+
+/*! Sends a image notify request.
+    \param notf - the request parameters
+    \return true on success false otherwise
+ */
+bool StdOtauPlugin::imageNotify(ImageNotifyReq *notf)
+{
+    deCONZ::ApsDataRequest req;
+    deCONZ::ZclFrame zclFrame;
+
+    OtauNode *node = nullptr;
+
+    if (notf->addrMode == deCONZ::ApsExtAddress)
+        node = m_model->getNode(notf->addr);
+
+    req.setDstAddressMode(notf->addrMode);
+    req.dstAddress() = notf->addr;
+    req.setDstEndpoint(notf->dstEndpoint);
+    req.setSrcEndpoint(m_srcEndpoint);
+    if (node)
+    {
+        req.setTxOptions(deCONZ::ApsTxAcknowledgedTransmission);
+        req.setProfileId(node->profileId);
+        DBG_Printf(DBG_OTA, "OTAU: send img notify to " FMT_MAC ", payload type: 0x%02X\n", FMT_MAC_CAST(node->address().ext()), notf->payloadType);
+    }
+    else
+    {
+        req.setProfileId(0x0104);
+        DBG_Printf(DBG_OTA, "OTAU: broadcast img notify, payload type: 0x%02X, jitter: %u, mfCode: 0x%04X, img type: 0x%04X, version: 0x%08X\n",
+                   notf->payloadType, notf->queryJitter, notf->manufacturerCode, notf->imageType, notf->fileVersion);
+    }
+    req.setClusterId(OTAU_CLUSTER_ID);
+
+    req.setRadius(notf->radius);
+
+    zclFrame.setSequenceNumber(m_zclSeq++);
+    zclFrame.setCommandId(OTAU_IMAGE_NOTIFY_CMD_ID);
+
+    uint8_t frameControl = deCONZ::ZclFCClusterCommand |
+            deCONZ::ZclFCDirectionServerToClient;
+
+    if (notf->addr.isNwkBroadcast())
+    {
+        frameControl |= deCONZ::ZclFCDisableDefaultResponse;
+    }
+
+    zclFrame.setFrameControl(frameControl);
+
+    { // ZCL payload
+        QDataStream stream(&zclFrame.payload(), QIODevice::WriteOnly);
+        stream.setByteOrder(QDataStream::LittleEndian);
+
+        stream << notf->payloadType;
+        stream << notf->queryJitter;
+
+        if (notf->payloadType >= IMAGE_NOTIFY_MFCODE)
+        {
+            stream << notf->manufacturerCode;
+        }
+
+        if (notf->payloadType >= IMAGE_NOTIFY_MFCODE_TYPE)
+        {
+            stream << notf->imageType;
+        }
+
+        if (notf->payloadType >= IMAGE_NOTIFY_MFCODE_TYPE_VER)
+        {
+            stream << notf->fileVersion;
+        }
+    }
+
+    { // ZCL frame
+        QDataStream stream(&req.asdu(), QIODevice::WriteOnly);
+        stream.setByteOrder(QDataStream::LittleEndian);
+        zclFrame.writeToStream(stream);
+    }
+
+    if (sendApsRequest(req) == deCONZ::Success)
+    {
+        return true;
+    }
+
+    return false;
+}
+
+/*! Returns the query jitter so that about as many clients query as transfer slots are free.
+    \param matching - number of clients expected to match the notify
+    \param freeSlots - free transfer slots
+ */
+static uint8_t imageNotifyJitter(unsigned matching, unsigned freeSlots)
+{
+    if (matching <= freeSlots)
+    {
+        return 100;
+    }
+
+    const unsigned jitter = (100 * freeSlots + matching - 1) / matching;
+    return static_cast<uint8_t>(std::max(1U, jitter));
+}
+
+/*! Returns the newest image in the store for a device model, or nullptr.
+ */
+const OtauImageEntry *StdOtauPlugin::newestImage(uint16_t manufacturerCode, uint16_t imageType) const
+{
+    const OtauImageEntry *result = nullptr;
+
+    for (const OtauImageEntry &e : m_imageStore.entries())
+    {
+        if (e.manufacturerCode == manufacturerCode && e.imageType == imageType &&
+            (!result || e.fileVersion > result->fileVersion))
+        {
+            result = &e;
+        }
+    }
+
+    return result;
+}
+
+/*! Broadcasts image notify requests.
+
+    For every device model with known nodes and a newer image a notify with payload type 0x03
+    is sent, so that only the matching clients query. The query jitter is derived from the
+    number of matching nodes and the free transfer slots. Without such models a plain notify
+    is sent which addresses all clients.
+ */
+bool StdOtauPlugin::broadcastImageNotify()
+{
+    struct Target
+    {
+        uint16_t manufacturerCode;
+        uint16_t imageType;
+        uint32_t fileVersion;
+        unsigned count;
+    };
+
+    std::vector<Target> targets;
+    const unsigned freeSlots = std::max(1, int(OTAU_MAX_ACTIVE) - int(m_otauTracker.size()));
+    unsigned nodeCount = 0;
+
+    if (m_model)
+    {
+        nodeCount = static_cast<unsigned>(m_model->nodes().size());
+
+        for (OtauNode *node : m_model->nodes())
+        {
+            if (node->imageType() == 0 && node->manufacturerId == 0)
+            {
+                continue; // never queried
+            }
+
+            const OtauImageEntry *image = newestImage(node->manufacturerId, node->imageType());
+            if (!image || image->fileVersion <= node->softwareVersion())
+            {
+                continue;
+            }
+
+            auto t = std::find_if(targets.begin(), targets.end(), [node](const Target &t)
+            {
+                return t.manufacturerCode == node->manufacturerId && t.imageType == node->imageType();
+            });
+
+            if (t != targets.end())
+            {
+                t->count++;
+            }
+            else
+            {
+                targets.push_back({node->manufacturerId, node->imageType(), image->fileVersion, 1});
+            }
+        }
+    }
+
+    ImageNotifyReq notf;
+
+    notf.radius = 0;
+    notf.addr.setNwk(deCONZ::BroadcastRxOnWhenIdle);
+    notf.addrMode = deCONZ::ApsNwkAddress;
+    notf.dstEndpoint = 0xFF; // broadcast endpoint
+
+    if (targets.empty())
+    {
+        notf.queryJitter = nodeCount > 0 ? imageNotifyJitter(nodeCount, freeSlots) : 100;
+        return imageNotify(&notf);
+    }
+
+    // most nodes first, each broadcast occupies the broadcast transaction table of all routers
+    std::sort(targets.begin(), targets.end(), [](const Target &a, const Target &b) { return a.count > b.count; });
+    if (targets.size() > MAX_IMAGE_NOTIFY_BROADCASTS)
+    {
+        targets.resize(MAX_IMAGE_NOTIFY_BROADCASTS);
+    }
+
+    bool ret = false;
+    for (const Target &t : targets)
+    {
+        notf.payloadType = IMAGE_NOTIFY_MFCODE_TYPE_VER;
+        notf.manufacturerCode = t.manufacturerCode;
+        notf.imageType = t.imageType;
+        notf.fileVersion = t.fileVersion;
+        notf.queryJitter = imageNotifyJitter(t.count, freeSlots);
+
+        if (imageNotify(&notf))
+        {
+            ret = true;
+        }
+    }
+
+    return ret;
+}
+
+/*! Sends a image notify request per unicast.
+    \param addr - the destination address
+    \return true on success false otherwise
+ */
+bool StdOtauPlugin::unicastImageNotify(const deCONZ::Address &addr)
+{
+    if (addr.hasExt())
+    {
+        ImageNotifyReq notf;
+
+        OtauNode *node = m_model->getNode(addr);
+
+        if (!node)
+        {
+            return false;
+        }
+
+        if (!node->transferProfile().unicastNotify)
+        {
+            DBG_Printf(DBG_OTA, "OTAU: skip image notify to sleepy end device " FMT_MAC "\n", FMT_MAC_CAST(addr.ext()));
+            return false; // the node queries on its own schedule
+        }
+
+        notf.radius = 0;
+        notf.addr = addr;
+        notf.addrMode = deCONZ::ApsExtAddress;
+        notf.dstEndpoint = node->endpoint;
+
+        // unicast notifies use the maximum jitter, the version lets clients which already run it stay silent,
+        // it's the file which will be served if one is loaded already, e.g. selected in the widget
+        if (node->manufacturerId != VENDOR_DDEL)
+        {
+            const OtauImageEntry *image = node->hasData() ? nullptr : newestImage(node->manufacturerId, node->imageType());
+
+            if (node->hasData())
+            {
+                notf.payloadType = IMAGE_NOTIFY_MFCODE_TYPE_VER;
+                notf.manufacturerCode = node->file.manufacturerCode;
+                notf.imageType = node->file.imageType;
+                notf.fileVersion = node->file.fileVersion;
+            }
+            else if (image)
+            {
+                notf.payloadType = IMAGE_NOTIFY_MFCODE_TYPE_VER;
+                notf.manufacturerCode = image->manufacturerCode;
+                notf.imageType = image->imageType;
+                notf.fileVersion = image->fileVersion;
+            }
+        }
+
+        // blacklist some faulty versions tue image notify bug in BitCloud 3.2, 3.3
+        if (node->manufacturerId == VENDOR_DDEL)
+        {
+            node->endpointNotify = 0x0A;
+            notf.dstEndpoint = node->endpointNotify;
+
+            if (node->imageType() == IMG_TYPE_FLS_PP3_H3)
+            {
+                notf.dstEndpoint = 0x0A;
+            }
+            else if (node->imageType() == IMG_TYPE_FLS_A2)
+            {
+                if (node->softwareVersion() > 0 && node->softwareVersion() < 0x201000C4)
+                {
+                    return false;
+                }
+            }
+            else if (node->imageType() == IMG_TYPE_FLS_NB)
+            {
+                if (node->softwareVersion() > 0 && node->softwareVersion() < 0x200000C8)
+                {
+                    return false;
+                }
+            }
+        }
+
+        return imageNotify(&notf);
+    }
+
+    return false;
+}
+
+/*! Sends a upgrade end request to a node via unicast.
+    \param addr - the destination address
+ */
+void StdOtauPlugin::unicastUpgradeEndRequest(const deCONZ::Address &addr)
+{
+    if (addr.hasExt())
+    {
+        OtauNode *node = m_model->getNode(addr);
+
+        DBG_Assert(node != nullptr);
+        if (node)
+        {
+            if (!upgradeEndResponse(node, DEFAULT_UPGRADE_TIME))
+            {
+                DBG_Printf(DBG_OTA, "OTAU: failed to send upgrade end response\n");
+            }
+        }
+    }
+}
+
+/*! Handles a match descriptor request and sends the response if needed.
+    \param ind - the APSDE-DATA.indication
+ */
+void StdOtauPlugin::matchDescriptorRequest(const deCONZ::ApsDataIndication &ind)
+{
+    bool sendResponse = false;
+    uint8_t seqNo;
+    uint16_t shortAddr;
+    uint16_t profileId;
+    uint8_t serverClusterCount;
+
+    if (ind.asdu().size() < 7) // minimum size for match descriptor request
+    {
+        DBG_Printf(DBG_OTA, "OTAU: ignore match descriptor req from 0x%04X with asduSize %d\n", ind.srcAddress().nwk(), (int)ind.asdu().size());
+    }
+
+    {
+        QDataStream stream(ind.asdu());
+        stream.setByteOrder(QDataStream::LittleEndian);
+        stream >> seqNo;
+        stream >> shortAddr;
+        stream >> profileId;
+        stream >> serverClusterCount;
+
+        for (uint i = 0; i < serverClusterCount; i++)
+        {
+            uint16_t clusterId;
+            stream >> clusterId;
+
+            if (clusterId == OTAU_CLUSTER_ID && (profileId == ZLL_PROFILE_ID || profileId == HA_PROFILE_ID))
+            {
+                const deCONZ::Node *coord = nullptr;
+                m_transport->getNode(0, &coord);
+
+                DBG_Assert(coord != nullptr);
+                if (!coord)
+                {
+                    return;
+                }
+
+                for (const deCONZ::SimpleDescriptor &sd : coord->simpleDescriptors())
+                {
+                    if (sd.profileId() == profileId)
+                    {
+                        return; // firmware will handle this
+                    }
+                }
+
+                DBG_Printf(DBG_OTA, "OTAU: match descriptor req, profileId 0x%04X from 0x%04X\n", profileId, ind.srcAddress().nwk());
+                sendResponse = true;
+                break;
+            }
+        }
+    }
+
+    if (sendResponse)
+    {
+        deCONZ::ApsDataRequest req;
+
+        //req.setTxOptions(deCONZ::ApsTxAcknowledgedTransmission);
+        req.dstAddress() = ind.srcAddress();
+        req.setDstAddressMode(deCONZ::ApsNwkAddress);
+        req.setProfileId(ZDP_PROFILE_ID);
+        req.setClusterId(ZDP_MATCH_DESCRIPTOR_RSP_CLID);
+        req.setDstEndpoint(ZDO_ENDPOINT);
+        req.setSrcEndpoint(ZDO_ENDPOINT);
+
+        QDataStream stream(&req.asdu(), QIODevice::WriteOnly);
+        stream.setByteOrder(QDataStream::LittleEndian);
+
+        uint8_t status = 0x00; // success
+        shortAddr = 0x0000; // TODO query from apsController
+        uint8_t matchLength = 0x01;
+        uint8_t matchList = m_srcEndpoint;
 
-                    if (!jsonGetString(so, "url", valbuf, sizeof(valbuf)))
-                        continue;
+        stream << seqNo;
+        stream << status;
+        stream << shortAddr;
+        stream << matchLength;
+        stream << matchList;
 
-                    dlota.url = valbuf;
+        if (sendApsRequest(req) == deCONZ::Success)
+        {
+            DBG_Printf(DBG_OTA, "OTAU: send match descriptor rsp, match endpoint 0x%02X\n", matchList);
+        }
+        else
+        {
+            DBG_Printf(DBG_OTA, "OTAU: send match descriptor rsp failed\n");
+        }
+    }
+}
 
-                    if (!jsonGetString(so, "sha512", valbuf, sizeof(valbuf)))
-                        continue;
+/*! Handles a query next image request and sends the response.
+    \param ind - the APSDE-DATA.indication
+    \param zclFrame - the ZCL frame
+ */
+void StdOtauPlugin::queryNextImageRequest(const deCONZ::ApsDataIndication &ind, const deCONZ::ZclFrame &zclFrame)
+{
+    uint16_t u16;
+    uint32_t u32;
+    OtauNode *node = m_model->getNode(ind.srcAddress());
 
-                    if (U_strlen(valbuf) != 128)
-                        continue;
+    if (!node)
+    {
+        DBG_Printf(DBG_OTA, "OTAU: query next image request for unknown node " FMT_MAC "\n", FMT_MAC_CAST(ind.srcAddress().ext()));
+        return;
+    }
 
-                    dlota.sha512 = valbuf;
+    if ((zclFrame.payload().size() != 9) &&
+        (zclFrame.payload().size() != 11)) // with hardware version present
+    {
+        DBG_Printf(DBG_OTA, "OTAU: query next image request for node " FMT_MAC " invalid payload length %d\n", FMT_MAC_CAST(ind.srcAddress().ext()), (int)zclFrame.payload().size());
+        return;
+    }
 
-                    { // check if we already have this file
-                        bool found = false;
-                        QFile f(m_localIndexPath);
-                        auto needle = QByteArray::fromRawData(valbuf, 128); // sha512
+    invalidateUpdateEndRequest(node);
 
-                        if (f.open(QFile::ReadOnly))
-                        {
-                            for (;;)
-                            {
-                                QByteArray line = f.readLine().trimmed(); // one json object per line
-                                if (line.size() <= 0)
-                                    break;
+    node->reqSequenceNumber = zclFrame.sequenceNumber();
+    node->endpoint = ind.srcEndpoint();
+    node->profileId = ind.profileId();
+    node->setAddress(ind.srcAddress());
+    node->restartElapsedTimer();
+    node->setStatus(OtauNode::StatusImageRequest);
 
-                                if (line.contains(needle))
-                                {
-                                    found = true;
-                                    break;
-                                }
-                            }
-                        }
+    QDataStream stream(zclFrame.payload());
+    stream.setByteOrder(QDataStream::LittleEndian);
 
-                        if (found) // don't need to download twice
-                            break;
-                    }
+    uint8_t fieldControl;
 
-                    U_SStream fname;
-                    U_sstream_init(&fname, valbuf, sizeof(valbuf));
+    stream >> fieldControl;
+    stream >> node->manufacturerId;
+    stream >> u16;
+    node->setImageType(u16);
+    stream >> u32;
+    node->setSoftwareVersion(u32);
+    if (fieldControl & 0x01)
+    {
+        stream >> u16;
+        node->setHardwareVersion(u16);
+    }
+    else
+    {
+        node->setHardwareVersion(0xFFFF);
+    }
 
-                    U_sstream_put_hex_u16(&fname, manufacturerCode);
-                    U_sstream_put_str(&fname, "-");
-                    U_sstream_put_hex_u16(&fname, imageType);
-                    U_sstream_put_str(&fname, "-");
-                    U_sstream_put_hex_u32(&fname, fileVersion);
-                    U_sstream_put_str(&fname, "-");
-                    for (int v = 0; v < 6; v++)
-                        fname.str[fname.pos++] = dlota.sha512.c_str()[v];
+    DBG_Printf(DBG_OTA, "OTAU: query next img req: " FMT_MAC " mfCode: 0x%04X, img type: 0x%04X, sw version: 0x%08X\n",
+               FMT_MAC_CAST(ind.srcAddress().ext()), node->manufacturerId, node->imageType(), node->softwareVersion());
 
-                    fname.str[fname.pos] = '\0';
-                    U_sstream_put_str(&fname, ".zigbee");
-                    dlota.fileName = fname.str;
+    node->lastSeen = QDateTime::currentMSecsSinceEpoch() / 1000;
+    resolveUpdate(node);
 
-                    bool found = false;
-                    for (const auto &dl : m_downloads)
-                    {
-                        if (dl.sha512 == dlota.sha512)
-                        {
-                            found = true;
-                            break;
-                        }
-                    }
+    // if (m_transport->otauActive())
+    {
+        // check for image
+        if (!node->hasData() && m_otauTracker.size() < OTAU_MAX_ACTIVE)
+        {
+            node->file.subElements.clear();
+            node->setHasData(false);
+            //node->setPermitUpdate(false);
 
-                    if (!found)
-                    {
-                        m_downloads.push_back(dlota);
-                        DBG_Printf(DBG_OTA, "OTAU: download %s from %s\n", dlota.fileName.c_str(), dlota.url.c_str());
-                    }
-                    break;
-                }
+            if (!checkForUpdateImageImage(node))
+            {
             }
         }
+    }
 
-        if (!m_downloads.empty())
+    if (queryNextImageResponse(node))
+    {
+        if (m_startup.firstQueryUs < 0)
         {
-            m_downloadState = DownloadStateRequestOtaFile;
-            m_downloadTimer->start(50);
+            m_startup.firstQueryUs = m_startupClock.nsecsElapsed() / 1000;
+            DBG_Printf(DBG_OTA, "OTAU: startup first_query_us=%lld\n", m_startup.firstQueryUs);
         }
+        node->setState(OtauNode::NodeWaitConfirm);
     }
-    else if (m_downloadState == DownloadStateRequestOtaFile)
+    else
     {
-        if (m_downloads.empty())
+        // TODO handle error
+        node->setState(OtauNode::NodeIdle);
+    }
+}
+
+/*! Sends a query next image response.
+    \param node - the destination node
+    \return true on success false otherwise
+ */
+bool StdOtauPlugin::queryNextImageResponse(OtauNode *node)
+{
+    deCONZ::ApsDataRequest req;
+    deCONZ::ZclFrame zclFrame;
+
+    DBG_Assert(node->address().hasExt());
+    if (!node->address().hasExt())
+    {
+        return false;
+    }
+
+    if (node->imageEvicted)
+    {
+        reloadImageData(node);
+    }
+
+    req.setProfileId(node->profileId);
+    req.setDstEndpoint(node->endpoint);
+    req.setClusterId(OTAU_CLUSTER_ID);
+    req.dstAddress().setExt(node->address().ext());
+    req.setDstAddressMode(deCONZ::ApsExtAddress);
+    req.setSrcEndpoint(m_srcEndpoint);
+    req.setTxOptions(deCONZ::ApsTxAcknowledgedTransmission);
+    req.setRadius(MAX_RADIUS);
+
+    zclFrame.setSequenceNumber(node->reqSequenceNumber);
+    zclFrame.setCommandId(OTAU_QUERY_NEXT_IMAGE_RESPONSE_CMD_ID);
+
+    zclFrame.setFrameControl(deCONZ::ZclFCClusterCommand |
+                             deCONZ::ZclFCDirectionServerToClient |
+                             deCONZ::ZclFCDisableDefaultResponse);
+
+    { // ZCL payload
+        QDataStream stream(&zclFrame.payload(), QIODevice::WriteOnly);
+        stream.setByteOrder(QDataStream::LittleEndian);
+
+        if (node->state() == OtauNode::NodeAbort)
         {
-            downloadCancelOrError();
-            return;
+            stream << (uint8_t)OTAU_ABORT;
+            DBG_Printf(DBG_OTA, "OTAU: send query next image response: OTAU_ABORT\n");
         }
-        DownloadOtaFile &dl = m_downloads.front();
-        if (dl.retry < 2)
+        else if (m_otauTracker.size() >= OTAU_MAX_ACTIVE)
         {
-            unsigned maxFileSize = 1 << 21; // 2 MB, should be plenty enough
-            dl.retry++;
-            m_downloadHandle = N_Download(dl.url.c_str(), maxFileSize, downloadOtaFileCallback, this);
-            m_downloadState = DownloadStateWaitOtaFileResponse;
-            m_downloadTimer->start(20000);
+            DBG_Printf(DBG_OTA, "OTAU: busy, don't answer and let node run in timeout\n");
+            return false;
+        }
+        else if (node->permitUpdate() && node->hasData() && !admitTransfer(node))
+        {
+            return false; // let node run in timeout, transfers on other branches go first
+        }
+        else if (node->manufacturerId == VENDOR_DDEL &&
+                 node->imageType() == IMG_TYPE_FLS_PP3_H3 &&
+                 node->softwareVersion() >= 0x20000050 &&
+                 node->softwareVersion() <= 0x20000054 &&
+                 node->file.fileVersion < 0x201000eb)
+        {
+            // workaround to prevent update FLS-H lp with older FLS-PP lp versions
+            stream << (uint8_t)OTAU_NO_IMAGE_AVAILABLE;
+            DBG_Printf(DBG_OTA, "OTAU: send query next image response: OTAU_NO_IMAGE_AVAILABLE to FLS-H lp\n");
+        }
+        else if (node->permitUpdate() && node->hasData() && node->file.raw.size() != 0)
+        {
+            node->rawFile = node->file.raw;
+            stream << (uint8_t)OTAU_SUCCESS;
+            stream << node->file.manufacturerCode;
+            stream << node->file.imageType;
+            stream << node->file.fileVersion;
+            stream << node->file.totalImageSize;
+
+            markOtauActivity(node->address());
         }
         else
         {
-            m_downloads.front() = m_downloads.back();
-            m_downloads.pop_back();
-            m_downloadTimer->start(100);
+            if (node->manufacturerId == VENDOR_BUSCH_JAEGER)
+            {
+                stream << (uint8_t)OTAU_ABORT;
+                DBG_Printf(DBG_OTA, "OTAU: send query next image response: OTAU_ABORT\n");
+            }
+            else
+            {
+                stream << (uint8_t)OTAU_NO_IMAGE_AVAILABLE;
+                DBG_Printf(DBG_OTA, "OTAU: send query next image response: OTAU_NO_IMAGE_AVAILABLE\n");
+            }
         }
     }
-    else if (m_downloadState == DownloadStateWaitOtaFileResponse)
+
+    if ((node->address().ext() & macPrefixMask) == osramMacPrefix &&
+        !(node->permitUpdate() && node->hasData()))
     {
-        m_downloadState = DownloadStateRequestOtaFile;
-        m_downloadTimer->start(100);
+        DBG_Printf(DBG_OTA, "OTAU: don't answer OSRAM node: OTAU_NO_IMAGE_AVAILABLE\n");
+        return false;
+    }
+
+    { // ZCL frame
+        QDataStream stream(&req.asdu(), QIODevice::WriteOnly);
+        stream.setByteOrder(QDataStream::LittleEndian);
+        zclFrame.writeToStream(stream);
+    }
+
+    if (sendApsRequest(req) == 0)
+    {
+        node->apsRequestId = req.id();
+        node->zclCommandId = zclFrame.commandId();
+        return true;
     }
+
+    return false;
 }
 
-void StdOtauPlugin::downloadedStoreIndex(const uint8_t *data, unsigned int size)
+/*! Handles a image block request and sends the response.
+    \param ind - the APSDE-DATA.indication
+    \param zclFrame - the ZCL frame
+ */
+void StdOtauPlugin::imageBlockRequest(const deCONZ::ApsDataIndication &ind, const deCONZ::ZclFrame &zclFrame)
 {
-    bool ok = false;
-
-    if (m_downloadState != DownloadStateWaitIndexResponse)
-        return; // should not happen
+    OtauNode *node = m_model->getNode(ind.srcAddress());
 
-    if (data && 512 < size)
+    if (!node)
     {
-        if (QFile::exists(m_downloadIndexPath))
-            QFile::remove(m_downloadIndexPath);
-
-        DBG_Printf(DBG_OTA, "OTAU: downloaded index file: %u kB\n", size / 1000);
-        QFile f(m_downloadIndexPath);
-        if (f.open(QFile::ReadWrite))
-        {
-            auto n = f.write((const char*)data, size);
-            f.close();
-
-            if (n == size)
-            {
-                ok = true;
-                m_downloadState = DownloadStateProcessIndex;
-                m_downloadTimer->start(50);
-            }
-        }        
+        return;
     }
 
-    if (!ok)
+    if (!m_journalPending.empty() && !node->hasData())
     {
-        downloadCancelOrError();
+        restoreFromJournal(node);
     }
-}
 
-void StdOtauPlugin::downloadedStoreOtaFile(const uint8_t *data, unsigned int size)
-{
-    if (m_downloadState != DownloadStateWaitOtaFileResponse)
-        return; // should not happen
+    markOtauActivity(node->address());
+    updateHealthState();
 
-    if (m_downloads.empty())
-        return; // should not happen
+    invalidateUpdateEndRequest(node);
 
-    DownloadOtaFile dl = m_downloads.front();
-    m_downloads.front() = m_downloads.back();
-    m_downloads.pop_back();
+    QDataStream stream(zclFrame.payload());
+    stream.setByteOrder(QDataStream::LittleEndian);
 
-    QString filePath = m_imgPath + "/" + dl.fileName.c_str();
+    stream >> node->imgBlockReq.fieldControl;
+    stream >> node->imgBlockReq.manufacturerCode;
+    stream >> node->imgBlockReq.imageType;
+    stream >> node->imgBlockReq.fileVersion;
+    stream >> node->imgBlockReq.offset;
+    stream >> node->imgBlockReq.maxDataSize;
 
-    if (data && 512 < size)
+    if (node->imgBlockReq.fileVersion == DONT_CARE_FILE_VERSION)
     {
-        if (QFile::exists(filePath))
-            QFile::remove(filePath);
-
-        DBG_Printf(DBG_OTA, "OTAU: downloaded %s: %u kB\n", dl.fileName.c_str(), size / 1000);
-        QFile f(filePath);
-        if (f.open(QFile::ReadWrite))
-        {
-            f.write((const char*)data, size);
-            f.close();
-        }
+        node->imgBlockReq.fileVersion = node->file.fileVersion;
     }
 
-    createLocalFileIndex();
+    node->setStatus(OtauNode::StatusUploading);
+    node->setOffset(node->imgBlockReq.offset);
+    node->setImageType(node->imgBlockReq.imageType);
+    node->notifyElapsedTimer();
+    publishProgress(node);
 
-    // proceed with next (or finish)
-    m_downloadState = DownloadStateRequestOtaFile;
-    m_downloadTimer->start(50);
-}
+    node->reqSequenceNumber = zclFrame.sequenceNumber();
+    node->endpoint = ind.srcEndpoint();
+    node->profileId = ind.profileId();
 
-void StdOtauPlugin::markOtauActivity(const deCONZ::Address &address)
-{
-    if (!address.hasExt())
+    if (DBG_IsEnabled(DBG_OTA))
     {
-        return;
+        DBG_Printf(DBG_OTA, "OTAU: img block req fwVersion:0x%08X, offset: 0x%08X, maxsize: %u\n", node->imgBlockReq.fileVersion, node->imgBlockReq.offset, node->imgBlockReq.maxDataSize);
     }
 
-    auto i = std::find_if(m_otauTracker.begin(), m_otauTracker.end(), [&](const OtauTracker &t)
+    // IEEE address present?
+    if (node->imgBlockReq.fieldControl & 0x01)
     {
-        return t.extAddr == address.ext();
-    });
+        quint64 extAddr;
+        stream >> extAddr;
 
-    if (i != m_otauTracker.end())
-    {
-        i->lastActivity = deCONZ::steadyTimeRef();
+        deCONZ::Address addr = node->address();
+        addr.setExt(extAddr);
+        node->setAddress(addr);
     }
-    else if (m_otauTracker.size() < OTAU_MAX_ACTIVE)
+
+    node->apsRequestId = INVALID_APS_REQ_ID;
+    if (imageBlockResponse(node))
     {
-        OtauTracker t;
-        t.extAddr = address.ext();
-        t.lastActivity = deCONZ::steadyTimeRef();
-        m_otauTracker.push_back(t);
+        recordLatency(node, OtauLatencyBlockResponse, latencyClockUs() - m_indicationTimeUs);
+        node->setState(OtauNode::NodeWaitConfirm);
     }
-
-    if (!m_activityTimer->isActive())
+    else
     {
-        m_activityTimer->start(ACTIVITY_TIMER_DELAY);
+        DBG_Printf(DBG_OTA, "OTAU: failed to send image block response\n");
+        node->setState(OtauNode::NodeIdle);
     }
 }
 
-struct OtaIndexEntry
-{
-    QString path;
-    uint8_t sha512[U_SHA512_HASH_SIZE];
-    uint32_t mfcode;
-    uint32_t imagetype;
-    uint32_t fileVersion;
-    uint32_t fileSize;
-};
-
-void StdOtauPlugin::createLocalFileIndex()
+/*! Sends a image block response.
+    \param node - the destination node
+    \return true on success false otherwise
+ */
+bool StdOtauPlugin::imageBlockResponse(OtauNode *node)
 {
-    QStringList paths;
-
+    DBG_Assert(node->address().hasExt());
+    if (!node->address().hasExt())
     {
-        QString defaultImgPath = deCONZ::getStorageLocation(deCONZ::HomeLocation) + "/otau";
-        defaultImgPath = deCONZ::appArgumentString("--otau-img-path", defaultImgPath);
+        return false;
+    }
 
-        QDir otauDir(defaultImgPath);
+    if (node->apsRequestId != INVALID_APS_REQ_ID)
+    {
+        if (isValid(node->lastResponseTime) &&
+            m_transport->steadyTime().ref - node->lastResponseTime.ref < (1000 * 10)) // prevent stallation
+        {
+            //DBG_Printf(DBG_OTA, "OTAU: ...\n");
+            return false;
+        }
 
-        if (otauDir.exists())
-            paths.append(defaultImgPath);
+        DBG_Printf(DBG_OTA, "OTAU: warn apsRequestId != 0\n");
+    }
 
-        QString secondaryPath = deCONZ::getStorageLocation(deCONZ::ApplicationsDataLocation) + "/otau";
-        otauDir = secondaryPath;
-        if (otauDir.exists())
-            paths.append(secondaryPath);
+    if (node->imageEvicted)
+    {
+        reloadImageData(node);
     }
 
-    m_localIndexPath = deCONZ::getStorageLocation(deCONZ::ApplicationsDataLocation) + "/ota_index.json";
+    uint8_t dataSize = 0;
+    deCONZ::ApsDataRequest req;
+    deCONZ::ZclFrame zclFrame;
 
-    if (QFile::exists(m_localIndexPath))
+    req.setProfileId(node->profileId);
+    req.setDstEndpoint(node->endpoint);
+    req.setClusterId(OTAU_CLUSTER_ID);
+    req.dstAddress() = node->address();
+    req.setDstAddressMode(deCONZ::ApsExtAddress);
+    //req.setTxOptions(deCONZ::ApsTxFragmentationPermitted);
+    req.setSrcEndpoint(m_srcEndpoint);
+    // APS ACKs are enabled for single image block requests
+    // they are disabled for image page request responses
+    if ((node->lastZclCmd() == OTAU_IMAGE_BLOCK_REQUEST_CMD_ID) || (node->state() == OtauNode::NodeAbort) || m_config.acksEnabled() ||
+        node->transferProfile().apsAcks)
     {
-        QFile::remove(m_localIndexPath);
+        req.setTxOptions(req.txOptions() | deCONZ::ApsTxAcknowledgedTransmission);
     }
 
-    std::vector<OtaIndexEntry> otaEntries;
+    zclFrame.setSequenceNumber(node->reqSequenceNumber);
+    req.setRadius(MAX_RADIUS);
+
+    zclFrame.setCommandId(OTAU_IMAGE_BLOCK_RESPONSE_CMD_ID);
 
-    for (const QString &path : paths)
-    {
-        QDir dir(path);
-        if (!dir.exists())
+    zclFrame.setFrameControl(deCONZ::ZclFCClusterCommand |
+                             deCONZ::ZclFCDirectionServerToClient |
+                             deCONZ::ZclFCDisableDefaultResponse);
+
+    { // ZCL payload
+        QDataStream stream(&zclFrame.payload(), QIODevice::WriteOnly);
+        stream.setByteOrder(QDataStream::LittleEndian);
+
+        if ((node->imgBlockReq.fileVersion != node->file.fileVersion) ||
+            (node->imgBlockReq.imageType != node->file.imageType) ||
+            (node->imgBlockReq.manufacturerCode != node->file.manufacturerCode))
         {
-            continue;
+            stream << (uint8_t)OTAU_ABORT;
+            node->setState(OtauNode::NodeAbort);
+            DBG_Printf(DBG_OTA, "OTAU: send img block " FMT_MAC " OTAU_ABORT\n", FMT_MAC_CAST(node->address().ext()));
+            dumpEventRingOnError();
+        }
+        else if (node->state() == OtauNode::NodeAbort)
+        {
+            stream << (uint8_t)OTAU_ABORT;
+            DBG_Printf(DBG_OTA, "OTAU: send img block " FMT_MAC " OTAU_ABORT\n", FMT_MAC_CAST(node->address().ext()));
         }
+        else if (!node->permitUpdate() || !node->hasData())
+        {
+            stream << (uint8_t)OTAU_NO_IMAGE_AVAILABLE;
+            DBG_Printf(DBG_OTA, "OTAU: send img block " FMT_MAC " OTAU_NO_IMAGE_AVAILABLE\n", FMT_MAC_CAST(node->address().ext()));
+        }
+        else if (node->paused || state() == StateBusySensors)
+        {
+            const uint32_t currentTime = 0; // request time is relative
+            const uint32_t requestTime = node->paused ? PAUSE_REQUEST_DELAY : BUSY_REQUEST_DELAY;
+            stream << (uint8_t)OTAU_WAIT_FOR_DATA;
+            stream << currentTime;
+            stream << requestTime;
+            DBG_Printf(DBG_OTA, "OTAU: send img block " FMT_MAC " OTAU_WAIT_FOR_DATA (%s)\n", FMT_MAC_CAST(node->address().ext()), node->paused ? "paused" : "network busy");
+        }
+        else if (node->imgBlockReq.offset < (uint32_t)node->rawFile.size())
+        {
+            if (node->imgBlockReq.maxDataSize > MAX_DATA_SIZE)
+            {
+                dataSize = MAX_DATA_SIZE;
+            }
+            else
+            {
+                dataSize = node->imgBlockReq.maxDataSize;
+            }
 
-        const QStringList ls = dir.entryList();
+            // some older DDEL and BJ devices have an error in BitCloud stack to support larger payloads
+            if ((node->manufacturerId == VENDOR_DDEL || node->manufacturerId == VENDOR_BUSCH_JAEGER) && dataSize > 40)
+            {
+                dataSize = 40;
+            }
 
-        for (const QString &n : ls)
-        {
-            QFile file(path + "/" + n);
-            if (!file.open(QFile::ReadOnly))
-                continue;
+            const uint8_t maxDataSize = node->transferProfile().maxDataSize;
+            if (maxDataSize > 0 && dataSize > maxDataSize)
+            {
+                dataSize = maxDataSize;
+            }
 
-            QByteArray arr = file.readAll();
-            if (arr.isEmpty())
-                continue;
+            uint32_t offset = node->imgBlockReq.offset;
 
-            OtauFile of;
-            of.path = n;
-            if (!of.fromArray(arr))
-                continue;
+            stream << (uint8_t)OTAU_SUCCESS;
+            stream << node->file.manufacturerCode;
+            stream << node->file.imageType;
+            stream << node->file.fileVersion;
+            stream << node->imgBlockReq.offset;
 
-            OtaIndexEntry otaEntry;
-            otaEntry.path = (path + "/" + n);
-            otaEntry.mfcode = of.manufacturerCode;
-            otaEntry.imagetype = of.imageType;
-            otaEntry.fileVersion = of.fileVersion;
-            otaEntry.fileSize = arr.size();
-            U_memset(otaEntry.sha512, 0, sizeof(otaEntry.sha512));
-            U_Sha512(arr.constData(), arr.size(), &otaEntry.sha512[0]);
+            dataSize = (uint8_t)qMin((uint32_t)dataSize, ((uint32_t)node->rawFile.size() - offset));
 
-            bool found = false;
-            for (const OtaIndexEntry &e : otaEntries)
+            if (node->lastZclCmd() == OTAU_IMAGE_PAGE_REQUEST_CMD_ID)
             {
-                if (U_memcmp(e.sha512, otaEntry.sha512, sizeof(e.sha512)) == 0)
+                // only fill till page boundary
+                dataSize = qMin((uint32_t)dataSize, (uint32_t)(node->imgBlockReq.pageSize - node->imgBlockReq.pageBytesDone));
+
+                if (dataSize == 0)
                 {
-                    found = true;
-                    break;
+                    // dont send empty block response
+                    DBG_Printf(DBG_OTA, "OTAU: prevent img block rsp with dataSize = 0 " FMT_MAC "\n", FMT_MAC_CAST(node->address().ext()));
+                    return false;
                 }
             }
 
-            if (!found)
+            // truncate datasize if not enough data is left
+            uint32_t avail = static_cast<quint32>(node->rawFile.size()) - offset;
+            if (avail < dataSize)
             {
-                otaEntries.push_back(otaEntry);
+                dataSize = static_cast<quint8>(avail);
             }
-        }
-    }
 
-    {
-        QFile otaIndexFile(m_localIndexPath);
-        if (otaIndexFile.open(QFile::ReadWrite))
-        {
-            int count = 0;
-            QTextStream stream(&otaIndexFile);
-            stream << "[\n";
-            for (const OtaIndexEntry &e : otaEntries)
+            if (dataSize == 0)
             {
-                char sha512Ascii[128 + 8];
-
-                {
-                    U_SStream ssha;
-                    U_sstream_init(&ssha, sha512Ascii, sizeof(sha512Ascii));
-                    U_sstream_put_hex(&ssha, e.sha512, 64);
-                    for (unsigned i = 0; i < ssha.pos; i++) // to lower
-                    {
-                        char ch = ssha.str[i];
-                        if (ch >= 'A' && ch <= 'Z')
-                            ch += (char)('a' - 'A');
-                        ssha.str[i] = ch;
-                    }
-                }
+                DBG_Printf(DBG_OTA, "OTAU: warn img block rsp with dataSize = 0 " FMT_MAC "\n", FMT_MAC_CAST(node->address().ext()));
+            }
 
-                if (count)
-                    stream << ",\n";
+            stream << dataSize;
 
-                // Important: one minified object per line (the parser expects exactly this)
-                stream << "{";
-                stream << "\"fileVersion\":" << e.fileVersion << ",";
-                stream << "\"fileSize\":" << e.fileSize << ",";
-                stream << "\"manufacturerCode\":" << e.mfcode << ",";
-                stream << "\"imageType\":" << e.imagetype << ",";
-                stream << "\"sha512\":\"" << sha512Ascii << "\",";
-                stream << "\"path\":\"" << e.path << "\"";
-                stream << "}";
-                count++;
+            for (uint i = 0; (i < dataSize) && (offset < (uint32_t)node->rawFile.size()); i++)
+            {
+                stream << (uint8_t)node->rawFile[offset++];
             }
 
-            stream << "\n]\n";
-
-            otaIndexFile.close();
+            node->imgBlockReq.maxDataSize = dataSize; // remember
+        }
+        else
+        {
+            DBG_Printf(DBG_OTA, "OTAU: send img block " FMT_MAC " OTAU_MALFORMED_COMMAND\n", FMT_MAC_CAST(node->address().ext()));
+            stream << (uint8_t)OTAU_MALFORMED_COMMAND;
         }
     }
-}
 
-/*! Executed when check online button is clicked */
-void StdOtauPlugin::downloadRequestIndex()
-{
-    if (m_downloadState == DownloadStateInitial)
-    {
-        m_downloadState = DownloadStateRequestIndex;
-        m_downloadsEnabled = true;
-        m_downloadTimer->start(10);
+    { // ZCL frame
+        QDataStream stream(&req.asdu(), QIODevice::WriteOnly);
+        stream.setByteOrder(QDataStream::LittleEndian);
+        zclFrame.writeToStream(stream);
+    }
 
-        if (m_selectedNodeAddress.hasExt())
-        {
-            unicastImageNotify(m_selectedNodeAddress);
-        }
-        else
+    if (sendApsRequest(req) == deCONZ::Success)
+    {
+        if (zclFrame.payload().size() > 1 && DBG_IsEnabled(DBG_OTA))
         {
-            broadcastImageNotify();
+            DBG_Printf(DBG_OTA, "OTAU: send img block rsp seq: %u offset: 0x%08X dataSize %u status: 0x%02X " FMT_MAC "\n", zclFrame.sequenceNumber(), node->imgBlockReq.offset, dataSize, quint8(zclFrame.payload().at(0)), FMT_MAC_CAST(node->address().ext()));
         }
+
+        node->apsRequestId = req.id();
+        node->zclCommandId = zclFrame.commandId();
+        m_bytesServed += dataSize;
+        m_apsBlockSize[req.id()] = dataSize;
+        node->lastResponseTime = m_transport->steadyTime();
+        return true;
     }
+
+    DBG_Printf(DBG_OTA, "OTAU: send img block response failed\n");
+    return false;
 }
 
-/*! Sends a image notify request.
-    \param notf - the request parameters
-    \return true on success false otherwise
+/*! Handles a image page request and sends the response.
+    \param ind - the APSDE-DATA.indication
+    \param zclFrame - the ZCL frame
  */
-bool StdOtauPlugin::imageNotify(ImageNotifyReq *notf)
+void StdOtauPlugin::imagePageRequest(const deCONZ::ApsDataIndication &ind, const deCONZ::ZclFrame &zclFrame)
 {
-    deCONZ::ApsDataRequest req;
-    deCONZ::ZclFrame zclFrame;
-
-    OtauNode *node = nullptr;
-
-    if (notf->addrMode == deCONZ::ApsExtAddress)
-        node = m_model->getNode(notf->addr);
+    OtauNode *node = m_model->getNode(ind.srcAddress());
 
-    req.setDstAddressMode(notf->addrMode);
-    req.dstAddress() = notf->addr;
-    req.setDstEndpoint(notf->dstEndpoint);
-    req.setSrcEndpoint(m_srcEndpoint);
-    if (node)
+    if (!node)
     {
-        req.setTxOptions(deCONZ::ApsTxAcknowledgedTransmission);
-        req.setProfileId(node->profileId);
-        DBG_Printf(DBG_OTA, "OTAU: send img notify to " FMT_MAC "\n", FMT_MAC_CAST(node->address().ext()));
+        return;
     }
-    else
+
+    if (!m_journalPending.empty() && !node->hasData())
     {
-        req.setProfileId(0x0104);
+        restoreFromJournal(node);
     }
-    req.setClusterId(OTAU_CLUSTER_ID);
-
-    req.setRadius(notf->radius);
 
-    zclFrame.setSequenceNumber(m_zclSeq++);
-    zclFrame.setCommandId(OTAU_IMAGE_NOTIFY_CMD_ID);
-
-    uint8_t frameControl = deCONZ::ZclFCClusterCommand |
-            deCONZ::ZclFCDirectionServerToClient;
+    markOtauActivity(node->address());
+    updateHealthState();
 
-    if (notf->addr.isNwkBroadcast())
+    if (!m_transport->isAvailable())
     {
-        frameControl |= deCONZ::ZclFCDisableDefaultResponse;
+        return;
     }
 
-    zclFrame.setFrameControl(frameControl);
-
-    { // ZCL payload
-        QDataStream stream(&zclFrame.payload(), QIODevice::WriteOnly);
-        stream.setByteOrder(QDataStream::LittleEndian);
-
-        stream << static_cast<quint8>(0x00); // query jitter
-        stream << static_cast<quint8>(100); // query jitter value
-    }
+    node->reqSequenceNumber = zclFrame.sequenceNumber();
 
-    { // ZCL frame
-        QDataStream stream(&req.asdu(), QIODevice::WriteOnly);
-        stream.setByteOrder(QDataStream::LittleEndian);
-        zclFrame.writeToStream(stream);
+    if (node->state() == OtauNode::NodeAbort)
+    {
+        defaultResponse(node, zclFrame.commandId(), OTAU_ABORT);
+        return;
     }
 
-    if (deCONZ::ApsController::instance()->apsdeDataRequest(req) == deCONZ::Success)
+    if (!m_config.pageRequestEnabled() || !node->transferProfile().pageRequests)
     {
-        return true;
+        defaultResponse(node, zclFrame.commandId(), OTAU_UNSUP_CLUSTER_COMMAND); // node falls back to block requests
+        return;
     }
 
-    return false;
-}
+    invalidateUpdateEndRequest(node);
 
-/*! Broadcasts a image notify request.
- */
-bool StdOtauPlugin::broadcastImageNotify()
-{
-    ImageNotifyReq notf;
+    QDataStream stream(zclFrame.payload());
+    stream.setByteOrder(QDataStream::LittleEndian);
 
-    notf.radius = 0;
-    notf.addr.setNwk(deCONZ::BroadcastRxOnWhenIdle);
-    notf.addrMode = deCONZ::ApsNwkAddress;
-    notf.dstEndpoint = 0xFF; // broadcast endpoint
+    stream >> node->imgPageReq.fieldControl;
+    stream >> node->imgPageReq.manufacturerCode;
+    stream >> node->imgPageReq.imageType;
+    stream >> node->imgPageReq.fileVersion;
+    stream >> node->imgPageReq.offset;
+    stream >> node->imgPageReq.maxDataSize;
+    stream >> node->imgPageReq.pageSize;
+    stream >> node->imgPageReq.responseSpacing;
 
-    return imageNotify(&notf);
-}
+    if (node->imgPageReq.fileVersion == DONT_CARE_FILE_VERSION)
+    {
+        node->imgPageReq.fileVersion = node->file.fileVersion;
+    }
 
-/*! Sends a image notify request per unicast.
-    \param addr - the destination address
-    \return true on success false otherwise
- */
-bool StdOtauPlugin::unicastImageNotify(const deCONZ::Address &addr)
-{
-    if (addr.hasExt())
+    if (node->imgPageReq.responseSpacing > MAX_RESPONSE_SPACING)
     {
-        ImageNotifyReq notf;
+        node->imgPageReq.responseSpacing = MAX_RESPONSE_SPACING;
+    }
+    else if (node->imgPageReq.responseSpacing < MIN_RESPONSE_SPACING)
+    {
+        node->imgPageReq.responseSpacing = MIN_RESPONSE_SPACING;
+    }
 
-        OtauNode *node = m_model->getNode(addr);
+    node->imgPageReq.pageBytesDone = 0;
 
-        if (!node)
-        {
-            return false;
-        }
+    node->imgBlockReq = node->imgPageReq;
 
-        notf.radius = 0;
-        notf.addr = addr;
-        notf.addrMode = deCONZ::ApsExtAddress;
-        notf.dstEndpoint = node->endpoint;
+    node->setOffset(node->imgBlockReq.offset);
+    node->setImageType(node->imgBlockReq.imageType);
+    node->notifyElapsedTimer();
+    publishProgress(node);
 
-        // blacklist some faulty versions tue image notify bug in BitCloud 3.2, 3.3
-        if (node->manufacturerId == VENDOR_DDEL)
-        {
-            node->endpointNotify = 0x0A;
-            notf.dstEndpoint = node->endpointNotify;
+    node->endpoint = ind.srcEndpoint();
+    node->profileId = ind.profileId();
 
-            if (node->imageType() == IMG_TYPE_FLS_PP3_H3)
-            {
-                notf.dstEndpoint = 0x0A;
-            }
-            else if (node->imageType() == IMG_TYPE_FLS_A2)
-            {
-                if (node->softwareVersion() > 0 && node->softwareVersion() < 0x201000C4)
-                {
-                    return false;
-                }
-            }
-            else if (node->imageType() == IMG_TYPE_FLS_NB)
-            {
-                if (node->softwareVersion() > 0 && node->softwareVersion() < 0x200000C8)
-                {
-                    return false;
-                }
-            }
-        }
+    if (DBG_IsEnabled(DBG_OTA))
+    {
+        DBG_Printf(DBG_OTA, "OTAU: img page req fwVersion:0x%08X, offset: 0x%08X, pageSize: %u, rspSpacing: %u ms\n", node->imgBlockReq.fileVersion, node->imgBlockReq.offset, node->imgBlockReq.pageSize, node->imgBlockReq.responseSpacing);
+    }
 
-        return imageNotify(&notf);
+    // IEEE address present?
+    if (node->imgBlockReq.fieldControl & 0x01)
+    {
+        quint64 requestNodeAddress;
+        stream >> requestNodeAddress;
+        // not used
     }
 
-    return false;
-}
+    node->apsRequestId = INVALID_APS_REQ_ID; // don't wait for prior requests
+    node->imgPageRequestRetry = 0;
+    node->imgBlockResponseRetry = 0;
 
-/*! Sends a upgrade end request to a node via unicast.
-    \param addr - the destination address
- */
-void StdOtauPlugin::unicastUpgradeEndRequest(const deCONZ::Address &addr)
-{
-    if (addr.hasExt())
+    node->setState(OtauNode::NodeWaitPageSpacing);
+    node->lastResponseTime = m_transport->steadyTime();
+    if (!m_imagePageTimer->isActive())
     {
-        OtauNode *node = m_model->getNode(addr);
-
-        DBG_Assert(node != nullptr);
-        if (node)
-        {
-            if (!upgradeEndResponse(node, DEFAULT_UPGRADE_TIME))
-            {
-                DBG_Printf(DBG_OTA, "OTAU: failed to send upgrade end response\n");
-            }
-        }
+        m_imagePageTimer->start(IMAGE_PAGE_TIMER_DELAY);
     }
 }
 
-/*! Handles a match descriptor request and sends the response if needed.
-    \param ind - the APSDE-DATA.indication
+/*! Sends a image block responses for a whole page.
+    \param node - the destination node
+    \return true on success false otherwise
  */
-void StdOtauPlugin::matchDescriptorRequest(const deCONZ::ApsDataIndication &ind)
+bool StdOtauPlugin::imagePageResponse(OtauNode *node)
 {
-    bool sendResponse = false;
-    uint8_t seqNo;
-    uint16_t shortAddr;
-    uint16_t profileId;
-    uint8_t serverClusterCount;
-
-    if (ind.asdu().size() < 7) // minimum size for match descriptor request
+    DBG_Assert(node != nullptr);
+    if (!node)
     {
-        DBG_Printf(DBG_OTA, "OTAU: ignore match descriptor req from 0x%04X with asduSize %d\n", ind.srcAddress().nwk(), (int)ind.asdu().size());
+        return false;
     }
 
+    if (node->lastZclCmd() != OTAU_IMAGE_PAGE_REQUEST_CMD_ID)
     {
-        QDataStream stream(ind.asdu());
-        stream.setByteOrder(QDataStream::LittleEndian);
-        stream >> seqNo;
-        stream >> shortAddr;
-        stream >> profileId;
-        stream >> serverClusterCount;
-
-        for (uint i = 0; i < serverClusterCount; i++)
-        {
-            uint16_t clusterId;
-            stream >> clusterId;
+        return false;
+    }
 
-            if (clusterId == OTAU_CLUSTER_ID && (profileId == ZLL_PROFILE_ID || profileId == HA_PROFILE_ID))
-            {
-                const deCONZ::Node *coord = nullptr;
-                deCONZ::ApsController::instance()->getNode(0, &coord);
+    if (node->state() == OtauNode::NodeAbort)
+    {
+        return imageBlockResponse(node);
+    }
 
-                DBG_Assert(coord != nullptr);
-                if (!coord)
-                {
-                    return;
-                }
+    if (node->paused || state() == StateBusySensors)
+    {
+        node->setState(OtauNode::NodeIdle); // one WAIT_FOR_DATA ends the page
+        return imageBlockResponse(node);
+    }
 
-                for (const deCONZ::SimpleDescriptor &sd : coord->simpleDescriptors())
-                {
-                    if (sd.profileId() == profileId)
-                    {
-                        return; // firmware will handle this
-                    }
-                }
+    if (node->apsRequestId != INVALID_APS_REQ_ID && node->zclCommandId == OTAU_IMAGE_BLOCK_RESPONSE_CMD_ID)
+    {
+        // wait confirm
+        return true;
+    }
 
-                DBG_Printf(DBG_OTA, "OTAU: match descriptor req, profileId 0x%04X from 0x%04X\n", profileId, ind.srcAddress().nwk());
-                sendResponse = true;
-                break;
-            }
+    if (node->imgBlockReq.pageBytesDone >= node->imgBlockReq.pageSize)
+    {
+        node->setState(OtauNode::NodeWaitNextRequest);
+
+        if (!m_imagePageTimer->isActive())
+        {
+            m_imagePageTimer->start(IMAGE_PAGE_TIMER_DELAY);
         }
+        return true;
     }
 
-    if (sendResponse)
+    //if (node->imgBlockReq.pageBytesDone > 0)
     {
-        deCONZ::ApsDataRequest req;
+        int spacing = m_config.packetSpacingMs();
 
-        //req.setTxOptions(deCONZ::ApsTxAcknowledgedTransmission);
-        req.dstAddress() = ind.srcAddress();
-        req.setDstAddressMode(deCONZ::ApsNwkAddress);
-        req.setProfileId(ZDP_PROFILE_ID);
-        req.setClusterId(ZDP_MATCH_DESCRIPTOR_RSP_CLID);
-        req.setDstEndpoint(ZDO_ENDPOINT);
-        req.setSrcEndpoint(ZDO_ENDPOINT);
+        if (m_health.level() == OtauConfirmHealth::LevelThrottle)
+        {
+            spacing *= BUSY_SPACING_FACTOR;
+        }
 
-        QDataStream stream(&req.asdu(), QIODevice::WriteOnly);
-        stream.setByteOrder(QDataStream::LittleEndian);
+        // transfers through the same router share its buffers
+        spacing *= int(branchLoad(node->address().ext()));
 
-        uint8_t status = 0x00; // success
-        shortAddr = 0x0000; // TODO query from apsController
-        uint8_t matchLength = 0x01;
-        uint8_t matchList = m_srcEndpoint;
+        if (isValid(node->lastResponseTime) && m_transport->steadyTime().ref - node->lastResponseTime.ref < spacing)
+        {
+            node->setState(OtauNode::NodeWaitPageSpacing);
 
-        stream << seqNo;
-        stream << status;
-        stream << shortAddr;
-        stream << matchLength;
-        stream << matchList;
+            if (!m_imagePageTimer->isActive())
+            {
+                m_imagePageTimer->start(IMAGE_PAGE_TIMER_DELAY);
+            }
 
-        if (deCONZ::ApsController::instance()->apsdeDataRequest(req) == deCONZ::Success)
-        {
-            DBG_Printf(DBG_OTA, "OTAU: send match descriptor rsp, match endpoint 0x%02X\n", matchList);
-        }
-        else
-        {
-            DBG_Printf(DBG_OTA, "OTAU: send match descriptor rsp failed\n");
+            return true;
         }
     }
+
+    int succ = 0;
+
+    if (imageBlockResponse(node))
+    {
+        node->imgBlockResponseRetry = 0;
+        succ++;
+    }
+    else
+    {
+        node->setState(OtauNode::NodeWaitPageSpacing);
+        node->imgBlockResponseRetry++;
+        DBG_Printf(DBG_OTA, "OTAU: failed send img block rsp (retry %d)\n", node->imgBlockResponseRetry);
+
+    }
+
+    return succ > 0;
 }
 
-/*! Handles a query next image request and sends the response.
+/*! Handles a upgrade end request and sends the response.
     \param ind - the APSDE-DATA.indication
     \param zclFrame - the ZCL frame
  */
-void StdOtauPlugin::queryNextImageRequest(const deCONZ::ApsDataIndication &ind, const deCONZ::ZclFrame &zclFrame)
+void StdOtauPlugin::upgradeEndRequest(const deCONZ::ApsDataIndication &ind, const deCONZ::ZclFrame &zclFrame)
 {
-    uint16_t u16;
-    uint32_t u32;
     OtauNode *node = m_model->getNode(ind.srcAddress());
 
     if (!node)
     {
-        DBG_Printf(DBG_OTA, "OTAU: query next image request for unknown node " FMT_MAC "\n", FMT_MAC_CAST(ind.srcAddress().ext()));
         return;
     }
 
-    if ((zclFrame.payload().size() != 9) &&
-        (zclFrame.payload().size() != 11)) // with hardware version present
+    QDataStream stream(zclFrame.payload());
+    stream.setByteOrder(QDataStream::LittleEndian);
+
+    stream >> node->upgradeEndReq.status;
+    stream >> node->upgradeEndReq.manufacturerCode;
+    stream >> node->upgradeEndReq.imageType;
+    stream >> node->upgradeEndReq.fileVersion;
+
+    if (node->hasData())
     {
-        DBG_Printf(DBG_OTA, "OTAU: query next image request for node " FMT_MAC " invalid payload length %d\n", FMT_MAC_CAST(ind.srcAddress().ext()), (int)zclFrame.payload().size());
-        return;
+        node->setOffset(node->imgBlockReq.offset);
+        node->setImageType(node->imgBlockReq.imageType);
     }
-
-    invalidateUpdateEndRequest(node);
+    node->notifyElapsedTimer();
 
     node->reqSequenceNumber = zclFrame.sequenceNumber();
     node->endpoint = ind.srcEndpoint();
     node->profileId = ind.profileId();
-    node->setAddress(ind.srcAddress());
-    node->refreshTimeout();
-    node->restartElapsedTimer();
-    node->setStatus(OtauNode::StatusImageRequest);
 
-    QDataStream stream(zclFrame.payload());
-    stream.setByteOrder(QDataStream::LittleEndian);
+    DBG_Printf(DBG_OTA, "OTAU: upgrade end req: status: 0x%02X, fwVersion:0x%08X, imgType: 0x%04X\n", node->upgradeEndReq.status, node->upgradeEndReq.fileVersion, node->upgradeEndReq.imageType);
 
-    uint8_t fieldControl;
+    node->setState(OtauNode::NodeIdle);
+    node->setStatus(OtauNode::StatusUpgradeEnd);
 
-    stream >> fieldControl;
-    stream >> node->manufacturerId;
-    stream >> u16;
-    node->setImageType(u16);
-    stream >> u32;
-    node->setSoftwareVersion(u32);
-    if (fieldControl & 0x01)
-    {
-        stream >> u16;
-        node->setHardwareVersion(u16);
-    }
-    else
+    if (node->upgradeEndReq.status == OTAU_SUCCESS)
     {
-        node->setHardwareVersion(0xFFFF);
-    }
+        if (node->imgBlockReq.offset == 0)
+        {
+            // This is a workaround for buggy Osram/Ledvance Plug Z3 firmware (maybe Plug 01 as well)
+            // it sends upgrade end request _without_ any update happening before,
+            // send a ABORT status to break the reboot cycle.
+            defaultResponse(node, zclFrame.commandId(), OTAU_ABORT);
+            return;
+        }
 
-    DBG_Printf(DBG_OTA, "OTAU: query next img req: " FMT_MAC " mfCode: 0x%04X, img type: 0x%04X, sw version: 0x%08X\n",
-               FMT_MAC_CAST(ind.srcAddress().ext()), node->manufacturerId, node->imageType(), node->softwareVersion());
+        node->setOffset(node->file.totalImageSize); // mark done
+        printLatency(node);
+        publishComplete(node, OTAU_SUCCESS);
 
-    // if (deCONZ::ApsController::instance()->getParameter(deCONZ::ParamOtauActive) != 0)
-    {
-        // check for image
-        if (!node->hasData() && m_otauTracker.size() < OTAU_MAX_ACTIVE)
+        node->file.subElements.clear();
+        node->setHasData(false);
+        node->setPermitUpdate(false);
+        saveJournal(); // don't resume a finished transfer
+        queueAvailableNotify(node);
+
+        uint32_t upgradeTime = m_config.restartTime();
+
+        if (upgradeTime != OTAU_UNLIMITED_RESTART_TIME)
         {
-            node->file.subElements.clear();
-            node->setHasData(false);
-            //node->setPermitUpdate(false);
+            m_activation.setMaxParallel(m_config.maxParallelRestarts());
+            m_activation.setSlotSeconds(m_config.restartSlotSeconds());
+            upgradeTime = m_activation.schedule(node->address().ext(), node->deviceClass == OtauNode::DeviceRouter, upgradeTime, m_transport->steadyTime().ref);
 
-            if (!checkForUpdateImageImage(node))
-            {
-            }
+            DBG_Printf(DBG_OTA, "OTAU: " FMT_MAC " switches to new image in %u seconds\n", FMT_MAC_CAST(node->address().ext()), upgradeTime);
         }
-    }
 
-    if (queryNextImageResponse(node))
-    {
-        node->setState(OtauNode::NodeWaitConfirm);
+        if (!upgradeEndResponse(node, upgradeTime))
+        {
+            DBG_Printf(DBG_OTA, "OTAU: failed to send upgrade end response\n");
+        }
     }
     else
-    {
-        // TODO handle error
-        node->setState(OtauNode::NodeIdle);
+    { // TODO show detailed status
+        node->setStatus(OtauNode::StatusUnknownError);
+        publishComplete(node, node->upgradeEndReq.status);
+        defaultResponse(node, zclFrame.commandId(), deCONZ::ZclSuccessStatus);
     }
 }
 
-/*! Sends a query next image response.
+/*! Sends a upgrade end response.
     \param node - the destination node
+    \param upgradeTime - time in seconds to wait for switching to new image
     \return true on success false otherwise
  */
-bool StdOtauPlugin::queryNextImageResponse(OtauNode *node)
+bool StdOtauPlugin::upgradeEndResponse(OtauNode *node, uint32_t upgradeTime)
 {
     deCONZ::ApsDataRequest req;
     deCONZ::ZclFrame zclFrame;
@@ -1828,17 +3847,25 @@ bool StdOtauPlugin::queryNextImageResponse(OtauNode *node)
         return false;
     }
 
+    if (node->upgradeEndReq.manufacturerCode == 0 &&
+        node->upgradeEndReq.fileVersion == 0 &&
+        node->upgradeEndReq.status != OTAU_SUCCESS)
+    {
+        DBG_Printf(DBG_OTA,"OTAU: upgrade end response not send because status is not success but 0x%02X\n", node->upgradeEndReq.status);
+        return false;
+    }
+
     req.setProfileId(node->profileId);
     req.setDstEndpoint(node->endpoint);
     req.setClusterId(OTAU_CLUSTER_ID);
-    req.dstAddress().setExt(node->address().ext());
+    req.dstAddress() = node->address();
     req.setDstAddressMode(deCONZ::ApsExtAddress);
     req.setSrcEndpoint(m_srcEndpoint);
     req.setTxOptions(deCONZ::ApsTxAcknowledgedTransmission);
     req.setRadius(MAX_RADIUS);
 
     zclFrame.setSequenceNumber(node->reqSequenceNumber);
-    zclFrame.setCommandId(OTAU_QUERY_NEXT_IMAGE_RESPONSE_CMD_ID);
+    zclFrame.setCommandId(OTAU_UPGRADE_END_RESPONSE_CMD_ID);
 
     zclFrame.setFrameControl(deCONZ::ZclFCClusterCommand |
                              deCONZ::ZclFCDirectionServerToClient |
@@ -1848,57 +3875,68 @@ bool StdOtauPlugin::queryNextImageResponse(OtauNode *node)
         QDataStream stream(&zclFrame.payload(), QIODevice::WriteOnly);
         stream.setByteOrder(QDataStream::LittleEndian);
 
-        if (node->state() == OtauNode::NodeAbort)
-        {
-            stream << (uint8_t)OTAU_ABORT;
-            DBG_Printf(DBG_OTA, "OTAU: send query next image response: OTAU_ABORT\n");
-        }
-        else if (m_otauTracker.size() >= OTAU_MAX_ACTIVE)
-        {
-            DBG_Printf(DBG_OTA, "OTAU: busy, don't answer and let node run in timeout\n");
-            return false;
-        }
-        else if (node->manufacturerId == VENDOR_DDEL &&
-                 node->imageType() == IMG_TYPE_FLS_PP3_H3 &&
-                 node->softwareVersion() >= 0x20000050 &&
-                 node->softwareVersion() <= 0x20000054 &&
-                 node->file.fileVersion < 0x201000eb)
-        {
-            // workaround to prevent update FLS-H lp with older FLS-PP lp versions
-            stream << (uint8_t)OTAU_NO_IMAGE_AVAILABLE;
-            DBG_Printf(DBG_OTA, "OTAU: send query next image response: OTAU_NO_IMAGE_AVAILABLE to FLS-H lp\n");
-        }
-        else if (node->permitUpdate() && node->hasData() && node->file.raw.size() != 0)
-        {
-            node->rawFile = node->file.raw;
-            stream << (uint8_t)OTAU_SUCCESS;
-            stream << node->file.manufacturerCode;
-            stream << node->file.imageType;
-            stream << node->file.fileVersion;
-            stream << node->file.totalImageSize;
+        stream << node->upgradeEndReq.manufacturerCode;
+        stream << node->upgradeEndReq.imageType;
+        stream << node->upgradeEndReq.fileVersion;
 
-            markOtauActivity(node->address());
-        }
-        else
-        {
-            if (node->manufacturerId == VENDOR_BUSCH_JAEGER)
-            {
-                stream << (uint8_t)OTAU_ABORT;
-                DBG_Printf(DBG_OTA, "OTAU: send query next image response: OTAU_ABORT\n");
-            }
-            else
-            {
-                stream << (uint8_t)OTAU_NO_IMAGE_AVAILABLE;
-                DBG_Printf(DBG_OTA, "OTAU: send query next image response: OTAU_NO_IMAGE_AVAILABLE\n");
-            }
-        }
+        uint32_t currentTime = 0;
+
+        stream << currentTime;
+        stream << upgradeTime;
+    }
+
+    { // ZCL frame
+        QDataStream stream(&req.asdu(), QIODevice::WriteOnly);
+        stream.setByteOrder(QDataStream::LittleEndian);
+        zclFrame.writeToStream(stream);
+    }
+
+    bool ret = false;
+
+    if (sendApsRequest(req) == 0)
+    {
+        node->apsRequestId = req.id();
+        node->zclCommandId = zclFrame.commandId();
+        ret = true;
+    }
+
+    return ret;
+}
+
+bool StdOtauPlugin::defaultResponse(OtauNode *node, quint8 commandId, quint8 status)
+{
+    deCONZ::ApsDataRequest req;
+    deCONZ::ZclFrame zclFrame;
+
+    DBG_Assert(node->address().hasExt());
+    if (!node->address().hasExt())
+    {
+        return false;
     }
 
-    if ((node->address().ext() & macPrefixMask) == osramMacPrefix &&
-        !(node->permitUpdate() && node->hasData()))
-    {
-        DBG_Printf(DBG_OTA, "OTAU: don't answer OSRAM node: OTAU_NO_IMAGE_AVAILABLE\n");
-        return false;
+    req.setProfileId(node->profileId);
+    req.setDstEndpoint(node->endpoint);
+    req.setClusterId(OTAU_CLUSTER_ID);
+    req.dstAddress() = node->address();
+    req.setDstAddressMode(deCONZ::ApsExtAddress);
+
+    req.setSrcEndpoint(m_srcEndpoint);
+    req.setTxOptions(deCONZ::ApsTxAcknowledgedTransmission);
+
+    zclFrame.setSequenceNumber(node->reqSequenceNumber);
+    req.setRadius(MAX_RADIUS);
+
+    zclFrame.setCommandId(deCONZ::ZclDefaultResponseId);
+
+    zclFrame.setFrameControl(deCONZ::ZclFCProfileCommand |
+                             deCONZ::ZclFCDirectionServerToClient |
+                             deCONZ::ZclFCDisableDefaultResponse);
+
+    { // ZCL payload
+        QDataStream stream(&zclFrame.payload(), QIODevice::WriteOnly);
+        stream.setByteOrder(QDataStream::LittleEndian);
+        stream << commandId;
+        stream << status;
     }
 
     { // ZCL frame
@@ -1907,639 +3945,1074 @@ bool StdOtauPlugin::queryNextImageResponse(OtauNode *node)
         zclFrame.writeToStream(stream);
     }
 
-    if (deCONZ::ApsController::instance()->apsdeDataRequest(req) == 0)
+    if (sendApsRequest(req) == deCONZ::Success)
     {
         node->apsRequestId = req.id();
         node->zclCommandId = zclFrame.commandId();
+        node->lastResponseTime = m_transport->steadyTime();
         return true;
     }
 
     return false;
 }
 
-/*! Handles a image block request and sends the response.
-    \param ind - the APSDE-DATA.indication
-    \param zclFrame - the ZCL frame
+/*! Queries this plugin which features are supported.
+    \param feature - feature to be checked
+    \return true if supported
  */
-void StdOtauPlugin::imageBlockRequest(const deCONZ::ApsDataIndication &ind, const deCONZ::ZclFrame &zclFrame)
+bool StdOtauPlugin::hasFeature(Features feature)
 {
-    OtauNode *node = m_model->getNode(ind.srcAddress());
+    switch (feature)
+    {
+    case WidgetFeature:
+        return true;
 
-    if (!node)
+    default:
+        break;
+    }
+
+    return false;
+}
+
+/*! Sends an APSDE-DATA.request through the transport and records it in the trace.
+    \param req - the request
+    \return deCONZ::Success if the request was queued
+ */
+int StdOtauPlugin::sendApsRequest(const deCONZ::ApsDataRequest &req)
+{
+    int ret = m_transport->apsdeDataRequest(req);
+
+    if (ret == deCONZ::Success)
     {
-        return;
+        if (m_trace.isOpen())
+        {
+            m_trace.writeRequest(req, m_transport->steadyTime().ref);
+        }
+
+        OtauEvent ev = {};
+        ev.type = OtauEventTx;
+        ev.extAddr = req.dstAddress().hasExt() ? req.dstAddress().ext() : 0;
+        ev.nwkAddr = req.dstAddress().hasNwk() ? req.dstAddress().nwk() : 0;
+        ev.profileId = req.profileId();
+        ev.clusterId = req.clusterId();
+        ev.srcEndpoint = req.srcEndpoint();
+        ev.dstEndpoint = req.dstEndpoint();
+        ev.apsId = req.id();
+        recordEvent(ev, req.asdu());
+
+        m_apsRequestTimeUs[req.id()] = latencyClockUs() | 1; // never 0 while pending
+    }
+    else
+    {
+        m_health.addQueueFull(m_transport->steadyTime().ref);
     }
 
-    markOtauActivity(node->address());
+    return ret;
+}
 
-    node->refreshTimeout();
-    invalidateUpdateEndRequest(node);
+/*! Loads an image file for a node.
+    The data is shared with a node which already holds the same file version.
+    \param node - the node
+    \param path - the image file
+    \param fileVersion - version of the file from the index
+    \return true on success
+ */
+bool StdOtauPlugin::loadImageFile(OtauNode *node, const QString &path, uint32_t fileVersion)
+{
+    node->imageEvicted = false;
 
-    QDataStream stream(zclFrame.payload());
-    stream.setByteOrder(QDataStream::LittleEndian);
+    for (OtauNode *other : m_model->nodes())
+    {
+        if (other != node && !other->file.raw.isEmpty() && other->file.path == path && other->file.fileVersion == fileVersion)
+        {
+            node->file = other->file; // implicitly shared
+            return true;
+        }
+    }
 
-    stream >> node->imgBlockReq.fieldControl;
-    stream >> node->imgBlockReq.manufacturerCode;
-    stream >> node->imgBlockReq.imageType;
-    stream >> node->imgBlockReq.fileVersion;
-    stream >> node->imgBlockReq.offset;
-    stream >> node->imgBlockReq.maxDataSize;
+    OtauFileLoader ld;
+    return ld.readFile(path, node->file);
+}
 
-    if (node->imgBlockReq.fileVersion == DONT_CARE_FILE_VERSION)
+/*! Reloads the image data of a node which was evicted, keeps the node's transfer state.
+ */
+void StdOtauPlugin::reloadImageData(OtauNode *node)
+{
+    const uint32_t fileVersion = node->file.fileVersion;
+
+    if (loadImageFile(node, node->file.path, fileVersion) && node->file.fileVersion == fileVersion)
     {
-        node->imgBlockReq.fileVersion = node->file.fileVersion;
+        node->rawFile = node->file.raw;
+        DBG_Printf(DBG_OTA, "OTAU: reloaded image data of " FMT_MAC "\n", FMT_MAC_CAST(node->address().ext()));
+        enforceMemoryBudget();
+    }
+    else
+    {
+        releaseImageData(node);
+        node->imageEvicted = false;
+        node->setHasData(false);
+        DBG_Printf(DBG_OTA, "OTAU: failed to reload image data of " FMT_MAC "\n", FMT_MAC_CAST(node->address().ext()));
     }
+}
 
-    node->setStatus(OtauNode::StatusUploading);
-    node->setOffset(node->imgBlockReq.offset);
-    node->setImageType(node->imgBlockReq.imageType);
-    node->notifyElapsedTimer();
+/*! Frees the image data of a node, header fields and path are kept for a reload.
+ */
+void StdOtauPlugin::releaseImageData(OtauNode *node)
+{
+    node->file.raw.clear();
+    node->file.subElements.clear();
+    node->file.subElements.shrink_to_fit();
+    node->rawFile.clear();
+}
 
-    node->reqSequenceNumber = zclFrame.sequenceNumber();
-    node->endpoint = ind.srcEndpoint();
-    node->profileId = ind.profileId();
+/*! Measures the memory held by the plugin.
+    \param images - if not nullptr receives the image data per image file
+ */
+const OtauMemoryUsage &StdOtauPlugin::updateMemoryUsage(std::vector<OtauImageMemory> *images)
+{
+    quint64 caches = sizeof(OtauEventRing);
+    caches += m_imageStore.entries().capacity() * sizeof(OtauImageEntry);
+    caches += m_downloads.capacity() * sizeof(DownloadOtaFile);
+    caches += m_otauTracker.capacity() * sizeof(OtauTracker);
 
-    DBG_Printf(DBG_OTA, "OTAU: img block req fwVersion:0x%08X, offset: 0x%08X, maxsize: %u\n", node->imgBlockReq.fileVersion, node->imgBlockReq.offset, node->imgBlockReq.maxDataSize);
+    return m_memory.measure(m_model->nodes(), caches, images);
+}
 
-    // IEEE address present?
-    if (node->imgBlockReq.fieldControl & 0x01)
+/*! Releases image data of idle nodes, least recently active first, until the image data fits into the budget.
+ */
+void StdOtauPlugin::enforceMemoryBudget()
+{
+    std::vector<OtauImageMemory> images;
+    updateMemoryUsage(&images);
+
+    if (DBG_IsEnabled(DBG_OTA))
     {
-        quint64 extAddr;
-        stream >> extAddr;
+        for (const OtauImageMemory &img : images)
+        {
+            DBG_Printf(DBG_OTA, "OTAU: memory %s %llu kB, %u nodes\n", qPrintable(img.path), img.bytes / 1024, img.nodes);
+        }
 
-        deCONZ::Address addr = node->address();
-        addr.setExt(extAddr);
-        node->setAddress(addr);
+        DBG_Printf(DBG_OTA, "OTAU: memory images %llu kB, nodes %llu kB, caches %llu kB, high-water %llu kB, budget %llu kB\n",
+                   m_memory.current().images / 1024, m_memory.current().nodes / 1024, m_memory.current().caches / 1024,
+                   m_memory.highWaterTotal() / 1024, m_memory.budget() / 1024);
     }
 
-    node->apsRequestId = INVALID_APS_REQ_ID;
-    if (imageBlockResponse(node))
+    if (!m_memory.overBudget())
     {
-        node->setState(OtauNode::NodeWaitConfirm);
+        return;
     }
-    else
+
+    const auto now = m_transport->steadyTime();
+    std::vector<OtauNode*> idle;
+    for (OtauNode *node : m_model->nodes())
     {
-        DBG_Printf(DBG_OTA, "OTAU: failed to send image block response\n");
-        node->setState(OtauNode::NodeIdle);
+        if (!node->imageEvicted && OtauMemoryMeter::nodeImageBytes(node) > 0 &&
+            (!isValid(node->lastActivity) || now.ref - node->lastActivity.ref > MEMORY_IDLE_TIMEOUT))
+        {
+            idle.push_back(node);
+        }
+    }
+
+    // least recently used first, nodes without any activity before all others
+    std::sort(idle.begin(), idle.end(), [](OtauNode *a, OtauNode *b) {
+        const qint64 ta = isValid(a->lastActivity) ? a->lastActivity.ref : std::numeric_limits<qint64>::min();
+        const qint64 tb = isValid(b->lastActivity) ? b->lastActivity.ref : std::numeric_limits<qint64>::min();
+        return ta < tb;
+    });
+
+    for (OtauNode *node : idle)
+    {
+        releaseImageData(node);
+        node->imageEvicted = true;
+        DBG_Printf(DBG_OTA, "OTAU: evicted image data of idle node " FMT_MAC "\n", FMT_MAC_CAST(node->address().ext()));
+
+        if (!updateMemoryUsage().images || !m_memory.overBudget())
+        {
+            break;
+        }
     }
 }
 
-/*! Sends a image block response.
-    \param node - the destination node
-    \return true on success false otherwise
+/*! Reloads the transfer settings when the configuration file changed.
  */
-bool StdOtauPlugin::imageBlockResponse(OtauNode *node)
+void StdOtauPlugin::configTimerFired()
 {
-    DBG_Assert(node->address().hasExt());
-    if (!node->address().hasExt())
+    if (m_config.reloadIfChanged())
     {
-        return false;
+        emit configChanged();
     }
+}
 
-    if (node->apsRequestId != INVALID_APS_REQ_ID)
+/*! Returns the image store entry of an image file, or nullptr.
+    \param path - image file, store object or alias
+ */
+const OtauImageEntry *StdOtauPlugin::imageEntry(const QString &path) const
+{
+    for (const OtauImageEntry &e : m_imageStore.entries())
     {
-        if (node->lastResponseTime.isValid() &&
-            node->lastResponseTime.elapsed() < (1000 * 10)) // prevent stallation
+        if (e.path == path || e.storePath == path || e.aliases.contains(path))
         {
-            //DBG_Printf(DBG_OTA, "OTAU: ...\n");
-            return false;
+            return &e;
         }
-
-        DBG_Printf(DBG_OTA, "OTAU: warn apsRequestId != 0\n");
     }
 
-    uint8_t dataSize = 0;
-    deCONZ::ApsDataRequest req;
-    deCONZ::ZclFrame zclFrame;
+    return nullptr;
+}
 
-    req.setProfileId(node->profileId);
-    req.setDstEndpoint(node->endpoint);
-    req.setClusterId(OTAU_CLUSTER_ID);
-    req.dstAddress() = node->address();
-    req.setDstAddressMode(deCONZ::ApsExtAddress);
-    //req.setTxOptions(deCONZ::ApsTxFragmentationPermitted);
-    req.setSrcEndpoint(m_srcEndpoint);
-    // APS ACKs are enabled for single image block requests
-    // they are disabled for image page request responses
-    if ((node->lastZclCmd() == OTAU_IMAGE_BLOCK_REQUEST_CMD_ID) || (node->state() == OtauNode::NodeAbort) || m_w->acksEnabled())
+/*! Reads the transfer journal, the entries are applied when their nodes show up.
+ */
+void StdOtauPlugin::loadJournal()
+{
+    QFile f(m_journalPath);
+    if (!f.open(QFile::ReadOnly))
     {
-        req.setTxOptions(req.txOptions() | deCONZ::ApsTxAcknowledgedTransmission);
+        return;
     }
 
-    zclFrame.setSequenceNumber(node->reqSequenceNumber);
-    req.setRadius(MAX_RADIUS);
+    m_journalPending.clear();
+    if (!OtauJournal::parse(f.readAll(), &m_journalPending))
+    {
+        DBG_Printf(DBG_OTA, "OTAU: ignore invalid journal %s\n", qPrintable(m_journalPath));
+        return;
+    }
 
-    zclFrame.setCommandId(OTAU_IMAGE_BLOCK_RESPONSE_CMD_ID);
+    DBG_Printf(DBG_OTA, "OTAU: journal has %d transfers to resume\n", int(m_journalPending.size()));
+}
 
-    zclFrame.setFrameControl(deCONZ::ZclFCClusterCommand |
-                             deCONZ::ZclFCDirectionServerToClient |
-                             deCONZ::ZclFCDisableDefaultResponse);
+/*! Writes the permitted and running transfers to the journal.
+    The file writer skips the write if nothing changed, so that idle periods cause no flash wear.
+ */
+void StdOtauPlugin::saveJournal()
+{
+    if (m_journalPath.isEmpty() || !m_model)
+    {
+        return;
+    }
 
-    { // ZCL payload
-        QDataStream stream(&zclFrame.payload(), QIODevice::WriteOnly);
-        stream.setByteOrder(QDataStream::LittleEndian);
+    std::vector<OtauJournalEntry> entries;
 
-        if ((node->imgBlockReq.fileVersion != node->file.fileVersion) ||
-            (node->imgBlockReq.imageType != node->file.imageType) ||
-            (node->imgBlockReq.manufacturerCode != node->file.manufacturerCode))
+    for (OtauNode *node : m_model->nodes())
+    {
+        if (!node->hasData() || !node->address().hasExt() || node->status() == OtauNode::StatusUpgradeEnd)
         {
-            stream << (uint8_t)OTAU_ABORT;
-            node->setState(OtauNode::NodeAbort);
-            DBG_Printf(DBG_OTA, "OTAU: send img block " FMT_MAC " OTAU_ABORT\n", FMT_MAC_CAST(node->address().ext()));
+            continue;
         }
-        else if (node->state() == OtauNode::NodeAbort)
+
+        if (!node->permitUpdate() && !(node->status() == OtauNode::StatusUploading && node->offset() > 0))
         {
-            stream << (uint8_t)OTAU_ABORT;
-            DBG_Printf(DBG_OTA, "OTAU: send img block " FMT_MAC " OTAU_ABORT\n", FMT_MAC_CAST(node->address().ext()));
+            continue;
         }
-        else if (!node->permitUpdate() || !node->hasData())
+
+        const OtauImageEntry *image = imageEntry(node->file.path);
+        if (!image || image->sha512.size() != 64)
         {
-            stream << (uint8_t)OTAU_NO_IMAGE_AVAILABLE;
-            DBG_Printf(DBG_OTA, "OTAU: send img block " FMT_MAC " OTAU_NO_IMAGE_AVAILABLE\n", FMT_MAC_CAST(node->address().ext()));
+            continue;
         }
-        else if (node->imgBlockReq.offset < (uint32_t)node->rawFile.size())
-        {
-            if (node->imgBlockReq.maxDataSize > MAX_DATA_SIZE)
-            {
-                dataSize = MAX_DATA_SIZE;
-            }
-            else
-            {
-                dataSize = node->imgBlockReq.maxDataSize;
-            }
 
-            // some older DDEL and BJ devices have an error in BitCloud stack to support larger payloads
-            if ((node->manufacturerId == VENDOR_DDEL || node->manufacturerId == VENDOR_BUSCH_JAEGER) && dataSize > 40)
-            {
-                dataSize = 40;
-            }
+        OtauJournalEntry e;
+        e.extAddr = node->address().ext();
+        e.manufacturerCode = node->file.manufacturerCode;
+        e.imageType = node->file.imageType;
+        e.fileVersion = node->file.fileVersion;
+        e.swVersion = node->softwareVersion();
+        e.offset = node->offset();
+        e.permitUpdate = node->permitUpdate();
+        e.sha512 = image->sha512;
+        entries.push_back(e);
+    }
 
-            uint32_t offset = node->imgBlockReq.offset;
+    // keep transfers of nodes which haven't shown up yet
+    if (m_startupClock.elapsed() < JOURNAL_RESTORE_TIMEOUT)
+    {
+        entries.insert(entries.end(), m_journalPending.begin(), m_journalPending.end());
+    }
+    else
+    {
+        m_journalPending.clear();
+    }
 
-            stream << (uint8_t)OTAU_SUCCESS;
-            stream << node->file.manufacturerCode;
-            stream << node->file.imageType;
-            stream << node->file.fileVersion;
-            stream << node->imgBlockReq.offset;
+    m_fileWriter.writeFile(m_journalPath, OtauJournal::serialize(entries), OtauWriteJournal);
+}
 
-            dataSize = (uint8_t)qMin((uint32_t)dataSize, ((uint32_t)node->rawFile.size() - offset));
+/*! Restores the transfer state of a node from the journal and loads its image.
+    The node continues with block requests from its own offset.
+ */
+void StdOtauPlugin::restoreFromJournal(OtauNode *node)
+{
+    if (!node->address().hasExt())
+    {
+        return;
+    }
 
-            if (node->lastZclCmd() == OTAU_IMAGE_PAGE_REQUEST_CMD_ID)
-            {
-                // only fill till page boundary
-                dataSize = qMin((uint32_t)dataSize, (uint32_t)(node->imgBlockReq.pageSize - node->imgBlockReq.pageBytesDone));
+    const uint64_t extAddr = node->address().ext();
+    auto i = std::find_if(m_journalPending.begin(), m_journalPending.end(), [extAddr](const OtauJournalEntry &e) { return e.extAddr == extAddr; });
+    if (i == m_journalPending.end())
+    {
+        return;
+    }
 
-                if (dataSize == 0)
-                {
-                    // dont send empty block response
-                    DBG_Printf(DBG_OTA, "OTAU: prevent img block rsp with dataSize = 0 " FMT_MAC "\n", FMT_MAC_CAST(node->address().ext()));
-                    return false;
-                }
-            }
+    const OtauJournalEntry entry = *i;
+    m_journalPending.erase(i);
 
-            // truncate datasize if not enough data is left
-            uint32_t avail = static_cast<quint32>(node->rawFile.size()) - offset;
-            if (avail < dataSize)
-            {
-                dataSize = static_cast<quint8>(avail);
-            }
+    const auto &entries = m_imageStore.entries();
+    const auto image = std::find_if(entries.cbegin(), entries.cend(), [&entry](const OtauImageEntry &e) { return e.sha512 == entry.sha512; });
+
+    if (image == entries.cend() ||
+        !loadImageFile(node, image->path, entry.fileVersion) ||
+        node->file.fileVersion != entry.fileVersion)
+    {
+        DBG_Printf(DBG_OTA, "OTAU: journal image of " FMT_MAC " not available\n", FMT_MAC_CAST(extAddr));
+        return;
+    }
+
+    node->manufacturerId = entry.manufacturerCode;
+    node->setImageType(entry.imageType);
+    node->setSoftwareVersion(entry.swVersion);
+    node->setOffset(entry.offset);
+    node->setPermitUpdate(entry.permitUpdate);
+    node->setHasData(true);
+    node->rawFile = node->file.raw;
+
+    DBG_Printf(DBG_OTA, "OTAU: resume " FMT_MAC " version 0x%08X at offset %u\n", FMT_MAC_CAST(extAddr), entry.fileVersion, entry.offset);
+    enforceMemoryBudget();
+}
+
+/*! Periodically saves the transfer journal and the inventory.
+ */
+void StdOtauPlugin::journalTimerFired()
+{
+    saveJournal();
+    saveInventory();
+}
 
-            if (dataSize == 0)
-            {
-                DBG_Printf(DBG_OTA, "OTAU: warn img block rsp with dataSize = 0 " FMT_MAC "\n", FMT_MAC_CAST(node->address().ext()));
-            }
+/*! Populates the model with the nodes of the inventory and resolves their pending updates.
+ */
+void StdOtauPlugin::loadInventory()
+{
+    QFile f(m_inventoryPath);
+    if (!m_model || !f.open(QFile::ReadOnly))
+    {
+        return;
+    }
 
-            stream << dataSize;
+    std::vector<OtauInventoryEntry> entries;
+    if (!OtauInventory::parse(f.readAll(), &entries))
+    {
+        DBG_Printf(DBG_OTA, "OTAU: ignore invalid inventory %s\n", qPrintable(m_inventoryPath));
+        return;
+    }
 
-            for (uint i = 0; (i < dataSize) && (offset < (uint32_t)node->rawFile.size()); i++)
-            {
-                stream << (uint8_t)node->rawFile[offset++];
-            }
+    const int64_t now = QDateTime::currentMSecsSinceEpoch() / 1000;
+    unsigned restored = 0;
+    unsigned pending = 0;
 
-            node->imgBlockReq.maxDataSize = dataSize; // remember
+    for (const OtauInventoryEntry &e : entries)
+    {
+        if (e.lastSeen > 0 && now - e.lastSeen > INVENTORY_MAX_AGE)
+        {
+            continue;
         }
-        else
+
+        deCONZ::Address addr;
+        addr.setExt(e.extAddr);
+        addr.setNwk(e.nwkAddr);
+
+        OtauNode *node = m_model->getNode(addr, true);
+        if (!node)
         {
-            DBG_Printf(DBG_OTA, "OTAU: send img block " FMT_MAC " OTAU_MALFORMED_COMMAND\n", FMT_MAC_CAST(node->address().ext()));
-            stream << (uint8_t)OTAU_MALFORMED_COMMAND;
+            continue;
         }
-    }
 
-    { // ZCL frame
-        QDataStream stream(&req.asdu(), QIODevice::WriteOnly);
-        stream.setByteOrder(QDataStream::LittleEndian);
-        zclFrame.writeToStream(stream);
-    }
+        node->manufacturerId = e.manufacturerCode;
+        node->setImageType(e.imageType);
+        node->setSoftwareVersion(e.swVersion);
+        node->setHardwareVersion(e.hwVersion);
+        node->endpoint = e.endpoint;
+        if (e.profileId != 0)
+        {
+            node->profileId = e.profileId;
+        }
+        if (e.deviceClass != OtauNode::DeviceUnknown)
+        {
+            node->setRxOnWhenIdle(e.deviceClass == OtauNode::DeviceRouter);
+        }
+        node->lastSeen = e.lastSeen;
 
-    if (deCONZ::ApsController::instance()->apsdeDataRequest(req) == deCONZ::Success)
-    {
-        if (zclFrame.payload().size() > 1)
+        resolveUpdate(node);
+        if (node->updateVersion != 0)
         {
-            DBG_Printf(DBG_OTA, "OTAU: send img block rsp seq: %u offset: 0x%08X dataSize %u status: 0x%02X " FMT_MAC "\n", zclFrame.sequenceNumber(), node->imgBlockReq.offset, dataSize, quint8(zclFrame.payload().at(0)), FMT_MAC_CAST(node->address().ext()));
+            pending++;
         }
 
-        node->apsRequestId = req.id();
-        node->zclCommandId = zclFrame.commandId();
-        node->lastResponseTime.invalidate();
-        node->lastResponseTime.start();
-        return true;
+        if (!m_journalPending.empty())
+        {
+            restoreFromJournal(node); // preload images of interrupted transfers
+        }
+        restored++;
     }
 
-    DBG_Printf(DBG_OTA, "OTAU: send img block response failed\n");
-    return false;
+    DBG_Printf(DBG_OTA, "OTAU: inventory restored %u nodes, %u with pending update\n", restored, pending);
 }
 
-/*! Handles a image page request and sends the response.
-    \param ind - the APSDE-DATA.indication
-    \param zclFrame - the ZCL frame
+/*! Writes all nodes with known OTA information to the inventory.
  */
-void StdOtauPlugin::imagePageRequest(const deCONZ::ApsDataIndication &ind, const deCONZ::ZclFrame &zclFrame)
+void StdOtauPlugin::saveInventory()
 {
-    OtauNode *node = m_model->getNode(ind.srcAddress());
-
-    if (!node)
+    if (m_inventoryPath.isEmpty() || !m_model)
     {
         return;
     }
 
-    markOtauActivity(node->address());
+    std::vector<OtauInventoryEntry> entries;
 
-    deCONZ::ApsController *apsCtrl = deCONZ::ApsController::instance();
-    if (!apsCtrl)
+    for (OtauNode *node : m_model->nodes())
+    {
+        if (!node->address().hasExt() || (node->manufacturerId == 0 && node->softwareVersion() == 0))
+        {
+            continue; // never queried
+        }
+
+        OtauInventoryEntry e;
+        e.extAddr = node->address().ext();
+        e.nwkAddr = node->address().nwk();
+        e.manufacturerCode = node->manufacturerId;
+        e.imageType = node->imageType();
+        e.swVersion = node->softwareVersion();
+        e.hwVersion = static_cast<uint16_t>(node->hardwareVersion());
+        e.endpoint = node->endpoint;
+        e.profileId = node->profileId;
+        e.deviceClass = node->deviceClass;
+        e.lastSeen = node->lastSeen - node->lastSeen % OTAU_INVENTORY_SEEN_GRANULARITY;
+        entries.push_back(e);
+    }
+
+    m_fileWriter.writeFile(m_inventoryPath, OtauInventory::serialize(entries), OtauWriteInventory);
+}
+
+/*! Returns what actor subscribers learn about the update availability of a node.
+ */
+OtauAvailability StdOtauPlugin::nodeAvailability(OtauNode *node)
+{
+    OtauAvailability a;
+    a.extAddr = node->address().ext();
+    a.manufacturerCode = node->manufacturerId;
+    a.imageType = node->imageType();
+    a.swVersion = node->softwareVersion();
+    a.hwVersion = static_cast<uint16_t>(node->hardwareVersion());
+    a.permitUpdate = node->permitUpdate();
+    a.fileVersion = node->hasData() ? node->file.fileVersion : node->updateVersion;
+    return a;
+}
+
+/*! Collects the update availability of all nodes in one pass over the nodes and the image store.
+    \param result - receives one entry per node with a known address
+ */
+void StdOtauPlugin::availability(std::vector<OtauAvailability> *result)
+{
+    result->clear();
+
+    if (!m_model)
     {
         return;
     }
 
-    if (!m_w->pageRequestEnabled())
+    // newest version per manufacturer code and image type
+    QHash<uint32_t, uint32_t> newest;
+    for (const OtauImageEntry &e : m_imageStore.entries())
     {
-        return;
+        uint32_t &version = newest[uint32_t(e.manufacturerCode) << 16 | e.imageType];
+        version = std::max(version, e.fileVersion);
     }
 
-    node->reqSequenceNumber = zclFrame.sequenceNumber();
+    result->reserve(m_model->nodes().size());
 
-    if (node->state() == OtauNode::NodeAbort)
+    for (OtauNode *node : m_model->nodes())
     {
-        defaultResponse(node, zclFrame.commandId(), OTAU_ABORT);
-        return;
+        if (!node->address().hasExt())
+        {
+            continue;
+        }
+
+        OtauAvailability a = nodeAvailability(node);
+        if (!node->hasData())
+        {
+            const uint32_t version = newest.value(uint32_t(a.manufacturerCode) << 16 | a.imageType, 0);
+            a.fileVersion = version > a.swVersion ? version : 0;
+        }
+        result->push_back(a);
     }
+}
 
-    if (!m_w->pageRequestEnabled())
+/*! Queues an availability notify for a node if the reported values changed.
+    Changes within AVAILABLE_NOTIFY_DELAY are published as one message per node.
+ */
+void StdOtauPlugin::queueAvailableNotify(OtauNode *node)
+{
+    if (!node->address().hasExt())
     {
-        defaultResponse(node, zclFrame.commandId(), OTAU_UNSUP_CLUSTER_COMMAND);
         return;
     }
 
-    node->refreshTimeout();
-    invalidateUpdateEndRequest(node);
-
-    QDataStream stream(zclFrame.payload());
-    stream.setByteOrder(QDataStream::LittleEndian);
-
-    stream >> node->imgPageReq.fieldControl;
-    stream >> node->imgPageReq.manufacturerCode;
-    stream >> node->imgPageReq.imageType;
-    stream >> node->imgPageReq.fileVersion;
-    stream >> node->imgPageReq.offset;
-    stream >> node->imgPageReq.maxDataSize;
-    stream >> node->imgPageReq.pageSize;
-    stream >> node->imgPageReq.responseSpacing;
+    const OtauAvailability a = nodeAvailability(node);
 
-    if (node->imgPageReq.fileVersion == DONT_CARE_FILE_VERSION)
+    if (node->availableNotified &&
+        node->notifiedSwVersion == a.swVersion &&
+        node->notifiedFileVersion == a.fileVersion &&
+        node->notifiedPermitUpdate == a.permitUpdate)
     {
-        node->imgPageReq.fileVersion = node->file.fileVersion;
+        return; // nothing new for subscribers
     }
 
-    if (node->imgPageReq.responseSpacing > MAX_RESPONSE_SPACING)
+    if (std::find(m_availableNotifyQueue.begin(), m_availableNotifyQueue.end(), a.extAddr) == m_availableNotifyQueue.end())
     {
-        node->imgPageReq.responseSpacing = MAX_RESPONSE_SPACING;
+        m_availableNotifyQueue.push_back(a.extAddr);
     }
-    else if (node->imgPageReq.responseSpacing < MIN_RESPONSE_SPACING)
+
+    if (!m_availableNotifyTimer->isActive())
     {
-        node->imgPageReq.responseSpacing = MIN_RESPONSE_SPACING;
+        m_availableNotifyTimer->start(AVAILABLE_NOTIFY_DELAY);
     }
+}
 
-    node->imgPageReq.pageBytesDone = 0;
+/*! Publishes the queued availability changes, one OTA_M_ID_OTA_AVAILABLE_NOTIFY per node.
+ */
+void StdOtauPlugin::availableNotifyTimerFired()
+{
+    std::vector<uint64_t> queue;
+    queue.swap(m_availableNotifyQueue);
 
-    node->imgBlockReq = node->imgPageReq;
+    for (uint64_t extAddr : queue)
+    {
+        deCONZ::Address addr;
+        addr.setExt(extAddr);
+        OtauNode *node = m_model ? m_model->getNode(addr) : nullptr;
+        if (!node)
+        {
+            continue;
+        }
 
-    node->setOffset(node->imgBlockReq.offset);
-    node->setImageType(node->imgBlockReq.imageType);
-    node->notifyElapsedTimer();
+        const OtauAvailability a = nodeAvailability(node);
 
-    node->endpoint = ind.srcEndpoint();
-    node->profileId = ind.profileId();
+        if (node->availableNotified &&
+            node->notifiedSwVersion == a.swVersion &&
+            node->notifiedFileVersion == a.fileVersion &&
+            node->notifiedPermitUpdate == a.permitUpdate)
+        {
+            continue; // changed back within the window
+        }
 
-    if (DBG_IsEnabled(DBG_OTA))
-    {
-        DBG_Printf(DBG_OTA, "OTAU: img page req fwVersion:0x%08X, offset: 0x%08X, pageSize: %u, rspSpacing: %u ms\n", node->imgBlockReq.fileVersion, node->imgBlockReq.offset, node->imgBlockReq.pageSize, node->imgBlockReq.responseSpacing);
+        node->availableNotified = true;
+        node->notifiedSwVersion = a.swVersion;
+        node->notifiedFileVersion = a.fileVersion;
+        node->notifiedPermitUpdate = a.permitUpdate;
+
+#ifdef USE_ACTOR_MODEL
+        if (am)
+        {
+            // broadcast OTA0 OTA_M_ID_OTA_AVAILABLE_NOTIFY message
+            struct am_message *m;
+
+            m = am->msg_alloc();
+            if (m)
+            {
+                m->src = AM_ACTOR_ID_OTA;
+                m->dst = AM_ACTOR_ID_SUBSCRIBERS;
+                m->id = OTA_M_ID_OTA_AVAILABLE_NOTIFY;
+
+                am->msg_put_u64(m, (am_u64)a.extAddr);
+                am->msg_put_u16(m, a.manufacturerCode);
+                am->msg_put_u16(m, a.imageType);
+                am->msg_put_u32(m, a.swVersion);
+                am->msg_put_u16(m, a.hwVersion);
+                am->msg_put_u8(m, a.permitUpdate);
+
+                if (a.fileVersion != 0)
+                {
+                    am->msg_put_u16(m, 1); // count
+                    am->msg_put_u32(m, a.fileVersion);
+                }
+                else
+                {
+                    am->msg_put_u16(m, 0); // count
+                }
+
+                am->send_message(m);
+            }
+        }
+#endif // USE_ACTOR_MODEL
     }
+}
 
-    // IEEE address present?
-    if (node->imgBlockReq.fieldControl & 0x01)
+/*! Executes a transfer control command.
+    \param ctl - the command and its target nodes
+    \return number of affected nodes, 0 if no node matched, -1 if the image wasn't found
+ */
+int StdOtauPlugin::control(const OtauControl &ctl)
+{
+    if (!m_model)
     {
-        quint64 requestNodeAddress;
-        stream >> requestNodeAddress;
-        // not used
+        return 0;
     }
 
-    node->apsRequestId = INVALID_APS_REQ_ID; // don't wait for prior requests
-    node->imgPageRequestRetry = 0;
-    node->imgBlockResponseRetry = 0;
+    const OtauImageEntry *image = nullptr;
 
-    node->setState(OtauNode::NodeWaitPageSpacing);
-    node->lastResponseTime.start();
-    if (!m_imagePageTimer->isActive())
+    if (ctl.command == OtauControl::CommandSelectImage)
     {
-        m_imagePageTimer->start(IMAGE_PAGE_TIMER_DELAY);
+        const auto &entries = m_imageStore.entries();
+        const auto i = std::find_if(entries.cbegin(), entries.cend(), [&ctl](const OtauImageEntry &e) { return e.sha512 == ctl.sha512; });
+        if (ctl.sha512.size() != 64 || i == entries.cend())
+        {
+            DBG_Printf(DBG_OTA, "OTAU: control select image, image not found\n");
+            return -1;
+        }
+        image = &*i;
     }
-}
 
-/*! Sends a image block responses for a whole page.
-    \param node - the destination node
-    \return true on success false otherwise
- */
-bool StdOtauPlugin::imagePageResponse(OtauNode *node)
-{
-    DBG_Assert(node != nullptr);
-    if (!node)
+    if (ctl.command == OtauControl::CommandPermit || ctl.command == OtauControl::CommandNotify)
     {
-        return false;
+        if (!m_transport->otauActive() && !m_transport->setOtauActive(true))
+        {
+            DBG_Printf(DBG_OTA, "OTAU: failed to enable otau server\n");
+        }
     }
 
-    if (node->lastZclCmd() != OTAU_IMAGE_PAGE_REQUEST_CMD_ID)
+    int count = 0;
+
+    for (OtauNode *node : m_model->nodes())
     {
-        return false;
+        if (!node->address().hasExt())
+        {
+            continue;
+        }
+
+        if (ctl.target == OtauControl::TargetNode && node->address().ext() != ctl.extAddr)
+        {
+            continue;
+        }
+
+        if (ctl.target == OtauControl::TargetModel &&
+            (node->manufacturerId != ctl.manufacturerCode || node->imageType() != ctl.imageType))
+        {
+            continue;
+        }
+
+        if (controlNode(node, ctl, image))
+        {
+            count++;
+        }
     }
 
-    if (node->state() == OtauNode::NodeAbort)
+    // one targeted broadcast instead of a unicast per node
+    if (ctl.command == OtauControl::CommandNotify && ctl.target == OtauControl::TargetAll)
     {
-        return imageBlockResponse(node);
+        count = broadcastImageNotify() ? std::max(count, 1) : count;
     }
+    else if ((ctl.command == OtauControl::CommandNotify || ctl.command == OtauControl::CommandPermit) &&
+             ctl.target == OtauControl::TargetModel && count > 0)
+    {
+        const OtauImageEntry *newest = newestImage(ctl.manufacturerCode, ctl.imageType);
 
-    if (node->apsRequestId != INVALID_APS_REQ_ID && node->zclCommandId == OTAU_IMAGE_BLOCK_RESPONSE_CMD_ID)
+        ImageNotifyReq notf;
+        notf.radius = 0;
+        notf.addr.setNwk(deCONZ::BroadcastRxOnWhenIdle);
+        notf.addrMode = deCONZ::ApsNwkAddress;
+        notf.dstEndpoint = 0xFF; // broadcast endpoint
+        notf.payloadType = newest ? IMAGE_NOTIFY_MFCODE_TYPE_VER : IMAGE_NOTIFY_MFCODE_TYPE;
+        notf.manufacturerCode = ctl.manufacturerCode;
+        notf.imageType = ctl.imageType;
+        notf.fileVersion = newest ? newest->fileVersion : 0;
+        notf.queryJitter = imageNotifyJitter(unsigned(count), unsigned(std::max(1, int(OTAU_MAX_ACTIVE) - int(m_otauTracker.size()))));
+        imageNotify(&notf);
+    }
+
+    DBG_Printf(DBG_OTA, "OTAU: control command 0x%02X target 0x%02X, %d nodes\n", ctl.command, ctl.target, count);
+    return count;
+}
+
+/*! Applies a control command to one node.
+    \param image - the image for CommandSelectImage
+    \return true if the node was affected
+ */
+bool StdOtauPlugin::controlNode(OtauNode *node, const OtauControl &ctl, const OtauImageEntry *image)
+{
+    const bool unicast = ctl.target == OtauControl::TargetNode;
+
+    switch (ctl.command)
     {
-        // wait confirm
+    case OtauControl::CommandPermit:
+    {
+        if (!node->hasData() && node->updateVersion != 0)
+        {
+            const OtauImageEntry *newest = newestImage(node->manufacturerId, node->imageType());
+            if (newest && loadImageFile(node, newest->path, newest->fileVersion))
+            {
+                node->setHasData(true);
+                enforceMemoryBudget();
+            }
+        }
+
+        if (!node->hasData())
+        {
+            return false;
+        }
+
+        node->setState(OtauNode::NodeIdle);
+        node->setPermitUpdate(true);
+        node->paused = false;
+        queueAvailableNotify(node);
+        if (unicast)
+        {
+            unicastImageNotify(node->address());
+        }
         return true;
     }
 
-    if (node->imgBlockReq.pageBytesDone >= node->imgBlockReq.pageSize)
-    {
-        node->setState(OtauNode::NodeWaitNextRequest);
+    case OtauControl::CommandDeny:
+        node->setPermitUpdate(false);
+        queueAvailableNotify(node);
+        return true;
 
-        if (!m_imagePageTimer->isActive())
+    case OtauControl::CommandSelectImage:
+        if (node->manufacturerId != 0 &&
+            (image->manufacturerCode != node->manufacturerId || image->imageType != node->imageType()))
         {
-            m_imagePageTimer->start(IMAGE_PAGE_TIMER_DELAY);
+            return false; // image doesn't fit the node
+        }
+
+        if (!loadImageFile(node, image->path, image->fileVersion))
+        {
+            node->setHasData(false);
+            return false;
+        }
+
+        node->setHasData(true);
+        node->lastActivity = m_transport->steadyTime();
+        enforceMemoryBudget();
+        queueAvailableNotify(node);
+        return true;
+
+    case OtauControl::CommandPause:
+        if (!node->hasData())
+        {
+            return false;
+        }
+        node->paused = true;
+        return true;
+
+    case OtauControl::CommandResume:
+        if (!node->paused)
+        {
+            return false;
+        }
+        node->paused = false; // the node asks again after PAUSE_REQUEST_DELAY
+        if (unicast)
+        {
+            unicastImageNotify(node->address());
+        }
+        return true;
+
+    case OtauControl::CommandAbort:
+        if (!node->hasData() && !node->permitUpdate())
+        {
+            return false;
         }
+        node->setPermitUpdate(false);
+        node->setState(OtauNode::NodeAbort);
+        node->paused = false;
+        publishComplete(node, OTAU_ABORT);
+        queueAvailableNotify(node);
         return true;
+
+    case OtauControl::CommandNotify:
+        if (unicast)
+        {
+            return unicastImageNotify(node->address());
+        }
+        return ctl.target == OtauControl::TargetModel; // broadcast by caller
+
+    default:
+        break;
     }
 
-    //if (node->imgBlockReq.pageBytesDone > 0)
+    return false;
+}
+
+/*! Publishes the progress of a transfer, at most every PROGRESS_NOTIFY_INTERVAL per node.
+
+    Notify: u64 ext, u32 file version, u32 offset, u32 image size, u32 eta in seconds
+ */
+void StdOtauPlugin::publishProgress(OtauNode *node)
+{
+    const int64_t now = m_transport->steadyTime().ref;
+
+    if (node->progressNotifyTime != 0 && now - node->progressNotifyTime < PROGRESS_NOTIFY_INTERVAL)
     {
-        int spacing = m_w->packetSpacingMs();
+        return;
+    }
 
-        if (node->lastResponseTime.isValid() && !node->lastResponseTime.hasExpired(spacing))
-        {
-            node->setState(OtauNode::NodeWaitPageSpacing);
+    node->progressNotifyTime = now;
 
-            if (!m_imagePageTimer->isActive())
-            {
-                m_imagePageTimer->start(IMAGE_PAGE_TIMER_DELAY);
-            }
+#ifdef USE_ACTOR_MODEL
+    if (am && node->address().hasExt())
+    {
+        struct am_message *m = am->msg_alloc();
+        if (m)
+        {
+            m->src = AM_ACTOR_ID_OTA;
+            m->dst = AM_ACTOR_ID_SUBSCRIBERS;
+            m->id = OTA_M_ID_PROGRESS_NOTIFY;
 
-            return true;
+            am->msg_put_u64(m, (am_u64)node->address().ext());
+            am->msg_put_u32(m, node->file.fileVersion);
+            am->msg_put_u32(m, node->offset());
+            am->msg_put_u32(m, node->file.totalImageSize);
+            am->msg_put_u32(m, node->eta(now));
+            am->send_message(m);
         }
     }
+#endif // USE_ACTOR_MODEL
+}
 
-    int succ = 0;
+/*! Publishes the end of a transfer.
 
-    if (imageBlockResponse(node))
+    Notify: u64 ext, u32 file version, u8 status (ZCL status, 0x00 success, 0x95 aborted)
+ */
+void StdOtauPlugin::publishComplete(OtauNode *node, uint8_t status)
+{
+    node->progressNotifyTime = 0;
+
+    if (node->address().hasExt())
     {
-        node->imgBlockResponseRetry = 0;
-        succ++;
+        m_campaign.transferEnd(node->address().ext(), status == OTAU_SUCCESS, m_transport->steadyTime().ref);
     }
-    else
+
+#ifdef USE_ACTOR_MODEL
+    if (am && node->address().hasExt())
     {
-        node->setState(OtauNode::NodeWaitPageSpacing);
-        node->imgBlockResponseRetry++;
-        DBG_Printf(DBG_OTA, "OTAU: failed send img block rsp (retry %d)\n", node->imgBlockResponseRetry);
+        struct am_message *m = am->msg_alloc();
+        if (m)
+        {
+            m->src = AM_ACTOR_ID_OTA;
+            m->dst = AM_ACTOR_ID_SUBSCRIBERS;
+            m->id = OTA_M_ID_COMPLETE_NOTIFY;
 
+            am->msg_put_u64(m, (am_u64)node->address().ext());
+            am->msg_put_u32(m, node->file.fileVersion);
+            am->msg_put_u8(m, status);
+            am->send_message(m);
+        }
     }
-
-    return succ > 0;
+#endif // USE_ACTOR_MODEL
 }
 
-/*! Handles a upgrade end request and sends the response.
-    \param ind - the APSDE-DATA.indication
-    \param zclFrame - the ZCL frame
+/*! Sets the newest available image version of a node according to the image store.
  */
-void StdOtauPlugin::upgradeEndRequest(const deCONZ::ApsDataIndication &ind, const deCONZ::ZclFrame &zclFrame)
+void StdOtauPlugin::resolveUpdate(OtauNode *node)
 {
-    OtauNode *node = m_model->getNode(ind.srcAddress());
+    node->updateVersion = 0;
 
-    if (!node)
+    if (node->manufacturerId == 0 && node->imageType() == 0)
     {
         return;
     }
 
-    node->refreshTimeout();
-
-    QDataStream stream(zclFrame.payload());
-    stream.setByteOrder(QDataStream::LittleEndian);
-
-    stream >> node->upgradeEndReq.status;
-    stream >> node->upgradeEndReq.manufacturerCode;
-    stream >> node->upgradeEndReq.imageType;
-    stream >> node->upgradeEndReq.fileVersion;
-
-    if (node->hasData())
+    const OtauImageEntry *image = newestImage(node->manufacturerId, node->imageType());
+    if (image && image->fileVersion > node->softwareVersion())
     {
-        node->setOffset(node->imgBlockReq.offset);
-        node->setImageType(node->imgBlockReq.imageType);
+        node->updateVersion = image->fileVersion;
     }
-    node->notifyElapsedTimer();
-
-    node->reqSequenceNumber = zclFrame.sequenceNumber();
-    node->endpoint = ind.srcEndpoint();
-    node->profileId = ind.profileId();
-
-    DBG_Printf(DBG_OTA, "OTAU: upgrade end req: status: 0x%02X, fwVersion:0x%08X, imgType: 0x%04X\n", node->upgradeEndReq.status, node->upgradeEndReq.fileVersion, node->upgradeEndReq.imageType);
+}
 
-    node->setState(OtauNode::NodeIdle);
-    node->setStatus(OtauNode::StatusUpgradeEnd);
+/*! Starts, restarts or stops the rollout campaign after the settings changed.
+    The members are selected when the campaign starts, nodes which show up later need a restart.
+ */
+void StdOtauPlugin::restartCampaign()
+{
+    OtauCampaignConfig config = m_config.campaign();
+    config.concurrency = std::min(config.concurrency, OTAU_MAX_ACTIVE); // more transfers would be rejected as busy
 
-    if (node->upgradeEndReq.status == OTAU_SUCCESS)
+    if (!config.enabled || !m_model)
     {
-        if (node->imgBlockReq.offset == 0)
+        if (m_campaign.state() != OtauCampaign::StateIdle)
         {
-            // This is a workaround for buggy Osram/Ledvance Plug Z3 firmware (maybe Plug 01 as well)
-            // it sends upgrade end request _without_ any update happening before,
-            // send a ABORT status to break the reboot cycle.
-            defaultResponse(node, zclFrame.commandId(), OTAU_ABORT);
-            return;
+            DBG_Printf(DBG_OTA, "OTAU: campaign stopped\n");
         }
+        m_campaign.stop();
+        m_campaignTimer->stop();
+        return;
+    }
 
-        node->setOffset(node->file.totalImageSize); // mark done
+    if (m_campaign.state() != OtauCampaign::StateIdle && m_campaign.config() == config)
+    {
+        return;
+    }
 
-        node->file.subElements.clear();
-        node->setHasData(false);
-        node->setPermitUpdate(false);
+    if (m_startupClock.elapsed() < CAMPAIGN_START_DELAY)
+    {
+        m_campaignTimer->start(CAMPAIGN_TIMER_INTERVAL); // starts when the nodes are known
+        return;
+    }
 
-        // use time from widget
-        uint32_t upgradeTime = m_w->restartTime();
+    // only nodes for which a newer image is available
+    std::vector<OtauNode*> candidates;
+    for (OtauNode *node : m_model->nodes())
+    {
+        const OtauImageEntry *image = newestImage(node->manufacturerId, node->imageType());
 
-        if (!upgradeEndResponse(node, upgradeTime))
+        if (image && image->fileVersion > node->softwareVersion() && node->address().hasExt())
         {
-            DBG_Printf(DBG_OTA, "OTAU: failed to send upgrade end response\n");
+            candidates.push_back(node);
         }
     }
-    else
-    { // TODO show detailed status
-        node->setStatus(OtauNode::StatusUnknownError);
-        defaultResponse(node, zclFrame.commandId(), deCONZ::ZclSuccessStatus);
-    }
+
+    m_campaign.start(config, candidates, m_transport->steadyTime().ref);
+    m_campaignTimer->start(CAMPAIGN_TIMER_INTERVAL);
 }
 
-/*! Sends a upgrade end response.
-    \param node - the destination node
-    \param upgradeTime - time in seconds to wait for switching to new image
-    \return true on success false otherwise
+/*! Notifies the next campaign node and tracks the progress.
  */
-bool StdOtauPlugin::upgradeEndResponse(OtauNode *node, uint32_t upgradeTime)
+void StdOtauPlugin::campaignTimerFired()
 {
-    deCONZ::ApsDataRequest req;
-    deCONZ::ZclFrame zclFrame;
-
-    DBG_Assert(node->address().hasExt());
-    if (!node->address().hasExt())
+    if (!m_model)
     {
-        return false;
+        return;
     }
 
-    if (node->upgradeEndReq.manufacturerCode == 0 &&
-        node->upgradeEndReq.fileVersion == 0 &&
-        node->upgradeEndReq.status != OTAU_SUCCESS)
+    if (m_campaign.state() == OtauCampaign::StateIdle)
     {
-        DBG_Printf(DBG_OTA,"OTAU: upgrade end response not send because status is not success but 0x%02X\n", node->upgradeEndReq.status);
-        return false;
+        if (m_startupClock.elapsed() > CAMPAIGN_START_DELAY)
+        {
+            restartCampaign();
+        }
+        return;
     }
 
-    req.setProfileId(node->profileId);
-    req.setDstEndpoint(node->endpoint);
-    req.setClusterId(OTAU_CLUSTER_ID);
-    req.dstAddress() = node->address();
-    req.setDstAddressMode(deCONZ::ApsExtAddress);
-    req.setSrcEndpoint(m_srcEndpoint);
-    req.setTxOptions(deCONZ::ApsTxAcknowledgedTransmission);
-    req.setRadius(MAX_RADIUS);
+    OtauNode *node = m_campaign.tick(m_model->nodes(), m_transport->steadyTime().ref, QTime::currentTime().hour());
 
-    zclFrame.setSequenceNumber(node->reqSequenceNumber);
-    zclFrame.setCommandId(OTAU_UPGRADE_END_RESPONSE_CMD_ID);
+    if (node)
+    {
+        node->setPermitUpdate(true);
+        queueAvailableNotify(node);
+        if (node->transferProfile().unicastNotify && !unicastImageNotify(node->address()))
+        {
+            DBG_Printf(DBG_OTA, "OTAU: campaign failed to notify " FMT_MAC "\n", FMT_MAC_CAST(node->address().ext()));
+        }
+    }
 
-    zclFrame.setFrameControl(deCONZ::ZclFCClusterCommand |
-                             deCONZ::ZclFCDirectionServerToClient |
-                             deCONZ::ZclFCDisableDefaultResponse);
+    if (m_campaign.state() == OtauCampaign::StateDone || m_campaign.state() == OtauCampaign::StateHalted)
+    {
+        m_campaignTimer->stop();
+    }
+}
 
-    { // ZCL payload
-        QDataStream stream(&zclFrame.payload(), QIODevice::WriteOnly);
-        stream.setByteOrder(QDataStream::LittleEndian);
+/*! Prints the startup timing as one line of key=value pairs.
+ */
+void StdOtauPlugin::printStartupTiming()
+{
+    const OtauStartupTiming &t = m_startup;
 
-        stream << node->upgradeEndReq.manufacturerCode;
-        stream << node->upgradeEndReq.imageType;
-        stream << node->upgradeEndReq.fileVersion;
+    DBG_Printf(DBG_OTA, "OTAU: startup total_us=%lld setup_us=%lld paths_us=%lld connect_us=%lld settings_us=%lld "
+               "enumerate_us=%lld read_us=%lld parse_us=%lld hash_us=%lld gc_us=%lld index_build_us=%lld index_write_us=%lld images=%d\n",
+               t.totalUs, t.setupUs, t.pathsUs, t.connectUs, t.settingsUs,
+               t.enumerateUs, t.readUs, t.parseUs, t.hashUs, t.gcUs, t.indexBuildUs, t.indexWriteUs,
+               int(m_imageStore.entries().size()));
+}
 
-        uint32_t currentTime = 0;
+/*! Adds a latency sample to the node and the global histogram.
+    \param node - the node or nullptr
+    \param path - the measured path
+    \param us - latency in microseconds
+ */
+void StdOtauPlugin::recordLatency(OtauNode *node, OtauLatencyPath path, int64_t us)
+{
+    m_latency[path].record(us);
 
-        stream << currentTime;
-        stream << upgradeTime;
+    if (node)
+    {
+        node->latency[path].record(us);
     }
+}
 
-    { // ZCL frame
-        QDataStream stream(&req.asdu(), QIODevice::WriteOnly);
-        stream.setByteOrder(QDataStream::LittleEndian);
-        zclFrame.writeToStream(stream);
+/*! Prints the latency percentiles of a node and the global ones.
+ */
+void StdOtauPlugin::printLatency(OtauNode *node)
+{
+    if (!DBG_IsEnabled(DBG_OTA))
+    {
+        return;
     }
 
-    bool ret = false;
-
-    if (deCONZ::ApsController::instance()->apsdeDataRequest(req) == 0)
+    for (int i = 0; i < OtauLatencyPathCount; i++)
     {
-        node->apsRequestId = req.id();
-        node->zclCommandId = zclFrame.commandId();
-        ret = true;
-    }
+        const OtauLatencyHistogram &n = node->latency[i];
+        const OtauLatencyHistogram &g = m_latency[i];
 
-    return ret;
+        DBG_Printf(DBG_OTA, "OTAU: latency " FMT_MAC " %s n: %u, p50: %u us, p99: %u us, max: %u us (all nodes n: %u, p50: %u us, p99: %u us, max: %u us)\n",
+                   FMT_MAC_CAST(node->address().ext()), OtauLatencyHistogram::pathName(OtauLatencyPath(i)),
+                   n.count(), n.percentile(50), n.percentile(99), n.max(),
+                   g.count(), g.percentile(50), g.percentile(99), g.max());
+    }
 }
 
-bool StdOtauPlugin::defaultResponse(OtauNode *node, quint8 commandId, quint8 status)
+/*! Records an event in the protocol event ring.
+    \param ev - the event, time and frame fields are filled here
+    \param asdu - the ZCL frame
+ */
+void StdOtauPlugin::recordEvent(OtauEvent &ev, const QByteArray &asdu)
 {
-    deCONZ::ApsDataRequest req;
-    deCONZ::ZclFrame zclFrame;
-
-    DBG_Assert(node->address().hasExt());
-    if (!node->address().hasExt())
-    {
-        return false;
-    }
+    ev.timeMs = static_cast<uint32_t>(m_transport->steadyTime().ref - m_eventRingStart);
+    m_eventRing->record(ev, reinterpret_cast<const uint8_t*>(asdu.constData()), static_cast<unsigned>(asdu.size()));
+}
 
-    req.setProfileId(node->profileId);
-    req.setDstEndpoint(node->endpoint);
-    req.setClusterId(OTAU_CLUSTER_ID);
-    req.dstAddress() = node->address();
-    req.setDstAddressMode(deCONZ::ApsExtAddress);
+/*! Writes the recorded protocol events to a file which can be decoded with otau_event_decode.
+    \param path - the destination file
+    \return true on success
+ */
+bool StdOtauPlugin::dumpEventRing(const QString &path)
+{
+    std::vector<OtauEvent> events(OTAU_EVENT_RING_SIZE);
+    const unsigned count = m_eventRing->snapshot(events.data());
 
-    req.setSrcEndpoint(m_srcEndpoint);
-    req.setTxOptions(deCONZ::ApsTxAcknowledgedTransmission);
+    OtauEventDumpHeader hdr = {};
+    U_memcpy(hdr.magic, OTAU_EVENT_MAGIC, sizeof(hdr.magic));
+    hdr.version = OTAU_EVENT_VERSION;
+    hdr.entrySize = sizeof(OtauEvent);
+    hdr.count = count;
+    hdr.created = QDateTime::currentMSecsSinceEpoch() - (m_transport->steadyTime().ref - m_eventRingStart);
 
-    zclFrame.setSequenceNumber(node->reqSequenceNumber);
-    req.setRadius(MAX_RADIUS);
+    QByteArray data(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+    data.append(reinterpret_cast<const char*>(events.data()), static_cast<int>(count * sizeof(OtauEvent)));
 
-    zclFrame.setCommandId(deCONZ::ZclDefaultResponseId);
+    return m_fileWriter.writeFile(path, data, OtauWriteEvents);
+}
 
-    zclFrame.setFrameControl(deCONZ::ZclFCProfileCommand |
-                             deCONZ::ZclFCDirectionServerToClient |
-                             deCONZ::ZclFCDisableDefaultResponse);
+/*! Keeps the protocol events of a failed transfer, at most every EVENT_DUMP_MIN_INTERVAL.
+ */
+void StdOtauPlugin::dumpEventRingOnError()
+{
+    const auto now = m_transport->steadyTime();
 
-    { // ZCL payload
-        QDataStream stream(&zclFrame.payload(), QIODevice::WriteOnly);
-        stream.setByteOrder(QDataStream::LittleEndian);
-        stream << commandId;
-        stream << status;
+    if (isValid(m_eventDumpTime) && !(deCONZ::TimeSeconds{EVENT_DUMP_MIN_INTERVAL} < (now - m_eventDumpTime)))
+    {
+        return;
     }
 
-    { // ZCL frame
-        QDataStream stream(&req.asdu(), QIODevice::WriteOnly);
-        stream.setByteOrder(QDataStream::LittleEndian);
-        zclFrame.writeToStream(stream);
-    }
+    m_eventDumpTime = now;
+    const QString path = deCONZ::getStorageLocation(deCONZ::ApplicationsDataLocation) + "/ota_events.bin";
 
-    if (deCONZ::ApsController::instance()->apsdeDataRequest(req) == deCONZ::Success)
+    if (dumpEventRing(path))
     {
-        node->apsRequestId = req.id();
-        node->zclCommandId = zclFrame.commandId();
-        node->lastResponseTime.restart();
-        return true;
+        DBG_Printf(DBG_OTA, "OTAU: protocol events written to %s\n", qPrintable(path));
     }
-
-    return false;
 }
 
-/*! Queries this plugin which features are supported.
-    \param feature - feature to be checked
-    \return true if supported
+/*! Sets the transport used for APS requests.
+    \param transport - the transport, nullptr restores the deCONZ::ApsController transport
  */
-bool StdOtauPlugin::hasFeature(Features feature)
+void StdOtauPlugin::setTransport(OtauTransport *transport)
 {
-    switch (feature)
-    {
-    case WidgetFeature:
-        return true;
-
-    default:
-        break;
-    }
-
-    return false;
+    m_transport = transport ? transport : &defaultTransport;
+    m_model->setTransport(m_transport);
 }
 
 /*! Creates a control widget for this plugin.
@@ -2567,8 +5040,10 @@ QWidget *StdOtauPlugin::createWidget()
 
         connect(this, SIGNAL(stateChanged(int)), m_w, SLOT(stateChanged(int)));
 
+        connect(this, SIGNAL(configChanged()), m_w, SLOT(configChanged()));
+
         m_w->setOtauModel(m_model);
-        m_w->setPacketSpacingMs(m_fastPageSpaceing);
+        m_w->setConfig(&m_config);
     }
 
     return m_w;
@@ -2601,6 +5076,28 @@ void StdOtauPlugin::setState(StdOtauPlugin::State state)
     }
 }
 
+/*! Switches between StateEnabled and StateBusySensors based on the confirms of all APS traffic.
+    While busy no image data is sent, nodes are asked to come back after BUSY_REQUEST_DELAY.
+ */
+void StdOtauPlugin::updateHealthState()
+{
+    const OtauConfirmHealth::Level level = m_health.update(m_transport->steadyTime().ref);
+
+    if (state() == StateDisabled)
+    {
+        return;
+    }
+
+    const State busy = level == OtauConfirmHealth::LevelPause ? StateBusySensors : StateEnabled;
+
+    if (busy != state())
+    {
+        DBG_Printf(DBG_OTA, "OTAU: network %s, confirm failures %u%%, latency %u ms, queue full %u\n",
+                   OtauConfirmHealth::levelName(level), m_health.failurePercent(), m_health.latencyMs(), m_health.queueFull());
+        setState(busy);
+    }
+}
+
 /*! Checks if the node is a not yet known otau node.
     If the node is unknown it will be added to the model.
     \param node - the node to check
@@ -2673,8 +5170,13 @@ void StdOtauPlugin::checkIfNewOtauNode(const deCONZ::Node *node, uint8_t endpoin
 
                 if (otauNode)
                 {
-                    otauNode->rxOnWhenIdle = node->nodeDescriptor().receiverOnWhenIdle();
+                    otauNode->setRxOnWhenIdle(node->nodeDescriptor().receiverOnWhenIdle());
                     otauNode->endpointNotify = sd->endpoint();
+
+                    if (!m_journalPending.empty() && !otauNode->hasData())
+                    {
+                        restoreFromJournal(otauNode);
+                    }
                 }
 
                 if (otauNode && otauNode->profileId != sd->profileId())
@@ -2707,7 +5209,7 @@ void StdOtauPlugin::activatedNodeAtRow(int row)
 {
     OtauNode *node = m_model->getNodeAtRow(row);
 
-    if (node)
+    if (node && m_w)
     {
         m_w->displayNode(node);
     }
@@ -1,6 +1,8 @@
 #ifndef STD_OTAU_PLUGIN_H
 #define STD_OTAU_PLUGIN_H
 
+#include <array>
+#include <memory>
 #include <QObject>
 #include <QElapsedTimer>
 
@@ -9,6 +11,21 @@
 #include <deconz/zcl.h>
 #include <deconz/node_interface.h>
 #include <deconz/node_event.h>
+#include "otau_activation.h"
+#include "otau_campaign.h"
+#include "otau_config.h"
+#include "otau_event_ring.h"
+#include "otau_file_writer.h"
+#include "otau_health.h"
+#include "otau_image_store.h"
+#include "otau_inventory.h"
+#include "otau_journal.h"
+#include "otau_latency.h"
+#include "otau_memory.h"
+#include "otau_source_list.h"
+#include "otau_topology.h"
+#include "otau_trace.h"
+#include "otau_transport.h"
 
 #define ONOFF_CLUSTER_ID 0x0006
 #define LEVEL_CLUSTER_ID 0x0008
@@ -25,6 +42,7 @@
 #define OTAU_UPGRADE_END_RESPONSE_CMD_ID       0x07
 
 #define OTAU_MAX_ACTIVE 4
+#define OTAU_MAX_DOWNLOAD_ATTEMPTS 4 // parallel downloads when racing sources
 
 /*! Otau ZCL status codes. */
 typedef enum
@@ -42,6 +60,7 @@ typedef enum
 
 class QFileSystemWatcher;
 class QTimer;
+class StdOtauPlugin;
 class StdOtauWidget;
 struct OtauNode;
 struct ImageNotifyReq;
@@ -51,6 +70,101 @@ struct OtauTracker
 {
     uint64_t extAddr;
     deCONZ::SteadyTimeRef lastActivity;
+    uint64_t parentAddr = 0; //!< parent of an end device, 0 if none
+    uint64_t branchAddr = 0; //!< router next to the coordinator carrying the transfer, 0 if unknown
+    int activityTimeoutMs = 0; //!< from the transfer profile of the node, sleepy nodes request less often
+};
+
+/*! Context of one running download, passed as user pointer to the downloader.
+ */
+struct OtauDownloadAttempt
+{
+    unsigned id = 0; //!< passed as user data to the downloader, late callbacks of freed slots don't match
+    int handle = 0; //!< downloader handle, used to cancel the attempt
+    unsigned generation = 0; //!< download request this attempt belongs to
+    int source = -1; //!< index in the source list
+    bool index = false; //!< true for the index file, false for an OTA file
+    bool active = false; //!< waiting for the downloader callback
+    QElapsedTimer time;
+};
+
+/*! Duration of the plugin initialisation phases in microseconds.
+ */
+struct OtauStartupTiming
+{
+    qint64 setupUs = 0; //!< model and timers
+    qint64 pathsUs = 0; //!< image directories
+    qint64 connectUs = 0; //!< ApsController signals
+    qint64 settingsUs = 0; //!< QSettings and trace file
+    qint64 enumerateUs = 0; //!< listing and stat of image files
+    qint64 readUs = 0; //!< reading image files
+    qint64 parseUs = 0; //!< OTA header parsing
+    qint64 hashUs = 0; //!< SHA-512 of new files
+    qint64 gcUs = 0; //!< garbage collection of superseded images
+    qint64 indexBuildUs = 0;
+    qint64 indexWriteUs = 0;
+    qint64 totalUs = 0; //!< whole constructor, 0 while running
+    qint64 firstQueryUs = -1; //!< constructor start to the first served query next image request, -1 if none yet
+};
+
+/*! Update availability of one node, as reported to actor subscribers.
+ */
+struct OtauAvailability
+{
+    uint64_t extAddr = 0;
+    uint16_t manufacturerCode = 0;
+    uint16_t imageType = 0;
+    uint32_t swVersion = 0;
+    uint16_t hwVersion = 0;
+    bool permitUpdate = false;
+    uint32_t fileVersion = 0; //!< newest image version for the node, 0 if none
+
+    bool operator==(const OtauAvailability &o) const
+    {
+        return extAddr == o.extAddr && manufacturerCode == o.manufacturerCode && imageType == o.imageType &&
+               swVersion == o.swVersion && hwVersion == o.hwVersion && permitUpdate == o.permitUpdate && fileVersion == o.fileVersion;
+    }
+};
+
+/*! Transfer control command received from the actor model.
+ */
+struct OtauControl
+{
+    enum Command
+    {
+        CommandPermit = 0x01, //!< permit the update, loads the newest image if none is selected
+        CommandDeny = 0x02,
+        CommandSelectImage = 0x03, //!< select the image with the digest in sha512
+        CommandPause = 0x04,
+        CommandResume = 0x05,
+        CommandAbort = 0x06,
+        CommandNotify = 0x07 //!< send image notify
+    };
+
+    enum Target
+    {
+        TargetNode = 0x00, //!< node with extAddr
+        TargetModel = 0x01, //!< all nodes with manufacturerCode and imageType
+        TargetAll = 0x02
+    };
+
+    uint8_t command = 0;
+    uint8_t target = TargetNode;
+    uint64_t extAddr = 0;
+    uint16_t manufacturerCode = 0;
+    uint16_t imageType = 0;
+    QByteArray sha512; //!< 64 byte digest for CommandSelectImage
+};
+
+/*! Value of a read-only entry in the OTA actor VFS.
+ */
+struct OtauVfsValue
+{
+    enum Type { TypeU32, TypeU64, TypeString };
+
+    Type type = TypeU32;
+    uint64_t num = 0;
+    QByteArray str;
 };
 
 class StdOtauPlugin : public QObject,
@@ -70,11 +184,19 @@ public:
     };
 
     explicit StdOtauPlugin(QObject *parent = 0);
+    ~StdOtauPlugin();
     const char *name();
     bool hasFeature(Features feature);
     QWidget *createWidget();
     QDialog *createDialog();
     State state() const { return m_state; }
+    void setTransport(OtauTransport *transport);
+    bool dumpEventRing(const QString &path);
+    const OtauLatencyHistogram &latencyHistogram(OtauLatencyPath path) const { return m_latency[path]; }
+    bool vfsRead(const QByteArray &path, OtauVfsValue *value);
+    void availability(std::vector<OtauAvailability> *result);
+    int control(const OtauControl &ctl);
+    void downloadAttemptDone(unsigned id, bool success, const uint8_t *data, unsigned size);
 
 public Q_SLOTS:
     void apsdeDataIndication(const deCONZ::ApsDataIndication &ind);
@@ -101,9 +223,15 @@ public Q_SLOTS:
     void imagePageTimerFired();
     void cleanupTimerFired();
     void activityTimerFired();
+    void configTimerFired();
+    void campaignTimerFired();
+    void restartCampaign();
+    void journalTimerFired();
+    void availableNotifyTimerFired();
     void downloadCancelOrError();
     void downloadTimerFired();
     void downloadRequestIndex();
+    void prefetchTimerFired();
     void downloadedStoreIndex(const uint8_t *data, unsigned size);
     void downloadedStoreOtaFile(const uint8_t *data, unsigned size);
     void markOtauActivity(const deCONZ::Address &address);
@@ -111,8 +239,12 @@ public Q_SLOTS:
 
 Q_SIGNALS:
     void stateChanged(int state);
+    void configChanged();
 
 private:
+    friend class OtauMicroBench;
+    friend class OtauSourceBench;
+
     enum DownloadState
     {
         DownloadStateInitial,
@@ -129,23 +261,76 @@ private:
         uint16_t manufacturerCode;
         uint16_t imageType;
         uint32_t fileVersion;
+        uint32_t fileSize = 0;
         std::string fileName;
         std::string sha512;
         std::string url;
     };
 
     void setState(State state);
+    void updateHealthState();
+    void refreshTopology();
+    bool admitTransfer(const OtauNode *node);
+    unsigned branchLoad(uint64_t extAddr) const;
     void checkIfNewOtauNode(const deCONZ::Node *node, uint8_t endpoint);
+    int sendApsRequest(const deCONZ::ApsDataRequest &req);
+    const OtauImageEntry *newestImage(uint16_t manufacturerCode, uint16_t imageType) const;
+    const OtauImageEntry *imageEntry(const QString &path) const;
+    void loadJournal();
+    void saveJournal();
+    void restoreFromJournal(OtauNode *node);
+    void loadInventory();
+    void saveInventory();
+    void resolveUpdate(OtauNode *node);
+    OtauAvailability nodeAvailability(OtauNode *node);
+    void queueAvailableNotify(OtauNode *node);
+    bool controlNode(OtauNode *node, const OtauControl &ctl, const OtauImageEntry *image);
+    void publishProgress(OtauNode *node);
+    void publishComplete(OtauNode *node, uint8_t status);
+    void recordEvent(OtauEvent &ev, const QByteArray &asdu);
+    void dumpEventRingOnError();
+    int64_t latencyClockUs() const { return m_latencyClock.nsecsElapsed() / 1000; }
+    void recordLatency(OtauNode *node, OtauLatencyPath path, int64_t us);
+    void printLatency(OtauNode *node);
+    bool loadImageFile(OtauNode *node, const QString &path, uint32_t fileVersion);
+    void reloadImageData(OtauNode *node);
+    void releaseImageData(OtauNode *node);
+    const OtauMemoryUsage &updateMemoryUsage(std::vector<OtauImageMemory> *images = nullptr);
+    void enforceMemoryBudget();
+    void printStartupTiming();
+    bool downloadStartAttempt();
+    void downloadRequestFailed();
+    void downloadCancelAttempts();
+    bool isPrefetchQuietTime() const;
     bool m_downloadsEnabled = false;
     deCONZ::Address m_selectedNodeAddress;
     QString m_downloadIndexUrl;
     deCONZ::Address m_delayedImageNotifyAddr;
     QString m_imgPath;
     QString m_localIndexPath;
+    OtauImageStore m_imageStore;
+    OtauFileWriter m_fileWriter;
+    OtauRetentionPolicy m_retention;
+    QTimer *m_gcTimer;
     OtauModel *m_model;
     State m_state;
     quint8 m_srcEndpoint;
     StdOtauWidget *m_w;
+    OtauTransport *m_transport;
+    OtauTraceWriter m_trace;
+    std::unique_ptr<OtauEventRing> m_eventRing;
+    int64_t m_eventRingStart = 0;
+    deCONZ::SteadyTimeRef m_eventDumpTime = {};
+    QElapsedTimer m_latencyClock;
+    int64_t m_indicationTimeUs = 0; //!< start of the current indication
+    std::array<int64_t, 256> m_apsRequestTimeUs{}; //!< send time by APS request id, 0 if none pending
+    std::array<OtauLatencyHistogram, OtauLatencyPathCount> m_latency;
+    quint64 m_bytesServed = 0;
+    std::array<uint8_t, 256> m_apsBlockSize{}; //!< image bytes by APS request id, 0 if none pending
+    unsigned m_noAckCount = 0;
+    OtauMemoryMeter m_memory;
+    QElapsedTimer m_startupClock;
+    OtauStartupTiming m_startup;
     quint8 m_zclSeq;
     quint8 m_maxAsduDataSize;
     quint8 m_nNoAckErrors;
@@ -154,12 +339,42 @@ private:
     QTimer *m_activityTimer;
     QTimer *m_downloadTimer;
     deCONZ::SteadyTimeRef m_downloadIndexAge = {};
-    int m_downloadHandle = 0;
     QString m_downloadIndexPath;
     DownloadState m_downloadState = DownloadStateInitial;
     std::vector<DownloadOtaFile> m_downloads;
+
+    // index sources and mirrors, a request races the best sources and fails over to the next
+    OtauSourceList m_indexSources;
+    OtauSourceList m_fileSources; // index 0 is the url from the index, followed by mirror base urls
+    std::array<OtauDownloadAttempt, OTAU_MAX_DOWNLOAD_ATTEMPTS> m_downloadAttempts;
+    unsigned m_downloadGeneration = 0;
+    unsigned m_downloadAttemptId = 0;
+    uint32_t m_downloadTried = 0; // bit mask of sources tried for the current request
+    QElapsedTimer m_downloadTime;
+
+    // background prefetch of firmware for all known device models
+    QTimer *m_prefetchTimer;
+    bool m_prefetchRunning = false;
+    int m_prefetchInterval; // minutes, 0 = disabled
+    int m_prefetchQuietStart; // hour 0..23
+    int m_prefetchQuietEnd; // hour 0..23
+    qint64 m_prefetchMaxBytes; // per run
+    deCONZ::SteadyTimeRef m_prefetchLastRun = {};
     std::vector<OtauTracker> m_otauTracker;
-    int m_fastPageSpaceing;
+    OtauConfig m_config;
+    QTimer *m_configTimer;
+    OtauCampaign m_campaign;
+    OtauActivationScheduler m_activation;
+    OtauConfirmHealth m_health; //!< confirms of all APS traffic
+    OtauTopology m_topology;
+    int64_t m_topologyTime = 0; //!< steady time of the last neighbour table scan, 0 if never
+    QString m_journalPath;
+    std::vector<OtauJournalEntry> m_journalPending; //!< restored transfers of nodes not seen since startup
+    QString m_inventoryPath;
+    QTimer *m_journalTimer;
+    std::vector<uint64_t> m_availableNotifyQueue; //!< nodes with changed availability, published when the timer fires
+    QTimer *m_availableNotifyTimer;
+    QTimer *m_campaignTimer;
 };
 
 #endif // STD_OTAU_PLUGIN_H
@@ -8,13 +8,12 @@
 #include <deconz/util.h>
 #include "std_otau_widget.h"
 #include "std_otau_plugin.h"
+#include "otau_config.h"
 #include "otau_file_loader.h"
 #include "otau_model.h"
 #include "otau_node.h"
 #include "ui_std_otau_widget.h"
 
-#define UNLIMITED_WATING_TIME 0xfffffffful
-
 #ifdef USE_ACTOR_MODEL
 
 #include <actor/plugin.h>
@@ -124,6 +123,8 @@ void StdOtauWidget::setOtauModel(OtauModel *model)
             ui->tableView->resizeColumnToContents(OtauModel::SectionSoftwareVersion);
             ui->tableView->resizeColumnToContents(OtauModel::SectionProgress);
             ui->tableView->resizeColumnToContents(OtauModel::SectionDuration);
+            ui->tableView->resizeColumnToContents(OtauModel::SectionRate);
+            ui->tableView->resizeColumnToContents(OtauModel::SectionEta);
         }
 
         ui->tableView->isSortingEnabled();
@@ -132,13 +133,68 @@ void StdOtauWidget::setOtauModel(OtauModel *model)
     });
 }
 
-uint StdOtauWidget::restartTime()
+/*! Sets the transfer settings shown and changed by the widget.
+ */
+void StdOtauWidget::setConfig(OtauConfig *config)
 {
-    if (ui->restartAfterUpgradeCheckbox->isChecked())
+    m_config = config;
+    configChanged();
+
+    auto updateRestartTime = [this]()
     {
-        return ui->restartAfterUpgradeSpinBox->value();
+        if (m_config)
+        {
+            m_config->setRestartTime(ui->restartAfterUpgradeCheckbox->isChecked() ? uint32_t(ui->restartAfterUpgradeSpinBox->value()) : uint32_t(OTAU_UNLIMITED_RESTART_TIME));
+        }
+    };
+
+    connect(ui->useAcksCheckBox, &QCheckBox::toggled, this, [this](bool checked) {
+        if (m_config)
+        {
+            m_config->setAcksEnabled(checked);
+        }
+    });
+
+    connect(ui->usePageRequestCheckBox, &QCheckBox::toggled, this, [this](bool checked) {
+        if (m_config)
+        {
+            m_config->setPageRequestEnabled(checked);
+        }
+    });
+
+    connect(ui->spacingSpinBox, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged), this, [this](int value) {
+        if (m_config)
+        {
+            m_config->setPacketSpacingMs(value);
+        }
+    });
+
+    connect(ui->restartAfterUpgradeCheckbox, &QCheckBox::toggled, this, updateRestartTime);
+    connect(ui->restartAfterUpgradeSpinBox, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged), this, updateRestartTime);
+}
+
+/*! Updates the controls after the settings were reloaded.
+ */
+void StdOtauWidget::configChanged()
+{
+    if (!m_config)
+    {
+        return;
+    }
+
+    OtauConfig *config = m_config;
+    m_config = nullptr; // the settings are the source, don't write them back
+
+    ui->useAcksCheckBox->setChecked(config->acksEnabled());
+    ui->usePageRequestCheckBox->setChecked(config->pageRequestEnabled());
+    ui->spacingSpinBox->setValue(config->packetSpacingMs());
+    ui->restartAfterUpgradeCheckbox->setChecked(config->restartTime() != OTAU_UNLIMITED_RESTART_TIME);
+    if (config->restartTime() != OTAU_UNLIMITED_RESTART_TIME)
+    {
+        ui->restartAfterUpgradeSpinBox->setValue(static_cast<int>(config->restartTime()));
     }
-    return UNLIMITED_WATING_TIME;
+
+    m_config = config;
 }
 
 void StdOtauWidget::queryClicked()
@@ -221,7 +277,7 @@ void StdOtauWidget::fileSelectClicked()
             if (ld.readFile(path, m_ouNode->file))
             {
                 m_ouNode->setHasData(true);
-                m_ouNode->lastActivity.restart();
+                m_ouNode->lastActivity = deCONZ::steadyTimeRef();
                 updateSettingsBox();
             }
             else
@@ -232,33 +288,13 @@ void StdOtauWidget::fileSelectClicked()
     }
 }
 
-bool StdOtauWidget::acksEnabled() const
-{
-    return ui->useAcksCheckBox->isChecked();
-}
-
-bool StdOtauWidget::pageRequestEnabled() const
-{
-    return ui->usePageRequestCheckBox->isChecked();
-}
-
-int StdOtauWidget::packetSpacingMs() const
-{
-    return ui->spacingSpinBox->value();
-}
-
-void StdOtauWidget::setPacketSpacingMs(int spacing)
-{
-    ui->spacingSpinBox->setValue(spacing);
-}
-
 void StdOtauWidget::stateChanged(int state)
 {
     if (state == StdOtauPlugin::StateDisabled)
     {
         ui->labelOtauState->setText(tr("OTAU disabled"));
     }
-    else if (state == StdOtauPlugin::StateDisabled)
+    else if (state == StdOtauPlugin::StateBusySensors)
     {
         ui->labelOtauState->setText(tr("OTAU wait sensors idle"));
     }
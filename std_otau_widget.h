@@ -11,6 +11,7 @@ class StdOtauWidget;
 }
 
 class StdOtauPlugin;
+class OtauConfig;
 struct OtauFile;
 class OtauModel;
 struct OtauNode;
@@ -25,10 +26,11 @@ public:
     explicit StdOtauWidget(QWidget *parent);
     ~StdOtauWidget();
     void setOtauModel(OtauModel *model);
-    uint restartTime();
+    void setConfig(OtauConfig *config);
 
 public Q_SLOTS:
     void stateChanged(int state);
+    void configChanged();
     void clearSettingsBox();
     void updateSettingsBox();
     void otauTableActivated(const QModelIndex &index);
@@ -40,11 +42,6 @@ public Q_SLOTS:
     void updateClicked();
     void fileSelectClicked();
 
-    bool acksEnabled() const;
-    bool pageRequestEnabled() const;
-    int packetSpacingMs() const;
-    void setPacketSpacingMs(int spacing);
-
     // OTAU file tab
     void saveClicked();
     void saveAsClicked();
@@ -68,6 +65,7 @@ private:
     QString m_path;
     OtauFile m_editOf;
     OtauNode *m_ouNode = nullptr;
+    OtauConfig *m_config = nullptr;
 };
 
 #endif // STD_OTAU_WIDGET_H